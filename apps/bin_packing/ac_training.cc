@@ -5,14 +5,18 @@
 
 #include <apps/bin_packing/bin_packing.h>
 
+void build_action_model(xylo::model &m) {
+  m.add_layer(std::make_unique<xylo::convolution1d_1_layer>(4, 64));
+  m.add_layer(std::make_unique<xylo::relu_activation>());
+  m.add_layer(std::make_unique<xylo::convolution1d_1_layer>(64, 32));
+  m.add_layer(std::make_unique<xylo::relu_activation>());
+  m.add_layer(std::make_unique<xylo::convolution1d_1_layer>(32, 1));
+  m.add_layer(std::make_unique<xylo::softmax_cross_entropy_layer>());
+}
+
 int main() {
   xylo::model action_model;
-  action_model.add_layer(std::make_unique<xylo::convolution1d_1_layer>(4, 64));
-  action_model.add_layer(std::make_unique<xylo::relu_activation>());
-  action_model.add_layer(std::make_unique<xylo::convolution1d_1_layer>(64, 32));
-  action_model.add_layer(std::make_unique<xylo::relu_activation>());
-  action_model.add_layer(std::make_unique<xylo::convolution1d_1_layer>(32, 1));
-  action_model.add_layer(std::make_unique<xylo::softmax_cross_entropy_layer>());
+  build_action_model(action_model);
   xylo::sgd_optimizer action_optimizer(action_model, 1e-5);
 
   xylo::model value_model;
@@ -24,7 +28,8 @@ int main() {
   value_model.add_layer(std::make_unique<xylo::full_layer>(32, 1));
   xylo::sgd_optimizer value_optimizer(value_model, 1e-4);
 
-  xylo::replay_buffer<bp::action, bp::observation> replay_buffer;
+  // Encodes states as they come in, for the learner to take as one matrix.
+  xylo::replay_buffer<bp::action, bp::observation> replay_buffer(true);
 
   constexpr int num_workers = 16;
   constexpr int steps_per_worker = 8;
@@ -44,41 +49,31 @@ int main() {
   bp::ac_learner learner(replay_buffer, action_model, action_optimizer,
                          value_model, value_optimizer, 0.99);
 
-  std::list<xeno::sys::thread> threads;
-  for (int i = 0; i < num_workers; ++i) {
-    threads.emplace_back(xeno::string::strcat("worker", i));
-  }
+  // Evaluated on a copy of the parameters, over the pool, while training
+  // goes on.
+  xylo::model evaluation_model;
+  build_action_model(evaluation_model);
+  bp::evaluator evaluator;
+  bp::background_evaluation evaluation(evaluator, evaluation_model,
+                                       bp::deterministic_policy, 100);
+
+  xeno::sys::thread_pool &pool = xeno::sys::default_thread_pool();
   float max_reward = 0;
   for (int steps = 0;; ++steps) {
-    int i = 0;
-    for (auto &t : threads) {
-      bp::agent &agent = agents[i++];
-      t.run([&]() { agent.play_steps(steps_per_worker); });
-    }
-    for (auto &t : threads) {
-      t.join();
+    xeno::sys::wait_group rollouts;
+    for (bp::agent &agent : agents) {
+      pool.submit(rollouts, [&agent]() { agent.play_steps(steps_per_worker); });
     }
+    pool.wait(rollouts);
 
     learner.step();
 
     replay_buffer.forget();
 
-    if (steps % 100 == 0) {
-      xylo::policy_gradient_deterministic_policy<bp::action, bp::observation>
-          policy(action_model);
-      bp::environment env;
-      xylo::replay_buffer<bp::action, bp::observation> rb;
-      bp::agent agent(policy, env, rb);
-      for (int i = 0; i < 100; ++i) {
-        agent.play_one_episode();
-      }
-      auto experience = rb.sample_td();
-      lg() << "round " << steps << " "
-           << xylo::total_rewards<bp::action, bp::observation>(experience) /
-                  100.0;
-
-      rb.forget();
-    }
+    if (steps % 100 == 0)
+      evaluation.offer(action_model.parameters(), steps);
+    if (auto done = evaluation.poll())
+      lg() << "round " << done->first << " " << done->second;
   }
 
   return 0;
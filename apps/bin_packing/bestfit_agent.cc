@@ -31,20 +31,10 @@ class bestfit_policy : public xylo::policy<bp::action, bp::observation> {
 
 int main() {
   constexpr std::size_t num_episodes = 10000;
+  bestfit_policy policy;
+  bp::evaluator evaluator;
   for (std::size_t steps = 0; steps <= 100; ++steps) {
-    bestfit_policy policy;
-    bp::environment env;
-    xylo::replay_buffer<bp::action, bp::observation> rb;
-    bp::agent agent(policy, env, rb);
-    for (int i = 0; i < num_episodes; ++i) {
-      agent.play_one_episode();
-    }
-    auto experience = rb.sample_td();
-    lg() << "round " << steps << " "
-         << xylo::total_rewards<bp::action, bp::observation>(experience) /
-                num_episodes;
-
-    rb.forget();
+    lg() << "round " << steps << " " << evaluator.run(policy, num_episodes);
   }
   return 0;
 }
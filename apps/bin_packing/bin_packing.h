@@ -1,11 +1,18 @@
 #ifndef BIN_PACKING
 #define BIN_PACKING
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
 #include <random>
+#include <span>
 #include <sstream>
 
+#include <xylo/evaluation.h>
 #include <xylo/nn.h>
 #include <xylo/policy_gradient.h>
+#include <xylo/static_nn.h>
 
 namespace bp {
 
@@ -18,8 +25,9 @@ struct observation {
 
   static constexpr std::pair<int, int> capacity{8, 8};
 
-  observation(const std::pair<int, int> &bin_shape)
-      : bins(num_bins, bin_shape), item{0, 0} {}
+  observation(const std::pair<int, int> &bin_shape) : item{0, 0} {
+    bins.fill(bin_shape);
+  }
 
   std::string to_string() const {
     std::ostringstream oss;
@@ -28,18 +36,36 @@ struct observation {
     return oss.str();
   }
 
+  // A row of four per bin, as vector_environment::observe lays them out.
   void to_vector(xylo::vector_view o) const {
-    xylo::matrix_view m = xylo::fold<2>(o, {bins.size(), 4});
+    if (o.size() != length())
+      throw xeno::error("wrong observation length.");
+
+    float *row = o.data();
+    for (const auto &bin : bins) {
+      row[0] = float(bin.first) / capacity.first;
+      row[1] = float(bin.second) / capacity.second;
+      row[2] = float(item.first) / capacity.first;
+      row[3] = float(item.second) / capacity.second;
+      row += 4;
+    }
+  }
 
-    for (std::size_t i = 0; i < bins.size(); ++i) {
-      m[i][0] = float(bins[i].first) / capacity.first;
-      m[i][1] = float(bins[i].second) / capacity.second;
-      m[i][2] = float(item.first) / capacity.first;
-      m[i][3] = float(item.second) / capacity.second;
+  // What to_vector wrote, back, for observations that came over the wire.
+  static observation from_vector(xylo::vector_view o) {
+    xylo::matrix_view m = xylo::fold<2>(o, {num_bins, 4});
+    observation result(capacity);
+    for (std::size_t i = 0; i < num_bins; ++i) {
+      result.bins[i] = {int(std::lround(m[i][0] * capacity.first)),
+                        int(std::lround(m[i][1] * capacity.second))};
     }
+    result.item = {int(std::lround(m[0][2] * capacity.first)),
+                   int(std::lround(m[0][3] * capacity.second))};
+    return result;
   }
 
-  std::vector<std::pair<int, int>> bins;
+  // Inline, so that copying one into a transition allocates nothing.
+  std::array<std::pair<int, int>, num_bins> bins;
   std::pair<int, int> item;
 };
 
@@ -47,12 +73,14 @@ class environment : public xylo::environment<action, observation> {
 public:
   static constexpr std::pair<int, int> capacity{8, 8};
 
-  environment() : state_(std::make_unique<observation>(capacity)), dist_(0.4) {
+  environment() : environment(xylo::default_generator()()) {}
+  explicit environment(std::uint64_t seed)
+      : state_(capacity), generator_(seed), dist_(0.4) {
     get_item();
   }
   void apply(const action &action, std::size_t id) override {
-    std::pair<int, int> &bin = state_->bins[action.choice];
-    std::pair<int, int> &item = state_->item;
+    std::pair<int, int> &bin = state_.bins[action.choice];
+    std::pair<int, int> &item = state_.item;
     bin.first -= item.first;
     bin.second -= item.second;
 
@@ -62,10 +90,10 @@ public:
 
     get_item();
   }
-  observation view(std::size_t id) const override { return *state_; }
+  observation view(std::size_t id) const override { return state_; }
 
   void reset(std::size_t id) override {
-    state_ = std::make_unique<observation>(capacity);
+    state_ = observation(capacity);
     get_item();
   }
 
@@ -75,12 +103,117 @@ private:
 
   void get_item() {
     auto item = biased_coin_toss() ? shape1 : shape2;
-    state_->item = item;
+    state_.item = item;
+  }
+
+  bool biased_coin_toss() { return dist_(generator_); }
+
+  observation state_;
+  // As vector_environment's, and seedable, so that evaluations can replay.
+  std::minstd_rand generator_;
+  std::bernoulli_distribution dist_;
+};
+
+// num_instances bin packing games in struct-of-arrays form: the free space of
+// every bin of every instance in two flat arrays, and the pending items in two
+// more. Rules and rewards are those of environment and agent: 1 for every item
+// that fits, and the episode ends with the first one that doesn't.
+class vector_environment : public xylo::vector_environment<action> {
+public:
+  static constexpr std::pair<int, int> capacity{8, 8};
+
+  explicit vector_environment(std::size_t num_instances)
+      : num_instances_(num_instances), free_first_(num_instances * num_bins),
+        free_second_(num_instances * num_bins), item_first_(num_instances),
+        item_second_(num_instances), generator_(xylo::default_generator()()),
+        dist_(0.4) {
+    for (std::size_t i = 0; i < num_instances; ++i) {
+      reset(i);
+    }
+  }
+
+  std::size_t size() const override { return num_instances_; }
+  std::size_t observation_length() const override {
+    return observation::length();
+  }
+
+  void step(std::span<const action> actions, xylo::vector_view rewards,
+            std::span<std::uint8_t> done) override {
+    if (actions.size() != num_instances_ || rewards.size() != num_instances_ ||
+        done.size() != num_instances_)
+      throw xeno::error("wrong number of instances.");
+
+    float *reward = rewards.data();
+    for (std::size_t i = 0; i < num_instances_; ++i) {
+      const std::size_t bin = i * num_bins + actions[i].choice;
+      free_first_[bin] -= item_first_[i];
+      free_second_[bin] -= item_second_[i];
+      const bool over = free_first_[bin] < 0 || free_second_[bin] < 0;
+      reward[i] = over ? 0 : 1;
+      done[i] = over;
+      if (over) {
+        reset(i);
+      } else {
+        get_item(i);
+      }
+    }
+  }
+
+  void observe(xylo::matrix_view out) const override {
+    if (out.num_rows() != num_instances_ ||
+        out.num_cols() != observation::length())
+      throw xeno::error("wrong observation shape.");
+
+    float *row = out.data();
+    for (std::size_t i = 0; i < num_instances_; ++i) {
+      const float item_first = float(item_first_[i]) / capacity.first;
+      const float item_second = float(item_second_[i]) / capacity.second;
+      for (std::size_t j = i * num_bins; j < (i + 1) * num_bins; ++j) {
+        row[0] = float(free_first_[j]) / capacity.first;
+        row[1] = float(free_second_[j]) / capacity.second;
+        row[2] = item_first;
+        row[3] = item_second;
+        row += 4;
+      }
+    }
   }
 
-  bool biased_coin_toss() { return dist_(xylo::default_generator()); }
+  void reset(std::size_t id) override {
+    std::fill_n(free_first_.begin() + id * num_bins, num_bins, capacity.first);
+    std::fill_n(free_second_.begin() + id * num_bins, num_bins,
+                capacity.second);
+    get_item(id);
+  }
 
-  std::unique_ptr<observation> state_;
+  // Instance id as an observation, for code that works on single states.
+  observation view(std::size_t id) const {
+    observation result(capacity);
+    for (std::size_t j = 0; j < num_bins; ++j) {
+      result.bins[j] = {free_first_[id * num_bins + j],
+                        free_second_[id * num_bins + j]};
+    }
+    result.item = {item_first_[id], item_second_[id]};
+    return result;
+  }
+
+private:
+  static constexpr std::pair<int, int> shape1{4, 2};
+  static constexpr std::pair<int, int> shape2{1, 2};
+
+  void get_item(std::size_t id) {
+    const auto &item = dist_(generator_) ? shape1 : shape2;
+    item_first_[id] = item.first;
+    item_second_[id] = item.second;
+  }
+
+  std::size_t num_instances_;
+  std::vector<int> free_first_;
+  std::vector<int> free_second_;
+  std::vector<int> item_first_;
+  std::vector<int> item_second_;
+  // One for all the instances, and cheap. It is the environment's own, so
+  // that stepping doesn't contend on the shared one.
+  std::minstd_rand generator_;
   std::bernoulli_distribution dist_;
 };
 
@@ -106,6 +239,47 @@ private:
   }
 };
 
+namespace detail {
+// A base, so that the environment is there before the agent that plays in it.
+struct owned_environment {
+  explicit owned_environment(std::uint64_t seed) : env(seed) {}
+  environment env;
+};
+} // namespace detail
+
+// An agent in an environment of its own, seeded with seed.
+class standalone_agent : private detail::owned_environment, public agent {
+public:
+  standalone_agent(const xylo::policy<action, observation> &p,
+                   xylo::replay_buffer<action, observation> &rb,
+                   std::uint64_t seed)
+      : detail::owned_environment(seed), agent(p, env, rb) {}
+};
+
+// Plays policies on the default pool, each chunk of episodes in an
+// environment of its own.
+class evaluator : public xylo::evaluator<action, observation> {
+public:
+  explicit evaluator(std::uint64_t seed = xylo::default_generator()(),
+                     std::size_t chunk_size = 16)
+      : xylo::evaluator<action, observation>(
+            [](const xylo::policy<action, observation> &p,
+               xylo::replay_buffer<action, observation> &rb,
+               std::uint64_t seed) {
+              return std::make_unique<standalone_agent>(p, rb, seed);
+            },
+            seed, chunk_size) {}
+};
+
+using background_evaluation = xylo::background_evaluation<action, observation>;
+
+// The greedy policy over m, which is what the trainers evaluate.
+inline std::shared_ptr<const xylo::policy<action, observation>>
+deterministic_policy(xylo::model &m) {
+  return std::make_shared<
+      xylo::policy_gradient_deterministic_policy<action, observation>>(m);
+}
+
 class pg_learner : public xylo::policy_gradient_learner<action, observation> {
 public:
   pg_learner(xylo::replay_buffer<action, observation> &rb,
@@ -131,10 +305,11 @@ public:
   ppo_learner(xylo::replay_buffer<action, observation> &rb,
               xylo::model &action_model, xylo::optimizer &action_optimizer,
               xylo::model &value_model, xylo::optimizer &value_optimizer,
-              float gamma = 0.99)
-      : xylo::ppo_learner<action, observation>(rb, action_model,
-                                               action_optimizer, value_model,
-                                               value_optimizer, gamma) {}
+              float gamma = 0.99, std::size_t epochs = 4,
+              std::size_t minibatch_size = 0)
+      : xylo::ppo_learner<action, observation>(
+            rb, action_model, action_optimizer, value_model, value_optimizer,
+            gamma, epochs, minibatch_size) {}
 };
 
 class kl_ppo_learner : public xylo::kl_ppo_learner<action, observation> {
@@ -142,12 +317,20 @@ public:
   kl_ppo_learner(xylo::replay_buffer<action, observation> &rb,
                  xylo::model &action_model, xylo::optimizer &action_optimizer,
                  xylo::model &value_model, xylo::optimizer &value_optimizer,
-                 float gamma = 0.99)
-      : xylo::kl_ppo_learner<action, observation>(rb, action_model,
-                                                  action_optimizer, value_model,
-                                                  value_optimizer, gamma) {}
+                 float gamma = 0.99, std::size_t epochs = 4,
+                 std::size_t minibatch_size = 0)
+      : xylo::kl_ppo_learner<action, observation>(
+            rb, action_model, action_optimizer, value_model, value_optimizer,
+            gamma, epochs, minibatch_size) {}
 };
 
+// The policy network deep_agent plays with, 4 -> 128 -> 64 -> 1 channels per
+// bin, with its shapes fixed.
+using static_action_model = xylo::static_model<
+    xylo::static_convolution1d_1_layer<num_bins, 4, 128, true>,
+    xylo::static_convolution1d_1_layer<num_bins, 128, 64, true>,
+    xylo::static_convolution1d_1_layer<num_bins, 64, 1>>;
+
 } // namespace bp
 
 #endif
@@ -9,8 +9,10 @@ def get_samples(filename):
 
     with open(filename) as f:
         for line in f:
+            # The mean follows "round <n>"; newer logs go on with the rest
+            # of the summary.
             fields = line.strip().split()
-            samples.append(float(fields[-1]))
+            samples.append(float(fields[fields.index("round") + 2]))
     return samples
 
 
@@ -2,6 +2,7 @@
 #include <xeno/sys/file_descriptor.h>
 #include <xeno/sys/thread.h>
 
+#include <xylo/checkpoint.h>
 #include <xylo/nn.h>
 #include <xylo/rl.h>
 
@@ -18,26 +19,26 @@ int main() {
 
   // wieghts.10 is good
   // wieghts.20 is good
-  xeno::sys::mmap f = xeno::sys::mmap<float>("weights.20");
-  xylo::vector_view v = xylo::borrow_vector(f.span());
-  action_model.set_parameters(v);
+  // A checkpoint is borrowed as mapped; a raw dump of the parameters, as
+  // older runs wrote them, is copied in.
+  const std::filesystem::path weights = "weights.20";
+  std::optional<xylo::checkpoint> checkpoint;
+  if (xylo::checkpoint::is_checkpoint(weights)) {
+    checkpoint.emplace(weights);
+    checkpoint->borrow(action_model);
+  } else {
+    xeno::sys::mmap f = xeno::sys::mmap<float>(weights);
+    action_model.set_parameters(xylo::borrow_vector(f.span()));
+  }
 
   constexpr std::size_t num_episodes = 10000;
+  // The weights don't change from round to round, so one copy does.
+  xylo::static_deterministic_policy<bp::action, bp::observation,
+                                    bp::static_action_model>
+      policy(action_model);
+  bp::evaluator evaluator;
   for (std::size_t steps = 0; steps <= 1000; ++steps) {
-    xylo::policy_gradient_deterministic_policy<bp::action, bp::observation>
-        policy(action_model);
-    bp::environment env;
-    xylo::replay_buffer<bp::action, bp::observation> rb;
-    bp::agent agent(policy, env, rb);
-    for (int i = 0; i < num_episodes; ++i) {
-      agent.play_one_episode();
-    }
-    auto experience = rb.sample_td();
-    lg() << "round " << steps << " "
-         << xylo::total_rewards<bp::action, bp::observation>(experience) /
-                num_episodes;
-
-    rb.forget();
+    lg() << "round " << steps << " " << evaluator.run(policy, num_episodes);
   }
 
   return 0;
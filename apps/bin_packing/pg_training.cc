@@ -38,25 +38,19 @@ int main() {
 
   bp::pg_learner learner(replay_buffer, action_model, action_optimizer, 0.99);
 
-  std::list<xeno::sys::thread> threads;
-  for (int i = 0; i < num_workers; ++i) {
-    threads.emplace_back(xeno::string::strcat("worker", i));
-  }
+  xeno::sys::thread_pool &pool = xeno::sys::default_thread_pool();
 
   float max_reward = 0;
   for (int steps = 0;; ++steps) {
-    int i = 0;
-    for (auto &t : threads) {
-      bp::agent &agent = agents[i++];
-      t.run([&]() {
+    xeno::sys::wait_group rollouts;
+    for (bp::agent &agent : agents) {
+      pool.submit(rollouts, [&agent]() {
         for (int i = 0; i < episodes_per_worker; ++i) {
           agent.play_one_episode();
         }
       });
     }
-    for (auto &t : threads) {
-      t.join();
-    }
+    pool.wait(rollouts);
 
     if (steps % 100 == 0) {
       float total_rewards = 0;
@@ -0,0 +1,123 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <xeno/sys/thread.h>
+
+#include <xylo/nn.h>
+#include <xylo/rl.h>
+#include <xylo/snapshot.h>
+
+#include <apps/bin_packing/bin_packing.h>
+
+// ppo_training without the lockstep: actors keep playing on their own copy of
+// the action model, refreshed from the latest snapshot between rounds, while
+// the learner trains on whatever they have published since its last step.
+
+void build_action_model(xylo::model &m) {
+  m.add_layer(std::make_unique<xylo::convolution1d_1_layer>(4, 128));
+  m.add_layer(std::make_unique<xylo::relu_activation>());
+  m.add_layer(std::make_unique<xylo::convolution1d_1_layer>(128, 64));
+  m.add_layer(std::make_unique<xylo::relu_activation>());
+  m.add_layer(std::make_unique<xylo::convolution1d_1_layer>(64, 1));
+  m.add_layer(std::make_unique<xylo::softmax_layer>());
+}
+
+int main() {
+  xylo::model action_model;
+  build_action_model(action_model);
+  xylo::sgd_optimizer action_optimizer(action_model, 1e-4);
+
+  xylo::model value_model;
+  value_model.add_layer(
+      std::make_unique<xylo::full_layer>(4 * bp::num_bins, 64));
+  value_model.add_layer(std::make_unique<xylo::relu_activation>());
+  value_model.add_layer(std::make_unique<xylo::full_layer>(64, 32));
+  value_model.add_layer(std::make_unique<xylo::relu_activation>());
+  value_model.add_layer(std::make_unique<xylo::full_layer>(32, 1));
+  xylo::sgd_optimizer value_optimizer(value_model, 1e-5);
+
+  // Encodes states as they come in, for the learner to take as one matrix.
+  xylo::replay_buffer<bp::action, bp::observation> replay_buffer(true);
+  bp::ppo_learner learner(replay_buffer, action_model, action_optimizer,
+                          value_model, value_optimizer, 0.99);
+
+  constexpr int num_actors = 8;
+  constexpr int steps_per_round = 4;
+  // As much as a lockstep round of ppo_training brings in.
+  constexpr std::size_t min_transitions = num_actors * steps_per_round;
+  // Actors wait for the learner after this many rounds on one version, or
+  // they'd outrun it wherever there are fewer cores than threads.
+  constexpr int max_rounds_per_version = 2;
+  // Older than this, and the importance ratios mean little.
+  constexpr std::size_t max_policy_lag = 4;
+
+  // Evaluated on a copy of the parameters, over the pool, while training
+  // goes on.
+  xylo::model evaluation_model;
+  build_action_model(evaluation_model);
+  bp::evaluator evaluator;
+  bp::background_evaluation evaluation(evaluator, evaluation_model,
+                                       bp::deterministic_policy, 100);
+
+  xylo::parameter_snapshot snapshot(action_model.parameters().size());
+  snapshot.publish(action_model.parameters());
+
+  std::atomic<bool> stopping = false;
+  std::vector<std::unique_ptr<xeno::sys::thread>> actors;
+  for (int i = 0; i < num_actors; ++i) {
+    actors.emplace_back(std::make_unique<xeno::sys::thread>("actor"));
+    actors.back()->run([&]() {
+      xylo::model replica;
+      build_action_model(replica);
+      std::size_t version = snapshot.update(replica.parameters(), 0);
+
+      xylo::policy_gradient_policy<bp::action, bp::observation> policy(
+          replica);
+      bp::environment env;
+      bp::agent agent(policy, env, replay_buffer);
+      int rounds = 0;
+      while (!stopping.load(std::memory_order_relaxed)) {
+        if (std::size_t latest = snapshot.update(replica.parameters(), version);
+            latest != version) {
+          version = latest;
+          rounds = 0;
+        }
+        if (rounds == max_rounds_per_version) {
+          snapshot.wait(version);
+          continue;
+        }
+        agent.set_policy_version(version);
+        agent.play_steps(steps_per_round);
+        ++rounds;
+      }
+    });
+  }
+
+  for (int steps = 0; steps <= 100000; ++steps) {
+    while (replay_buffer.size() < min_transitions) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    auto lag = replay_buffer.drop_stale(snapshot.version(), max_policy_lag);
+
+    learner.step();
+    replay_buffer.forget();
+    snapshot.publish(action_model.parameters());
+
+    if (steps % 100 == 0)
+      evaluation.offer(action_model.parameters(), steps);
+    if (auto done = evaluation.poll()) {
+      lg() << "round " << done->first << " " << done->second << " (policy lag "
+           << lag.mean << " mean, " << lag.max << " max, " << lag.dropped
+           << " transitions dropped)";
+    }
+  }
+
+  stopping = true;
+  // Wakes up whoever is waiting for a version.
+  snapshot.publish(action_model.parameters());
+  for (auto &actor : actors) {
+    actor->join();
+  }
+  return 0;
+}
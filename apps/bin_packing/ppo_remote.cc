@@ -0,0 +1,143 @@
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include <xeno/sys/thread.h>
+
+#include <xylo/nn.h>
+#include <xylo/remote.h>
+#include <xylo/rl.h>
+#include <xylo/snapshot.h>
+
+#include <apps/bin_packing/bin_packing.h>
+
+// ppo_async_training with the actors in other processes, possibly on other
+// machines:
+//
+//   ppo_remote learner [port]
+//   ppo_remote actor host [port]
+//
+// Actors play on the latest parameters the learner has sent, and ship what
+// they have after every round; the learner steps whenever enough has come in,
+// and sends the new parameters back.
+
+namespace {
+
+constexpr int default_port = 23200;
+constexpr int num_agents = 8;
+constexpr int steps_per_round = 4;
+
+void build_action_model(xylo::model &m) {
+  m.add_layer(std::make_unique<xylo::convolution1d_1_layer>(4, 128));
+  m.add_layer(std::make_unique<xylo::relu_activation>());
+  m.add_layer(std::make_unique<xylo::convolution1d_1_layer>(128, 64));
+  m.add_layer(std::make_unique<xylo::relu_activation>());
+  m.add_layer(std::make_unique<xylo::convolution1d_1_layer>(64, 1));
+  m.add_layer(std::make_unique<xylo::softmax_layer>());
+}
+
+int run_learner(int port) {
+  xylo::model action_model;
+  build_action_model(action_model);
+  xylo::sgd_optimizer action_optimizer(action_model, 1e-4);
+
+  xylo::model value_model;
+  value_model.add_layer(
+      std::make_unique<xylo::full_layer>(4 * bp::num_bins, 64));
+  value_model.add_layer(std::make_unique<xylo::relu_activation>());
+  value_model.add_layer(std::make_unique<xylo::full_layer>(64, 32));
+  value_model.add_layer(std::make_unique<xylo::relu_activation>());
+  value_model.add_layer(std::make_unique<xylo::full_layer>(32, 1));
+  xylo::sgd_optimizer value_optimizer(value_model, 1e-5);
+
+  // Remote trajectories come encoded.
+  xylo::replay_buffer<bp::action, bp::observation> replay_buffer(true);
+  bp::ppo_learner learner(replay_buffer, action_model, action_optimizer,
+                          value_model, value_optimizer, 0.99);
+  xylo::trajectory_receiver<bp::action, bp::observation> receiver(
+      replay_buffer, port);
+
+  // As much as a lockstep round of ppo_training brings in.
+  constexpr std::size_t min_transitions = num_agents * steps_per_round;
+  // Older than this, and the importance ratios mean little.
+  constexpr std::size_t max_policy_lag = 4;
+
+  // Evaluated on a copy of the parameters, over the pool, while training
+  // goes on.
+  xylo::model evaluation_model;
+  build_action_model(evaluation_model);
+  bp::evaluator evaluator;
+  bp::background_evaluation evaluation(evaluator, evaluation_model,
+                                       bp::deterministic_policy, 100);
+
+  std::size_t version = 1;
+  receiver.broadcast(action_model.parameters(), version);
+  lg() << "listening on " << port;
+  for (int steps = 0;; ++steps) {
+    while (replay_buffer.size() < min_transitions) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    auto lag = replay_buffer.drop_stale(version, max_policy_lag);
+
+    learner.step();
+    replay_buffer.forget();
+    receiver.broadcast(action_model.parameters(), ++version);
+
+    if (steps % 100 == 0)
+      evaluation.offer(action_model.parameters(), steps);
+    if (auto done = evaluation.poll()) {
+      lg() << "round " << done->first << " " << done->second << " ("
+           << receiver.num_actors() << " actors, policy lag " << lag.mean
+           << " mean, " << lag.dropped << " transitions dropped)";
+    }
+  }
+  return 0;
+}
+
+int run_actor(const std::string &host, int port) {
+  xylo::model replica;
+  build_action_model(replica);
+  xylo::parameter_snapshot snapshot(replica.parameters().size());
+  xylo::remote_learner<bp::action, bp::observation> learner(host, port,
+                                                            snapshot);
+  std::size_t have = snapshot.update(replica.parameters(), snapshot.wait(0));
+
+  // Encodes states as they come in, so that sending doesn't have to.
+  xylo::replay_buffer<bp::action, bp::observation> replay_buffer(true);
+  xylo::policy_gradient_policy<bp::action, bp::observation> policy(replica);
+  std::vector<bp::environment> envs(num_agents);
+  std::vector<bp::agent> agents;
+  agents.reserve(num_agents);
+  for (int i = 0; i < num_agents; ++i) {
+    agents.emplace_back(policy, envs[i], replay_buffer);
+  }
+
+  xeno::sys::thread_pool &pool = xeno::sys::default_thread_pool();
+  while (learner.connected()) {
+    have = snapshot.update(replica.parameters(), have);
+    xeno::sys::wait_group rollouts;
+    for (bp::agent &agent : agents) {
+      agent.set_policy_version(learner.version());
+      pool.submit(rollouts, [&agent]() { agent.play_steps(steps_per_round); });
+    }
+    pool.wait(rollouts);
+    learner.send(replay_buffer);
+  }
+  lg() << "learner went away";
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const std::string mode = argc > 1 ? argv[1] : "";
+  if (mode == "learner") {
+    return run_learner(argc > 2 ? std::atoi(argv[2]) : default_port);
+  }
+  if (mode == "actor" && argc > 2) {
+    return run_actor(argv[2], argc > 3 ? std::atoi(argv[3]) : default_port);
+  }
+  lg() << "usage: ppo_remote learner [port] | ppo_remote actor host [port]";
+  return 1;
+}
@@ -1,31 +1,53 @@
+#include <cstdlib>
+#include <optional>
+
 #include <xeno/sys/thread.h>
 
+#include <xylo/checkpoint.h>
 #include <xylo/nn.h>
+#include <xylo/profile.h>
 #include <xylo/rl.h>
 
 #include <apps/bin_packing/bin_packing.h>
 
+void build_action_model(xylo::model &m) {
+  m.add_layer(
+      std::make_unique<xylo::convolution1d_1_layer>(4, 128, "action_conv0"));
+  m.add_layer(std::make_unique<xylo::relu_activation>("action_relu0"));
+  m.add_layer(
+      std::make_unique<xylo::convolution1d_1_layer>(128, 64, "action_conv1"));
+  m.add_layer(std::make_unique<xylo::relu_activation>("action_relu1"));
+  m.add_layer(
+      std::make_unique<xylo::convolution1d_1_layer>(64, 1, "action_conv2"));
+  m.add_layer(std::make_unique<xylo::softmax_layer>("action_softmax"));
+}
+
 int main() {
+  // XYLO_PROFILE=path profiles training, and keeps the profile at path.
+  std::optional<xylo::profile_writer> profile;
+  if (const char *path = std::getenv("XYLO_PROFILE"))
+    profile.emplace(path);
+
   xylo::model action_model;
-  action_model.add_layer(std::make_unique<xylo::convolution1d_1_layer>(4, 128));
-  action_model.add_layer(std::make_unique<xylo::relu_activation>());
-  action_model.add_layer(
-      std::make_unique<xylo::convolution1d_1_layer>(128, 64));
-  action_model.add_layer(std::make_unique<xylo::relu_activation>());
-  action_model.add_layer(std::make_unique<xylo::convolution1d_1_layer>(64, 1));
-  action_model.add_layer(std::make_unique<xylo::softmax_layer>());
+  build_action_model(action_model);
   xylo::sgd_optimizer action_optimizer(action_model, 1e-4);
 
   xylo::model value_model;
   value_model.add_layer(
-      std::make_unique<xylo::full_layer>(4 * bp::num_bins, 64));
-  value_model.add_layer(std::make_unique<xylo::relu_activation>());
-  value_model.add_layer(std::make_unique<xylo::full_layer>(64, 32));
-  value_model.add_layer(std::make_unique<xylo::relu_activation>());
-  value_model.add_layer(std::make_unique<xylo::full_layer>(32, 1));
+      std::make_unique<xylo::full_layer>(4 * bp::num_bins, 64, "value_full0"));
+  value_model.add_layer(std::make_unique<xylo::relu_activation>("value_relu0"));
+  value_model.add_layer(
+      std::make_unique<xylo::full_layer>(64, 32, "value_full1"));
+  value_model.add_layer(std::make_unique<xylo::relu_activation>("value_relu1"));
+  value_model.add_layer(
+      std::make_unique<xylo::full_layer>(32, 1, "value_full2"));
   xylo::sgd_optimizer value_optimizer(value_model, 1e-5);
+  // Learns over the whole buffer, in a shard per core.
+  action_optimizer.set_shards(0);
+  value_optimizer.set_shards(0);
 
-  xylo::replay_buffer<bp::action, bp::observation> replay_buffer;
+  // Encodes states as they come in, for the learner to take as one matrix.
+  xylo::replay_buffer<bp::action, bp::observation> replay_buffer(true);
 
   constexpr int num_workers = 8;
   constexpr int steps_per_worker = 4;
@@ -35,8 +57,12 @@ int main() {
 
   envs.reserve(num_workers);
   agents.reserve(num_workers);
-  xylo::policy_gradient_policy<bp::action, bp::observation> policy(
-      action_model);
+  // Workers step in parallel, and the main thread joins in while it waits for
+  // them, so up to that many states can be evaluated together.
+  xeno::sys::thread_pool &pool = xeno::sys::default_thread_pool();
+  xylo::batched_policy<bp::action, bp::observation> policy(
+      action_model, std::min<std::size_t>(num_workers, pool.size() + 1),
+      std::chrono::microseconds(50));
   for (int i = 0; i < num_workers; ++i) {
     envs.emplace_back();
     agents.emplace_back(policy, envs[i], replay_buffer);
@@ -45,39 +71,39 @@ int main() {
   bp::ppo_learner learner(replay_buffer, action_model, action_optimizer,
                           value_model, value_optimizer, 0.99);
 
-  std::list<xeno::sys::thread> threads;
-  for (int i = 0; i < num_workers; ++i) {
-    threads.emplace_back(xeno::string::strcat("worker", i));
-  }
+  // Evaluated on a copy of the parameters, over the pool, while training
+  // goes on.
+  xylo::model evaluation_model;
+  build_action_model(evaluation_model);
+  bp::evaluator evaluator;
+  bp::background_evaluation evaluation(evaluator, evaluation_model,
+                                       bp::deterministic_policy, 100);
+
+  // Saved in the background, for deep_agent to play from.
+  xylo::checkpoint_writer checkpoints(action_model);
+
   float max_reward = 0;
   for (int steps = 0;; ++steps) {
-    int i = 0;
-    for (auto &t : threads) {
-      bp::agent &agent = agents[i++];
-      t.run([&]() { agent.play_steps(steps_per_worker); });
-    }
-    for (auto &t : threads) {
-      t.join();
+    xeno::sys::wait_group rollouts;
+    for (bp::agent &agent : agents) {
+      pool.submit(rollouts, [&agent]() { agent.play_steps(steps_per_worker); });
     }
+    pool.wait(rollouts);
 
     learner.step();
 
     replay_buffer.forget();
 
-    if (steps % 100 == 0) {
-      xylo::policy_gradient_deterministic_policy<bp::action, bp::observation>
-          policy(action_model);
-      bp::environment env;
-      xylo::replay_buffer<bp::action, bp::observation> rb;
-      bp::agent agent(policy, env, rb);
-      for (int i = 0; i < 100; ++i) {
-        agent.play_one_episode();
-      }
-      auto experience = rb.sample_td();
-      lg() << "round " << steps << " "
-           << xylo::total_rewards<bp::action, bp::observation>(experience) /
-                  100.0;
-      rb.forget();
+    if (steps % 100 == 0)
+      evaluation.offer(action_model.parameters(), steps);
+    if (auto done = evaluation.poll())
+      lg() << "round " << done->first << " " << done->second;
+    // What deployment would run.
+    if (steps % 1000 == 0) {
+      xylo::quantized_deterministic_policy<bp::action, bp::observation> policy(
+          action_model);
+      lg() << "round " << steps << " int8 " << evaluator.run(policy, 100);
+      checkpoints.save(action_model, "weights.ckpt", steps);
     }
   }
 
@@ -0,0 +1,39 @@
+#include <xeno/time.h>
+
+#include <apps/bin_packing/bin_packing.h>
+
+// random_agent over a vector_environment, mostly to see how fast the
+// environment alone can go.
+int main() {
+  constexpr std::size_t num_instances = 1024;
+  constexpr std::size_t steps_per_round = 10000;
+
+  bp::vector_environment env(num_instances);
+  std::vector<bp::action> actions(num_instances);
+  xylo::vector rewards({num_instances});
+  std::vector<std::uint8_t> done(num_instances);
+  xylo::matrix observations({num_instances, env.observation_length()});
+
+  std::minstd_rand generator(xylo::default_generator()());
+  std::uniform_int_distribution<std::size_t> choice(0, bp::num_bins - 1);
+
+  for (std::size_t round = 0; round <= 10; ++round) {
+    float total_rewards = 0;
+    std::size_t num_episodes = 0;
+    auto start = xeno::time::now();
+    for (std::size_t step = 0; step < steps_per_round; ++step) {
+      env.observe(observations);
+      for (auto &a : actions) {
+        a.choice = choice(generator);
+      }
+      env.step(actions, rewards, done);
+      total_rewards += sum(rewards);
+      num_episodes += std::count(done.begin(), done.end(), 1);
+    }
+    double seconds = (xeno::time::now() - start).to_microseconds() / 1e6;
+    lg() << "round " << round << " " << total_rewards / num_episodes << " ("
+         << num_instances * steps_per_round / seconds << " steps/s)";
+  }
+
+  return 0;
+}
@@ -1,11 +1,19 @@
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <vector>
+
 #include <xeno/logging.h>
 
+#include <xylo/all_reduce.h>
+#include <xylo/batch_loader.h>
 #include <xylo/mnist.h>
 #include <xylo/nn.h>
+#include <xylo/profile.h>
 #include <xylo/tensor.h>
 
 float calculate_accuracy(xylo::matrix_view batch,
-                         std::span<uint8_t> label_batch) {
+                         std::span<const uint8_t> label_batch) {
   float num_correct_predictions = 0;
   for (std::size_t i = 0; i < label_batch.size(); ++i) {
     xylo::vector_view v = batch[i];
@@ -14,41 +22,78 @@ float calculate_accuracy(xylo::matrix_view batch,
   return num_correct_predictions / label_batch.size();
 }
 
-int main() {
+// simple_mnist [rank host...] trains as one process of a distributed job,
+// whose rank i runs on hosts[i]. Each process trains on its share of the
+// training set, with its share of every batch.
+int main(int argc, char **argv) {
+  // XYLO_PROFILE=path profiles training, and keeps the profile at path.
+  std::optional<xylo::profile_writer> profile;
+  if (const char *path = std::getenv("XYLO_PROFILE"))
+    profile.emplace(path);
+
+  std::vector<std::string> hosts(argv + std::min(argc, 2), argv + argc);
+  if (hosts.empty())
+    hosts.emplace_back("localhost");
+  const std::size_t rank = argc > 1 ? std::atoi(argv[1]) : 0;
+  constexpr int base_port = 23100;
+  xylo::ring_all_reduce ring(rank, hosts, base_port);
+
   using conv_layer = xylo::convolution2d_layer<28, 28>;
 
   xylo::model model;
-  // model.add_layer(std::make_unique<conv_layer>(3, 1, 8, "conv0"));
-  model.add_layer(std::make_unique<xylo::full_layer>(784, 256, "full0"));
+  model.add_layer(std::make_unique<conv_layer>(3, 1, 8, "conv0"));
+  model.add_layer(std::make_unique<xylo::relu_activation>("relu_conv0"));
+  model.add_layer(std::make_unique<xylo::full_layer>(784 * 8, 256, "full0"));
   model.add_layer(std::make_unique<xylo::relu_activation>("relu0"));
   model.add_layer(std::make_unique<xylo::full_layer>(256, 128, "full1"));
   model.add_layer(std::make_unique<xylo::relu_activation>("relu1"));
+  // The model ends at the logits; the loss takes their softmax itself.
   model.add_layer(std::make_unique<xylo::full_layer>(128, 10, "full2"));
-  model.add_layer(std::make_unique<xylo::softmax_cross_entropy_layer>(
-      "softmax_cross_entropy"));
 
   xylo::sgd_optimizer opt(model, 1e-3, 1e-5);
+  // A shard of every batch per core.
+  opt.set_shards(0);
+  // Every process starts from the parameters of rank 0, and takes the same
+  // steps with the gradients of all of them, summed a few layers at a time
+  // while the backward pass goes on.
+  ring.broadcast(model.parameters());
+  opt.set_gradient_reduce(
+      [&ring](xylo::vector_view gradient) { ring.sum(gradient); }, 1 << 18);
   // xylo::mnist mnist("/home/xinli/git_repo/apps/supervised/simple_mnist");
   xylo::mnist mnist(".");
 
-  xylo::matrix_view data = mnist.training_samples();
-  std::span<uint8_t> labels = mnist.training_labels();
-  constexpr int batch_size = 120;
+  const xylo::matrix testing_samples = mnist.testing_samples();
+  const std::size_t batch_size = 120 / ring.size();
+  const std::size_t num_samples = mnist.training_labels().size();
+  const std::size_t first = rank * num_samples / ring.size();
+  const std::size_t share = (rank + 1) * num_samples / ring.size() - first;
+  // Shuffled, and made ready while the previous batch trains.
+  xylo::batch_loader training(
+      mnist.training_images().subspan(first * mnist.image_size(),
+                                      share * mnist.image_size()),
+      mnist.training_labels().subspan(first, share), mnist.image_size(),
+      batch_size);
+  // The same for every process, whose shares may differ by a sample.
+  const std::size_t batches_per_epoch =
+      num_samples / ring.size() / batch_size;
 
   lg() << "start training";
   for (int epoch = 0;; ++epoch) {
-    for (int i = 0; i < labels.size() / batch_size; ++i) {
-      std::size_t start = i * batch_size;
-      auto label_batch = labels.subspan(start, batch_size);
-      auto loss_grad = std::bind_front(
-          xylo::softmax_cross_entropy_loss_grad<uint8_t>, label_batch, 10);
-      xylo::matrix_view slice = xylo::slice(data, start, batch_size);
-      opt.step(slice, loss_grad);
+    for (std::size_t i = 0; i < batches_per_epoch; ++i) {
+      xylo::batch_loader::batch batch = training.next();
+      auto loss_grad = [&batch](xylo::matrix_view logits) {
+        xylo::matrix grad({logits.num_rows(), logits.num_cols()});
+        xylo::softmax_cross_entropy(batch.labels, logits, grad);
+        return grad;
+      };
+      opt.step(batch.samples, loss_grad);
     }
     // if (i % (60000 / batch_size) == 0 && i != 0) {
-    float accuracy = calculate_accuracy(model.eval(mnist.testing_samples()),
+    float accuracy = calculate_accuracy(model.eval(testing_samples),
                                         mnist.testing_labels());
     lg() << "accuracy " << epoch << ": " << accuracy;
+    lg() << "  step workspace peak: " << xylo::local_workspace().peak_bytes()
+         << " bytes";
     for (auto &layer : model.layers()) {
       lg() << "  layer " << layer->name();
       lg() << "  mean: " << mean(layer->parameters());
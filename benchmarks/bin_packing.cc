@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <xeno/logging.h>
+#include <xeno/sys/thread.h>
+
+#include <xylo/accumulator.h>
+#include <xylo/benchmark.h>
+#include <xylo/nn.h>
+#include <xylo/replay.h>
+#include <xylo/rl.h>
+#include <xylo/tensor.h>
+
+#include <apps/bin_packing/bin_packing.h>
+
+// The replay buffers, the environments, and whole iterations of ppo_training,
+// whose env steps per second bound how fast the policy can learn.
+
+namespace {
+
+// Takes choices from a fixed cycle, so that the environment is all that's
+// timed.
+class cycling_policy : public xylo::policy<bp::action, bp::observation> {
+public:
+  bp::action react(const bp::observation &state) const override {
+    bp::action a;
+    a.choice = next_++ % bp::num_bins;
+    return a;
+  }
+
+private:
+  mutable std::size_t next_ = 0;
+};
+
+void benchmark_replay(xylo::benchmark_suite &suite) {
+  constexpr std::size_t num_transitions = 1024;
+  constexpr std::size_t episode_length = 16;
+  bp::environment env;
+  const bp::observation state = env.view(0);
+  auto fill = [&](xylo::replay_buffer<bp::action, bp::observation> &rb,
+                  auto &producer) {
+    for (std::size_t i = 0; i < num_transitions; ++i) {
+      if (i % episode_length == 0)
+        producer.open(bp::observation(state));
+      bp::action a;
+      a.choice = i % bp::num_bins;
+      producer.add_transition(std::move(a), 1, bp::observation(state));
+      if (i % episode_length == episode_length - 1) {
+        producer.current()->freeze();
+        producer.publish();
+      }
+    }
+  };
+
+  for (bool encode : {false, true}) {
+    const std::string kind = encode ? "encoded" : "plain";
+    xylo::replay_buffer<bp::action, bp::observation> rb(encode);
+    auto &producer = rb.add_producer();
+    suite.run("replay/" + kind + "/insert_and_forget/1024", [&]() {
+      fill(rb, producer);
+      rb.forget();
+    }, num_transitions, "transitions");
+
+    fill(rb, producer);
+    suite.run("replay/" + kind + "/sample_td/1024", [&]() {
+      auto experience = rb.sample_td();
+      xylo::keep(experience);
+      if (encode) {
+        auto states = rb.encoded_states();
+        xylo::keep(states);
+      }
+    }, num_transitions, "transitions");
+    suite.run("replay/" + kind + "/sample_transitions/256", [&]() {
+      auto sample = rb.sample_transitions(256);
+      xylo::keep(sample);
+    }, 256, "transitions");
+    rb.forget();
+  }
+}
+
+// ring_replay full of bin packing transitions, sampled as an off-policy
+// learner would, uniformly or by priority. A quarter of the new priorities are
+// 0, as |TD error| can be.
+void benchmark_ring_replay(xylo::benchmark_suite &suite) {
+  constexpr std::size_t capacity = 1 << 16;
+  constexpr std::size_t batch_size = 256;
+  bp::environment env;
+  const bp::observation state = env.view(0);
+  for (bool prioritized : {false, true}) {
+    const std::string kind = prioritized ? "prioritized" : "uniform";
+    xylo::ring_replay<bp::action, bp::observation> replay(capacity,
+                                                          prioritized);
+    std::size_t choice = 0;
+    auto add = [&]() {
+      bp::action a;
+      a.choice = choice++ % bp::num_bins;
+      return replay.add({state, a, 1, state, choice % 16 == 0});
+    };
+    suite.run("ring_replay/" + kind + "/add", [&]() {
+      const std::size_t slot = add();
+      xylo::keep(slot);
+    }, 1, "transitions");
+
+    while (replay.size() < capacity)
+      add();
+    std::vector<std::size_t> slots(batch_size);
+    std::vector<float> weights(batch_size);
+    std::vector<float> priorities(batch_size);
+    std::size_t round = 0;
+    suite.run("ring_replay/" + kind + "/sample/256", [&]() {
+      replay.sample(slots, weights);
+      if (prioritized) {
+        for (std::size_t i = 0; i < batch_size; ++i)
+          priorities[i] = (round + i) % 4 * 0.25f;
+        replay.update_priorities(slots, priorities);
+        ++round;
+      }
+      xylo::keep(weights);
+    }, batch_size, "transitions");
+  }
+}
+
+void benchmark_environments(xylo::benchmark_suite &suite) {
+  {
+    bp::environment env;
+    std::size_t choice = 0;
+    suite.run("environment/apply_and_view", [&]() {
+      bp::action a;
+      a.choice = choice++ % bp::num_bins;
+      env.apply(a, 0);
+      const bp::observation o = env.view(0);
+      for (const auto &bin : o.bins) {
+        if (bin.first < 0 || bin.second < 0) {
+          env.reset(0);
+          break;
+        }
+      }
+      xylo::keep(o);
+    }, 1, "env_steps");
+  }
+  {
+    cycling_policy policy;
+    bp::environment env;
+    xylo::replay_buffer<bp::action, bp::observation> rb(true);
+    bp::agent agent(policy, env, rb);
+    // Plays into an encoding buffer, and empties it every so often.
+    constexpr std::size_t steps = 256;
+    suite.run("agent/play_steps/256", [&]() {
+      agent.play_steps(steps);
+      rb.forget();
+    }, steps, "env_steps");
+  }
+  for (std::size_t n : {std::size_t(64), std::size_t(1024)}) {
+    bp::vector_environment env(n);
+    std::vector<bp::action> actions(n);
+    xylo::vector rewards(n);
+    std::vector<std::uint8_t> done(n);
+    xylo::matrix observations(
+        std::array<std::size_t, 2>{n, bp::observation::length()});
+    std::minstd_rand generator(1);
+    suite.run("vector_environment/step_and_observe/" + std::to_string(n),
+              [&]() {
+                for (bp::action &a : actions)
+                  a.choice = generator() % bp::num_bins;
+                env.step(actions, rewards, done);
+                env.observe(observations);
+                xylo::keep(observations);
+              },
+              n, "env_steps");
+  }
+}
+
+// deep_agent's network, reacting to one state through the compiled model and
+// through its static copy. Then to the states of a game, one after the other,
+// through the compiled model and through accumulator_policy, which only pays
+// for what changed in the first layer from one state to the next.
+void benchmark_policies(xylo::benchmark_suite &suite) {
+  xylo::model m;
+  m.add_layer(std::make_unique<xylo::convolution1d_1_layer>(4, 128));
+  m.add_layer(std::make_unique<xylo::relu_activation>());
+  m.add_layer(std::make_unique<xylo::convolution1d_1_layer>(128, 64));
+  m.add_layer(std::make_unique<xylo::relu_activation>());
+  m.add_layer(std::make_unique<xylo::convolution1d_1_layer>(64, 1));
+  bp::environment env;
+  const bp::observation state = env.view(0);
+
+  auto benchmark_policy =
+      [&](const std::string &name,
+          const xylo::policy<bp::action, bp::observation> &policy) {
+        suite.run("policy/" + name + "/react", [&]() {
+          bp::action a = policy.react(state);
+          xylo::keep(a);
+        }, 1, "states");
+      };
+  benchmark_policy("compiled",
+                   xylo::policy_gradient_deterministic_policy<
+                       bp::action, bp::observation>(m));
+  benchmark_policy(
+      "static", xylo::static_deterministic_policy<bp::action, bp::observation,
+                                                  bp::static_action_model>(m));
+
+  constexpr std::size_t num_states = 256;
+  std::vector<bp::observation> game;
+  for (std::size_t i = 0; game.size() < num_states; ++i) {
+    bp::action a;
+    a.choice = i % bp::num_bins;
+    env.apply(a, 0);
+    game.push_back(env.view(0));
+    for (const auto &bin : game.back().bins) {
+      if (bin.first < 0 || bin.second < 0) {
+        env.reset(0);
+        break;
+      }
+    }
+  }
+  // With the softmax ppo_training puts on top from here on, so that the
+  // stochastic policies have distributions to compare. Ties between bins that
+  // look alike make comparing the choices of the deterministic ones moot.
+  m.add_layer(std::make_unique<xylo::softmax_layer>());
+  {
+    const xylo::policy_gradient_policy<bp::action, bp::observation> compiled(m);
+    const xylo::accumulator_policy<bp::action, bp::observation> accumulated(m);
+    const xylo::policy<bp::action, bp::observation> &p = compiled;
+    const xylo::policy<bp::action, bp::observation> &q = accumulated;
+    float max_difference = 0;
+    for (const bp::observation &o : game) {
+      const bp::action a = p.react(o), b = q.react(o);
+      for (std::size_t i = 0; i < bp::num_bins; ++i) {
+        max_difference = std::max(max_difference,
+                                  std::abs((*a.distrib)[i] - (*b.distrib)[i]));
+      }
+    }
+    lg() << "accumulator_policy is within " << max_difference
+         << " of the compiled policy over " << num_states << " states";
+  }
+
+  auto benchmark_game =
+      [&](const std::string &name,
+          const xylo::policy<bp::action, bp::observation> &policy) {
+        suite.run("policy/" + name + "/react_game/256", [&]() {
+          for (const bp::observation &o : game) {
+            bp::action a = policy.react(o);
+            xylo::keep(a);
+          }
+        }, num_states, "states");
+      };
+  benchmark_game("compiled",
+                 xylo::policy_gradient_deterministic_policy<bp::action,
+                                                            bp::observation>(
+                     m));
+  benchmark_game("accumulator",
+                 xylo::accumulator_policy<bp::action, bp::observation>(
+                     m, /*deterministic=*/true));
+}
+
+// As in ppo_training.
+void benchmark_ppo(xylo::benchmark_suite &suite) {
+  if (!suite.selected("ppo/iteration"))
+    return;
+  xylo::model action_model;
+  action_model.add_layer(std::make_unique<xylo::convolution1d_1_layer>(4, 128));
+  action_model.add_layer(std::make_unique<xylo::relu_activation>());
+  action_model.add_layer(
+      std::make_unique<xylo::convolution1d_1_layer>(128, 64));
+  action_model.add_layer(std::make_unique<xylo::relu_activation>());
+  action_model.add_layer(std::make_unique<xylo::convolution1d_1_layer>(64, 1));
+  action_model.add_layer(std::make_unique<xylo::softmax_layer>());
+  xylo::sgd_optimizer action_optimizer(action_model, 1e-4);
+
+  xylo::model value_model;
+  value_model.add_layer(
+      std::make_unique<xylo::full_layer>(4 * bp::num_bins, 64));
+  value_model.add_layer(std::make_unique<xylo::relu_activation>());
+  value_model.add_layer(std::make_unique<xylo::full_layer>(64, 32));
+  value_model.add_layer(std::make_unique<xylo::relu_activation>());
+  value_model.add_layer(std::make_unique<xylo::full_layer>(32, 1));
+  xylo::sgd_optimizer value_optimizer(value_model, 1e-5);
+  action_optimizer.set_shards(0);
+  value_optimizer.set_shards(0);
+
+  xylo::replay_buffer<bp::action, bp::observation> replay_buffer(true);
+  constexpr std::size_t num_workers = 8;
+  constexpr std::size_t steps_per_worker = 4;
+  xeno::sys::thread_pool &pool = xeno::sys::default_thread_pool();
+  xylo::batched_policy<bp::action, bp::observation> policy(
+      action_model, std::min<std::size_t>(num_workers, pool.size() + 1),
+      std::chrono::microseconds(50));
+  std::vector<bp::environment> envs(num_workers);
+  std::vector<bp::agent> agents;
+  agents.reserve(num_workers);
+  for (bp::environment &env : envs)
+    agents.emplace_back(policy, env, replay_buffer);
+  bp::ppo_learner learner(replay_buffer, action_model, action_optimizer,
+                          value_model, value_optimizer, 0.99);
+
+  suite.run("ppo/iteration", [&]() {
+    xeno::sys::wait_group rollouts;
+    for (bp::agent &agent : agents) {
+      pool.submit(rollouts, [&agent]() { agent.play_steps(steps_per_worker); });
+    }
+    pool.wait(rollouts);
+    learner.step();
+    replay_buffer.forget();
+  }, num_workers * steps_per_worker, "env_steps");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  xylo::benchmark_suite suite(argc, argv);
+  benchmark_replay(suite);
+  benchmark_ring_replay(suite);
+  benchmark_environments(suite);
+  benchmark_policies(suite);
+  benchmark_ppo(suite);
+  return 0;
+}
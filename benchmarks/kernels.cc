@@ -0,0 +1,131 @@
+#include <array>
+#include <cstddef>
+#include <random>
+#include <string>
+
+#include <xylo/benchmark.h>
+#include <xylo/gemm.h>
+#include <xylo/kernels.h>
+#include <xylo/random.h>
+#include <xylo/tensor.h>
+
+// The gemm in the shapes training runs into, and the element-wise kernels and
+// random fills over sizes from L1 to memory.
+int main(int argc, char **argv) {
+  xylo::benchmark_suite suite(argc, argv);
+
+  struct shape {
+    std::size_t m, n, k;
+  };
+  // Square ones, simple_mnist's first full layer on its batch, the first two
+  // convolutions of the bin packing policy on 64 states of 32 bins, and the
+  // mnist output layer.
+  constexpr std::array<shape, 7> shapes = {{{64, 64, 64},
+                                            {256, 256, 256},
+                                            {512, 512, 512},
+                                            {120, 256, 6272},
+                                            {2048, 128, 4},
+                                            {2048, 64, 128},
+                                            {120, 10, 128}}};
+  for (const shape &s : shapes) {
+    xylo::matrix a(std::array<std::size_t, 2>{s.m, s.k});
+    xylo::matrix at(std::array<std::size_t, 2>{s.k, s.m});
+    xylo::matrix b(std::array<std::size_t, 2>{s.k, s.n});
+    xylo::matrix bt(std::array<std::size_t, 2>{s.n, s.k});
+    xylo::matrix c(std::array<std::size_t, 2>{s.m, s.n});
+    for (xylo::matrix *m : {&a, &at, &b, &bt})
+      uniform_distribution(-1, 1, xylo::flatten(*m));
+    const std::string dims = xeno::string::strcat(s.m, "x", s.n, "x", s.k);
+    const double flops = 2.0 * s.m * s.n * s.k;
+    float *out = xylo::matrix_view(c).data();
+    auto data = [](xylo::matrix &m) { return xylo::matrix_view(m).data(); };
+
+    // The three forms the layers use: forward, backward, gradient.
+    suite.run("gemm_nt/" + dims, [&]() {
+      xylo::gemm(false, true, s.m, s.n, s.k, data(a), s.k, data(bt), s.k, out,
+                 s.n);
+      xylo::keep(out);
+    }, flops, "flops");
+    suite.run("gemm_nn/" + dims, [&]() {
+      xylo::gemm(false, false, s.m, s.n, s.k, data(a), s.k, data(b), s.n, out,
+                 s.n);
+      xylo::keep(out);
+    }, flops, "flops");
+    suite.run("gemm_tn/" + dims, [&]() {
+      xylo::gemm(true, false, s.m, s.n, s.k, data(at), s.m, data(b), s.n, out,
+                 s.n);
+      xylo::keep(out);
+    }, flops, "flops");
+  }
+
+  // 16KiB, 1MiB and 16MiB of floats each.
+  for (std::size_t size : {std::size_t(1) << 12, std::size_t(1) << 18,
+                           std::size_t(1) << 22}) {
+    xylo::vector x(size), y(size), z(size);
+    uniform_distribution(0.5, 2, x);
+    uniform_distribution(0.5, 2, y);
+    const float *in1 = xylo::vector_view(x).data();
+    const float *in2 = xylo::vector_view(y).data();
+    float *out = xylo::vector_view(z).data();
+    const std::string n = std::to_string(size);
+
+    suite.run("add/" + n, [&]() {
+      xylo::kernels::add(in1, in2, out, size);
+      xylo::keep(out);
+    }, size, "elements");
+    suite.run("multiply/" + n, [&]() {
+      xylo::kernels::multiply(in1, 0.5f, out, size);
+      xylo::keep(out);
+    }, size, "elements");
+    suite.run("exp/" + n, [&]() {
+      xylo::kernels::exp(in1, out, size);
+      xylo::keep(out);
+    }, size, "elements");
+    suite.run("log/" + n, [&]() {
+      xylo::kernels::log(in1, out, size);
+      xylo::keep(out);
+    }, size, "elements");
+    suite.run("sum/" + n, [&]() {
+      float s = xylo::kernels::sum(in1, size);
+      xylo::keep(s);
+    }, size, "elements");
+    suite.run("dot/" + n, [&]() {
+      float d = xylo::kernels::dot(in1, in2, size);
+      xylo::keep(d);
+    }, size, "elements");
+    suite.run("max/" + n, [&]() {
+      float m = xylo::kernels::max(in1, size);
+      xylo::keep(m);
+    }, size, "elements");
+
+    // Against the std distributions on the same generator, what they replace.
+    xylo::philox &g = xylo::default_generator();
+    suite.run("uniform_fill/" + n, [&]() {
+      xylo::uniform_fill(g, -1, 1, out, size);
+      xylo::keep(out);
+    }, size, "elements");
+    suite.run("normal_fill/" + n, [&]() {
+      xylo::normal_fill(g, 0, 1, out, size);
+      xylo::keep(out);
+    }, size, "elements");
+    suite.run("std_normal/" + n, [&]() {
+      std::normal_distribution<float> d(0, 1);
+      for (std::size_t i = 0; i < size; ++i)
+        out[i] = d(g);
+      xylo::keep(out);
+    }, size, "elements");
+  }
+
+  // Rows as wide as the policy and mnist outputs.
+  for (std::size_t cols : {std::size_t(10), std::size_t(128)}) {
+    const std::size_t rows = 1024;
+    xylo::matrix in(std::array<std::size_t, 2>{rows, cols});
+    xylo::matrix out(std::array<std::size_t, 2>{rows, cols});
+    uniform_distribution(-4, 4, xylo::flatten(in));
+    suite.run(xeno::string::strcat("softmax/", rows, "x", cols), [&]() {
+      xylo::softmax(in, out);
+      xylo::keep(out);
+    }, rows * cols, "elements");
+  }
+  return 0;
+}
@@ -0,0 +1,129 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <xylo/benchmark.h>
+#include <xylo/nn.h>
+#include <xylo/tensor.h>
+
+namespace {
+
+// The three passes of l on a batch of batch_size rows, each in a workspace
+// scope like a step runs them in.
+void benchmark_layer(xylo::benchmark_suite &suite, const std::string &name,
+                     xylo::layer &l, std::size_t batch_size,
+                     std::size_t input_size) {
+  xylo::matrix input(std::array<std::size_t, 2>{batch_size, input_size});
+  uniform_distribution(-1, 1, xylo::flatten(input));
+  const xylo::matrix output = l.forward(input);
+  xylo::matrix backprop(output);
+  uniform_distribution(-1, 1, xylo::flatten(backprop));
+  xylo::vector gradient(l.parameters().size());
+
+  using pass = xylo::layer::pass;
+  suite.run(name + "/forward", [&]() {
+    xylo::workspace_scope scope;
+    xylo::matrix result = l.forward(input);
+    xylo::keep(result);
+  }, l.flops(pass::forward, input), "flops");
+  suite.run(name + "/backward", [&]() {
+    xylo::workspace_scope scope;
+    xylo::matrix result = l.backward(input, output, backprop);
+    xylo::keep(result);
+  }, l.flops(pass::backward, input), "flops");
+  if (l.parameters().size() != 0) {
+    suite.run(name + "/gradient", [&]() {
+      l.gradient(input, backprop, gradient);
+      xylo::keep(gradient);
+    }, l.flops(pass::gradient, input), "flops");
+  }
+}
+
+// The simple_mnist network, without the convolution.
+std::unique_ptr<xylo::model> mnist_mlp() {
+  auto m = std::make_unique<xylo::model>();
+  m->add_layer(std::make_unique<xylo::full_layer>(784, 256, "full0"));
+  m->add_layer(std::make_unique<xylo::relu_activation>("relu0"));
+  m->add_layer(std::make_unique<xylo::full_layer>(256, 128, "full1"));
+  m->add_layer(std::make_unique<xylo::relu_activation>("relu1"));
+  m->add_layer(std::make_unique<xylo::full_layer>(128, 10, "full2"));
+  m->add_layer(std::make_unique<xylo::softmax_cross_entropy_layer>("softmax"));
+  return m;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  xylo::benchmark_suite suite(argc, argv);
+
+  // Layers in the sizes of simple_mnist, on its batch of 120.
+  {
+    xylo::full_layer full(784, 256);
+    benchmark_layer(suite, "full/120x784x256", full, 120, 784);
+    xylo::convolution2d_layer<28, 28> conv(3, 1, 8, "conv");
+    benchmark_layer(suite, "conv2d/120x28x28x8", conv, 120, 784);
+    xylo::relu_activation relu;
+    benchmark_layer(suite, "relu/120x6272", relu, 120, 784 * 8);
+    xylo::softmax_layer softmax;
+    benchmark_layer(suite, "softmax/120x10", softmax, 120, 10);
+  }
+  // And in those of the bin packing policy, on 32 states of 32 bins.
+  {
+    xylo::convolution1d_1_layer conv0(4, 128);
+    benchmark_layer(suite, "conv1d_1/32x32x4x128", conv0, 32, 32 * 4);
+    xylo::convolution1d_1_layer conv1(128, 64);
+    benchmark_layer(suite, "conv1d_1/32x32x128x64", conv1, 32, 32 * 128);
+  }
+
+  // Whole steps of an mnist classifier, serial and sharded, with two of the
+  // optimizers.
+  const std::size_t batch_size = 120;
+  xylo::matrix samples(std::array<std::size_t, 2>{batch_size, 784});
+  uniform_distribution(0, 1, xylo::flatten(samples));
+  std::vector<std::uint8_t> labels(batch_size);
+  for (std::size_t i = 0; i < batch_size; ++i)
+    labels[i] = i % 10;
+  auto loss_grad = std::bind_front(
+      xylo::softmax_cross_entropy_loss_grad<std::uint8_t>,
+      std::span<const std::uint8_t>(labels), 10);
+
+  std::unique_ptr<xylo::model> m = mnist_mlp();
+  // Per step.
+  std::uint64_t flops = 0;
+  {
+    xylo::workspace_scope scope;
+    std::vector<xylo::matrix> activations = m->forward(samples);
+    using pass = xylo::layer::pass;
+    for (std::size_t i = 0; i < m->layers().size(); ++i) {
+      const xylo::layer &l = *m->layers()[i];
+      flops += l.flops(pass::forward, activations[i]) +
+               l.flops(pass::gradient, activations[i]);
+      // Nothing propagates back past the first layer.
+      if (i > 0)
+        flops += l.flops(pass::backward, activations[i]);
+    }
+  }
+  auto benchmark_optimizer = [&](const std::string &name,
+                                 xylo::optimizer &opt) {
+    suite.run(name + "/serial", [&]() { opt.step(samples, loss_grad); },
+              flops, "flops");
+    opt.set_shards(0);
+    suite.run(name + "/sharded", [&]() { opt.step(samples, loss_grad); },
+              flops, "flops");
+    opt.set_shards(1);
+  };
+  {
+    xylo::sgd_optimizer opt(*m, 1e-4);
+    benchmark_optimizer("step_sgd/mnist_mlp/120", opt);
+  }
+  {
+    xylo::adam_optimizer opt(*m, 1e-4);
+    benchmark_optimizer("step_adam/mnist_mlp/120", opt);
+  }
+  return 0;
+}
@@ -194,7 +194,7 @@ std::string LINKER = "ld";
 std::string OPT = "-O3";
 std::string G = "-g0";
 std::string STD = "-std=c++20";
-std::string AVX = "-mavx";
+std::string AVX = "-mavx2 -mfma";
 std::string FAST_MATH = "-ffast-math";
 std::string INCLUDE = xeno::string::strcat("-I", repo_abs_path.string());
 std::string PTHREAD = "-pthread";
@@ -1,5 +1,287 @@
 #include <xeno/logging.h>
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
 namespace xeno::logging {
 thread_local std::string thread_name("main");
+std::atomic<int> min_level = logstream::info;
+
+namespace {
+
+std::int64_t nanoseconds(timespec t) {
+  return t.tv_sec * 1'000'000'000 + t.tv_nsec;
+}
+
+void write_all(std::string_view s) {
+  while (!s.empty()) {
+    const ssize_t n = ::write(STDERR_FILENO, s.data(), s.size());
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    s.remove_prefix(n);
+  }
+}
+
+// "%F %T.uuuuuu", with the part before the dot formatted once a second.
+void append_timestamp(std::string &out, timespec t) {
+  thread_local time_t second = -1;
+  thread_local char prefix[32];
+  thread_local std::size_t length = 0;
+  if (t.tv_sec != second) {
+    std::tm tm;
+    localtime_r(&t.tv_sec, &tm);
+    length = std::strftime(prefix, sizeof(prefix), "%F %T", &tm);
+    second = t.tv_sec;
+  }
+  out.append(prefix, length);
+  char micros[8] = {'.'};
+  for (long us = t.tv_nsec / 1'000, i = 6; i > 0; --i, us /= 10)
+    micros[i] = '0' + us % 10;
+  out.append(micros, 7);
+}
+
+struct record {
+  std::int64_t time;
+  std::string line;
+};
+
+// Bounded, with one thread that pushes and the writer that drains.
+class ring {
+public:
+  explicit ring(std::size_t capacity) : slots_(capacity) {}
+
+  // Leaves line alone if full.
+  bool push(std::int64_t time, std::string &line) {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == slots_.size())
+      return false;
+    record &r = slots_[tail % slots_.size()];
+    r.time = time;
+    r.line = std::move(line);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // For the writer.
+  void drain(std::vector<record> &out) {
+    std::size_t head = head_.load(std::memory_order_relaxed);
+    const std::size_t tail = tail_.load(std::memory_order_acquire);
+    for (; head != tail; ++head)
+      out.push_back(std::move(slots_[head % slots_.size()]));
+    head_.store(head, std::memory_order_release);
+  }
+
+  std::size_t size() const {
+    return tail_.load(std::memory_order_relaxed) -
+           head_.load(std::memory_order_relaxed);
+  }
+  std::size_t capacity() const { return slots_.size(); }
+  bool empty() const { return size() == 0; }
+
+  // Set when its thread exits, for the writer to let it go once drained.
+  std::atomic<bool> retired = false;
+
+private:
+  std::vector<record> slots_;
+  alignas(64) std::atomic<std::size_t> head_ = 0;
+  alignas(64) std::atomic<std::size_t> tail_ = 0;
+};
+
+// The rings outlive the threads and the writers, so that it doesn't matter
+// which of them goes first.
+struct registry {
+  std::mutex mutex;
+  std::vector<std::shared_ptr<ring>> rings;
+
+  // For the writer's wakeups.
+  std::condition_variable wake_cv;
+  bool wake = false;
+  bool stop = false;
+  // flush() waits for flushed to catch up with its request.
+  std::condition_variable flushed_cv;
+  std::uint64_t flush_requests = 0;
+  std::uint64_t flushed = 0;
+
+  std::atomic<bool> running = false;
+  // From before running until the writer is joined, which outlasts running
+  // while the last lines are drained. Without it, a line written in place
+  // has nothing to wait for, and takes no lock.
+  std::atomic<bool> writing = false;
+  std::size_t ring_size = 0;
+  std::thread writer;
+
+  // Never destroyed, for threads that log during exit.
+  static registry &get() {
+    static registry *r = new registry;
+    return *r;
+  }
+
+  void notify() {
+    {
+      std::lock_guard l(mutex);
+      wake = true;
+    }
+    wake_cv.notify_one();
+  }
+
+  void run() {
+    thread_name = "logging";
+    std::vector<std::shared_ptr<ring>> snapshot;
+    std::vector<record> batch;
+    std::string buffer;
+    for (;;) {
+      std::uint64_t requests;
+      bool done;
+      {
+        std::unique_lock l(mutex);
+        wake_cv.wait_for(l, std::chrono::milliseconds(10),
+                         [this]() { return wake || stop; });
+        wake = false;
+        done = stop;
+        requests = flush_requests;
+        std::erase_if(rings, [](const std::shared_ptr<ring> &r) {
+          return r->retired.load() && r->empty();
+        });
+        snapshot = rings;
+      }
+      for (const std::shared_ptr<ring> &r : snapshot)
+        r->drain(batch);
+      snapshot.clear();
+      // Each ring is in order already.
+      std::stable_sort(batch.begin(), batch.end(),
+                       [](const record &a, const record &b) {
+                         return a.time < b.time;
+                       });
+      for (const record &r : batch)
+        buffer += r.line;
+      write_all(buffer);
+      buffer.clear();
+      batch.clear();
+      {
+        std::lock_guard l(mutex);
+        flushed = requests;
+      }
+      flushed_cv.notify_all();
+      if (done)
+        return;
+    }
+  }
+};
+
+// This thread's ring, made on first use.
+ring &local_ring() {
+  struct holder {
+    std::shared_ptr<ring> r;
+    ~holder() {
+      if (r)
+        r->retired = true;
+    }
+  };
+  thread_local holder h;
+  if (!h.r) {
+    registry &reg = registry::get();
+    std::lock_guard l(reg.mutex);
+    h.r = std::make_shared<ring>(reg.ring_size);
+    reg.rings.push_back(h.r);
+  }
+  return *h.r;
+}
+
+} // namespace
+
+void logstream::output() {
+  if (!enabled(level_))
+    return;
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  const char *file = location_.file_name();
+  if (const char *slash = std::strrchr(file, '/'))
+    file = slash + 1;
+  std::string line;
+  append_timestamp(line, now);
+  line += ' ';
+  line += level_char();
+  line += ' ';
+  line += thread_name;
+  line += '\t';
+  line += file;
+  line += ':';
+  line += std::to_string(location_.line());
+  line += ":\t";
+  line += view();
+  line += '\n';
+
+  registry &reg = registry::get();
+  if (level_ < fatal && reg.running.load(std::memory_order_acquire)) {
+    ring &r = local_ring();
+    while (!r.push(nanoseconds(now), line)) {
+      reg.notify();
+      std::this_thread::yield();
+    }
+    // On the way past half full, not on every line after.
+    if (level_ >= error || r.size() == r.capacity() / 2 + 1)
+      reg.notify();
+    return;
+  }
+  if (reg.writing.load(std::memory_order_acquire))
+    flush();
+  write_all(line);
+}
+
+async_logging::async_logging(std::size_t ring_size) {
+  registry &reg = registry::get();
+  {
+    std::lock_guard l(reg.mutex);
+    if (reg.running)
+      return;
+    reg.ring_size = std::max<std::size_t>(ring_size, 1);
+    reg.stop = false;
+  }
+  reg.writing.store(true, std::memory_order_release);
+  reg.writer = std::thread([&reg]() { reg.run(); });
+  reg.running.store(true, std::memory_order_release);
+  started_ = true;
+}
+
+async_logging::~async_logging() {
+  if (!started_)
+    return;
+  registry &reg = registry::get();
+  reg.running.store(false, std::memory_order_release);
+  {
+    std::lock_guard l(reg.mutex);
+    reg.stop = true;
+  }
+  reg.wake_cv.notify_one();
+  reg.writer.join();
+  reg.writing.store(false, std::memory_order_release);
+}
+
+void flush() {
+  registry &reg = registry::get();
+  std::unique_lock l(reg.mutex);
+  if (!reg.writer.joinable())
+    return;
+  const std::uint64_t request = ++reg.flush_requests;
+  reg.wake = true;
+  reg.wake_cv.notify_one();
+  reg.flushed_cv.wait(l, [&]() {
+    return reg.flushed >= request || reg.stop;
+  });
+}
+
 } // namespace xeno::logging
@@ -1,11 +1,12 @@
 #ifndef XENO_LOGGING_
 #define XENO_LOGGING_
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <ctime>
 #include <experimental/source_location>
-#include <filesystem>
 #include <iostream>
-#include <map>
 #include <sstream>
 #include <string>
 #include <string_view>
@@ -23,26 +24,10 @@ namespace logging {
 
 extern thread_local std::string thread_name;
 
-struct key {
-  xeno::time::point timestamp;
-  std::thread::id tid;
-};
-
-struct entry {
-  std::source_location location;
-  std::string content;
-};
-
-class log_store {
-  log_store() = default;
-
-private:
-  std::map<key, entry> logs;
-};
-
 class logstream : public std::ostringstream {
 public:
   enum level {
+    debug,
     info,
     warning,
     error,
@@ -59,20 +44,14 @@ public:
   logstream(logstream &&other) : std::ostringstream(std::move(other)) {}
 
 protected:
-  void output() {
-    std::filesystem::path p(location_.file_name());
-
-    std::ostringstream buffer;
-
-    buffer << time::now().to_localtime() << ' ' << level() << ' ' << thread_name
-           << '\t' << p.filename().string() << ":" << location_.line() << ":\t"
-           << str() << std::endl;
-    std::cerr << buffer.str();
-  }
+  // Writes the line, or hands it to the async writer if there is one.
+  void output();
 
 private:
-  char level() {
+  char level_char() const {
     switch (level_) {
+    case debug:
+      return 'D';
     case info:
       return 'I';
     case warning:
@@ -90,9 +69,106 @@ private:
   std::experimental::source_location location_;
 };
 
+// Lines below the minimum level are dropped. The XENO_LOG macros check it
+// before building a line at all, and compile to nothing below
+// XENO_LOG_MIN_LEVEL, so that what they log costs nothing while filtered.
+#ifndef XENO_LOG_MIN_LEVEL
+#define XENO_LOG_MIN_LEVEL 0
+#endif
+
+extern std::atomic<int> min_level;
+
+inline void set_min_level(logstream::level l) {
+  min_level.store(l, std::memory_order_relaxed);
+}
+inline bool enabled(logstream::level l) {
+  return l >= XENO_LOG_MIN_LEVEL &&
+         l >= min_level.load(std::memory_order_relaxed);
+}
+
+// While one exists, threads don't write their lines themselves. Each thread
+// that logs puts them in a ring of its own, of ring_size lines, without
+// taking locks, and a writer thread drains all the rings every few
+// milliseconds, or as soon as one is half full, in one write to stderr in
+// the order they were logged. A thread whose ring is full waits for the
+// writer. Errors wake the writer right away, and fatal lines are written on
+// the spot, after everything logged before them.
+//
+// Make it before and let it go after the threads that log to it are done;
+// while one exists, more of them do nothing.
+class async_logging {
+public:
+  explicit async_logging(std::size_t ring_size = 1024);
+  ~async_logging();
+
+  async_logging(const async_logging &) = delete;
+  void operator=(const async_logging &) = delete;
+
+private:
+  // Whether this one started the writer.
+  bool started_ = false;
+};
+
+// Returns once what this thread logged so far is written.
+void flush();
+
+// Lets log calls be one side of ?:.
+struct voidify {
+  void operator&(const std::ostream &) {}
+};
+
+// One per call site of the sampled macros.
+class sampler {
+public:
+  // True every n-th call, from the first.
+  bool every_n(std::uint64_t n) {
+    return count_.fetch_add(1, std::memory_order_relaxed) % n == 0;
+  }
+  // True at most once in that long, the first call included.
+  bool every(double seconds) {
+    const timespec t = xeno::time::mono_now().time_;
+    const std::int64_t now = t.tv_sec * 1'000'000'000 + t.tv_nsec;
+    std::int64_t next = next_.load(std::memory_order_relaxed);
+    return now >= next &&
+           next_.compare_exchange_strong(
+               next, now + static_cast<std::int64_t>(seconds * 1e9),
+               std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<std::uint64_t> count_ = 0;
+  std::atomic<std::int64_t> next_ = 0;
+};
+
 } // namespace logging
 using log = logging::logstream;
 } // namespace xeno
 
 using lg = xeno::log;
+
+// XENO_LOG(info) << ...; is lg(lg::info) << ...; except that nothing after
+// it is evaluated while info is filtered.
+#define XENO_LOG(l)                                                            \
+  !::xeno::logging::enabled(::xeno::log::l)                                    \
+      ? (void)0                                                                \
+      : ::xeno::logging::voidify() & ::xeno::log(::xeno::log::l)
+
+// For per-step diagnostics: logs the first of every n times it's reached.
+#define XENO_LOG_EVERY_N(l, n)                                                 \
+  XENO_LOG_SAMPLED(l, every_n(n))
+
+// Logs at most once every that many seconds.
+#define XENO_LOG_EVERY_T(l, seconds)                                           \
+  XENO_LOG_SAMPLED(l, every(seconds))
+
+// The lambda gives each call site a sampler of its own.
+#define XENO_LOG_SAMPLED(l, condition)                                         \
+  !(::xeno::logging::enabled(::xeno::log::l) &&                                \
+    []() -> ::xeno::logging::sampler & {                                       \
+      static ::xeno::logging::sampler s;                                       \
+      return s;                                                                \
+    }()                                                                        \
+                .condition)                                                    \
+      ? (void)0                                                                \
+      : ::xeno::logging::voidify() & ::xeno::log(::xeno::log::l)
 #endif // XENO_LOGGING_
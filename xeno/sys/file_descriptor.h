@@ -199,6 +199,9 @@ public:
     address addr = local_tcp_address(port);
     socket s(addr.family(), t);
     reinterpret_cast<sockaddr_in *>(addr.addr())->sin_port = htons(port);
+    // So that a restarted server doesn't wait for old connections to expire.
+    int one = 1;
+    setsockopt(s.handle_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
     s.bind(addr);
     s.listen(backlog);
     return s;
@@ -241,6 +244,10 @@ public:
   static file open_to_read(const std::filesystem::path &p) {
     return open(p, O_RDONLY);
   }
+  // Truncates whatever was there.
+  static file open_to_write(const std::filesystem::path &p) {
+    return open(p, O_WRONLY | O_CREAT | O_TRUNC);
+  }
   static file open_to_append(const std::filesystem::path &p) {
     return open(p, O_WRONLY | O_CREAT | O_APPEND);
   }
@@ -271,9 +278,11 @@ template <typename T> class mmap {
 public:
   mmap() = default;
 
-  // Size and pos are in terms of mapped objects.
-  mmap(const std::filesystem::path &p, std::size_t size = -1) {
-    file f = file::open_to_mmap(p);
+  // Size and pos are in terms of mapped objects. Unless shared, writes stay
+  // in this process and the file has to exist already.
+  mmap(const std::filesystem::path &p, std::size_t size = -1,
+       bool shared = true) {
+    file f = shared ? file::open_to_mmap(p) : file::open_to_read(p);
     if (size == -1) {
       size = file_size(p) / sizeof(T);
     }
@@ -281,9 +290,9 @@ public:
     if (size == 0)
       return;
 
-    T *ptr = reinterpret_cast<T *>(::mmap(nullptr, size * sizeof(T),
-                                          PROT_READ | PROT_WRITE, MAP_SHARED,
-                                          f.get_handle(), 0));
+    T *ptr = reinterpret_cast<T *>(
+        ::mmap(nullptr, size * sizeof(T), PROT_READ | PROT_WRITE,
+               shared ? MAP_SHARED : MAP_PRIVATE, f.get_handle(), 0));
     if (ptr == reinterpret_cast<T *>(-1))
       throw xeno::error("mmap failed");
 
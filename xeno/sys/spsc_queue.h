@@ -0,0 +1,64 @@
+#ifndef XENO_SYS_SPSC_QUEUE_
+#define XENO_SYS_SPSC_QUEUE_
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+namespace xeno {
+namespace sys {
+
+// Unbounded queue for exactly one producer thread and one consumer thread,
+// without locks: push() and pop() each touch only their own end, and hand
+// nodes over through a single release/acquire pair. push() allocates a node,
+// so it never has to wait for the consumer to make room.
+template <typename T> class spsc_queue {
+public:
+  spsc_queue() : head_(new node), tail_(head_) {}
+  ~spsc_queue() {
+    while (head_) {
+      node *next = head_->next.load(std::memory_order_relaxed);
+      delete head_;
+      head_ = next;
+    }
+  }
+
+  spsc_queue(const spsc_queue &) = delete;
+  void operator=(const spsc_queue &) = delete;
+
+  // Producer only.
+  void push(T value) {
+    node *n = new node;
+    n->value.emplace(std::move(value));
+    tail_->next.store(n, std::memory_order_release);
+    tail_ = n;
+  }
+
+  // Consumer only.
+  std::optional<T> pop() {
+    node *next = head_->next.load(std::memory_order_acquire);
+    if (!next)
+      return std::nullopt;
+    // next becomes the new dummy, so its value moves out.
+    std::optional<T> result = std::move(next->value);
+    next->value.reset();
+    delete head_;
+    head_ = next;
+    return result;
+  }
+
+private:
+  struct node {
+    std::atomic<node *> next = nullptr;
+    std::optional<T> value;
+  };
+
+  // The consumer's end is a dummy node whose successor is the front.
+  alignas(64) node *head_;
+  alignas(64) node *tail_;
+};
+
+} // namespace sys
+} // namespace xeno
+
+#endif // XENO_SYS_SPSC_QUEUE_
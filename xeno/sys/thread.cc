@@ -1,9 +1,13 @@
+#include <pthread.h>
+#include <sched.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <string>
 
 #include <xeno/logging.h>
+#include <xeno/string.h>
 #include <xeno/sys/thread.h>
 
 namespace xeno::logging {
@@ -18,6 +22,10 @@ void set_local_name(std::string_view s) {
   // us.
   xeno::logging::thread_name = s;
 }
+
+// Which pool, if any, the current thread works for.
+thread_local const thread_pool *local_pool = nullptr;
+thread_local std::size_t local_index = 0;
 } // namespace
 
 void thread::join() {
@@ -33,4 +41,211 @@ void *thread::execute_closure(void *p) {
   return nullptr;
 }
 
+// ******** Thread pool ********
+thread_pool::thread_pool(std::size_t num_threads, bool pin_threads,
+                         std::string_view name) {
+  workers_.reserve(num_threads);
+  for (std::size_t i = 0; i < num_threads; ++i) {
+    auto &w = workers_.emplace_back(std::make_unique<worker>());
+    w->runner = std::make_unique<thread>(xeno::string::strcat(name, i));
+  }
+  // Only start once all the deques exist, since workers steal from each other.
+  for (std::size_t i = 0; i < num_threads; ++i) {
+    workers_[i]->runner->run([this, i, pin_threads]() {
+      run_worker(i, pin_threads);
+    });
+  }
+}
+
+thread_pool::~thread_pool() {
+  {
+    std::lock_guard l(sleep_mutex_);
+    stopping_ = true;
+  }
+  sleep_cv_.notify_all();
+  for (auto &w : workers_) {
+    w->runner->join();
+  }
+}
+
+bool thread_pool::in_pool() const { return local_pool == this; }
+
+void thread_pool::submit(task t) { push(std::move(t)); }
+
+void thread_pool::submit(wait_group &wg, task t) {
+  wg.add();
+  push([&wg, t = std::move(t)]() {
+    try {
+      t();
+    } catch (...) {
+      wg.done();
+      throw;
+    }
+    wg.done();
+  });
+}
+
+void thread_pool::wait(wait_group &wg) {
+  while (!wg.finished()) {
+    std::size_t start = in_pool() ? local_index : next_.load();
+    if (auto t = acquire(start)) {
+      execute(*t);
+      continue;
+    }
+    // Everything we could help with is already running somewhere. Sleep a
+    // little, but come back to check for work spawned in the meantime.
+    wg.wait_for(std::chrono::microseconds(100));
+  }
+  // Synchronize with the last done().
+  wg.wait();
+}
+
+void thread_pool::parallel_for(
+    std::size_t begin, std::size_t end,
+    const std::function<void(std::size_t, std::size_t)> &f,
+    std::size_t grain) {
+  if (end <= begin)
+    return;
+
+  const std::size_t n = end - begin;
+  grain = std::max<std::size_t>(grain, 1);
+  const std::size_t num_chunks =
+      std::min((n + grain - 1) / grain, workers_.size() + 1);
+  if (num_chunks <= 1) {
+    f(begin, end);
+    return;
+  }
+
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  const auto guarded = [&](std::size_t b, std::size_t e) {
+    try {
+      f(b, e);
+    } catch (...) {
+      std::lock_guard l(error_mutex);
+      if (!error)
+        error = std::current_exception();
+    }
+  };
+
+  // Spread the remainder over the first chunks, so chunk sizes differ by at
+  // most one.
+  const std::size_t base = n / num_chunks;
+  const std::size_t extra = n % num_chunks;
+  const auto chunk_begin = [&](std::size_t c) {
+    return begin + c * base + std::min(c, extra);
+  };
+
+  wait_group wg;
+  for (std::size_t c = 1; c < num_chunks; ++c) {
+    std::size_t b = chunk_begin(c);
+    std::size_t e = chunk_begin(c + 1);
+    submit(wg, [&guarded, b, e]() { guarded(b, e); });
+  }
+  guarded(chunk_begin(0), chunk_begin(1));
+  wait(wg);
+
+  if (error)
+    std::rethrow_exception(error);
+}
+
+void thread_pool::run_worker(std::size_t index, bool pin) {
+  local_pool = this;
+  local_index = index;
+
+  if (pin) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(index % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+      lg(lg::warning) << "failed to pin worker " << index;
+    }
+  }
+
+  for (;;) {
+    if (auto t = acquire(index)) {
+      execute(*t);
+      continue;
+    }
+
+    std::unique_lock l(sleep_mutex_);
+    if (stopping_ && pending_.load() == 0)
+      return;
+    sleep_cv_.wait(l, [this]() { return stopping_ || pending_.load() > 0; });
+  }
+}
+
+void thread_pool::push(task t) {
+  if (workers_.empty()) {
+    execute(t);
+    return;
+  }
+
+  // Workers keep their own spawns local, which is the cache friendly order for
+  // nested work. Everybody else goes round-robin.
+  std::size_t index =
+      in_pool() ? local_index : next_.fetch_add(1) % workers_.size();
+
+  // Count first. A worker that sees the count before the task lands just spins
+  // once more instead of going to sleep on it.
+  pending_.fetch_add(1);
+  {
+    worker &w = *workers_[index];
+    std::lock_guard l(w.mutex);
+    w.tasks.push_back(std::move(t));
+  }
+  {
+    // Taking the lock orders us after any worker that is about to sleep.
+    std::lock_guard l(sleep_mutex_);
+  }
+  sleep_cv_.notify_one();
+}
+
+std::optional<thread_pool::task> thread_pool::acquire(std::size_t start) {
+  const std::size_t n = workers_.size();
+  if (n == 0)
+    return std::nullopt;
+  start %= n;
+
+  // Our own deque from the back, if we have one.
+  if (in_pool()) {
+    worker &w = *workers_[start];
+    std::lock_guard l(w.mutex);
+    if (!w.tasks.empty()) {
+      task t = std::move(w.tasks.back());
+      w.tasks.pop_back();
+      pending_.fetch_sub(1);
+      return t;
+    }
+  }
+
+  // Steal the oldest work from everybody else.
+  for (std::size_t i = 0; i < n; ++i) {
+    worker &w = *workers_[(start + i) % n];
+    std::lock_guard l(w.mutex);
+    if (!w.tasks.empty()) {
+      task t = std::move(w.tasks.front());
+      w.tasks.pop_front();
+      pending_.fetch_sub(1);
+      return t;
+    }
+  }
+  return std::nullopt;
+}
+
+void thread_pool::execute(task &t) {
+  try {
+    t();
+  } catch (const std::exception &e) {
+    lg(lg::error) << "task failed: " << e.what();
+  } catch (...) {
+    lg(lg::error) << "task failed";
+  }
+}
+
+thread_pool &default_thread_pool() {
+  static thread_pool pool(std::max(1u, std::thread::hardware_concurrency()));
+  return pool;
+}
+
 } // namespace xeno::sys
@@ -3,11 +3,20 @@
 
 #include <signal.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <vector>
 
 namespace xeno {
 namespace sys {
@@ -50,11 +59,106 @@ private:
   std::function<void()> closure_;
 };
 
+// Counts outstanding work. add() before handing work out, done() when each
+// piece finishes, and wait() until the count drops back to zero.
+class wait_group {
+public:
+  wait_group() = default;
+  wait_group(const wait_group &) = delete;
+  void operator=(const wait_group &) = delete;
+
+  void add(std::size_t n = 1) { count_.fetch_add(n); }
+  void done() {
+    // Decrement under the lock, so that a waiter that wakes up and destroys us
+    // can't race with the notification.
+    std::lock_guard l(mutex_);
+    if (count_.fetch_sub(1) == 1)
+      cv_.notify_all();
+  }
+
+  bool finished() const { return count_.load() == 0; }
+
+  void wait() {
+    std::unique_lock l(mutex_);
+    cv_.wait(l, [this]() { return finished(); });
+  }
+
+  template <typename Rep, typename Period>
+  bool wait_for(const std::chrono::duration<Rep, Period> &timeout) {
+    std::unique_lock l(mutex_);
+    return cv_.wait_for(l, timeout, [this]() { return finished(); });
+  }
+
+private:
+  std::atomic<std::size_t> count_ = 0;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+};
+
+// A fixed set of long-lived worker threads. Every worker owns a deque: it
+// pushes and pops its own work at the back, and idle workers steal from the
+// front of everybody else's. Work submitted from outside the pool is spread
+// round-robin over the deques.
+//
+// Waiting through the pool (wait() and parallel_for()) makes the calling thread
+// run queued work until the wait group drains, so nested parallelism from
+// inside a task doesn't deadlock the pool.
 class thread_pool {
 public:
-  thread_pool(std::size_t num_threads) {}
+  using task = std::function<void()>;
+
+  explicit thread_pool(std::size_t num_threads, bool pin_threads = false,
+                       std::string_view name = "pool");
+  thread_pool(const thread_pool &) = delete;
+  ~thread_pool();
+
+  void operator=(const thread_pool &) = delete;
+
+  std::size_t size() const { return workers_.size(); }
+
+  // Fire and forget. Exceptions escaping the task are logged and dropped.
+  void submit(task t);
+
+  // The wait group is incremented now and decremented once the task is done.
+  void submit(wait_group &wg, task t);
+
+  // Blocks until wg is finished, running queued tasks in the meantime.
+  void wait(wait_group &wg);
+
+  // Calls f(chunk_begin, chunk_end) over [begin, end) split into chunks of at
+  // least grain indices. The calling thread takes part. The first exception
+  // thrown by any chunk is rethrown here after all chunks are done.
+  void parallel_for(std::size_t begin, std::size_t end,
+                    const std::function<void(std::size_t, std::size_t)> &f,
+                    std::size_t grain = 1);
+
+  // Whether the current thread is one of our workers.
+  bool in_pool() const;
+
+private:
+  struct worker {
+    std::mutex mutex;
+    std::deque<task> tasks;
+    std::unique_ptr<thread> runner;
+  };
+
+  void run_worker(std::size_t index, bool pin);
+  void push(task t);
+  std::optional<task> acquire(std::size_t start);
+  void execute(task &t);
+
+  std::vector<std::unique_ptr<worker>> workers_;
+  std::atomic<std::size_t> next_ = 0;
+
+  std::atomic<std::size_t> pending_ = 0;
+  std::mutex sleep_mutex_;
+  std::condition_variable sleep_cv_;
+  bool stopping_ = false;
 };
 
+// Process-wide pool with one worker per hardware thread, created on first use.
+thread_pool &default_thread_pool();
+
 } // namespace sys
 } // namespace xeno
 
@@ -43,7 +43,9 @@ public:
   ssize_t to_microseconds() {
     return time_.tv_sec * 1'000'000 + time_.tv_nsec / 1'000;
   }
-  ssize_t to_nanoseconds() { return time_.tv_nsec; }
+  ssize_t to_nanoseconds() {
+    return time_.tv_sec * 1'000'000'000 + time_.tv_nsec;
+  }
 
 public:
   constexpr duration(timespec t) : time_(t) {}
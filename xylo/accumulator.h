@@ -0,0 +1,142 @@
+#ifndef XYLO_ACCUMULATOR_
+#define XYLO_ACCUMULATOR_
+
+#include <algorithm>
+#include <optional>
+#include <typeinfo>
+#include <vector>
+
+#include <xeno/exception.h>
+#include <xylo/nn.h>
+#include <xylo/tensor.h>
+
+// The first layer of a model in the form NNUE evaluates it: instead of the
+// whole product for every input, a state keeps the layer's pre-activations
+// for the last input it saw, and moving it to the next input adds one column
+// of the weights for every feature that changed. When consecutive inputs are
+// close, as the states of one game are, that costs in proportion to the
+// change rather than to the input width.
+//
+// The first layer has to be a matmul_layer or a convolution1d_1_layer; a
+// relu_activation right after it is applied too. The weights are copied, so
+// update() has to be called to take in new ones, which also makes every state
+// start from scratch on its next move.
+namespace xylo {
+
+class first_layer_accumulator {
+public:
+  first_layer_accumulator(const model &m, std::size_t input_width) {
+    auto layers = m.layers();
+    if (layers.empty())
+      throw xeno::error("accumulating an empty model.");
+    layer *l = layers[0].get();
+    if (typeid(*l) == typeid(matmul_layer)) {
+      auto *affine = static_cast<matmul_layer *>(l);
+      weights_.emplace(affine->weights());
+      bias_.emplace(affine->bias());
+    } else if (typeid(*l) == typeid(convolution1d_1_layer)) {
+      auto *affine = static_cast<convolution1d_1_layer *>(l);
+      weights_.emplace(affine->weights());
+      bias_.emplace(affine->bias());
+    } else {
+      throw xeno::error("the first layer can't be accumulated.");
+    }
+    // A full layer is a convolution over a single point.
+    channels_ = weights_->num_cols();
+    outputs_ = weights_->num_rows();
+    if (input_width == 0 || input_width % channels_ != 0)
+      throw xeno::error("wrong input shape for the first layer.");
+    points_ = input_width / channels_;
+    relu_ = layers.size() > 1 &&
+            typeid(*layers[1]) == typeid(relu_activation);
+    update();
+  }
+
+  std::size_t input_width() const { return points_ * channels_; }
+  std::size_t output_width() const { return points_ * outputs_; }
+  // The first layer that isn't covered.
+  std::size_t rest() const { return relu_ ? 2 : 1; }
+
+  // Copies the weights again. Not while anyone advances a state.
+  void update() {
+    // Transposed, so that the column of a feature is contiguous.
+    columns_.resize(channels_ * outputs_);
+    for (std::size_t c = 0; c < channels_; ++c) {
+      for (std::size_t o = 0; o < outputs_; ++o)
+        columns_[c * outputs_ + o] = (*weights_)[o][c];
+    }
+    bias_values_.assign(bias_->begin(), bias_->end());
+    ++generation_;
+  }
+
+  // What one sequence of inputs has accumulated. Belongs to one thread at a
+  // time.
+  class state {
+  public:
+    explicit state(const first_layer_accumulator &a)
+        : input_(a.input_width()), pre_activations_(a.output_width()) {}
+
+  private:
+    std::vector<float> input_;
+    std::vector<float> pre_activations_;
+    // Of the weights it was accumulated with; 0 for none.
+    std::size_t generation_ = 0;
+    std::size_t moves_ = 0;
+
+    friend class first_layer_accumulator;
+  };
+
+  // Moves s to input, and writes the output of the first layer for it into
+  // out.
+  void advance(state &s, vector_view input, vector_view out) const {
+    if (input.size() != input_width() || out.size() != output_width())
+      throw xeno::error("wrong shapes for the first layer.");
+    // Starting over every so often keeps rounding errors from piling up.
+    if (s.generation_ != generation_ || ++s.moves_ > refresh_interval) {
+      // Start from the bias of every point, as if the input were all 0.
+      for (std::size_t p = 0; p < points_; ++p) {
+        std::copy(bias_values_.begin(), bias_values_.end(),
+                  s.pre_activations_.begin() + p * outputs_);
+      }
+      std::fill(s.input_.begin(), s.input_.end(), 0.0f);
+      s.generation_ = generation_;
+      s.moves_ = 0;
+    }
+
+    const float *x = input.data();
+    for (std::size_t k = 0; k < s.input_.size(); ++k) {
+      const float delta = x[k] - s.input_[k];
+      if (delta == 0)
+        continue;
+      const float *column = &columns_[(k % channels_) * outputs_];
+      float *pre = &s.pre_activations_[(k / channels_) * outputs_];
+      for (std::size_t o = 0; o < outputs_; ++o)
+        pre[o] += delta * column[o];
+      s.input_[k] = x[k];
+    }
+
+    float *dst = out.data();
+    for (std::size_t i = 0; i < s.pre_activations_.size(); ++i) {
+      const float y = s.pre_activations_[i];
+      dst[i] = relu_ && y < 0 ? 0 : y;
+    }
+  }
+
+private:
+  static constexpr std::size_t refresh_interval = 256;
+
+  std::optional<matrix_view> weights_;
+  std::optional<vector_view> bias_;
+  std::size_t channels_;
+  std::size_t outputs_;
+  std::size_t points_;
+  bool relu_;
+
+  std::vector<float> columns_;
+  std::vector<float> bias_values_;
+  std::size_t generation_ = 0;
+};
+
+} // namespace xylo
+
+#endif // XYLO_ACCUMULATOR_
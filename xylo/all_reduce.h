@@ -0,0 +1,323 @@
+#ifndef XYLO_ALL_REDUCE_
+#define XYLO_ALL_REDUCE_
+
+#include <netinet/tcp.h>
+#include <poll.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <xeno/endian.h>
+#include <xeno/exception.h>
+#include <xeno/string.h>
+#include <xeno/sys/file_descriptor.h>
+#include <xeno/sys/io.h>
+#include <xeno/sys/thread.h>
+#include <xylo/kernels.h>
+#include <xylo/tensor.h>
+
+// Data-parallel training over several processes, possibly on several
+// machines: each computes the gradient of its share of a batch, and sum()
+// leaves every one of them with the total, as if one process had done the
+// whole batch.
+//
+// The processes form a ring over TCP, each sending to the next and receiving
+// from the previous one. A sum is a reduce-scatter followed by an all-gather:
+// the vector is cut into one segment per process, and in 2 (n - 1) steps every
+// segment travels once around the ring to be added up, and once more to be
+// handed out. Each process then sends and receives 2 (n - 1) / n of the vector,
+// however many processes there are.
+//
+// Segments go in chunks, and a thread of the ring's own does the sending, so
+// that a chunk is passed on as soon as it's been added to, while the next is
+// still on its way in.
+//
+// That overlaps the steps of one sum with each other. To overlap the sum with
+// the backward pass as well, hand it to optimizer::set_gradient_reduce with a
+// bucket size: the optimizer then sums the gradient a few layers at a time,
+// from the last, on a thread of its own, while the earlier layers are still
+// being worked out.
+namespace xylo {
+
+class ring_all_reduce {
+public:
+  // hosts[i] is the machine of rank i, which listens on base_port + i. Blocks
+  // until connected to both neighbours, and throws if the next one isn't
+  // listening, or the previous one hasn't connected, within timeout.
+  ring_all_reduce(std::size_t rank, const std::vector<std::string> &hosts,
+                  int base_port,
+                  std::chrono::milliseconds timeout = std::chrono::seconds(60))
+      : rank_(rank), size_(hosts.size()), sender_("all_reduce") {
+    if (rank >= size_)
+      throw xeno::error("rank out of range.");
+    if (size_ == 1)
+      return;
+    const std::size_t next = (rank + 1) % size_;
+    const std::size_t previous = (rank + size_ - 1) % size_;
+
+    xeno::sys::socket listener = xeno::sys::socket::create(base_port + rank);
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    for (;;) {
+      try {
+        next_ = xeno::sys::socket::open(hosts[next], base_port + next);
+        break;
+      } catch (const xeno::error &) {
+        if (std::chrono::steady_clock::now() > deadline)
+          throw;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+    }
+    previous_ = accept(listener, deadline);
+    no_delay(next_);
+    no_delay(previous_);
+
+    // Whoever connected to us has to be the previous rank of the same ring.
+    std::array<std::uint64_t, 2> hello = {rank, size_};
+    send_words(hello);
+    receive_words(hello);
+    if (hello[0] != previous || hello[1] != size_) {
+      throw xeno::error(xeno::string::strcat("rank ", rank, " expected rank ",
+                                             previous, " of ", size_,
+                                             ", got ", hello[0], " of ",
+                                             hello[1]));
+    }
+
+    sender_.run([this]() { send_loop(); });
+  }
+
+  ~ring_all_reduce() {
+    if (size_ == 1)
+      return;
+    {
+      std::lock_guard l(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    sender_.join();
+  }
+
+  ring_all_reduce(const ring_all_reduce &) = delete;
+  void operator=(const ring_all_reduce &) = delete;
+
+  std::size_t rank() const { return rank_; }
+  std::size_t size() const { return size_; }
+
+  // Replaces v with the sum of v over all processes. Everyone has to call it,
+  // with vectors of the same size.
+  void sum(vector_view v) {
+    if (size_ == 1)
+      return;
+    check_size(v.size());
+    const std::size_t n = size_;
+    const std::span<float> data(v.data(), v.size());
+    // Rank r sends segment r - s at step s and receives r - s - 1, which is
+    // what it sends at step s + 1.
+    auto segment = [&](std::size_t j) {
+      j %= n;
+      const std::size_t begin = j * data.size() / n;
+      return data.subspan(begin, (j + 1) * data.size() / n - begin);
+    };
+
+    send(segment(rank_));
+    const std::size_t steps = 2 * (n - 1);
+    for (std::size_t s = 0; s < steps; ++s) {
+      const bool reducing = s < n - 1;
+      const std::span<float> in =
+          segment(reducing ? rank_ + n - 1 - s : rank_ + n - (s - (n - 1)));
+      for (std::size_t offset = 0; offset < in.size(); offset += chunk_size) {
+        const std::span<float> chunk =
+            in.subspan(offset, std::min(chunk_size, in.size() - offset));
+        if (reducing) {
+          scratch_.resize(chunk.size());
+          receive(scratch_);
+          kernels::add(chunk.data(), scratch_.data(), chunk.data(),
+                       chunk.size());
+        } else {
+          receive(chunk);
+        }
+        // Sent from where it is: the chunk is only written again once it has
+        // been all the way round the ring, which it can't before this is out.
+        if (s + 1 < steps)
+          send(chunk);
+      }
+    }
+    wait_sent();
+  }
+
+  // Replaces v with its value at root.
+  void broadcast(vector_view v, std::size_t root = 0) {
+    if (root >= size_)
+      throw xeno::error("rank out of range.");
+    if (size_ == 1)
+      return;
+    check_size(v.size());
+    const std::span<float> data(v.data(), v.size());
+    if (rank_ == root) {
+      send(data);
+    } else {
+      const bool last = (rank_ + 1) % size_ == root;
+      for (std::size_t offset = 0; offset < data.size();
+           offset += chunk_size) {
+        const std::span<float> chunk =
+            data.subspan(offset, std::min(chunk_size, data.size() - offset));
+        receive(chunk);
+        if (!last)
+          send(chunk);
+      }
+    }
+    wait_sent();
+  }
+
+private:
+  // 64KiB: large enough to keep the connection busy, small enough for the
+  // next hop to start early.
+  static constexpr std::size_t chunk_size = 1 << 14;
+
+  // The first connection to listener, or throws if there is none by
+  // deadline.
+  xeno::sys::socket accept(xeno::sys::socket &listener,
+                           std::chrono::steady_clock::time_point deadline) {
+    pollfd p = {listener.get_handle(), POLLIN, 0};
+    for (;;) {
+      const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now());
+      const int ready = ::poll(&p, 1, std::max<int>(left.count(), 0));
+      if (ready > 0)
+        break;
+      if (ready == 0)
+        throw xeno::error(xeno::string::strcat(
+            "rank ", rank_, ": the previous rank didn't connect in time"));
+      if (errno != EINTR)
+        throw xeno::error(
+            xeno::string::strcat("waiting to accept: ", strerror(errno)));
+    }
+    xeno::sys::socket s = listener.accept();
+    if (s.get_handle() < 0)
+      throw xeno::error(xeno::string::strcat("accept: ", strerror(errno)));
+    return s;
+  }
+
+  static void no_delay(xeno::sys::socket &s) {
+    int one = 1;
+    setsockopt(s.get_handle(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+  // Catches callers that disagree on what they're summing, which would
+  // otherwise hang or mix up the stream.
+  void check_size(std::size_t size) {
+    std::array<std::uint64_t, 2> header = {size, calls_++};
+    const std::array<std::uint64_t, 2> expected = header;
+    send_words(header);
+    receive_words(header);
+    if (header != expected) {
+      throw xeno::error(xeno::string::strcat(
+          "rank ", rank_, " reduces ", expected[0], " floats in call ",
+          expected[1], ", the previous rank ", header[0], " in call ",
+          header[1]));
+    }
+  }
+
+  // Before the sender is running, or while it has nothing queued.
+  void send_words(const std::array<std::uint64_t, 2> &words) {
+    std::array<std::byte, 16> bytes;
+    for (std::size_t i = 0; i < words.size(); ++i) {
+      const auto wire = xeno::to_wire(words[i]);
+      std::copy(wire.begin(), wire.end(), bytes.begin() + 8 * i);
+    }
+    xeno::sys::blocking_io(next_).assured_write(bytes);
+  }
+  void receive_words(std::array<std::uint64_t, 2> &words) {
+    std::array<std::byte, 16> bytes;
+    receive_bytes(bytes);
+    for (std::size_t i = 0; i < words.size(); ++i) {
+      words[i] = xeno::from_wire<std::uint64_t>(
+          std::span<const std::byte>(bytes).subspan(8 * i, 8));
+    }
+  }
+
+  // Floats go in the byte order of the machine, like checkpoints do.
+  void receive(std::span<float> chunk) {
+    receive_bytes(std::as_writable_bytes(chunk));
+  }
+  void receive_bytes(std::span<std::byte> bytes) {
+    while (!bytes.empty()) {
+      const std::size_t n = previous_.read(bytes);
+      if (n == 0 || n > bytes.size())
+        throw xeno::error("lost the previous rank of the ring.");
+      bytes = bytes.subspan(n);
+    }
+  }
+
+  void send(std::span<const float> chunk) {
+    {
+      std::lock_guard l(mutex_);
+      if (error_)
+        std::rethrow_exception(error_);
+      queue_.push_back(std::as_bytes(chunk));
+    }
+    cv_.notify_all();
+  }
+  void wait_sent() {
+    std::unique_lock l(mutex_);
+    cv_.wait(l, [this]() { return (queue_.empty() && !busy_) || error_; });
+    if (error_)
+      std::rethrow_exception(error_);
+  }
+
+  void send_loop() {
+    xeno::sys::blocking_io io(next_);
+    std::unique_lock l(mutex_);
+    for (;;) {
+      cv_.wait(l, [this]() { return !queue_.empty() || stop_; });
+      if (queue_.empty())
+        return;
+      const std::span<const std::byte> bytes = queue_.front();
+      queue_.pop_front();
+      busy_ = true;
+      l.unlock();
+      std::exception_ptr error;
+      try {
+        io.assured_write(bytes);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      l.lock();
+      busy_ = false;
+      if (error) {
+        error_ = error;
+        queue_.clear();
+      }
+      cv_.notify_all();
+    }
+  }
+
+  const std::size_t rank_;
+  const std::size_t size_;
+  std::uint64_t calls_ = 0;
+  xeno::sys::socket next_;
+  xeno::sys::socket previous_;
+  std::vector<float> scratch_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::span<const std::byte>> queue_;
+  bool busy_ = false;
+  bool stop_ = false;
+  std::exception_ptr error_;
+
+  xeno::sys::thread sender_;
+};
+
+} // namespace xylo
+
+#endif // XYLO_ALL_REDUCE_
@@ -0,0 +1,166 @@
+#ifndef XYLO_BATCH_LOADER_
+#define XYLO_BATCH_LOADER_
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <span>
+#include <vector>
+
+#include <xeno/exception.h>
+#include <xeno/sys/thread.h>
+#include <xylo/kernels.h>
+#include <xylo/tensor.h>
+
+namespace xylo {
+
+// Rows of bytes as floats, each byte times scale.
+inline matrix widen_rows(std::span<const std::uint8_t> data,
+                         std::size_t row_size, float scale) {
+  if (row_size == 0 || data.size() % row_size != 0)
+    throw xeno::error("data isn't a whole number of rows.");
+  matrix result(std::array<std::size_t, 2>{data.size() / row_size, row_size});
+  kernels::widen_u8(data.data(), scale, matrix_view(result).data(),
+                    data.size());
+  return result;
+}
+
+// Shuffled minibatches of a labelled dataset that's kept in bytes, such as
+// the pixels of mnist. A thread of the loader's own turns the next batch into
+// floats while the caller trains on the current one, so there are two
+// batches: one handed out, one being filled.
+//
+// Every epoch visits the samples in a new random order. The samples left
+// over after the last full batch of an epoch are skipped that epoch.
+class batch_loader {
+public:
+  struct batch {
+    matrix_view samples;
+    std::span<const std::uint8_t> labels;
+  };
+
+  // samples holds one row of sample_size bytes for each label, and has to
+  // outlive the loader.
+  batch_loader(std::span<const std::uint8_t> samples,
+               std::span<const std::uint8_t> labels, std::size_t sample_size,
+               std::size_t batch_size, float scale = 1.0f / 255)
+      : samples_(samples), labels_(labels), sample_size_(sample_size),
+        batch_size_(batch_size), scale_(scale),
+        generator_(default_generator()()), thread_("batch_loader") {
+    if (sample_size == 0 || samples.size() != labels.size() * sample_size)
+      throw xeno::error("samples and labels don't match.");
+    if (batch_size == 0 || batch_size > labels.size())
+      throw xeno::error("batch size out of range.");
+    // Outlives whatever scope the caller has open.
+    heap_scope heap;
+    for (slot &s : slots_) {
+      s.samples = std::make_unique<matrix>(
+          std::array<std::size_t, 2>{batch_size, sample_size});
+      s.labels.resize(batch_size);
+    }
+    thread_.run([this]() { run(); });
+  }
+
+  ~batch_loader() {
+    {
+      std::lock_guard l(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  batch_loader(const batch_loader &) = delete;
+  void operator=(const batch_loader &) = delete;
+
+  std::size_t batch_size() const { return batch_size_; }
+  std::size_t batches_per_epoch() const {
+    return labels_.size() / batch_size_;
+  }
+
+  // Blocks until the next batch is ready, which it rarely has to. The batch
+  // stays valid until the next call, which hands its buffer back to be
+  // filled.
+  batch next() {
+    std::unique_lock l(mutex_);
+    if (handed_out_) {
+      slots_[current_].full = false;
+      current_ ^= 1;
+      cv_.notify_all();
+    }
+    cv_.wait(l, [this]() { return slots_[current_].full; });
+    handed_out_ = true;
+    const slot &s = slots_[current_];
+    return {*s.samples, s.labels};
+  }
+
+private:
+  struct slot {
+    std::unique_ptr<matrix> samples;
+    std::vector<std::uint8_t> labels;
+    bool full = false;
+  };
+
+  void run() {
+    std::vector<std::size_t> order(labels_.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::size_t position = order.size();
+    std::size_t next = 0;
+    for (;;) {
+      {
+        std::unique_lock l(mutex_);
+        cv_.wait(l, [&]() { return !slots_[next].full || stop_; });
+        if (stop_)
+          return;
+      }
+
+      // Nobody looks at a slot that isn't full.
+      if (position + batch_size_ > order.size()) {
+        std::shuffle(order.begin(), order.end(), generator_);
+        position = 0;
+      }
+      slot &s = slots_[next];
+      float *dst = matrix_view(*s.samples).data();
+      for (std::size_t i = 0; i < batch_size_; ++i) {
+        const std::size_t sample = order[position + i];
+        kernels::widen_u8(samples_.data() + sample * sample_size_, scale_,
+                          dst + i * sample_size_, sample_size_);
+        s.labels[i] = labels_[sample];
+      }
+      position += batch_size_;
+
+      {
+        std::lock_guard l(mutex_);
+        s.full = true;
+      }
+      cv_.notify_all();
+      next ^= 1;
+    }
+  }
+
+  const std::span<const std::uint8_t> samples_;
+  const std::span<const std::uint8_t> labels_;
+  const std::size_t sample_size_;
+  const std::size_t batch_size_;
+  const float scale_;
+  std::mt19937 generator_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::array<slot, 2> slots_;
+  // The slot next() hands out, and whether it has.
+  std::size_t current_ = 0;
+  bool handed_out_ = false;
+  bool stop_ = false;
+
+  xeno::sys::thread thread_;
+};
+
+} // namespace xylo
+
+#endif // XYLO_BATCH_LOADER_
@@ -0,0 +1,205 @@
+#ifndef XYLO_BENCHMARK_
+#define XYLO_BENCHMARK_
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <xeno/exception.h>
+#include <xeno/json.h>
+#include <xeno/logging.h>
+#include <xeno/string.h>
+#include <xeno/sys/file_descriptor.h>
+#include <xeno/time.h>
+
+// A small harness for the benchmark targets. Each benchmark is a function
+// that is called warmup times first, to fill caches and workspaces and fix
+// how many calls go in a sample, and then timed for repetitions samples. A
+// sample is as many calls as take min_sample_us or more; the report is per
+// call, with the median, p99, min and mean over the samples, and the rate of
+// whatever the benchmark counts per call: FLOPs, elements, steps.
+//
+// Benchmarks take --warmup=N, --repetitions=N, --min_sample_us=N, --filter=S
+// to only run those whose name has S in it, and --json=PATH to also write the
+// report there, for comparing runs.
+namespace xylo {
+
+// Makes the compiler assume v is read, so that the work which produced it
+// stays.
+template <typename T> inline void keep(const T &v) {
+  asm volatile("" : : "r"(&v) : "memory");
+}
+
+struct benchmark_options {
+  std::size_t warmup = 10;
+  std::size_t repetitions = 50;
+  std::size_t min_sample_us = 1000;
+  std::string filter;
+  std::string json_path;
+};
+
+inline benchmark_options parse_benchmark_options(int argc, char **argv) {
+  benchmark_options options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    auto value = [&](std::string_view flag) -> std::optional<std::string> {
+      if (arg.size() <= flag.size() + 3 || arg.substr(0, 2) != "--" ||
+          arg.substr(2, flag.size()) != flag || arg[flag.size() + 2] != '=')
+        return std::nullopt;
+      return std::string(arg.substr(flag.size() + 3));
+    };
+    if (auto v = value("warmup")) {
+      options.warmup = std::stoul(*v);
+    } else if (auto v = value("repetitions")) {
+      options.repetitions = std::max<std::size_t>(std::stoul(*v), 1);
+    } else if (auto v = value("min_sample_us")) {
+      options.min_sample_us = std::stoul(*v);
+    } else if (auto v = value("filter")) {
+      options.filter = *v;
+    } else if (auto v = value("json")) {
+      options.json_path = *v;
+    } else {
+      throw xeno::error(xeno::string::strcat("unknown flag ", arg));
+    }
+  }
+  return options;
+}
+
+struct benchmark_result {
+  std::string name;
+  // Calls per sample.
+  std::size_t calls = 0;
+  std::size_t repetitions = 0;
+  // Per call.
+  double median_ns = 0;
+  double p99_ns = 0;
+  double min_ns = 0;
+  double mean_ns = 0;
+  double items = 0;
+  std::string unit;
+
+  // At the median.
+  double items_per_second() const {
+    return median_ns > 0 ? items * 1e9 / median_ns : 0;
+  }
+};
+
+class benchmark_suite {
+public:
+  explicit benchmark_suite(benchmark_options options)
+      : options_(std::move(options)) {}
+  benchmark_suite(int argc, char **argv)
+      : benchmark_suite(parse_benchmark_options(argc, argv)) {}
+
+  // Writes the JSON report, if asked for.
+  ~benchmark_suite() {
+    if (options_.json_path.empty())
+      return;
+    try {
+      write(options_.json_path);
+    } catch (const std::exception &e) {
+      lg() << "writing benchmark report: " << e.what();
+    }
+  }
+
+  benchmark_suite(const benchmark_suite &) = delete;
+  void operator=(const benchmark_suite &) = delete;
+
+  // Whether name is to run, for benchmarks with setup worth skipping.
+  bool selected(std::string_view name) const {
+    return name.find(options_.filter) != std::string_view::npos;
+  }
+
+  // Times f(), which does items units of work per call.
+  template <typename F>
+  void run(std::string_view name, F &&f, double items = 1,
+           std::string_view unit = "calls") {
+    if (!selected(name))
+      return;
+    // Warmup, and one call on its own to size the samples.
+    for (std::size_t i = 0; i < options_.warmup; ++i)
+      f();
+    xeno::time::stopwatch watch;
+    f();
+    const double once = std::max<double>(watch.read().to_nanoseconds(), 1);
+    const std::size_t calls = std::max<std::size_t>(
+        1, static_cast<std::size_t>(options_.min_sample_us * 1e3 / once));
+
+    std::vector<double> samples(options_.repetitions);
+    for (double &sample : samples) {
+      watch.start();
+      for (std::size_t i = 0; i < calls; ++i)
+        f();
+      sample = double(watch.read().to_nanoseconds()) / calls;
+    }
+    std::sort(samples.begin(), samples.end());
+
+    benchmark_result r;
+    r.name = name;
+    r.calls = calls;
+    r.repetitions = samples.size();
+    r.median_ns = percentile(samples, 0.5);
+    r.p99_ns = percentile(samples, 0.99);
+    r.min_ns = samples.front();
+    r.mean_ns = 0;
+    for (double s : samples)
+      r.mean_ns += s / samples.size();
+    r.items = items;
+    r.unit = unit;
+    lg() << r.name << ": median " << r.median_ns << "ns, p99 " << r.p99_ns
+         << "ns, " << r.items_per_second() << " " << r.unit << "/s";
+    results_.push_back(std::move(r));
+  }
+
+  std::span<const benchmark_result> results() const { return results_; }
+
+  // {"benchmarks": [{"name", "calls", "repetitions", "median_ns", "p99_ns",
+  // "min_ns", "mean_ns", "items", "unit", "items_per_s"}]}
+  xeno::json::element to_json() const {
+    std::vector<xeno::json::element> benchmarks;
+    for (const benchmark_result &r : results_) {
+      xeno::json::element &e = benchmarks.emplace_back();
+      e["name"] = std::string_view(r.name);
+      e["calls"] = std::int64_t(r.calls);
+      e["repetitions"] = std::int64_t(r.repetitions);
+      e["median_ns"] = float(r.median_ns);
+      e["p99_ns"] = float(r.p99_ns);
+      e["min_ns"] = float(r.min_ns);
+      e["mean_ns"] = float(r.mean_ns);
+      e["items"] = float(r.items);
+      e["unit"] = std::string_view(r.unit);
+      e["items_per_s"] = float(r.items_per_second());
+    }
+    xeno::json::element result;
+    result["benchmarks"].set_array(std::move(benchmarks));
+    return result;
+  }
+
+  void write(const std::filesystem::path &p) const {
+    const std::string json = to_json().to_string();
+    xeno::sys::file f = xeno::sys::file::open_to_write(p);
+    auto bytes = std::as_bytes(std::span(json.data(), json.size()));
+    while (!bytes.empty())
+      bytes = bytes.subspan(f.write(bytes));
+  }
+
+private:
+  // Of sorted samples, taking the nearest rank.
+  static double percentile(const std::vector<double> &sorted, double p) {
+    const std::size_t rank = static_cast<std::size_t>(p * sorted.size());
+    return sorted[std::min(rank, sorted.size() - 1)];
+  }
+
+  const benchmark_options options_;
+  std::vector<benchmark_result> results_;
+};
+
+} // namespace xylo
+
+#endif // XYLO_BENCHMARK_
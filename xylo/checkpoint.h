@@ -0,0 +1,385 @@
+#ifndef XYLO_CHECKPOINT_
+#define XYLO_CHECKPOINT_
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+#include <xeno/exception.h>
+#include <xeno/sys/file_descriptor.h>
+#include <xeno/sys/thread.h>
+#include <xylo/nn.h>
+#include <xylo/tensor.h>
+
+// A model's parameters on disk:
+//
+//   header   64 bytes: magic, format version, number of tensors, the step the
+//            checkpoint was taken at, and where the payload is.
+//   table    128 bytes per tensor: name, dtype, shape, and where its data is
+//            in the payload.
+//   payload  the parameters of every layer, back to back and in order, from a
+//            64-byte boundary.
+//
+// The payload is laid out exactly like model::parameters(), so a mapped
+// checkpoint can be borrowed by a model without copying anything. Numbers are
+// in the byte order of the machine that wrote them.
+namespace xylo {
+
+constexpr char checkpoint_magic[8] = {'X', 'Y', 'L', 'O', 'C', 'K', 'P', 'T'};
+constexpr std::uint32_t checkpoint_format = 1;
+
+struct checkpoint_header {
+  char magic[8];
+  std::uint32_t format;
+  std::uint32_t num_tensors;
+  std::uint64_t step;
+  // In bytes from the start of the file.
+  std::uint64_t payload_offset;
+  std::uint64_t payload_size;
+  char reserved[24];
+};
+static_assert(sizeof(checkpoint_header) == 64);
+
+struct checkpoint_tensor {
+  enum dtype_enum : std::uint32_t { float32 = 0 };
+
+  // Zero-padded.
+  char name[64];
+  std::uint32_t dtype;
+  std::uint32_t rank;
+  std::uint64_t shape[4];
+  // In bytes from the start of the payload.
+  std::uint64_t offset;
+  std::uint64_t size;
+  char reserved[8];
+
+  std::string_view name_view() const {
+    return std::string_view(name, strnlen(name, sizeof(name)));
+  }
+};
+static_assert(sizeof(checkpoint_tensor) == 128);
+
+// The tensors of m, in the order of its parameters. Full and 1x1 convolution
+// layers, and convolution2d_layer, get their weights and bias as two tensors;
+// other layers with parameters one flat tensor each. Layers without a name
+// are called by their index.
+inline std::vector<checkpoint_tensor> checkpoint_table(const model &m) {
+  std::vector<checkpoint_tensor> result;
+  std::uint64_t offset = 0;
+  auto add = [&](const std::string &name,
+                 std::initializer_list<std::size_t> shape) {
+    checkpoint_tensor t{};
+    if (name.size() >= sizeof(t.name))
+      throw xeno::error("layer name too long for a checkpoint.");
+    std::memcpy(t.name, name.data(), name.size());
+    t.dtype = checkpoint_tensor::float32;
+    t.rank = shape.size();
+    std::uint64_t elements = 1;
+    std::size_t i = 0;
+    for (std::size_t d : shape) {
+      t.shape[i++] = d;
+      elements *= d;
+    }
+    t.offset = offset;
+    t.size = elements * sizeof(float);
+    offset += t.size;
+    result.push_back(t);
+  };
+
+  auto layers = m.layers();
+  for (std::size_t i = 0; i < layers.size(); ++i) {
+    layer *l = layers[i].get();
+    const std::size_t size = l->parameters().size();
+    if (size == 0)
+      continue;
+    std::string name(l->name());
+    if (name.empty())
+      name = "layer" + std::to_string(i);
+
+    std::optional<matrix_view> weights;
+    if (auto *affine = dynamic_cast<matmul_layer *>(l)) {
+      weights.emplace(affine->weights());
+    } else if (typeid(*l) == typeid(convolution1d_1_layer)) {
+      weights.emplace(static_cast<convolution1d_1_layer *>(l)->weights());
+    }
+    if (weights) {
+      add(name + ".weights", {weights->num_rows(), weights->num_cols()});
+      add(name + ".bias", {weights->num_rows()});
+    } else {
+      add(name, {size});
+    }
+  }
+  return result;
+}
+
+namespace {
+// Throws if what was written to fd can't be made to stick.
+void sync_or_throw(int fd, const std::filesystem::path &p) {
+  if (::fsync(fd) != 0)
+    throw xeno::error(
+        xeno::string::strcat("can't sync ", p.string(), ": ", strerror(errno)));
+}
+} // namespace
+
+// Writes parameters, laid out as table says, to a file next to p that is then
+// renamed to p, so that p is always a complete checkpoint. The file is synced
+// before the rename, and the directory after it, so that this holds across a
+// crash too.
+inline void write_checkpoint(const std::filesystem::path &p,
+                             std::span<const checkpoint_tensor> table,
+                             vector_view parameters, std::uint64_t step = 0) {
+  checkpoint_header header{};
+  std::memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+  header.format = checkpoint_format;
+  header.num_tensors = table.size();
+  header.step = step;
+  const std::uint64_t table_end =
+      sizeof(header) + table.size() * sizeof(checkpoint_tensor);
+  header.payload_offset = (table_end + 63) / 64 * 64;
+  header.payload_size = parameters.size() * sizeof(float);
+
+  std::filesystem::path temporary = p;
+  temporary += ".tmp";
+  {
+    xeno::sys::file f = xeno::sys::file::open_to_write(temporary);
+    auto write = [&](const void *data, std::size_t size) {
+      auto bytes = std::span(static_cast<const std::byte *>(data), size);
+      while (!bytes.empty())
+        bytes = bytes.subspan(f.write(bytes));
+    };
+    write(&header, sizeof(header));
+    write(table.data(), table.size() * sizeof(checkpoint_tensor));
+    const std::vector<std::byte> padding(header.payload_offset - table_end);
+    write(padding.data(), padding.size());
+    write(parameters.data(), header.payload_size);
+    sync_or_throw(f.get_handle(), temporary);
+  }
+  std::filesystem::rename(temporary, p);
+
+  const std::filesystem::path directory =
+      p.has_parent_path() ? p.parent_path() : std::filesystem::path(".");
+  const int d = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+  if (d < 0)
+    throw xeno::error(xeno::string::strcat("can't open ", directory.string(),
+                                           ": ", strerror(errno)));
+  try {
+    sync_or_throw(d, directory);
+  } catch (...) {
+    ::close(d);
+    throw;
+  }
+  ::close(d);
+}
+
+inline void save_checkpoint(const model &m, const std::filesystem::path &p,
+                            std::uint64_t step = 0) {
+  write_checkpoint(p, checkpoint_table(m), m.parameters(), step);
+}
+
+// A checkpoint mapped into memory. The mapping is private: writing to what it
+// maps, or to a model borrowing it, never reaches the file.
+class checkpoint {
+public:
+  explicit checkpoint(const std::filesystem::path &p)
+      : map_(p, -1, /*shared=*/false) {
+    const std::span<std::byte> bytes = map_.span();
+    if (bytes.size() < sizeof(checkpoint_header))
+      throw xeno::error("not a checkpoint.");
+    std::memcpy(&header_, bytes.data(), sizeof(header_));
+    if (std::memcmp(header_.magic, checkpoint_magic, sizeof(header_.magic)))
+      throw xeno::error("not a checkpoint.");
+    if (header_.format != checkpoint_format)
+      throw xeno::error("unknown checkpoint format.");
+    // Each bound as a subtraction that can't wrap, whatever the header says.
+    if (header_.num_tensors >
+        (bytes.size() - sizeof(header_)) / sizeof(checkpoint_tensor))
+      throw xeno::error("truncated checkpoint.");
+    const std::uint64_t table_end =
+        sizeof(header_) + header_.num_tensors * sizeof(checkpoint_tensor);
+    if (table_end > header_.payload_offset || header_.payload_offset % 64 ||
+        header_.payload_offset > bytes.size() ||
+        header_.payload_size > bytes.size() - header_.payload_offset)
+      throw xeno::error("truncated checkpoint.");
+    table_ = std::span(
+        reinterpret_cast<const checkpoint_tensor *>(bytes.data() +
+                                                    sizeof(header_)),
+        header_.num_tensors);
+    for (const checkpoint_tensor &t : table_) {
+      if (t.dtype != checkpoint_tensor::float32 ||
+          t.offset > header_.payload_size ||
+          t.size > header_.payload_size - t.offset)
+        throw xeno::error("bad tensor in checkpoint.");
+    }
+  }
+
+  // Whether p starts like a checkpoint, rather than a raw dump.
+  static bool is_checkpoint(const std::filesystem::path &p) {
+    char magic[sizeof(checkpoint_magic)] = {};
+    xeno::sys::file f = xeno::sys::file::open_to_read(p);
+    f.read(std::span(magic, sizeof(magic)));
+    return std::memcmp(magic, checkpoint_magic, sizeof(magic)) == 0;
+  }
+
+  std::uint64_t step() const { return header_.step; }
+  std::span<const checkpoint_tensor> tensors() const { return table_; }
+
+  // Valid as long as the checkpoint.
+  vector_view parameters() const {
+    return borrow_vector(std::span(
+        reinterpret_cast<float *>(map_.span().data() + header_.payload_offset),
+        header_.payload_size / sizeof(float)));
+  }
+
+  // Copies the parameters into m, which has to be built like the model that
+  // was saved.
+  void load(model &m) const {
+    check(m);
+    m.set_parameters(parameters());
+  }
+
+  // Makes the mapping the parameters of m, which then needs the checkpoint to
+  // stay around.
+  void borrow(model &m) const {
+    check(m);
+    m.borrow_parameters(parameters());
+  }
+
+private:
+  void check(const model &m) const {
+    const std::vector<checkpoint_tensor> expected = checkpoint_table(m);
+    bool same = expected.size() == table_.size() &&
+                m.parameters().size() * sizeof(float) == header_.payload_size;
+    for (std::size_t i = 0; same && i < expected.size(); ++i) {
+      same = expected[i].rank == table_[i].rank &&
+             std::equal(expected[i].shape, expected[i].shape + 4,
+                        table_[i].shape) &&
+             expected[i].offset == table_[i].offset;
+    }
+    if (!same)
+      throw xeno::error("checkpoint doesn't match the model.");
+  }
+
+  xeno::sys::mmap<std::byte> map_;
+  checkpoint_header header_;
+  std::span<const checkpoint_tensor> table_;
+};
+
+// Saves checkpoints on a thread of its own, so that save() only costs the
+// caller a copy of the parameters. A save that comes in while another is
+// still waiting to be written replaces it: the writer lags by at most one.
+class checkpoint_writer {
+public:
+  explicit checkpoint_writer(const model &m)
+      : table_(checkpoint_table(m)), size_(m.parameters().size()),
+        thread_("checkpoint") {
+    // Outlives whatever scope the caller has open.
+    heap_scope heap;
+    pending_.parameters = std::make_unique<vector>(size_);
+    writing_.parameters = std::make_unique<vector>(size_);
+    thread_.run([this]() { run(); });
+  }
+
+  // Finishes what's been saved.
+  ~checkpoint_writer() {
+    {
+      std::lock_guard l(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  checkpoint_writer(const checkpoint_writer &) = delete;
+  void operator=(const checkpoint_writer &) = delete;
+
+  void save(vector_view parameters, const std::filesystem::path &p,
+            std::uint64_t step = 0) {
+    if (parameters.size() != size_)
+      throw xeno::error("different tensor shapes.");
+    {
+      std::lock_guard l(mutex_);
+      vector_view pending = *pending_.parameters;
+      pending = parameters;
+      pending_.path = p;
+      pending_.step = step;
+      has_pending_ = true;
+    }
+    cv_.notify_all();
+  }
+  void save(const model &m, const std::filesystem::path &p,
+            std::uint64_t step = 0) {
+    save(m.parameters(), p, step);
+  }
+
+  // Blocks until everything saved so far is on disk, and rethrows what the
+  // last failed write threw.
+  void flush() {
+    std::unique_lock l(mutex_);
+    cv_.wait(l, [this]() { return !has_pending_ && !busy_; });
+    if (error_)
+      std::rethrow_exception(std::exchange(error_, nullptr));
+  }
+
+private:
+  struct job {
+    std::unique_ptr<vector> parameters;
+    std::filesystem::path path;
+    std::uint64_t step = 0;
+  };
+
+  void run() {
+    std::unique_lock l(mutex_);
+    for (;;) {
+      cv_.wait(l, [this]() { return has_pending_ || stop_; });
+      if (!has_pending_)
+        return;
+      std::swap(pending_, writing_);
+      has_pending_ = false;
+      busy_ = true;
+      l.unlock();
+      std::exception_ptr error;
+      try {
+        write_checkpoint(writing_.path, table_, *writing_.parameters,
+                         writing_.step);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      l.lock();
+      busy_ = false;
+      if (error)
+        error_ = error;
+      cv_.notify_all();
+    }
+  }
+
+  const std::vector<checkpoint_tensor> table_;
+  const std::size_t size_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  job pending_;
+  job writing_;
+  bool has_pending_ = false;
+  bool busy_ = false;
+  bool stop_ = false;
+  std::exception_ptr error_;
+
+  xeno::sys::thread thread_;
+};
+
+} // namespace xylo
+
+#endif // XYLO_CHECKPOINT_
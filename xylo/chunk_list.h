@@ -0,0 +1,208 @@
+#ifndef XYLO_CHUNK_LIST_
+#define XYLO_CHUNK_LIST_
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace xylo {
+
+// Storage for Ts in chunks of about a page, recycled instead of freed. One
+// pool per T serves every thread: actors take chunks as their trajectories
+// grow, and the learner gives them back when it forgets, a lock per chunk
+// rather than an allocation per element. Never destroyed, so that lists in
+// statics can still give their chunks back at exit.
+template <typename T> class chunk_pool {
+public:
+  static constexpr std::size_t capacity =
+      std::max<std::size_t>(4, 4096 / sizeof(T));
+
+  struct chunk {
+    T *data() { return std::launder(reinterpret_cast<T *>(storage)); }
+
+    chunk *next = nullptr;
+    std::size_t size = 0;
+    alignas(T) std::byte storage[capacity * sizeof(T)];
+  };
+
+  static chunk_pool &instance() {
+    static chunk_pool *pool = new chunk_pool;
+    return *pool;
+  }
+
+  chunk *get() {
+    {
+      std::lock_guard l(mutex_);
+      if (chunk *c = free_) {
+        free_ = c->next;
+        c->next = nullptr;
+        return c;
+      }
+    }
+    return new chunk;
+  }
+  // The chunks from first on, linked through next, all empty.
+  void put(chunk *first) {
+    if (!first)
+      return;
+    chunk *last = first;
+    while (last->next)
+      last = last->next;
+    std::lock_guard l(mutex_);
+    last->next = free_;
+    free_ = first;
+  }
+
+private:
+  chunk_pool() = default;
+
+  std::mutex mutex_;
+  chunk *free_ = nullptr;
+};
+
+// A sequence that only grows at the back, in chunks from chunk_pool<T>. What
+// it holds never moves, so references and iterators stay valid as it grows,
+// though an end() taken before stays where it was. Walking it is mostly
+// walking arrays.
+template <typename T> class chunk_list {
+  using pool = chunk_pool<T>;
+  using chunk = typename pool::chunk;
+
+  template <typename U> class basic_iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = U *;
+    using reference = U &;
+
+    basic_iterator() = default;
+    // iterator to const_iterator.
+    template <typename V>
+      requires std::is_same_v<const V, U> && (!std::is_const_v<V>)
+    basic_iterator(const basic_iterator<V> &other)
+        : chunk_(other.chunk_), i_(other.i_) {}
+
+    U &operator*() const { return chunk_->data()[i_]; }
+    U *operator->() const { return chunk_->data() + i_; }
+    basic_iterator &operator++() {
+      if (++i_ == pool::capacity && chunk_->next) {
+        chunk_ = chunk_->next;
+        i_ = 0;
+      }
+      return *this;
+    }
+    basic_iterator operator++(int) {
+      basic_iterator result = *this;
+      ++*this;
+      return result;
+    }
+
+    // The end of a full chunk is the start of the next, if there is one
+    // by now.
+    friend bool operator==(const basic_iterator &a, const basic_iterator &b) {
+      return a.normal() == b.normal();
+    }
+
+  private:
+    basic_iterator(chunk *c, std::size_t i) : chunk_(c), i_(i) {}
+
+    std::pair<chunk *, std::size_t> normal() const {
+      if (i_ == pool::capacity && chunk_->next)
+        return {chunk_->next, 0};
+      return {chunk_, i_};
+    }
+
+    chunk *chunk_ = nullptr;
+    std::size_t i_ = 0;
+
+    template <typename V> friend class basic_iterator;
+    friend class chunk_list;
+  };
+
+public:
+  using value_type = T;
+  using iterator = basic_iterator<T>;
+  using const_iterator = basic_iterator<const T>;
+
+  chunk_list() = default;
+  ~chunk_list() { clear(); }
+
+  chunk_list(chunk_list &&other)
+      : head_(std::exchange(other.head_, nullptr)),
+        tail_(std::exchange(other.tail_, nullptr)),
+        size_(std::exchange(other.size_, 0)) {}
+  chunk_list &operator=(chunk_list &&other) {
+    if (this != &other) {
+      clear();
+      head_ = std::exchange(other.head_, nullptr);
+      tail_ = std::exchange(other.tail_, nullptr);
+      size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+  }
+  chunk_list(const chunk_list &other) {
+    for (const T &t : other)
+      emplace_back(t);
+  }
+  chunk_list &operator=(const chunk_list &other) {
+    if (this != &other) {
+      clear();
+      for (const T &t : other)
+        emplace_back(t);
+    }
+    return *this;
+  }
+
+  template <typename... Args> T &emplace_back(Args &&...args) {
+    if (!tail_ || tail_->size == pool::capacity) {
+      chunk *c = pool::instance().get();
+      (tail_ ? tail_->next : head_) = c;
+      tail_ = c;
+    }
+    T *t = new (tail_->data() + tail_->size) T(std::forward<Args>(args)...);
+    ++tail_->size;
+    ++size_;
+    return *t;
+  }
+
+  // Destroys everything, and gives the chunks back.
+  void clear() {
+    for (chunk *c = head_; c; c = c->next) {
+      std::destroy_n(c->data(), c->size);
+      c->size = 0;
+    }
+    pool::instance().put(head_);
+    head_ = tail_ = nullptr;
+    size_ = 0;
+  }
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  T &front() { return head_->data()[0]; }
+  const T &front() const { return head_->data()[0]; }
+  T &back() { return tail_->data()[tail_->size - 1]; }
+  const T &back() const { return tail_->data()[tail_->size - 1]; }
+
+  iterator begin() { return iterator(head_, 0); }
+  iterator end() { return iterator(tail_, tail_ ? tail_->size : 0); }
+  const_iterator begin() const { return const_iterator(head_, 0); }
+  const_iterator end() const {
+    return const_iterator(tail_, tail_ ? tail_->size : 0);
+  }
+
+private:
+  chunk *head_ = nullptr;
+  chunk *tail_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+} // namespace xylo
+
+#endif // XYLO_CHUNK_LIST_
@@ -0,0 +1,275 @@
+#ifndef XYLO_EVALUATION_
+#define XYLO_EVALUATION_
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include <xeno/exception.h>
+#include <xeno/sys/thread.h>
+#include <xylo/nn.h>
+#include <xylo/rl.h>
+#include <xylo/tensor.h>
+
+// Monte-Carlo evaluation of a policy: many episodes, played in parallel, and
+// the distribution of their total rewards.
+namespace xylo {
+
+struct evaluation_summary {
+  std::size_t episodes = 0;
+  float mean = 0;
+  float stddev = 0;
+  float min = 0;
+  float p10 = 0;
+  float median = 0;
+  float p90 = 0;
+  float max = 0;
+};
+
+// Sorts totals. Percentiles are nearest rank.
+inline evaluation_summary summarize(std::vector<float> &totals) {
+  evaluation_summary s;
+  s.episodes = totals.size();
+  if (totals.empty())
+    return s;
+
+  std::sort(totals.begin(), totals.end());
+  const auto percentile = [&](double q) {
+    const std::size_t rank = std::ceil(q * totals.size());
+    return totals[std::clamp<std::size_t>(rank, 1, totals.size()) - 1];
+  };
+  // In double, so that a million episodes still add up.
+  double sum = 0;
+  double squares = 0;
+  for (float t : totals) {
+    sum += t;
+    squares += double(t) * t;
+  }
+  const double mean = sum / totals.size();
+  s.mean = mean;
+  s.stddev = std::sqrt(std::max(0.0, squares / totals.size() - mean * mean));
+  s.min = totals.front();
+  s.p10 = percentile(0.1);
+  s.median = percentile(0.5);
+  s.p90 = percentile(0.9);
+  s.max = totals.back();
+  return s;
+}
+
+// The mean comes first, so that logs of it read like the old averages.
+inline std::ostream &operator<<(std::ostream &os, const evaluation_summary &s) {
+  return os << s.mean << " (stddev " << s.stddev << ", p10 " << s.p10
+            << ", median " << s.median << ", p90 " << s.p90 << ", range "
+            << s.min << ".." << s.max << ", " << s.episodes << " episodes)";
+}
+
+// Plays episodes of a policy over a thread pool. Episodes are dealt out in
+// chunks of chunk_size, and every chunk plays on an agent and an environment
+// of its own, from make_agent, seeded from the evaluator's seed, the number of
+// the run and the chunk's index. Which thread plays a chunk doesn't matter, so
+// a deterministic policy in an environment that only draws from its seed gets
+// the same summary from one pool to the next.
+//
+// All the chunks react on the one policy, which has to take concurrent calls,
+// as those of policy_gradient.h do. To keep training while an evaluation runs,
+// evaluate a copy of the parameters.
+template <typename A, typename S> class evaluator {
+public:
+  // An agent that plays p into rb, in an environment seeded with seed that the
+  // agent keeps alive.
+  using agent_factory = std::function<std::unique_ptr<agent<A, S>>(
+      const policy<A, S> &p, replay_buffer<A, S> &rb, std::uint64_t seed)>;
+
+private:
+  struct job;
+
+public:
+  // An evaluation running on the pool's workers.
+  class pending {
+  public:
+    bool ready() const { return job_->done.finished(); }
+
+    // Blocks until every episode is played, running queued work meanwhile.
+    void wait() { job_->pool.wait(job_->done); }
+    evaluation_summary get() {
+      wait();
+      return job_->summary();
+    }
+
+  private:
+    explicit pending(std::shared_ptr<job> j) : job_(std::move(j)) {}
+
+    std::shared_ptr<job> job_;
+
+    friend class evaluator;
+  };
+
+  explicit evaluator(
+      agent_factory make_agent, std::uint64_t seed = 0,
+      std::size_t chunk_size = 16,
+      xeno::sys::thread_pool &pool = xeno::sys::default_thread_pool())
+      : make_agent_(std::move(make_agent)), seed_(seed),
+        chunk_size_(chunk_size), pool_(pool) {
+    if (chunk_size == 0)
+      throw xeno::error("evaluation chunks need an episode.");
+  }
+
+  // Plays episodes of p and blocks until they are done. The calling thread
+  // takes part.
+  evaluation_summary run(const policy<A, S> &p, std::size_t episodes) {
+    job j(*this, p, episodes);
+    pool_.parallel_for(0, j.totals.size(),
+                       [&](std::size_t begin, std::size_t end) {
+                         for (std::size_t c = begin; c < end; ++c)
+                           j.play(c);
+                       });
+    return j.summary();
+  }
+
+  // Returns right away, with the episodes queued on the pool. The pending
+  // evaluation keeps p alive, and needs nothing else from here.
+  pending start(std::shared_ptr<const policy<A, S>> p, std::size_t episodes) {
+    auto j = std::make_shared<job>(*this, *p, episodes);
+    j->owned = std::move(p);
+    for (std::size_t c = 0; c < j->totals.size(); ++c) {
+      pool_.submit(j->done, [j, c]() {
+        try {
+          j->play(c);
+        } catch (...) {
+          std::lock_guard l(j->mutex);
+          if (!j->error)
+            j->error = std::current_exception();
+        }
+      });
+    }
+    return pending(std::move(j));
+  }
+
+private:
+  // splitmix64 over both, so that neighbouring seeds give unrelated streams.
+  static std::uint64_t mix(std::uint64_t a, std::uint64_t b) {
+    std::uint64_t z = a * 0x9e3779b97f4a7c15ull + b + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+
+  struct job {
+    job(evaluator &e, const policy<A, S> &p, std::size_t episodes)
+        : make_agent(e.make_agent_), played(p),
+          seed(mix(e.seed_, e.runs_.fetch_add(1))), episodes(episodes),
+          chunk_size(e.chunk_size_),
+          totals((episodes + chunk_size - 1) / chunk_size), pool(e.pool_) {}
+
+    // Chunk c writes only totals[c].
+    void play(std::size_t c) {
+      const std::size_t begin = c * chunk_size;
+      const std::size_t n = std::min(chunk_size, episodes - begin);
+      replay_buffer<A, S> rb;
+      std::unique_ptr<agent<A, S>> a = make_agent(played, rb, mix(seed, c));
+      std::vector<float> &out = totals[c];
+      out.reserve(n);
+      for (std::size_t i = 0; i < n; ++i) {
+        a->play_one_episode();
+        for (const auto &traj : rb.take_published()) {
+          float total = 0;
+          for (const transition<A, S> &t : traj->transitions)
+            total += t.reward;
+          out.push_back(total);
+        }
+      }
+    }
+
+    evaluation_summary summary() {
+      if (error)
+        std::rethrow_exception(error);
+      std::vector<float> all;
+      all.reserve(episodes);
+      for (const std::vector<float> &chunk : totals)
+        all.insert(all.end(), chunk.begin(), chunk.end());
+      return summarize(all);
+    }
+
+    const agent_factory make_agent;
+    const policy<A, S> &played;
+    // Set by start(), for played to outlive the evaluator's caller.
+    std::shared_ptr<const policy<A, S>> owned;
+    const std::uint64_t seed;
+    const std::size_t episodes;
+    const std::size_t chunk_size;
+    std::vector<std::vector<float>> totals;
+    xeno::sys::thread_pool &pool;
+    xeno::sys::wait_group done;
+    std::mutex mutex;
+    std::exception_ptr error;
+  };
+
+  const agent_factory make_agent_;
+  const std::uint64_t seed_;
+  const std::size_t chunk_size_;
+  xeno::sys::thread_pool &pool_;
+  std::atomic<std::uint64_t> runs_ = 0;
+};
+
+// Evaluates copies of a model's parameters while training goes on. replica
+// has the same layers as the model and holds the copy; make_policy builds the
+// policy over it. There is one evaluation at a time, since they share replica,
+// so a training loop offers parameters every so often and logs whatever
+// poll() hands back.
+template <typename A, typename S> class background_evaluation {
+public:
+  using policy_factory =
+      std::function<std::shared_ptr<const policy<A, S>>(model &)>;
+
+  background_evaluation(evaluator<A, S> &e, model &replica,
+                        policy_factory make_policy, std::size_t episodes)
+      : evaluator_(e), replica_(replica), make_policy_(std::move(make_policy)),
+        episodes_(episodes) {}
+  // Waits for the evaluation still running, which reads replica.
+  ~background_evaluation() {
+    if (pending_)
+      pending_->second.wait();
+  }
+
+  background_evaluation(const background_evaluation &) = delete;
+  void operator=(const background_evaluation &) = delete;
+
+  // Copies parameters and starts on them, tagged with step, unless the last
+  // evaluation is still running. Returns whether it started.
+  bool offer(vector_view parameters, std::size_t step) {
+    if (pending_)
+      return false;
+    replica_.parameters() = parameters;
+    pending_.emplace(step, evaluator_.start(make_policy_(replica_), episodes_));
+    return true;
+  }
+
+  // The step and summary of the last evaluation, once, when it's done.
+  std::optional<std::pair<std::size_t, evaluation_summary>> poll() {
+    if (!pending_ || !pending_->second.ready())
+      return std::nullopt;
+    auto done = std::exchange(pending_, std::nullopt);
+    return std::pair(done->first, done->second.get());
+  }
+
+private:
+  evaluator<A, S> &evaluator_;
+  model &replica_;
+  const policy_factory make_policy_;
+  const std::size_t episodes_;
+  std::optional<std::pair<std::size_t, typename evaluator<A, S>::pending>>
+      pending_;
+};
+
+} // namespace xylo
+
+#endif // XYLO_EVALUATION_
@@ -0,0 +1,235 @@
+#ifndef XYLO_EXPRESSION_
+#define XYLO_EXPRESSION_
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+#include <xeno/exception.h>
+#include <xylo/kernels.h>
+#include <xylo/tensor.h>
+
+// Lazy element-wise arithmetic. The eager operators in tensor.h allocate a
+// vector per operator; here lazy(v) starts an expression that allocates
+// nothing, and assign() evaluates the whole tree in a single pass:
+//
+//   assign(out, lazy(m) * beta + lazy(g) * (1 - beta));
+//
+// Evaluation goes block by block, so the intermediates of each block stay in
+// L1 and every step still runs on the vectorized kernels. Expressions only hold
+// pointers, so everything they refer to has to outlive the assign(). Writing to
+// one of the operands is fine.
+namespace xylo {
+
+namespace lazy_ops {
+
+// Floats per block, per node of the tree.
+constexpr std::size_t block_size = 512;
+
+struct expression_tag {};
+
+template <typename E>
+concept expression = std::is_base_of_v<expression_tag, E>;
+
+// Reads straight from a view.
+class terminal : public expression_tag {
+public:
+  explicit terminal(vector_view v) : data_(v.data()), size_(v.size()) {}
+
+  std::size_t size() const { return size_; }
+  const float *eval(std::size_t offset, std::size_t, float *) const {
+    return data_ + offset;
+  }
+
+private:
+  const float *data_;
+  std::size_t size_;
+};
+
+// Leaves yield pointers into their storage, every other node computes into
+// the scratch it is handed.
+template <typename Op, expression E> class unary : public expression_tag {
+public:
+  explicit unary(const E &e) : e_(e) {}
+
+  std::size_t size() const { return e_.size(); }
+  const float *eval(std::size_t offset, std::size_t n, float *out) const {
+    alignas(32) float scratch[block_size];
+    Op::apply(e_.eval(offset, n, scratch), out, n);
+    return out;
+  }
+
+private:
+  E e_;
+};
+
+template <typename Op, expression E> class with_scalar : public expression_tag {
+public:
+  with_scalar(const E &e, float scalar) : e_(e), scalar_(scalar) {}
+
+  std::size_t size() const { return e_.size(); }
+  const float *eval(std::size_t offset, std::size_t n, float *out) const {
+    alignas(32) float scratch[block_size];
+    Op::apply(e_.eval(offset, n, scratch), scalar_, out, n);
+    return out;
+  }
+
+private:
+  E e_;
+  float scalar_;
+};
+
+template <typename Op, expression L, expression R>
+class binary : public expression_tag {
+public:
+  binary(const L &l, const R &r) : l_(l), r_(r) {
+    if (l.size() != r.size())
+      throw xeno::error("different tensor shapes.");
+  }
+
+  std::size_t size() const { return l_.size(); }
+  const float *eval(std::size_t offset, std::size_t n, float *out) const {
+    alignas(32) float l_scratch[block_size];
+    alignas(32) float r_scratch[block_size];
+    Op::apply(l_.eval(offset, n, l_scratch), r_.eval(offset, n, r_scratch), out,
+              n);
+    return out;
+  }
+
+private:
+  L l_;
+  R r_;
+};
+
+// The operations, by the kernel they run.
+#define XYLO_LAZY_BINARY_OP(name)                                              \
+  struct name##_op {                                                           \
+    static void apply(const float *in1, const float *in2, float *out,          \
+                      std::size_t n) {                                         \
+      kernels::name(in1, in2, out, n);                                         \
+    }                                                                          \
+    static void apply(const float *in, float scalar, float *out,               \
+                      std::size_t n) {                                         \
+      kernels::name(in, scalar, out, n);                                       \
+    }                                                                          \
+  };
+XYLO_LAZY_BINARY_OP(add)
+XYLO_LAZY_BINARY_OP(minus)
+XYLO_LAZY_BINARY_OP(multiply)
+XYLO_LAZY_BINARY_OP(divide)
+#undef XYLO_LAZY_BINARY_OP
+
+#define XYLO_LAZY_UNARY_OP(name)                                               \
+  struct name##_op {                                                           \
+    static void apply(const float *in, float *out, std::size_t n) {            \
+      kernels::name(in, out, n);                                               \
+    }                                                                          \
+  };
+XYLO_LAZY_UNARY_OP(abs)
+XYLO_LAZY_UNARY_OP(sqrt)
+XYLO_LAZY_UNARY_OP(exp)
+XYLO_LAZY_UNARY_OP(log)
+#undef XYLO_LAZY_UNARY_OP
+
+// scalar - x and scalar / x.
+struct reverse_minus_op {
+  static void apply(const float *in, float scalar, float *out, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i)
+      out[i] = scalar - in[i];
+  }
+};
+struct reverse_divide_op {
+  static void apply(const float *in, float scalar, float *out, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i)
+      out[i] = scalar / in[i];
+  }
+};
+
+// Mixing expressions with views is allowed, as long as one side is an
+// expression; two views keep going through the eager operators.
+template <typename T>
+concept operand = expression<T> || std::is_convertible_v<T, vector_view>;
+
+template <operand T> auto as_expression(const T &t) {
+  if constexpr (expression<T>) {
+    return t;
+  } else {
+    return terminal(vector_view(t));
+  }
+}
+
+template <typename L, typename R>
+concept mixed = operand<L> && operand<R> && (expression<L> || expression<R>);
+
+// Operators and functions live next to the expressions, for ADL.
+#define XYLO_LAZY_BINARY_OPERATOR(op, name)                                    \
+  template <typename L, typename R>                                            \
+    requires mixed<L, R>                                                       \
+  auto operator op(const L &l, const R &r) {                                   \
+    auto le = as_expression(l);                                                \
+    auto re = as_expression(r);                                                \
+    return binary<name##_op, decltype(le), decltype(re)>(le, re);              \
+  }                                                                            \
+  template <expression E> auto operator op(const E &e, float s) {              \
+    return with_scalar<name##_op, E>(e, s);                                    \
+  }
+XYLO_LAZY_BINARY_OPERATOR(+, add)
+XYLO_LAZY_BINARY_OPERATOR(-, minus)
+XYLO_LAZY_BINARY_OPERATOR(*, multiply)
+XYLO_LAZY_BINARY_OPERATOR(/, divide)
+#undef XYLO_LAZY_BINARY_OPERATOR
+
+template <expression E> auto operator+(float s, const E &e) {
+  return e + s;
+}
+template <expression E> auto operator*(float s, const E &e) {
+  return e * s;
+}
+template <expression E> auto operator-(float s, const E &e) {
+  return with_scalar<reverse_minus_op, E>(e, s);
+}
+template <expression E> auto operator/(float s, const E &e) {
+  return with_scalar<reverse_divide_op, E>(e, s);
+}
+template <expression E> auto operator-(const E &e) {
+  return with_scalar<reverse_minus_op, E>(e, 0.0f);
+}
+
+#define XYLO_LAZY_UNARY_FUNCTION(name)                                         \
+  template <expression E> auto name(const E &e) {                              \
+    return unary<name##_op, E>(e);                                             \
+  }
+XYLO_LAZY_UNARY_FUNCTION(abs)
+XYLO_LAZY_UNARY_FUNCTION(sqrt)
+XYLO_LAZY_UNARY_FUNCTION(exp)
+XYLO_LAZY_UNARY_FUNCTION(log)
+#undef XYLO_LAZY_UNARY_FUNCTION
+
+} // namespace lazy_ops
+
+inline lazy_ops::terminal lazy(vector_view v) { return lazy_ops::terminal(v); }
+
+// Evaluates expr into out.
+template <lazy_ops::expression E> void assign(vector_view out, const E &expr) {
+  if (out.size() != expr.size())
+    throw xeno::error("different tensor shapes.");
+  float *dst = out.data();
+  for (std::size_t offset = 0; offset < out.size();
+       offset += lazy_ops::block_size) {
+    const std::size_t n = std::min(lazy_ops::block_size, out.size() - offset);
+    const float *result = expr.eval(offset, n, dst + offset);
+    // Only a bare lazy(v) hands back its own storage.
+    if (result != dst + offset)
+      std::memmove(dst + offset, result, n * sizeof(float));
+  }
+}
+
+template <lazy_ops::expression E> vector evaluate(const E &expr) {
+  vector result(expr.size());
+  assign(result, expr);
+  return result;
+}
+
+} // namespace xylo
+
+#endif // XYLO_EXPRESSION_
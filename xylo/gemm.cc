@@ -0,0 +1,435 @@
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__)
+// As in kernels_avx512.cc, for GCC 12's AVX-512 intrinsics.
+#if !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#include <immintrin.h>
+#if !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+#include <xylo/gemm.h>
+#include <xylo/kernel_table.h>
+#include <xylo/kernels.h>
+
+namespace xylo {
+
+namespace {
+// Register tile. 6 rows by a width that depends on the instruction set: with
+// AVX2, 16 columns keep 12 ymm accumulators, 2 for the b row and 1 for the
+// broadcast of a, out of the 16 available, and AVX-512 does the same with 32
+// columns of zmm.
+constexpr std::size_t mr = 6;
+constexpr std::size_t max_nr = 32;
+
+// Cache blocks. A kc x nr sliver of b (16KB) stays in L1, the mc x kc block of
+// a (~72KB) in L2, and the kc x nc panel of b (~512KB) in L3.
+constexpr std::size_t kc_block = 256;
+constexpr std::size_t mc_block = 72;
+constexpr std::size_t nc_block = 512;
+
+static_assert(mc_block % mr == 0);
+static_assert(nc_block % max_nr == 0);
+
+// Packing buffers are per thread and live as long as the thread, so that the
+// steady state does no allocation.
+class pack_buffers {
+public:
+  pack_buffers() {
+    void *a;
+    void *b;
+    posix_memalign(&a, 64, mc_block * kc_block * sizeof(float));
+    posix_memalign(&b, 64, kc_block * nc_block * sizeof(float));
+    a_ = reinterpret_cast<float *>(a);
+    b_ = reinterpret_cast<float *>(b);
+  }
+  ~pack_buffers() {
+    free(a_);
+    free(b_);
+  }
+
+  float *a() { return a_; }
+  float *b() { return b_; }
+
+private:
+  float *a_;
+  float *b_;
+};
+
+pack_buffers &local_pack_buffers() {
+  thread_local pack_buffers buffers;
+  return buffers;
+}
+
+// Packs the mc x kc block of op(a) starting at (i0, p0) into row panels of mr.
+// Each panel is laid out k-major: panel[p * mr + i]. Rows past m are zeroed so
+// the micro-kernel never has to special-case them.
+void pack_a(bool transpose, const float *a, std::size_t lda, std::size_t i0,
+            std::size_t p0, std::size_t mc, std::size_t kc, float *packed) {
+  for (std::size_t ir = 0; ir < mc; ir += mr) {
+    const std::size_t rows = std::min(mr, mc - ir);
+    float *panel = packed + ir * kc;
+    if (transpose) {
+      // a is stored k x m, so a row of storage is a column of op(a).
+      for (std::size_t p = 0; p < kc; ++p) {
+        const float *src = a + (p0 + p) * lda + i0 + ir;
+        float *dst = panel + p * mr;
+        std::size_t i = 0;
+        for (; i < rows; ++i)
+          dst[i] = src[i];
+        for (; i < mr; ++i)
+          dst[i] = 0;
+      }
+    } else {
+      for (std::size_t i = 0; i < rows; ++i) {
+        const float *src = a + (i0 + ir + i) * lda + p0;
+        for (std::size_t p = 0; p < kc; ++p)
+          panel[p * mr + i] = src[p];
+      }
+      for (std::size_t i = rows; i < mr; ++i) {
+        for (std::size_t p = 0; p < kc; ++p)
+          panel[p * mr + i] = 0;
+      }
+    }
+  }
+}
+
+// Packs the kc x nc block of op(b) starting at (p0, j0) into column panels of
+// nr, laid out k-major: panel[p * nr + j]. Columns past n are zeroed.
+void pack_b(bool transpose, const float *b, std::size_t ldb, std::size_t p0,
+            std::size_t j0, std::size_t kc, std::size_t nc, std::size_t nr,
+            float *packed) {
+  for (std::size_t jr = 0; jr < nc; jr += nr) {
+    const std::size_t cols = std::min(nr, nc - jr);
+    float *panel = packed + jr * kc;
+    if (transpose) {
+      // b is stored n x k, so a row of storage is a column of op(b).
+      for (std::size_t j = 0; j < cols; ++j) {
+        const float *src = b + (j0 + jr + j) * ldb + p0;
+        for (std::size_t p = 0; p < kc; ++p)
+          panel[p * nr + j] = src[p];
+      }
+      for (std::size_t j = cols; j < nr; ++j) {
+        for (std::size_t p = 0; p < kc; ++p)
+          panel[p * nr + j] = 0;
+      }
+    } else {
+      for (std::size_t p = 0; p < kc; ++p) {
+        const float *src = b + (p0 + p) * ldb + j0 + jr;
+        float *dst = panel + p * nr;
+        if (cols == nr) {
+          std::memcpy(dst, src, nr * sizeof(float));
+          continue;
+        }
+        std::size_t j = 0;
+        for (; j < cols; ++j)
+          dst[j] = src[j];
+        for (; j < nr; ++j)
+          dst[j] = 0;
+      }
+    }
+  }
+}
+
+// The epilogue of one tile: bias points at the tile's first column, or is null.
+struct tile_epilogue {
+  const float *bias = nullptr;
+  bool relu = false;
+};
+
+// c[0:mr][0:nr] (+)= a_panel * b_panel over kc, then the epilogue.
+using micro_kernel_fn = void (*)(std::size_t kc, const float *a,
+                                 const float *b, float *c, std::size_t ldc,
+                                 bool accumulate, const tile_epilogue &ep);
+
+struct micro_kernel {
+  std::size_t nr;
+  micro_kernel_fn run;
+};
+
+// Portable fallback. The fixed trip counts let the compiler vectorize the
+// inner loop on whatever ISA it targets.
+template <std::size_t nr>
+void portable_kernel(std::size_t kc, const float *a, const float *b, float *c,
+                     std::size_t ldc, bool accumulate,
+                     const tile_epilogue &ep) {
+  float acc[mr][nr] = {};
+  for (std::size_t p = 0; p < kc; ++p) {
+    for (std::size_t i = 0; i < mr; ++i) {
+      const float ai = a[i];
+      for (std::size_t j = 0; j < nr; ++j)
+        acc[i][j] += ai * b[j];
+    }
+    a += mr;
+    b += nr;
+  }
+  for (std::size_t i = 0; i < mr; ++i) {
+    float *row = c + i * ldc;
+    for (std::size_t j = 0; j < nr; ++j) {
+      float v = accumulate ? row[j] + acc[i][j] : acc[i][j];
+      if (ep.bias)
+        v += ep.bias[j];
+      row[j] = ep.relu ? std::max(v, 0.0f) : v;
+    }
+  }
+}
+
+#if defined(__x86_64__)
+XYLO_TARGET_BEGIN("avx2,fma")
+void avx2_kernel(std::size_t kc, const float *a, const float *b, float *c,
+                 std::size_t ldc, bool accumulate, const tile_epilogue &ep) {
+  constexpr std::size_t nr = 16;
+  __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+  __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+  __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+  __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+  __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+  __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+
+  for (std::size_t p = 0; p < kc; ++p) {
+    const __m256 b0 = _mm256_load_ps(b);
+    const __m256 b1 = _mm256_load_ps(b + 8);
+    __m256 ai;
+    ai = _mm256_broadcast_ss(a + 0);
+    c00 = _mm256_fmadd_ps(ai, b0, c00);
+    c01 = _mm256_fmadd_ps(ai, b1, c01);
+    ai = _mm256_broadcast_ss(a + 1);
+    c10 = _mm256_fmadd_ps(ai, b0, c10);
+    c11 = _mm256_fmadd_ps(ai, b1, c11);
+    ai = _mm256_broadcast_ss(a + 2);
+    c20 = _mm256_fmadd_ps(ai, b0, c20);
+    c21 = _mm256_fmadd_ps(ai, b1, c21);
+    ai = _mm256_broadcast_ss(a + 3);
+    c30 = _mm256_fmadd_ps(ai, b0, c30);
+    c31 = _mm256_fmadd_ps(ai, b1, c31);
+    ai = _mm256_broadcast_ss(a + 4);
+    c40 = _mm256_fmadd_ps(ai, b0, c40);
+    c41 = _mm256_fmadd_ps(ai, b1, c41);
+    ai = _mm256_broadcast_ss(a + 5);
+    c50 = _mm256_fmadd_ps(ai, b0, c50);
+    c51 = _mm256_fmadd_ps(ai, b1, c51);
+    a += mr;
+    b += nr;
+  }
+
+  const __m256 bias_lo =
+      ep.bias ? _mm256_loadu_ps(ep.bias) : _mm256_setzero_ps();
+  const __m256 bias_hi =
+      ep.bias ? _mm256_loadu_ps(ep.bias + 8) : _mm256_setzero_ps();
+  const auto store = [&](float *row, __m256 lo, __m256 hi) {
+    if (accumulate) {
+      lo = _mm256_add_ps(lo, _mm256_loadu_ps(row));
+      hi = _mm256_add_ps(hi, _mm256_loadu_ps(row + 8));
+    }
+    if (ep.bias) {
+      lo = _mm256_add_ps(lo, bias_lo);
+      hi = _mm256_add_ps(hi, bias_hi);
+    }
+    if (ep.relu) {
+      lo = _mm256_max_ps(lo, _mm256_setzero_ps());
+      hi = _mm256_max_ps(hi, _mm256_setzero_ps());
+    }
+    _mm256_storeu_ps(row, lo);
+    _mm256_storeu_ps(row + 8, hi);
+  };
+  store(c + 0 * ldc, c00, c01);
+  store(c + 1 * ldc, c10, c11);
+  store(c + 2 * ldc, c20, c21);
+  store(c + 3 * ldc, c30, c31);
+  store(c + 4 * ldc, c40, c41);
+  store(c + 5 * ldc, c50, c51);
+}
+XYLO_TARGET_END
+
+XYLO_TARGET_BEGIN("avx512f,avx2,fma")
+// The AVX2 kernel at twice the width.
+void avx512_kernel(std::size_t kc, const float *a, const float *b, float *c,
+                   std::size_t ldc, bool accumulate, const tile_epilogue &ep) {
+  constexpr std::size_t nr = 32;
+  __m512 c00 = _mm512_setzero_ps(), c01 = _mm512_setzero_ps();
+  __m512 c10 = _mm512_setzero_ps(), c11 = _mm512_setzero_ps();
+  __m512 c20 = _mm512_setzero_ps(), c21 = _mm512_setzero_ps();
+  __m512 c30 = _mm512_setzero_ps(), c31 = _mm512_setzero_ps();
+  __m512 c40 = _mm512_setzero_ps(), c41 = _mm512_setzero_ps();
+  __m512 c50 = _mm512_setzero_ps(), c51 = _mm512_setzero_ps();
+
+  for (std::size_t p = 0; p < kc; ++p) {
+    const __m512 b0 = _mm512_load_ps(b);
+    const __m512 b1 = _mm512_load_ps(b + 16);
+    __m512 ai;
+    ai = _mm512_set1_ps(a[0]);
+    c00 = _mm512_fmadd_ps(ai, b0, c00);
+    c01 = _mm512_fmadd_ps(ai, b1, c01);
+    ai = _mm512_set1_ps(a[1]);
+    c10 = _mm512_fmadd_ps(ai, b0, c10);
+    c11 = _mm512_fmadd_ps(ai, b1, c11);
+    ai = _mm512_set1_ps(a[2]);
+    c20 = _mm512_fmadd_ps(ai, b0, c20);
+    c21 = _mm512_fmadd_ps(ai, b1, c21);
+    ai = _mm512_set1_ps(a[3]);
+    c30 = _mm512_fmadd_ps(ai, b0, c30);
+    c31 = _mm512_fmadd_ps(ai, b1, c31);
+    ai = _mm512_set1_ps(a[4]);
+    c40 = _mm512_fmadd_ps(ai, b0, c40);
+    c41 = _mm512_fmadd_ps(ai, b1, c41);
+    ai = _mm512_set1_ps(a[5]);
+    c50 = _mm512_fmadd_ps(ai, b0, c50);
+    c51 = _mm512_fmadd_ps(ai, b1, c51);
+    a += mr;
+    b += nr;
+  }
+
+  const __m512 bias_lo =
+      ep.bias ? _mm512_loadu_ps(ep.bias) : _mm512_setzero_ps();
+  const __m512 bias_hi =
+      ep.bias ? _mm512_loadu_ps(ep.bias + 16) : _mm512_setzero_ps();
+  const auto store = [&](float *row, __m512 lo, __m512 hi) {
+    if (accumulate) {
+      lo = _mm512_add_ps(lo, _mm512_loadu_ps(row));
+      hi = _mm512_add_ps(hi, _mm512_loadu_ps(row + 16));
+    }
+    if (ep.bias) {
+      lo = _mm512_add_ps(lo, bias_lo);
+      hi = _mm512_add_ps(hi, bias_hi);
+    }
+    if (ep.relu) {
+      lo = _mm512_max_ps(lo, _mm512_setzero_ps());
+      hi = _mm512_max_ps(hi, _mm512_setzero_ps());
+    }
+    _mm512_storeu_ps(row, lo);
+    _mm512_storeu_ps(row + 16, hi);
+  };
+  store(c + 0 * ldc, c00, c01);
+  store(c + 1 * ldc, c10, c11);
+  store(c + 2 * ldc, c20, c21);
+  store(c + 3 * ldc, c30, c31);
+  store(c + 4 * ldc, c40, c41);
+  store(c + 5 * ldc, c50, c51);
+}
+XYLO_TARGET_END
+#endif
+
+// Picked once, on the same instruction set as the element-wise kernels.
+const micro_kernel &active_kernel() {
+  static const micro_kernel k = [] {
+    switch (kernels::active_isa()) {
+#if defined(__x86_64__)
+    case kernels::isa::avx512:
+      return micro_kernel{32, avx512_kernel};
+    case kernels::isa::avx2:
+      return micro_kernel{16, avx2_kernel};
+#endif
+    case kernels::isa::simd128:
+      return micro_kernel{8, portable_kernel<8>};
+    default:
+      return micro_kernel{16, portable_kernel<16>};
+    }
+  }();
+  return k;
+}
+
+// Edge tiles go through a scratch tile, so the micro-kernel itself only ever
+// sees full mr x nr blocks.
+void edge_kernel(const micro_kernel &kernel, std::size_t kc, const float *a,
+                 const float *b, float *c, std::size_t ldc, std::size_t rows,
+                 std::size_t cols, bool accumulate, const tile_epilogue &ep) {
+  const std::size_t nr = kernel.nr;
+  alignas(64) float tile[mr * max_nr];
+  kernel.run(kc, a, b, tile, nr, false, {});
+  for (std::size_t i = 0; i < rows; ++i) {
+    float *row = c + i * ldc;
+    const float *src = tile + i * nr;
+    for (std::size_t j = 0; j < cols; ++j) {
+      float v = accumulate ? row[j] + src[j] : src[j];
+      if (ep.bias)
+        v += ep.bias[j];
+      row[j] = ep.relu ? std::max(v, 0.0f) : v;
+    }
+  }
+}
+
+// bias, if any, points at the block's first column.
+void macro_kernel(const micro_kernel &kernel, std::size_t mc, std::size_t nc,
+                  std::size_t kc, const float *packed_a,
+                  const float *packed_b, float *c, std::size_t ldc,
+                  bool accumulate, const float *bias, bool relu) {
+  const std::size_t nr = kernel.nr;
+  for (std::size_t jr = 0; jr < nc; jr += nr) {
+    const std::size_t cols = std::min(nr, nc - jr);
+    const float *b_panel = packed_b + jr * kc;
+    const tile_epilogue ep{bias ? bias + jr : nullptr, relu};
+    for (std::size_t ir = 0; ir < mc; ir += mr) {
+      const std::size_t rows = std::min(mr, mc - ir);
+      const float *a_panel = packed_a + ir * kc;
+      float *c_tile = c + ir * ldc + jr;
+      if (rows == mr && cols == nr) {
+        kernel.run(kc, a_panel, b_panel, c_tile, ldc, accumulate, ep);
+      } else {
+        edge_kernel(kernel, kc, a_panel, b_panel, c_tile, ldc, rows, cols,
+                    accumulate, ep);
+      }
+    }
+  }
+}
+} // namespace
+
+void gemm(bool transpose_a, bool transpose_b, std::size_t m, std::size_t n,
+          std::size_t k, const float *a, std::size_t lda, const float *b,
+          std::size_t ldb, float *c, std::size_t ldc, bool accumulate) {
+  gemm(transpose_a, transpose_b, m, n, k, a, lda, b, ldb, c, ldc, accumulate,
+       gemm_epilogue{});
+}
+
+void gemm(bool transpose_a, bool transpose_b, std::size_t m, std::size_t n,
+          std::size_t k, const float *a, std::size_t lda, const float *b,
+          std::size_t ldb, float *c, std::size_t ldc, bool accumulate,
+          const gemm_epilogue &epilogue) {
+  if (m == 0 || n == 0)
+    return;
+
+  if (k == 0) {
+    for (std::size_t i = 0; i < m; ++i) {
+      float *row = c + i * ldc;
+      for (std::size_t j = 0; j < n; ++j) {
+        float v = accumulate ? row[j] : 0.0f;
+        if (epilogue.bias)
+          v += epilogue.bias[j];
+        row[j] = epilogue.relu ? std::max(v, 0.0f) : v;
+      }
+    }
+    return;
+  }
+
+  const micro_kernel &kernel = active_kernel();
+  pack_buffers &buffers = local_pack_buffers();
+  for (std::size_t jc = 0; jc < n; jc += nc_block) {
+    const std::size_t nc = std::min(nc_block, n - jc);
+    for (std::size_t pc = 0; pc < k; pc += kc_block) {
+      const std::size_t kc = std::min(kc_block, k - pc);
+      // Only the first k panel may overwrite c, and only the last one runs
+      // the epilogue.
+      const bool acc = accumulate || pc != 0;
+      const bool last = pc + kc == k;
+      const float *bias =
+          last && epilogue.bias ? epilogue.bias + jc : nullptr;
+      const bool relu = last && epilogue.relu;
+      pack_b(transpose_b, b, ldb, pc, jc, kc, nc, kernel.nr, buffers.b());
+      for (std::size_t ic = 0; ic < m; ic += mc_block) {
+        const std::size_t mc = std::min(mc_block, m - ic);
+        pack_a(transpose_a, a, lda, ic, pc, mc, kc, buffers.a());
+        macro_kernel(kernel, mc, nc, kc, buffers.a(), buffers.b(),
+                     c + ic * ldc + jc, ldc, acc, bias, relu);
+      }
+    }
+  }
+}
+
+} // namespace xylo
@@ -0,0 +1,41 @@
+#ifndef XYLO_GEMM_
+#define XYLO_GEMM_
+
+#include <cstddef>
+
+namespace xylo {
+
+// Single precision general matrix multiplication on raw row-major storage.
+//
+//   c = op(a) * op(b)          (accumulate == false)
+//   c = op(a) * op(b) + c      (accumulate == true)
+//
+// op(a) is m x k and op(b) is k x n. When transpose_a is set, a is stored as a
+// k x m matrix with leading dimension lda, otherwise as m x k. Likewise for b.
+// Operands are never transposed in memory; the packing routines read them in
+// whichever order they are stored.
+//
+// The implementation follows the usual Goto/BLIS layering: the k dimension is
+// split into panels that stay in L1/L2, b is packed into column panels that sit
+// in L3, a is packed into row panels, and a register-tiled micro-kernel (6x16
+// with AVX2/FMA) does the arithmetic.
+void gemm(bool transpose_a, bool transpose_b, std::size_t m, std::size_t n,
+          std::size_t k, const float *a, std::size_t lda, const float *b,
+          std::size_t ldb, float *c, std::size_t ldc, bool accumulate = false);
+
+// Work done on each tile of c while it is still in registers, after the last
+// k panel: bias[j] is added to column j, then negative values are clamped to 0
+// if relu is set.
+struct gemm_epilogue {
+  const float *bias = nullptr;
+  bool relu = false;
+};
+
+void gemm(bool transpose_a, bool transpose_b, std::size_t m, std::size_t n,
+          std::size_t k, const float *a, std::size_t lda, const float *b,
+          std::size_t ldb, float *c, std::size_t ldc, bool accumulate,
+          const gemm_epilogue &epilogue);
+
+} // namespace xylo
+
+#endif // XYLO_GEMM_
@@ -0,0 +1,294 @@
+#ifndef XYLO_INFERENCE_
+#define XYLO_INFERENCE_
+
+#include <memory>
+#include <mutex>
+#include <typeinfo>
+#include <vector>
+
+#include <xeno/exception.h>
+#include <xylo/nn.h>
+#include <xylo/tensor.h>
+
+// An inference-only form of a model. Compiling walks the layers once and folds
+// every matmul_layer or convolution1d_1_layer, together with a relu_activation
+// right after it, into one gemm that adds the bias and clamps in its epilogue.
+// Standalone relu and softmax layers run as plain kernels, and anything else
+// through the layer's own forward().
+//
+// The stages are fixed at construction, but the weights are read through views
+// into the model, so in-place updates by the optimizer show up in the next
+// eval(). The model has to outlive the compiled form, and gets compiled again
+// if layers are added to it.
+namespace xylo {
+
+class inference_context;
+
+class compiled_model {
+public:
+  // Starting from layer first, for callers that do the layers before it
+  // themselves.
+  explicit compiled_model(const model &m, std::size_t first = 0) {
+    auto layers = m.layers();
+    for (std::size_t i = first; i < layers.size(); ++i) {
+      layer *l = layers[i].get();
+      stage s;
+      // Exact types: subclasses such as convolution2d_layer do more in their
+      // forward() than the product.
+      if (typeid(*l) == typeid(matmul_layer)) {
+        auto *affine = static_cast<matmul_layer *>(l);
+        s.kind = stage::op::fused;
+        s.weights.emplace(affine->weights());
+        s.bias.emplace(affine->bias());
+      } else if (typeid(*l) == typeid(convolution1d_1_layer)) {
+        auto *affine = static_cast<convolution1d_1_layer *>(l);
+        s.kind = stage::op::fused;
+        s.weights.emplace(affine->weights());
+        s.bias.emplace(affine->bias());
+      } else if (typeid(*l) == typeid(relu_activation)) {
+        s.kind = stage::op::relu;
+      } else if (typeid(*l) == typeid(softmax_layer) ||
+                 typeid(*l) == typeid(softmax_cross_entropy_layer)) {
+        s.kind = stage::op::softmax;
+      } else {
+        s.kind = stage::op::other;
+        s.layer = l;
+      }
+      if (s.kind == stage::op::fused && i + 1 < layers.size() &&
+          typeid(*layers[i + 1]) == typeid(relu_activation)) {
+        s.relu = true;
+        ++i;
+      }
+      stages_.emplace_back(std::move(s));
+    }
+  }
+
+  matrix eval(matrix_view batch) const {
+    matrix_var input = matrix(batch);
+    for (const stage &s : stages_) {
+      if (s.kind == stage::op::other) {
+        input = s.layer->forward(input.value());
+        continue;
+      }
+      matrix_view in = input.value();
+      matrix result({in.num_rows(), output_width(s, in.num_cols())});
+      run(s, in, result);
+      input = std::move(result);
+    }
+    return input.value();
+  }
+
+  // Evaluates the first batch rows of context.input() into the context's own
+  // buffers. See inference_context.
+  matrix_view eval(inference_context &context, std::size_t batch = 1) const;
+
+  std::size_t num_stages() const { return stages_.size(); }
+
+private:
+  struct stage {
+    enum class op { fused, relu, softmax, other };
+    op kind = op::other;
+    // Fused stages only.
+    std::optional<matrix_view> weights;
+    std::optional<vector_view> bias;
+    bool relu = false;
+    // Other stages only.
+    xylo::layer *layer = nullptr;
+  };
+
+  // A full layer has one row of input_size per sample, a 1x1 convolution one
+  // row of input_channels per point. Both are the same product once the input
+  // is folded into rows of the weights' width.
+  static std::size_t output_width(const stage &s, std::size_t input_width) {
+    switch (s.kind) {
+    case stage::op::fused: {
+      const std::size_t in = s.weights->num_cols();
+      if (input_width % in != 0)
+        throw xeno::error("wrong input shape for compiled layer.");
+      return input_width / in * s.weights->num_rows();
+    }
+    case stage::op::relu:
+    case stage::op::softmax:
+      return input_width;
+    case stage::op::other: {
+      // There's no way to ask a layer, so run it once on a row of zeros.
+      matrix probe({1, input_width});
+      flatten(probe) = 0;
+      return matrix_view(s.layer->forward(probe)).num_cols();
+    }
+    }
+    return 0;
+  }
+
+  // out has to have the shape output_width() gives.
+  static void run(const stage &s, matrix_view in, matrix_view out) {
+    switch (s.kind) {
+    case stage::op::fused: {
+      const std::size_t width = s.weights->num_cols();
+      const std::size_t rows = in.size() / width;
+      matmul_transposed(fold<2>(flatten(in), {rows, width}), *s.weights,
+                        *s.bias, s.relu,
+                        fold<2>(flatten(out), {rows, s.weights->num_rows()}));
+      break;
+    }
+    case stage::op::relu: {
+      const float *src = in.data();
+      float *dst = out.data();
+      for (std::size_t i = 0; i < in.size(); ++i)
+        dst[i] = src[i] > 0 ? src[i] : 0;
+      break;
+    }
+    case stage::op::softmax:
+      softmax(in, out);
+      break;
+    case stage::op::other: {
+      // Whatever forward() allocates comes from the thread's workspace, which
+      // stops growing after the first few calls.
+      workspace_scope scope;
+      matrix result = s.layer->forward(in);
+      if (result.size() != out.size())
+        throw xeno::error("layer changed its output shape.");
+      flatten(out) = flatten(result);
+      break;
+    }
+    }
+  }
+
+  std::vector<stage> stages_;
+
+  friend class inference_context;
+};
+
+// Preallocated buffers for evaluating a compiled_model on up to max_batch rows
+// of a fixed input width. Stages write alternately into two buffers sized for
+// the widest stage, so after construction an eval allocates nothing as long as
+// the model is made of fused, relu and softmax stages.
+//
+//   inference_context context(compiled, state.length());
+//   state.to_vector(context.input()[0]);
+//   matrix_view output = context.eval();
+//
+// A context belongs to one thread at a time; the compiled model may be shared.
+class inference_context {
+public:
+  inference_context(const compiled_model &m, std::size_t input_width,
+                    std::size_t max_batch = 1)
+      : model_(m), max_batch_(max_batch) {
+    // The buffers outlive any scope that may be open on this thread.
+    heap_scope heap;
+    widths_.push_back(input_width);
+    std::size_t max_width = 0;
+    for (const auto &s : m.stages_) {
+      widths_.push_back(compiled_model::output_width(s, widths_.back()));
+      max_width = std::max(max_width, widths_.back());
+    }
+    input_ = std::make_unique<vector>(max_batch * input_width);
+    for (auto &buffer : buffers_)
+      buffer = std::make_unique<vector>(max_batch * max_width);
+  }
+
+  std::size_t input_width() const { return widths_.front(); }
+  std::size_t max_batch() const { return max_batch_; }
+
+  // The rows to fill in before eval().
+  matrix_view input(std::size_t batch = 1) const {
+    check_batch(batch);
+    return fold<2>(slice(*input_, 0, batch * widths_.front()),
+                   {batch, widths_.front()});
+  }
+
+  // Valid until the next eval() on this context.
+  matrix_view eval(std::size_t batch = 1) {
+    check_batch(batch);
+    // Views copy on assignment, so hold the current one in an optional.
+    std::optional<matrix_view> in(input(batch));
+    for (std::size_t i = 0; i < model_.stages_.size(); ++i) {
+      matrix_view out = fold<2>(
+          slice(*buffers_[i % 2], 0, batch * widths_[i + 1]),
+          {batch, widths_[i + 1]});
+      compiled_model::run(model_.stages_[i], *in, out);
+      in.emplace(out);
+    }
+    return *in;
+  }
+
+private:
+  void check_batch(std::size_t batch) const {
+    if (batch > max_batch_)
+      throw xeno::error("batch is larger than the inference context.");
+  }
+
+  const compiled_model &model_;
+  std::size_t max_batch_;
+  // Input and output width of each stage, in order.
+  std::vector<std::size_t> widths_;
+  std::unique_ptr<vector> input_;
+  std::unique_ptr<vector> buffers_[2];
+
+  friend class compiled_model;
+};
+
+inline matrix_view compiled_model::eval(inference_context &context,
+                                        std::size_t batch) const {
+  if (&context.model_ != this)
+    throw xeno::error("inference context is for a different model.");
+  return context.eval(batch);
+}
+
+// Contexts for callers that may run on any thread, such as a policy shared by
+// several agents. Each acquire() hands out a context no other thread is using,
+// and takes it back when the lease goes away; contexts are only created when
+// more threads evaluate at once than ever did before.
+class inference_context_pool {
+public:
+  class lease {
+  public:
+    lease(inference_context_pool &pool,
+          std::unique_ptr<inference_context> &&context)
+        : pool_(pool), context_(std::move(context)) {}
+    ~lease() { pool_.release(std::move(context_)); }
+
+    lease(const lease &) = delete;
+    void operator=(const lease &) = delete;
+
+    inference_context &operator*() const { return *context_; }
+    inference_context *operator->() const { return context_.get(); }
+
+  private:
+    inference_context_pool &pool_;
+    std::unique_ptr<inference_context> context_;
+  };
+
+  explicit inference_context_pool(const compiled_model &m) : model_(m) {}
+
+  lease acquire(std::size_t input_width, std::size_t max_batch = 1) {
+    std::unique_ptr<inference_context> context;
+    {
+      std::lock_guard l(mutex_);
+      if (!free_.empty()) {
+        context = std::move(free_.back());
+        free_.pop_back();
+      }
+    }
+    if (!context || context->input_width() != input_width ||
+        context->max_batch() < max_batch) {
+      context = std::make_unique<inference_context>(model_, input_width,
+                                                    max_batch);
+    }
+    return lease(*this, std::move(context));
+  }
+
+private:
+  void release(std::unique_ptr<inference_context> &&context) {
+    std::lock_guard l(mutex_);
+    free_.emplace_back(std::move(context));
+  }
+
+  const compiled_model &model_;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<inference_context>> free_;
+};
+
+} // namespace xylo
+
+#endif // XYLO_INFERENCE_
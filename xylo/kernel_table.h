@@ -0,0 +1,98 @@
+#ifndef XYLO_KERNEL_TABLE_
+#define XYLO_KERNEL_TABLE_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <xylo/kernels.h>
+
+// Shared by kernels.cc, which picks a table, and the files with the kernels of
+// each instruction set, which fill one in with the functions of kernels.h.
+namespace xylo::kernels {
+
+struct kernel_table {
+  void (*add)(const float *, const float *, float *, std::size_t);
+  void (*add_scalar)(const float *, float, float *, std::size_t);
+  void (*minus)(const float *, const float *, float *, std::size_t);
+  void (*minus_scalar)(const float *, float, float *, std::size_t);
+  void (*multiply)(const float *, const float *, float *, std::size_t);
+  void (*multiply_scalar)(const float *, float, float *, std::size_t);
+  void (*divide)(const float *, const float *, float *, std::size_t);
+  void (*divide_scalar)(const float *, float, float *, std::size_t);
+
+  void (*abs)(const float *, float *, std::size_t);
+  void (*sqrt)(const float *, float *, std::size_t);
+  void (*widen_u8)(const std::uint8_t *, float, float *, std::size_t);
+  void (*exp)(const float *, float *, std::size_t);
+  void (*log)(const float *, float *, std::size_t);
+
+  float (*sum)(const float *, std::size_t);
+  float (*dot)(const float *, const float *, std::size_t);
+  float (*variance)(const float *, std::size_t);
+  float (*max)(const float *, std::size_t);
+  std::size_t (*argmax)(const float *, std::size_t);
+
+  std::int32_t (*dot_u8s8)(const std::uint8_t *, const std::int8_t *,
+                           std::size_t);
+  float (*dot_bf16)(const float *, const std::uint16_t *, std::size_t);
+};
+
+namespace scalar {
+const kernel_table &table();
+}
+namespace simd128 {
+const kernel_table &table();
+}
+#if defined(__x86_64__)
+// The same with dot_u8s8 on vpdpbusd, for the CPUs that also have AVX-VNNI
+// or AVX512-VNNI respectively.
+namespace avx2 {
+const kernel_table &table();
+const kernel_table &vnni_table();
+}
+namespace avx512 {
+const kernel_table &table();
+const kernel_table &vnni_table();
+}
+#endif
+
+} // namespace xylo::kernels
+
+// Functions defined between XYLO_TARGET_BEGIN("avx2,fma") and XYLO_TARGET_END
+// may use those instructions whatever flags the file is built with, and are
+// only to be called once the CPU is known to have them. gemm.cc uses these for
+// its micro-kernels too.
+#define XYLO_STRINGIFY(x) #x
+#if defined(__clang__)
+#define XYLO_TARGET_BEGIN(t)                                                   \
+  _Pragma(XYLO_STRINGIFY(                                                      \
+      clang attribute push(__attribute__((target(t))), apply_to = function)))
+#define XYLO_TARGET_END _Pragma("clang attribute pop")
+#else
+#define XYLO_TARGET_BEGIN(t)                                                   \
+  _Pragma("GCC push_options") _Pragma(XYLO_STRINGIFY(GCC target(t)))
+#define XYLO_TARGET_END _Pragma("GCC pop_options")
+#endif
+
+// -ffast-math may reassociate, and where a range reduction splits a constant in
+// two, that adds the halves back up into the rounded constant the split was
+// there to avoid. Intrinsics are left alone, but plain vector arithmetic isn't:
+// there, Clang evaluates everything between XYLO_STRICT_FP_BEGIN and
+// XYLO_STRICT_FP_END as written, and GCC, whose optimize pragmas would stop
+// inlining, keeps XYLO_ASSOC_BARRIER(x) whole.
+#if defined(__clang__)
+#define XYLO_STRICT_FP_BEGIN _Pragma("float_control(precise, on, push)")
+#define XYLO_STRICT_FP_END _Pragma("float_control(pop)")
+#define XYLO_ASSOC_BARRIER(x) (x)
+#else
+#define XYLO_STRICT_FP_BEGIN
+#define XYLO_STRICT_FP_END
+#if __has_builtin(__builtin_assoc_barrier)
+#define XYLO_ASSOC_BARRIER(x) __builtin_assoc_barrier(x)
+#else
+// Before GCC 12 there is none, and simd128 exp can be a few ulp further off.
+#define XYLO_ASSOC_BARRIER(x) (x)
+#endif
+#endif
+
+#endif // XYLO_KERNEL_TABLE_
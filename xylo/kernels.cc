@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <string_view>
+
+#include <xylo/kernel_table.h>
+#include <xylo/kernels.h>
+
+namespace xylo::kernels {
+
+namespace {
+
+// What the CPU can run, best first.
+isa detect_isa() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+    return isa::avx512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return isa::avx2;
+  // SSE2 is part of x86-64.
+  return isa::simd128;
+#elif defined(__ARM_NEON) || defined(__wasm_simd128__)
+  // Fixed when compiling: every aarch64 has NEON, and a WebAssembly module
+  // built with simd128 doesn't load where it's missing.
+  return isa::simd128;
+#else
+  return isa::scalar;
+#endif
+}
+
+// Whether the CPU has vpdpbusd at level i, for dot_u8s8. AVX-VNNI is the VEX
+// encoding, which CPUs with only AVX512-VNNI lack.
+bool detect_vnni(isa i) {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (i == isa::avx512)
+    return __builtin_cpu_supports("avx512vnni");
+  if (i == isa::avx2)
+    return __builtin_cpu_supports("avxvnni");
+#endif
+  return false;
+}
+
+isa select_isa() {
+  isa best = detect_isa();
+  const char *cap = std::getenv("XYLO_ISA");
+  if (!cap)
+    return best;
+  const std::string_view name = cap;
+  for (isa i : {isa::scalar, isa::simd128, isa::avx2, isa::avx512}) {
+    if (name == isa_name(i) || (i == isa::simd128 && name == "simd128"))
+      return std::min(best, i);
+  }
+  return best;
+}
+
+const kernel_table &table_for(isa i) {
+  switch (i) {
+#if defined(__x86_64__)
+  case isa::avx512:
+    return vnni_active() ? avx512::vnni_table() : avx512::table();
+  case isa::avx2:
+    return vnni_active() ? avx2::vnni_table() : avx2::table();
+#endif
+  case isa::simd128:
+    return simd128::table();
+  default:
+    return scalar::table();
+  }
+}
+
+const kernel_table &table() {
+  static const kernel_table &t = table_for(active_isa());
+  return t;
+}
+
+} // namespace
+
+isa active_isa() {
+  static const isa i = select_isa();
+  return i;
+}
+
+bool vnni_active() {
+  static const bool vnni = detect_vnni(active_isa());
+  return vnni;
+}
+
+std::string_view isa_name(isa i) {
+  switch (i) {
+  case isa::scalar:
+    return "scalar";
+  case isa::simd128:
+#if defined(__x86_64__)
+    return "sse2";
+#elif defined(__wasm__)
+    return "wasm_simd128";
+#else
+    return "neon";
+#endif
+  case isa::avx2:
+    return "avx2";
+  case isa::avx512:
+    return "avx512";
+  }
+  return "";
+}
+
+void add(const float *in1, const float *in2, float *out, std::size_t size) {
+  table().add(in1, in2, out, size);
+}
+void add(const float *in, float scalar, float *out, std::size_t size) {
+  table().add_scalar(in, scalar, out, size);
+}
+void minus(const float *in1, const float *in2, float *out, std::size_t size) {
+  table().minus(in1, in2, out, size);
+}
+void minus(const float *in, float scalar, float *out, std::size_t size) {
+  table().minus_scalar(in, scalar, out, size);
+}
+void multiply(const float *in1, const float *in2, float *out,
+              std::size_t size) {
+  table().multiply(in1, in2, out, size);
+}
+void multiply(const float *in, float scalar, float *out, std::size_t size) {
+  table().multiply_scalar(in, scalar, out, size);
+}
+void divide(const float *in1, const float *in2, float *out, std::size_t size) {
+  table().divide(in1, in2, out, size);
+}
+void divide(const float *in, float scalar, float *out, std::size_t size) {
+  table().divide_scalar(in, scalar, out, size);
+}
+
+void abs(const float *in, float *out, std::size_t size) {
+  table().abs(in, out, size);
+}
+void sqrt(const float *in, float *out, std::size_t size) {
+  table().sqrt(in, out, size);
+}
+void widen_u8(const std::uint8_t *in, float scale, float *out,
+              std::size_t size) {
+  table().widen_u8(in, scale, out, size);
+}
+void sin(const float *in, float *out, std::size_t size) {
+  for (std::size_t i = 0; i < size; ++i)
+    out[i] = ::sinf(in[i]);
+}
+void exp(const float *in, float *out, std::size_t size) {
+  table().exp(in, out, size);
+}
+void log(const float *in, float *out, std::size_t size) {
+  table().log(in, out, size);
+}
+
+float sum(const float *in, std::size_t size) { return table().sum(in, size); }
+float dot(const float *in1, const float *in2, std::size_t size) {
+  return table().dot(in1, in2, size);
+}
+float variance(const float *in, std::size_t size) {
+  return table().variance(in, size);
+}
+float max(const float *in, std::size_t size) { return table().max(in, size); }
+std::size_t argmax(const float *in, std::size_t size) {
+  return table().argmax(in, size);
+}
+
+std::int32_t dot_u8s8(const std::uint8_t *a, const std::int8_t *b,
+                      std::size_t size) {
+  return table().dot_u8s8(a, b, size);
+}
+float dot_bf16(const float *a, const std::uint16_t *b, std::size_t size) {
+  return table().dot_bf16(a, b, size);
+}
+
+} // namespace xylo::kernels
@@ -0,0 +1,81 @@
+#ifndef XYLO_KERNELS_
+#define XYLO_KERNELS_
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Element-wise maps and reductions over raw float storage. tensor.cc builds
+// the vector and matrix functions on top of these.
+//
+// Each comes in a table per instruction set, and the best table the CPU runs
+// is picked the first time any of them is called, along with gemm's
+// micro-kernel. One build thus uses AVX-512 where there is some and AVX2
+// elsewhere, and the same sources build for ARM and WebAssembly, which get
+// the 128-bit vector kernels.
+//
+// Pointers need no particular alignment, since slices of a tensor start
+// wherever the slice starts, and sizes need not be a multiple of the vector
+// width. The outputs of the maps may alias their inputs.
+namespace xylo::kernels {
+
+// In order: the best available is the greatest.
+enum class isa { scalar, simd128, avx2, avx512 };
+
+// The instruction set the kernels run with. XYLO_ISA in the environment, set
+// to one of the names below or to simd128, caps it, to compare the paths.
+isa active_isa();
+// scalar, sse2, neon or wasm_simd128 for simd128 depending on the target,
+// avx2, avx512.
+std::string_view isa_name(isa i);
+// Whether dot_u8s8 runs on VNNI's vpdpbusd, which the CPU has at the level of
+// active_isa() or not, whatever the build flags.
+bool vnni_active();
+
+void add(const float *in1, const float *in2, float *out, std::size_t size);
+void add(const float *in, float scalar, float *out, std::size_t size);
+void minus(const float *in1, const float *in2, float *out, std::size_t size);
+void minus(const float *in, float scalar, float *out, std::size_t size);
+void multiply(const float *in1, const float *in2, float *out, std::size_t size);
+void multiply(const float *in, float scalar, float *out, std::size_t size);
+void divide(const float *in1, const float *in2, float *out, std::size_t size);
+void divide(const float *in, float scalar, float *out, std::size_t size);
+
+void abs(const float *in, float *out, std::size_t size);
+void sqrt(const float *in, float *out, std::size_t size);
+// out[i] = in[i] * scale, for data stored as bytes.
+void widen_u8(const std::uint8_t *in, float scale, float *out,
+              std::size_t size);
+// sin isn't on any hot path and stays with libm.
+void sin(const float *in, float *out, std::size_t size);
+
+// Polynomial approximations. Over the range where the result is a normal
+// float, exp is within 2 ulp of the correctly rounded result, and log within 2
+// ulp for all positive inputs, denormals included. exp flushes to 0 below
+// -87.34, where the result would be denormal (the scalar table, which is libm,
+// keeps the denormals), and goes to inf above 88.72. log returns -inf for 0,
+// inf for inf and NaN for negative inputs. Both return NaN for NaN.
+void exp(const float *in, float *out, std::size_t size);
+void log(const float *in, float *out, std::size_t size);
+
+// Reductions. These accumulate in several independent lanes, so the rounding
+// differs slightly from a sequential sum.
+float sum(const float *in, std::size_t size);
+float dot(const float *in1, const float *in2, std::size_t size);
+// Population variance, about the mean.
+float variance(const float *in, std::size_t size);
+// Both require size > 0. argmax returns the first index of the maximum.
+float max(const float *in, std::size_t size);
+std::size_t argmax(const float *in, std::size_t size);
+
+// Dot products for quantized inference, see quantize.h. The values in a of
+// dot_u8s8 must be at most 127, so that the pairwise sums of vpmaddubsw can't
+// saturate; vpdpbusd, where there is VNNI, doesn't, but results shouldn't
+// depend on the CPU. dot_bf16 reads b as bfloat16, the upper half of a float.
+std::int32_t dot_u8s8(const std::uint8_t *a, const std::int8_t *b,
+                      std::size_t size);
+float dot_bf16(const float *a, const std::uint16_t *b, std::size_t size);
+
+} // namespace xylo::kernels
+
+#endif // XYLO_KERNELS_
@@ -0,0 +1,492 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include <xylo/kernel_table.h>
+
+// Nothing here off x86; kernels.cc never asks for this table there.
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+// The kernels with AVX2 and FMA, 8 floats to a register.
+namespace xylo::kernels::avx2 {
+
+XYLO_TARGET_BEGIN("avx2,fma")
+namespace {
+constexpr std::size_t width = 8;
+
+// exp(x) = 2^n * exp(r), with n = round(x / ln2) and |r| <= ln2 / 2. ln2 is
+// split in two so that r = x - n * ln2 is exact enough, and exp(r) is the
+// Cephes degree 6 minimax polynomial.
+__m256 exp8(__m256 x) {
+  // Outside of these the result isn't a normal float. NaNs are told by their
+  // bits, since -ffast-math may fold a floating point test for them away.
+  const __m256 underflow =
+      _mm256_cmp_ps(x, _mm256_set1_ps(-87.3365447505531f), _CMP_LT_OQ);
+  const __m256 overflow =
+      _mm256_cmp_ps(x, _mm256_set1_ps(88.7228391116729f), _CMP_GT_OQ);
+  const __m256 nan = _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+      _mm256_and_si256(_mm256_castps_si256(x), _mm256_set1_epi32(0x7fffffff)),
+      _mm256_set1_epi32(0x7f800000)));
+  const __m256 in = x;
+  // So that n is at most 128. Below the range, whatever comes out is masked.
+  x = _mm256_min_ps(x, _mm256_set1_ps(88.7228391116729f));
+
+  const __m256 n = _mm256_round_ps(
+      _mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)),
+      _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+  r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+
+  __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+  p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), r);
+  p = _mm256_add_ps(p, _mm256_set1_ps(1.0f));
+
+  // Scale by 2^n by adding n to the exponent field. Multiplying by 2^n
+  // instead lets -ffast-math distribute the product over the polynomial,
+  // which flushes the small terms to zero near the bottom of the range. n
+  // runs from -126 to 128, where the field of p would go to 0 or 255, so the
+  // field takes n1 in [-125, 127] and the last factor of 2, if any, is a
+  // multiplication by 2^(n - n1), exact.
+  const __m256 n1 = _mm256_max_ps(_mm256_min_ps(n, _mm256_set1_ps(127.0f)),
+                                  _mm256_set1_ps(-125.0f));
+  const __m256i e1 = _mm256_slli_epi32(_mm256_cvtps_epi32(n1), 23);
+  const __m256i e2 = _mm256_slli_epi32(
+      _mm256_add_epi32(_mm256_cvtps_epi32(_mm256_sub_ps(n, n1)),
+                       _mm256_set1_epi32(127)),
+      23);
+  __m256 result = _mm256_mul_ps(
+      _mm256_castsi256_ps(_mm256_add_epi32(_mm256_castps_si256(p), e1)),
+      _mm256_castsi256_ps(e2));
+  result = _mm256_andnot_ps(underflow, result);
+  result = _mm256_blendv_ps(
+      result, _mm256_set1_ps(std::numeric_limits<float>::infinity()), overflow);
+  return _mm256_blendv_ps(result, in, nan);
+}
+
+// log(x) = e * ln2 + log(m), with m in [sqrt(1/2), sqrt(2)). log(1 + f) is the
+// Cephes degree 9 polynomial in f = m - 1.
+__m256 log8(__m256 x) {
+  // Sorted by their bits, which -ffast-math can't assume away as it may NaNs
+  // and infinities.
+  const __m256i bits = _mm256_castps_si256(x);
+  const __m256i magnitude =
+      _mm256_and_si256(bits, _mm256_set1_epi32(0x7fffffff));
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256 is_zero =
+      _mm256_castsi256_ps(_mm256_cmpeq_epi32(magnitude, zero));
+  const __m256 is_negative =
+      _mm256_castsi256_ps(_mm256_cmpgt_epi32(zero, bits));
+  // Infinities and NaNs, which are their own log unless negative.
+  const __m256 is_special = _mm256_castsi256_ps(
+      _mm256_cmpgt_epi32(magnitude, _mm256_set1_epi32(0x7f7fffff)));
+  // A denormal is x * 2^149 read as an integer, and that converts to a normal
+  // float exactly.
+  const __m256 is_denormal = _mm256_andnot_ps(
+      is_zero, _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+                   _mm256_set1_epi32(0x00800000), magnitude)));
+  x = _mm256_blendv_ps(x, _mm256_cvtepi32_ps(magnitude), is_denormal);
+
+  const __m256i normal_bits = _mm256_castps_si256(x);
+  __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(
+      _mm256_srli_epi32(normal_bits, 23), _mm256_set1_epi32(126)));
+  e = _mm256_sub_ps(e, _mm256_and_ps(is_denormal, _mm256_set1_ps(149.0f)));
+  // Mantissa in [0.5, 1).
+  __m256 m = _mm256_castsi256_ps(_mm256_or_si256(
+      _mm256_and_si256(normal_bits, _mm256_set1_epi32(0x007fffff)),
+      _mm256_set1_epi32(0x3f000000)));
+
+  // Shift m into [sqrt(1/2), sqrt(2)) and take 1 off.
+  const __m256 small = _mm256_cmp_ps(m, _mm256_set1_ps(0.707106781186547524f),
+                                     _CMP_LT_OQ);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  e = _mm256_sub_ps(e, _mm256_and_ps(one, small));
+  const __m256 f = _mm256_sub_ps(_mm256_add_ps(m, _mm256_and_ps(m, small)), one);
+
+  const __m256 z = _mm256_mul_ps(f, f);
+  __m256 p = _mm256_set1_ps(7.0376836292e-2f);
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(-1.1514610310e-1f));
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(1.1676998740e-1f));
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(-1.2420140846e-1f));
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(1.4249322787e-1f));
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(-1.6668057665e-1f));
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(2.0000714765e-1f));
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(-2.4999993993e-1f));
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(3.3333331174e-1f));
+  p = _mm256_mul_ps(_mm256_mul_ps(p, f), z);
+
+  // Same split ln2 as exp8, small part first.
+  p = _mm256_fmadd_ps(e, _mm256_set1_ps(-2.12194440e-4f), p);
+  p = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), p);
+  __m256 result = _mm256_add_ps(f, p);
+  result = _mm256_fmadd_ps(e, _mm256_set1_ps(0.693359375f), result);
+
+  // In this order, so that -inf is NaN and -0 is -inf.
+  result = _mm256_blendv_ps(result, _mm256_castsi256_ps(bits), is_special);
+  result = _mm256_blendv_ps(
+      result, _mm256_set1_ps(std::numeric_limits<float>::quiet_NaN()),
+      is_negative);
+  return _mm256_blendv_ps(
+      result, _mm256_set1_ps(-std::numeric_limits<float>::infinity()),
+      is_zero);
+}
+
+float horizontal_sum(__m256 v) {
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_movehdup_ps(s));
+  return _mm_cvtss_f32(s);
+}
+
+float horizontal_max(__m256 v) {
+  __m128 s = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_max_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_max_ss(s, _mm_movehdup_ps(s));
+  return _mm_cvtss_f32(s);
+}
+
+// Runs f over full vectors, then over the tail through a zero padded scratch
+// vector, so the tail sees exactly the same arithmetic as the body.
+template <typename F>
+void unary(const float *in, float *out, std::size_t size, F &&f) {
+  std::size_t i = 0;
+  for (; i + width <= size; i += width)
+    _mm256_storeu_ps(out + i, f(_mm256_loadu_ps(in + i)));
+  if (i == size)
+    return;
+  alignas(32) float tail[width] = {};
+  std::memcpy(tail, in + i, (size - i) * sizeof(float));
+  _mm256_store_ps(tail, f(_mm256_load_ps(tail)));
+  std::memcpy(out + i, tail, (size - i) * sizeof(float));
+}
+
+template <typename F>
+void binary(const float *in1, const float *in2, float *out, std::size_t size,
+            F &&f) {
+  std::size_t i = 0;
+  for (; i + width <= size; i += width)
+    _mm256_storeu_ps(out + i,
+                     f(_mm256_loadu_ps(in1 + i), _mm256_loadu_ps(in2 + i)));
+  if (i == size)
+    return;
+  // Pad the second operand with ones, which is harmless for division too.
+  alignas(32) float tail1[width] = {};
+  alignas(32) float tail2[width] = {1, 1, 1, 1, 1, 1, 1, 1};
+  std::memcpy(tail1, in1 + i, (size - i) * sizeof(float));
+  std::memcpy(tail2, in2 + i, (size - i) * sizeof(float));
+  _mm256_store_ps(tail1, f(_mm256_load_ps(tail1), _mm256_load_ps(tail2)));
+  std::memcpy(out + i, tail1, (size - i) * sizeof(float));
+}
+
+void add(const float *in1, const float *in2, float *out, std::size_t size) {
+  binary(in1, in2, out, size, [](__m256 a, __m256 b) { return _mm256_add_ps(a, b); });
+}
+void add(const float *in, float scalar, float *out, std::size_t size) {
+  const __m256 s = _mm256_set1_ps(scalar);
+  unary(in, out, size, [s](__m256 a) { return _mm256_add_ps(a, s); });
+}
+void minus(const float *in1, const float *in2, float *out, std::size_t size) {
+  binary(in1, in2, out, size, [](__m256 a, __m256 b) { return _mm256_sub_ps(a, b); });
+}
+void minus(const float *in, float scalar, float *out, std::size_t size) {
+  const __m256 s = _mm256_set1_ps(scalar);
+  unary(in, out, size, [s](__m256 a) { return _mm256_sub_ps(a, s); });
+}
+void multiply(const float *in1, const float *in2, float *out,
+              std::size_t size) {
+  binary(in1, in2, out, size, [](__m256 a, __m256 b) { return _mm256_mul_ps(a, b); });
+}
+void multiply(const float *in, float scalar, float *out, std::size_t size) {
+  const __m256 s = _mm256_set1_ps(scalar);
+  unary(in, out, size, [s](__m256 a) { return _mm256_mul_ps(a, s); });
+}
+void divide(const float *in1, const float *in2, float *out, std::size_t size) {
+  binary(in1, in2, out, size, [](__m256 a, __m256 b) { return _mm256_div_ps(a, b); });
+}
+void divide(const float *in, float scalar, float *out, std::size_t size) {
+  const __m256 s = _mm256_set1_ps(scalar);
+  unary(in, out, size, [s](__m256 a) { return _mm256_div_ps(a, s); });
+}
+
+void abs(const float *in, float *out, std::size_t size) {
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  unary(in, out, size, [sign](__m256 a) { return _mm256_andnot_ps(sign, a); });
+}
+void sqrt(const float *in, float *out, std::size_t size) {
+  unary(in, out, size, [](__m256 a) { return _mm256_sqrt_ps(a); });
+}
+void exp(const float *in, float *out, std::size_t size) {
+  unary(in, out, size, exp8);
+}
+void log(const float *in, float *out, std::size_t size) {
+  unary(in, out, size, log8);
+}
+
+float sum(const float *in, std::size_t size) {
+  // Four accumulators hide the latency of the adds.
+  __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+  __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 4 * width <= size; i += 4 * width) {
+    s0 = _mm256_add_ps(s0, _mm256_loadu_ps(in + i));
+    s1 = _mm256_add_ps(s1, _mm256_loadu_ps(in + i + width));
+    s2 = _mm256_add_ps(s2, _mm256_loadu_ps(in + i + 2 * width));
+    s3 = _mm256_add_ps(s3, _mm256_loadu_ps(in + i + 3 * width));
+  }
+  for (; i + width <= size; i += width)
+    s0 = _mm256_add_ps(s0, _mm256_loadu_ps(in + i));
+  float result = horizontal_sum(
+      _mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3)));
+  for (; i < size; ++i)
+    result += in[i];
+  return result;
+}
+
+float dot(const float *in1, const float *in2, std::size_t size) {
+  __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+  __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 4 * width <= size; i += 4 * width) {
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(in1 + i), _mm256_loadu_ps(in2 + i), s0);
+    s1 = _mm256_fmadd_ps(_mm256_loadu_ps(in1 + i + width),
+                         _mm256_loadu_ps(in2 + i + width), s1);
+    s2 = _mm256_fmadd_ps(_mm256_loadu_ps(in1 + i + 2 * width),
+                         _mm256_loadu_ps(in2 + i + 2 * width), s2);
+    s3 = _mm256_fmadd_ps(_mm256_loadu_ps(in1 + i + 3 * width),
+                         _mm256_loadu_ps(in2 + i + 3 * width), s3);
+  }
+  for (; i + width <= size; i += width)
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(in1 + i), _mm256_loadu_ps(in2 + i), s0);
+  float result = horizontal_sum(
+      _mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3)));
+  for (; i < size; ++i)
+    result += in1[i] * in2[i];
+  return result;
+}
+
+float variance(const float *in, std::size_t size) {
+  if (size == 0)
+    return 0.0f;
+  // Two passes; the one pass sum of squares loses too much to cancellation.
+  const float mean = sum(in, size) / size;
+  const __m256 m = _mm256_set1_ps(mean);
+  __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 2 * width <= size; i += 2 * width) {
+    const __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(in + i), m);
+    const __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(in + i + width), m);
+    s0 = _mm256_fmadd_ps(d0, d0, s0);
+    s1 = _mm256_fmadd_ps(d1, d1, s1);
+  }
+  for (; i + width <= size; i += width) {
+    const __m256 d = _mm256_sub_ps(_mm256_loadu_ps(in + i), m);
+    s0 = _mm256_fmadd_ps(d, d, s0);
+  }
+  float result = horizontal_sum(_mm256_add_ps(s0, s1));
+  for (; i < size; ++i) {
+    const float d = in[i] - mean;
+    result += d * d;
+  }
+  return result / size;
+}
+
+float max(const float *in, std::size_t size) {
+  std::size_t i = 0;
+  float result = in[0];
+  if (size >= width) {
+    __m256 m = _mm256_loadu_ps(in);
+    for (i = width; i + width <= size; i += width)
+      m = _mm256_max_ps(m, _mm256_loadu_ps(in + i));
+    result = horizontal_max(m);
+  }
+  for (; i < size; ++i)
+    result = std::max(result, in[i]);
+  return result;
+}
+
+std::size_t argmax(const float *in, std::size_t size) {
+  std::size_t i = 0;
+  std::size_t best = 0;
+  // Lane indices are 32 bit.
+  if (size >= width && size <= std::numeric_limits<std::int32_t>::max()) {
+    // Every lane keeps its own first maximum. Strictly greater only, so ties
+    // within a lane keep the earlier index.
+    __m256 best_values = _mm256_loadu_ps(in);
+    __m256i best_indices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i indices = best_indices;
+    const __m256i step = _mm256_set1_epi32(width);
+    for (i = width; i + width <= size; i += width) {
+      indices = _mm256_add_epi32(indices, step);
+      const __m256 values = _mm256_loadu_ps(in + i);
+      const __m256 greater = _mm256_cmp_ps(values, best_values, _CMP_GT_OQ);
+      best_values = _mm256_blendv_ps(best_values, values, greater);
+      best_indices = _mm256_castps_si256(
+          _mm256_blendv_ps(_mm256_castsi256_ps(best_indices),
+                           _mm256_castsi256_ps(indices), greater));
+    }
+
+    // Ties across lanes go to the smallest index.
+    alignas(32) float lane_values[width];
+    alignas(32) std::int32_t lane_indices[width];
+    _mm256_store_ps(lane_values, best_values);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lane_indices), best_indices);
+    best = lane_indices[0];
+    for (std::size_t l = 1; l < width; ++l) {
+      if (lane_values[l] > in[best] ||
+          (lane_values[l] == in[best] && std::size_t(lane_indices[l]) < best))
+        best = lane_indices[l];
+    }
+  } else {
+    i = 1;
+  }
+  for (; i < size; ++i) {
+    if (in[i] > in[best])
+      best = i;
+  }
+  return best;
+}
+
+void widen_u8(const std::uint8_t *in, float scale, float *out,
+              std::size_t size) {
+  std::size_t i = 0;
+  const __m256 s = _mm256_set1_ps(scale);
+  for (; i + 2 * width <= size; i += 2 * width) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    const __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v));
+    const __m256 hi =
+        _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(lo, s));
+    _mm256_storeu_ps(out + i + width, _mm256_mul_ps(hi, s));
+  }
+  for (; i < size; ++i)
+    out[i] = in[i] * scale;
+}
+
+std::int32_t horizontal_sum(__m256i v) {
+  __m128i s =
+      _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(s);
+}
+
+std::int32_t dot_u8s8(const std::uint8_t *a, const std::int8_t *b,
+                      std::size_t size) {
+  std::size_t i = 0;
+  __m256i acc = _mm256_setzero_si256();
+  for (; i + 32 <= size; i += 32) {
+    const __m256i va =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+    const __m256i vb =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+    // Pairs of u8 * s8 products summed into 16 bits, then pairs of those
+    // into 32.
+    acc = _mm256_add_epi32(acc,
+                           _mm256_madd_epi16(_mm256_maddubs_epi16(va, vb),
+                                             _mm256_set1_epi16(1)));
+  }
+  std::int32_t result = horizontal_sum(acc);
+  for (; i < size; ++i)
+    result += std::int32_t(a[i]) * b[i];
+  return result;
+}
+
+float dot_bf16(const float *a, const std::uint16_t *b, std::size_t size) {
+  std::size_t i = 0;
+  float result = 0.0f;
+  __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+  // A bfloat16 widened to 32 bits and shifted up is the float it stands for.
+  auto load = [](const std::uint16_t *p) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(v), 16));
+  };
+  for (; i + 2 * width <= size; i += 2 * width) {
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), load(b + i), s0);
+    s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + width), load(b + i + width),
+                         s1);
+  }
+  result = horizontal_sum(_mm256_add_ps(s0, s1));
+  for (; i < size; ++i) {
+    const std::uint32_t bits = std::uint32_t(b[i]) << 16;
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    result += a[i] * f;
+  }
+  return result;
+}
+
+} // namespace
+XYLO_TARGET_END
+
+// For the CPUs with AVX-VNNI, which kernels.cc checks for on its own.
+XYLO_TARGET_BEGIN("avx2,fma,avxvnni")
+namespace {
+
+// As dot_u8s8, but vpdpbusd sums four products at a time straight into 32
+// bits.
+std::int32_t dot_u8s8_vnni(const std::uint8_t *a, const std::int8_t *b,
+                           std::size_t size) {
+  std::size_t i = 0;
+  __m256i acc = _mm256_setzero_si256();
+  for (; i + 32 <= size; i += 32) {
+    const __m256i va =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+    const __m256i vb =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+    acc = _mm256_dpbusd_avx_epi32(acc, va, vb);
+  }
+  std::int32_t result = horizontal_sum(acc);
+  for (; i < size; ++i)
+    result += std::int32_t(a[i]) * b[i];
+  return result;
+}
+
+} // namespace
+XYLO_TARGET_END
+
+namespace {
+constexpr kernel_table base{
+    .add = add,
+    .add_scalar = add,
+    .minus = minus,
+    .minus_scalar = minus,
+    .multiply = multiply,
+    .multiply_scalar = multiply,
+    .divide = divide,
+    .divide_scalar = divide,
+    .abs = abs,
+    .sqrt = sqrt,
+    .widen_u8 = widen_u8,
+    .exp = exp,
+    .log = log,
+    .sum = sum,
+    .dot = dot,
+    .variance = variance,
+    .max = max,
+    .argmax = argmax,
+    .dot_u8s8 = dot_u8s8,
+    .dot_bf16 = dot_bf16,
+};
+
+constexpr kernel_table with_vnni(kernel_table t) {
+  t.dot_u8s8 = dot_u8s8_vnni;
+  return t;
+}
+} // namespace
+
+const kernel_table &table() { return base; }
+const kernel_table &vnni_table() {
+  static constexpr kernel_table t = with_vnni(base);
+  return t;
+}
+
+} // namespace xylo::kernels::avx2
+
+#endif
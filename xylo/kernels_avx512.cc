@@ -0,0 +1,469 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include <xylo/kernel_table.h>
+
+// Nothing here off x86; kernels.cc never asks for this table there.
+#if defined(__x86_64__)
+// GCC 12's unmasked AVX-512 intrinsics start from a self-initialized
+// _mm512_undefined_*(), and warn wherever they're inlined. Only the header is
+// silenced; the code here still gets the warnings.
+#if !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#include <immintrin.h>
+#if !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// The kernels with AVX-512 F and BW, 16 floats to a register. The arithmetic
+// is that of kernels_avx2.cc, but tails are masked loads and stores instead of
+// a round trip through scratch.
+namespace xylo::kernels::avx512 {
+
+XYLO_TARGET_BEGIN("avx512f,avx512bw,avx2,fma")
+namespace {
+constexpr std::size_t width = 16;
+
+// The first n lanes, n < width.
+__mmask16 first_lanes(std::size_t n) { return __mmask16((1u << n) - 1); }
+
+// As exp8; see there.
+__m512 exp16(__m512 x) {
+  const __mmask16 underflow =
+      _mm512_cmp_ps_mask(x, _mm512_set1_ps(-87.3365447505531f), _CMP_LT_OQ);
+  const __mmask16 overflow =
+      _mm512_cmp_ps_mask(x, _mm512_set1_ps(88.7228391116729f), _CMP_GT_OQ);
+  const __mmask16 nan = _mm512_cmpgt_epi32_mask(
+      _mm512_and_si512(_mm512_castps_si512(x), _mm512_set1_epi32(0x7fffffff)),
+      _mm512_set1_epi32(0x7f800000));
+  const __m512 in = x;
+  x = _mm512_min_ps(x, _mm512_set1_ps(88.7228391116729f));
+
+  const __m512 n = _mm512_roundscale_ps(
+      _mm512_mul_ps(x, _mm512_set1_ps(1.44269504088896341f)),
+      _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(0.693359375f), x);
+  r = _mm512_fnmadd_ps(n, _mm512_set1_ps(-2.12194440e-4f), r);
+
+  __m512 p = _mm512_set1_ps(1.9875691500e-4f);
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.3981999507e-3f));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(8.3334519073e-3f));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(4.1665795894e-2f));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.6666665459e-1f));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(5.0000001201e-1f));
+  p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), r);
+  p = _mm512_add_ps(p, _mm512_set1_ps(1.0f));
+
+  const __m512 n1 = _mm512_max_ps(_mm512_min_ps(n, _mm512_set1_ps(127.0f)),
+                                  _mm512_set1_ps(-125.0f));
+  const __m512i e1 = _mm512_slli_epi32(_mm512_cvtps_epi32(n1), 23);
+  const __m512i e2 = _mm512_slli_epi32(
+      _mm512_add_epi32(_mm512_cvtps_epi32(_mm512_sub_ps(n, n1)),
+                       _mm512_set1_epi32(127)),
+      23);
+  __m512 result = _mm512_mul_ps(
+      _mm512_castsi512_ps(_mm512_add_epi32(_mm512_castps_si512(p), e1)),
+      _mm512_castsi512_ps(e2));
+  result = _mm512_maskz_mov_ps(_knot_mask16(underflow), result);
+  result = _mm512_mask_mov_ps(
+      result, overflow,
+      _mm512_set1_ps(std::numeric_limits<float>::infinity()));
+  return _mm512_mask_mov_ps(result, nan, in);
+}
+
+// As log8.
+__m512 log16(__m512 x) {
+  const __m512i bits = _mm512_castps_si512(x);
+  const __m512i magnitude =
+      _mm512_and_si512(bits, _mm512_set1_epi32(0x7fffffff));
+  const __m512i zero = _mm512_setzero_si512();
+  const __mmask16 is_zero = _mm512_cmpeq_epi32_mask(magnitude, zero);
+  const __mmask16 is_negative = _mm512_cmpgt_epi32_mask(zero, bits);
+  const __mmask16 is_special =
+      _mm512_cmpgt_epi32_mask(magnitude, _mm512_set1_epi32(0x7f7fffff));
+  const __mmask16 is_denormal = _mm512_mask_cmpgt_epi32_mask(
+      _knot_mask16(is_zero), _mm512_set1_epi32(0x00800000), magnitude);
+  x = _mm512_mask_mov_ps(x, is_denormal, _mm512_cvtepi32_ps(magnitude));
+
+  const __m512i normal_bits = _mm512_castps_si512(x);
+  __m512 e = _mm512_cvtepi32_ps(_mm512_sub_epi32(
+      _mm512_srli_epi32(normal_bits, 23), _mm512_set1_epi32(126)));
+  e = _mm512_mask_sub_ps(e, is_denormal, e, _mm512_set1_ps(149.0f));
+  __m512 m = _mm512_castsi512_ps(_mm512_or_si512(
+      _mm512_and_si512(normal_bits, _mm512_set1_epi32(0x007fffff)),
+      _mm512_set1_epi32(0x3f000000)));
+
+  const __mmask16 small = _mm512_cmp_ps_mask(
+      m, _mm512_set1_ps(0.707106781186547524f), _CMP_LT_OQ);
+  const __m512 one = _mm512_set1_ps(1.0f);
+  e = _mm512_mask_sub_ps(e, small, e, one);
+  const __m512 f = _mm512_sub_ps(_mm512_mask_add_ps(m, small, m, m), one);
+
+  const __m512 z = _mm512_mul_ps(f, f);
+  __m512 p = _mm512_set1_ps(7.0376836292e-2f);
+  p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(-1.1514610310e-1f));
+  p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(1.1676998740e-1f));
+  p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(-1.2420140846e-1f));
+  p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(1.4249322787e-1f));
+  p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(-1.6668057665e-1f));
+  p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(2.0000714765e-1f));
+  p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(-2.4999993993e-1f));
+  p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(3.3333331174e-1f));
+  p = _mm512_mul_ps(_mm512_mul_ps(p, f), z);
+
+  p = _mm512_fmadd_ps(e, _mm512_set1_ps(-2.12194440e-4f), p);
+  p = _mm512_fnmadd_ps(z, _mm512_set1_ps(0.5f), p);
+  __m512 result = _mm512_add_ps(f, p);
+  result = _mm512_fmadd_ps(e, _mm512_set1_ps(0.693359375f), result);
+
+  result = _mm512_mask_mov_ps(result, is_special, _mm512_castsi512_ps(bits));
+  result = _mm512_mask_mov_ps(
+      result, is_negative,
+      _mm512_set1_ps(std::numeric_limits<float>::quiet_NaN()));
+  return _mm512_mask_mov_ps(
+      result, is_zero,
+      _mm512_set1_ps(-std::numeric_limits<float>::infinity()));
+}
+
+// The maps are named functions rather than lambdas: GCC builds a lambda's
+// function pointer thunk without the target, and passing an __m512 there
+// changes the ABI. Lanes past the end load as 0, or as 1 for the second
+// operand, which is harmless for division too.
+using unary_op = __m512 (*)(__m512);
+using binary_op = __m512 (*)(__m512, __m512);
+
+template <unary_op f>
+void unary(const float *in, float *out, std::size_t size) {
+  std::size_t i = 0;
+  for (; i + width <= size; i += width)
+    _mm512_storeu_ps(out + i, f(_mm512_loadu_ps(in + i)));
+  if (i == size)
+    return;
+  const __mmask16 m = first_lanes(size - i);
+  _mm512_mask_storeu_ps(out + i, m, f(_mm512_maskz_loadu_ps(m, in + i)));
+}
+
+template <binary_op f>
+void binary(const float *in1, const float *in2, float *out, std::size_t size) {
+  std::size_t i = 0;
+  for (; i + width <= size; i += width)
+    _mm512_storeu_ps(out + i,
+                     f(_mm512_loadu_ps(in1 + i), _mm512_loadu_ps(in2 + i)));
+  if (i == size)
+    return;
+  const __mmask16 m = first_lanes(size - i);
+  _mm512_mask_storeu_ps(
+      out + i, m,
+      f(_mm512_maskz_loadu_ps(m, in1 + i),
+        _mm512_mask_loadu_ps(_mm512_set1_ps(1.0f), m, in2 + i)));
+}
+
+// The second operand is scalar throughout.
+template <binary_op f>
+void binary(const float *in, float scalar, float *out, std::size_t size) {
+  const __m512 s = _mm512_set1_ps(scalar);
+  std::size_t i = 0;
+  for (; i + width <= size; i += width)
+    _mm512_storeu_ps(out + i, f(_mm512_loadu_ps(in + i), s));
+  if (i == size)
+    return;
+  const __mmask16 m = first_lanes(size - i);
+  _mm512_mask_storeu_ps(out + i, m, f(_mm512_maskz_loadu_ps(m, in + i), s));
+}
+
+inline __m512 add16(__m512 a, __m512 b) { return _mm512_add_ps(a, b); }
+inline __m512 sub16(__m512 a, __m512 b) { return _mm512_sub_ps(a, b); }
+inline __m512 mul16(__m512 a, __m512 b) { return _mm512_mul_ps(a, b); }
+inline __m512 div16(__m512 a, __m512 b) { return _mm512_div_ps(a, b); }
+inline __m512 abs16(__m512 a) { return _mm512_abs_ps(a); }
+inline __m512 sqrt16(__m512 a) { return _mm512_sqrt_ps(a); }
+
+void add(const float *in1, const float *in2, float *out, std::size_t size) {
+  binary<add16>(in1, in2, out, size);
+}
+void add(const float *in, float scalar, float *out, std::size_t size) {
+  binary<add16>(in, scalar, out, size);
+}
+void minus(const float *in1, const float *in2, float *out, std::size_t size) {
+  binary<sub16>(in1, in2, out, size);
+}
+void minus(const float *in, float scalar, float *out, std::size_t size) {
+  binary<sub16>(in, scalar, out, size);
+}
+void multiply(const float *in1, const float *in2, float *out,
+              std::size_t size) {
+  binary<mul16>(in1, in2, out, size);
+}
+void multiply(const float *in, float scalar, float *out, std::size_t size) {
+  binary<mul16>(in, scalar, out, size);
+}
+void divide(const float *in1, const float *in2, float *out, std::size_t size) {
+  binary<div16>(in1, in2, out, size);
+}
+void divide(const float *in, float scalar, float *out, std::size_t size) {
+  binary<div16>(in, scalar, out, size);
+}
+
+void abs(const float *in, float *out, std::size_t size) {
+  unary<abs16>(in, out, size);
+}
+void sqrt(const float *in, float *out, std::size_t size) {
+  unary<sqrt16>(in, out, size);
+}
+void exp(const float *in, float *out, std::size_t size) {
+  unary<exp16>(in, out, size);
+}
+void log(const float *in, float *out, std::size_t size) {
+  unary<log16>(in, out, size);
+}
+
+float sum(const float *in, std::size_t size) {
+  __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+  __m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 4 * width <= size; i += 4 * width) {
+    s0 = _mm512_add_ps(s0, _mm512_loadu_ps(in + i));
+    s1 = _mm512_add_ps(s1, _mm512_loadu_ps(in + i + width));
+    s2 = _mm512_add_ps(s2, _mm512_loadu_ps(in + i + 2 * width));
+    s3 = _mm512_add_ps(s3, _mm512_loadu_ps(in + i + 3 * width));
+  }
+  for (; i + width <= size; i += width)
+    s0 = _mm512_add_ps(s0, _mm512_loadu_ps(in + i));
+  if (i < size)
+    s1 = _mm512_add_ps(s1,
+                       _mm512_maskz_loadu_ps(first_lanes(size - i), in + i));
+  return _mm512_reduce_add_ps(
+      _mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3)));
+}
+
+float dot(const float *in1, const float *in2, std::size_t size) {
+  __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+  __m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 4 * width <= size; i += 4 * width) {
+    s0 = _mm512_fmadd_ps(_mm512_loadu_ps(in1 + i), _mm512_loadu_ps(in2 + i),
+                         s0);
+    s1 = _mm512_fmadd_ps(_mm512_loadu_ps(in1 + i + width),
+                         _mm512_loadu_ps(in2 + i + width), s1);
+    s2 = _mm512_fmadd_ps(_mm512_loadu_ps(in1 + i + 2 * width),
+                         _mm512_loadu_ps(in2 + i + 2 * width), s2);
+    s3 = _mm512_fmadd_ps(_mm512_loadu_ps(in1 + i + 3 * width),
+                         _mm512_loadu_ps(in2 + i + 3 * width), s3);
+  }
+  for (; i + width <= size; i += width)
+    s0 = _mm512_fmadd_ps(_mm512_loadu_ps(in1 + i), _mm512_loadu_ps(in2 + i),
+                         s0);
+  if (i < size) {
+    const __mmask16 m = first_lanes(size - i);
+    s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, in1 + i),
+                         _mm512_maskz_loadu_ps(m, in2 + i), s1);
+  }
+  return _mm512_reduce_add_ps(
+      _mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3)));
+}
+
+float variance(const float *in, std::size_t size) {
+  if (size == 0)
+    return 0.0f;
+  const float mean = sum(in, size) / size;
+  const __m512 m = _mm512_set1_ps(mean);
+  __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+  std::size_t i = 0;
+  for (; i + 2 * width <= size; i += 2 * width) {
+    const __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(in + i), m);
+    const __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(in + i + width), m);
+    s0 = _mm512_fmadd_ps(d0, d0, s0);
+    s1 = _mm512_fmadd_ps(d1, d1, s1);
+  }
+  for (; i + width <= size; i += width) {
+    const __m512 d = _mm512_sub_ps(_mm512_loadu_ps(in + i), m);
+    s0 = _mm512_fmadd_ps(d, d, s0);
+  }
+  if (i < size) {
+    // Lanes past the end are 0, not 0 - mean.
+    const __mmask16 tail = first_lanes(size - i);
+    const __m512 d =
+        _mm512_maskz_sub_ps(tail, _mm512_maskz_loadu_ps(tail, in + i), m);
+    s1 = _mm512_fmadd_ps(d, d, s1);
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1)) / size;
+}
+
+float max(const float *in, std::size_t size) {
+  __m512 m = _mm512_set1_ps(in[0]);
+  std::size_t i = 0;
+  for (; i + width <= size; i += width)
+    m = _mm512_max_ps(m, _mm512_loadu_ps(in + i));
+  if (i < size) {
+    const __mmask16 tail = first_lanes(size - i);
+    m = _mm512_mask_max_ps(m, tail, m, _mm512_maskz_loadu_ps(tail, in + i));
+  }
+  return _mm512_reduce_max_ps(m);
+}
+
+std::size_t argmax(const float *in, std::size_t size) {
+  std::size_t i = 0;
+  std::size_t best = 0;
+  if (size >= width && size <= std::numeric_limits<std::int32_t>::max()) {
+    // As in kernels_avx2.cc: a first maximum per lane, then the smallest
+    // index among the lanes' maxima.
+    __m512 best_values = _mm512_loadu_ps(in);
+    __m512i best_indices = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                             11, 12, 13, 14, 15);
+    __m512i indices = best_indices;
+    const __m512i step = _mm512_set1_epi32(width);
+    for (i = width; i + width <= size; i += width) {
+      indices = _mm512_add_epi32(indices, step);
+      const __m512 values = _mm512_loadu_ps(in + i);
+      const __mmask16 greater =
+          _mm512_cmp_ps_mask(values, best_values, _CMP_GT_OQ);
+      best_values = _mm512_mask_mov_ps(best_values, greater, values);
+      best_indices = _mm512_mask_mov_epi32(best_indices, greater, indices);
+    }
+
+    alignas(64) float lane_values[width];
+    alignas(64) std::int32_t lane_indices[width];
+    _mm512_store_ps(lane_values, best_values);
+    _mm512_store_si512(lane_indices, best_indices);
+    best = lane_indices[0];
+    for (std::size_t l = 1; l < width; ++l) {
+      if (lane_values[l] > in[best] ||
+          (lane_values[l] == in[best] && std::size_t(lane_indices[l]) < best))
+        best = lane_indices[l];
+    }
+  } else {
+    i = 1;
+  }
+  for (; i < size; ++i) {
+    if (in[i] > in[best])
+      best = i;
+  }
+  return best;
+}
+
+void widen_u8(const std::uint8_t *in, float scale, float *out,
+              std::size_t size) {
+  std::size_t i = 0;
+  const __m512 s = _mm512_set1_ps(scale);
+  for (; i + width <= size; i += width) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    const __m512 f = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(v));
+    _mm512_storeu_ps(out + i, _mm512_mul_ps(f, s));
+  }
+  for (; i < size; ++i)
+    out[i] = in[i] * scale;
+}
+
+std::int32_t dot_u8s8(const std::uint8_t *a, const std::int8_t *b,
+                      std::size_t size) {
+  std::size_t i = 0;
+  __m512i acc = _mm512_setzero_si512();
+  for (; i + 64 <= size; i += 64) {
+    const __m512i va = _mm512_loadu_si512(a + i);
+    const __m512i vb = _mm512_loadu_si512(b + i);
+    acc = _mm512_add_epi32(acc,
+                           _mm512_madd_epi16(_mm512_maddubs_epi16(va, vb),
+                                             _mm512_set1_epi16(1)));
+  }
+  std::int32_t result = _mm512_reduce_add_epi32(acc);
+  for (; i < size; ++i)
+    result += std::int32_t(a[i]) * b[i];
+  return result;
+}
+
+// 16 bfloat16s, widened to the floats they stand for.
+inline __m512 load_bf16(const std::uint16_t *p) {
+  const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+  return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(v), 16));
+}
+
+float dot_bf16(const float *a, const std::uint16_t *b, std::size_t size) {
+  std::size_t i = 0;
+  __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+  for (; i + 2 * width <= size; i += 2 * width) {
+    s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), load_bf16(b + i), s0);
+    s1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + width),
+                         load_bf16(b + i + width), s1);
+  }
+  float result = _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+  for (; i < size; ++i) {
+    const std::uint32_t bits = std::uint32_t(b[i]) << 16;
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    result += a[i] * f;
+  }
+  return result;
+}
+
+} // namespace
+XYLO_TARGET_END
+
+XYLO_TARGET_BEGIN("avx512f,avx512bw,avx512vnni,avx2,fma")
+namespace {
+
+// As dot_u8s8, with vpdpbusd, and a masked tail since lanes past the end
+// load as 0.
+std::int32_t dot_u8s8_vnni(const std::uint8_t *a, const std::int8_t *b,
+                           std::size_t size) {
+  std::size_t i = 0;
+  __m512i acc = _mm512_setzero_si512();
+  for (; i + 64 <= size; i += 64) {
+    acc = _mm512_dpbusd_epi32(acc, _mm512_loadu_si512(a + i),
+                              _mm512_loadu_si512(b + i));
+  }
+  if (i < size) {
+    const __mmask64 m = (std::uint64_t(1) << (size - i)) - 1;
+    acc = _mm512_dpbusd_epi32(acc, _mm512_maskz_loadu_epi8(m, a + i),
+                              _mm512_maskz_loadu_epi8(m, b + i));
+  }
+  return _mm512_reduce_add_epi32(acc);
+}
+
+} // namespace
+XYLO_TARGET_END
+
+namespace {
+constexpr kernel_table base{
+    .add = add,
+    .add_scalar = add,
+    .minus = minus,
+    .minus_scalar = minus,
+    .multiply = multiply,
+    .multiply_scalar = multiply,
+    .divide = divide,
+    .divide_scalar = divide,
+    .abs = abs,
+    .sqrt = sqrt,
+    .widen_u8 = widen_u8,
+    .exp = exp,
+    .log = log,
+    .sum = sum,
+    .dot = dot,
+    .variance = variance,
+    .max = max,
+    .argmax = argmax,
+    .dot_u8s8 = dot_u8s8,
+    .dot_bf16 = dot_bf16,
+};
+
+constexpr kernel_table with_vnni(kernel_table t) {
+  t.dot_u8s8 = dot_u8s8_vnni;
+  return t;
+}
+} // namespace
+
+const kernel_table &table() { return base; }
+const kernel_table &vnni_table() {
+  static constexpr kernel_table t = with_vnni(base);
+  return t;
+}
+} // namespace xylo::kernels::avx512
+
+#endif
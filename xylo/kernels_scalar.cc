@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <xylo/kernel_table.h>
+
+// Plain loops, for any target, and the reference for the other tables.
+namespace xylo::kernels::scalar {
+
+namespace {
+template <typename F>
+void unary(const float *in, float *out, std::size_t size, F &&f) {
+  for (std::size_t i = 0; i < size; ++i)
+    out[i] = f(in[i]);
+}
+
+template <typename F>
+void binary(const float *in1, const float *in2, float *out, std::size_t size,
+            F &&f) {
+  for (std::size_t i = 0; i < size; ++i)
+    out[i] = f(in1[i], in2[i]);
+}
+
+void add(const float *in1, const float *in2, float *out, std::size_t size) {
+  binary(in1, in2, out, size, [](float a, float b) { return a + b; });
+}
+void add(const float *in, float scalar, float *out, std::size_t size) {
+  unary(in, out, size, [scalar](float a) { return a + scalar; });
+}
+void minus(const float *in1, const float *in2, float *out, std::size_t size) {
+  binary(in1, in2, out, size, [](float a, float b) { return a - b; });
+}
+void minus(const float *in, float scalar, float *out, std::size_t size) {
+  unary(in, out, size, [scalar](float a) { return a - scalar; });
+}
+void multiply(const float *in1, const float *in2, float *out,
+              std::size_t size) {
+  binary(in1, in2, out, size, [](float a, float b) { return a * b; });
+}
+void multiply(const float *in, float scalar, float *out, std::size_t size) {
+  unary(in, out, size, [scalar](float a) { return a * scalar; });
+}
+void divide(const float *in1, const float *in2, float *out, std::size_t size) {
+  binary(in1, in2, out, size, [](float a, float b) { return a / b; });
+}
+void divide(const float *in, float scalar, float *out, std::size_t size) {
+  unary(in, out, size, [scalar](float a) { return a / scalar; });
+}
+
+void abs(const float *in, float *out, std::size_t size) {
+  unary(in, out, size, ::fabsf);
+}
+void sqrt(const float *in, float *out, std::size_t size) {
+  unary(in, out, size, ::sqrtf);
+}
+// These are libm, which is at least as accurate as documented.
+void exp(const float *in, float *out, std::size_t size) {
+  unary(in, out, size, ::expf);
+}
+void log(const float *in, float *out, std::size_t size) {
+  unary(in, out, size, ::logf);
+}
+
+float sum(const float *in, std::size_t size) {
+  float s[4] = {};
+  std::size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    for (std::size_t l = 0; l < 4; ++l)
+      s[l] += in[i + l];
+  }
+  float result = (s[0] + s[1]) + (s[2] + s[3]);
+  for (; i < size; ++i)
+    result += in[i];
+  return result;
+}
+
+float dot(const float *in1, const float *in2, std::size_t size) {
+  float s[4] = {};
+  std::size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    for (std::size_t l = 0; l < 4; ++l)
+      s[l] += in1[i + l] * in2[i + l];
+  }
+  float result = (s[0] + s[1]) + (s[2] + s[3]);
+  for (; i < size; ++i)
+    result += in1[i] * in2[i];
+  return result;
+}
+
+float variance(const float *in, std::size_t size) {
+  if (size == 0)
+    return 0.0f;
+  const float mean = sum(in, size) / size;
+  float result = 0.0f;
+  for (std::size_t i = 0; i < size; ++i) {
+    const float d = in[i] - mean;
+    result += d * d;
+  }
+  return result / size;
+}
+
+float max(const float *in, std::size_t size) {
+  return *std::max_element(in, in + size);
+}
+
+std::size_t argmax(const float *in, std::size_t size) {
+  return std::max_element(in, in + size) - in;
+}
+
+void widen_u8(const std::uint8_t *in, float scale, float *out,
+              std::size_t size) {
+  for (std::size_t i = 0; i < size; ++i)
+    out[i] = in[i] * scale;
+}
+
+std::int32_t dot_u8s8(const std::uint8_t *a, const std::int8_t *b,
+                      std::size_t size) {
+  std::int32_t result = 0;
+  for (std::size_t i = 0; i < size; ++i)
+    result += std::int32_t(a[i]) * b[i];
+  return result;
+}
+
+float dot_bf16(const float *a, const std::uint16_t *b, std::size_t size) {
+  float result = 0.0f;
+  for (std::size_t i = 0; i < size; ++i) {
+    const std::uint32_t bits = std::uint32_t(b[i]) << 16;
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    result += a[i] * f;
+  }
+  return result;
+}
+
+} // namespace
+
+const kernel_table &table() {
+  static constexpr kernel_table t{
+      .add = add,
+      .add_scalar = add,
+      .minus = minus,
+      .minus_scalar = minus,
+      .multiply = multiply,
+      .multiply_scalar = multiply,
+      .divide = divide,
+      .divide_scalar = divide,
+      .abs = abs,
+      .sqrt = sqrt,
+      .widen_u8 = widen_u8,
+      .exp = exp,
+      .log = log,
+      .sum = sum,
+      .dot = dot,
+      .variance = variance,
+      .max = max,
+      .argmax = argmax,
+      .dot_u8s8 = dot_u8s8,
+      .dot_bf16 = dot_bf16,
+  };
+  return t;
+}
+
+} // namespace xylo::kernels::scalar
@@ -0,0 +1,362 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include <xylo/kernel_table.h>
+
+// The kernels on 128-bit vectors of 4 floats, written with the GCC and Clang
+// vector extensions rather than intrinsics, so that the one file is SSE2 on
+// x86, NEON on ARM and simd128 on WebAssembly, for whatever the target
+// compiles the vector operations to. The arithmetic follows kernels_avx2.cc.
+namespace xylo::kernels::simd128 {
+
+namespace {
+typedef float f4 __attribute__((vector_size(16)));
+typedef std::int32_t i4 __attribute__((vector_size(16)));
+constexpr std::size_t width = 4;
+
+f4 load(const float *p) {
+  f4 v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+void store(float *p, f4 v) { std::memcpy(p, &v, sizeof(v)); }
+f4 splat(float x) { return f4{x, x, x, x}; }
+i4 splat(std::int32_t x) { return i4{x, x, x, x}; }
+
+// Lanes of a where mask is set, of b elsewhere. Masks are what comparisons
+// return, all ones or all zeros per lane.
+f4 select(i4 mask, f4 a, f4 b) {
+  return f4((mask & i4(a)) | (~mask & i4(b)));
+}
+f4 min(f4 a, f4 b) { return select(a < b, a, b); }
+f4 max(f4 a, f4 b) { return select(a > b, a, b); }
+
+float horizontal_sum(f4 v) { return (v[0] + v[1]) + (v[2] + v[3]); }
+
+XYLO_STRICT_FP_BEGIN
+// As exp8 in kernels_avx2.cc, but rounding to nearest as floor(x + 0.5),
+// since conversion truncates.
+f4 exp4(f4 x) {
+  const i4 underflow = x < splat(-87.3365447505531f);
+  const i4 overflow = x > splat(88.7228391116729f);
+  const i4 nan = (i4(x) & splat(0x7fffffff)) > splat(0x7f800000);
+  const f4 in = x;
+  // Both ways, since converting a float past the range of int is undefined.
+  x = max(min(x, splat(88.7228391116729f)), splat(-87.3365447505531f));
+
+  const f4 t = x * splat(1.44269504088896341f) + splat(0.5f);
+  i4 ni = __builtin_convertvector(t, i4);
+  ni += __builtin_convertvector(ni, f4) > t;
+  const f4 n = __builtin_convertvector(ni, f4);
+  f4 r = XYLO_ASSOC_BARRIER(x - n * splat(0.693359375f));
+  r = r - n * splat(-2.12194440e-4f);
+
+  f4 p = splat(1.9875691500e-4f);
+  p = p * r + splat(1.3981999507e-3f);
+  p = p * r + splat(8.3334519073e-3f);
+  p = p * r + splat(4.1665795894e-2f);
+  p = p * r + splat(1.6666665459e-1f);
+  p = p * r + splat(5.0000001201e-1f);
+  p = p * (r * r) + r;
+  p = p + splat(1.0f);
+
+  // n2 is the factor of 2 past [-125, 127]; comparisons are -1 where true.
+  const i4 n2 = (ni < splat(-125)) - (ni > splat(127));
+  f4 result = f4(i4(p) + ((ni - n2) << 23)) * f4((n2 + splat(127)) << 23);
+  result = f4(~underflow & i4(result));
+  result = select(overflow, splat(std::numeric_limits<float>::infinity()),
+                  result);
+  return select(nan, in, result);
+}
+
+// As log8.
+f4 log4(f4 x) {
+  const i4 bits = i4(x);
+  const i4 magnitude = bits & splat(0x7fffffff);
+  const i4 is_zero = magnitude == splat(0);
+  const i4 is_negative = bits < splat(0);
+  const i4 is_special = magnitude > splat(0x7f7fffff);
+  const i4 is_denormal = ~is_zero & (magnitude < splat(0x00800000));
+  x = select(is_denormal, __builtin_convertvector(magnitude, f4), x);
+
+  const i4 normal_bits = i4(x);
+  // The exponent field is positive, so the shift doesn't need to be logical.
+  f4 e = __builtin_convertvector((normal_bits >> 23) - splat(126), f4);
+  e = e - f4(i4(splat(149.0f)) & is_denormal);
+  f4 m = f4((normal_bits & splat(0x007fffff)) | splat(0x3f000000));
+
+  const i4 small = m < splat(0.707106781186547524f);
+  const f4 one = splat(1.0f);
+  e = e - f4(i4(one) & small);
+  const f4 f = m + f4(i4(m) & small) - one;
+
+  const f4 z = f * f;
+  f4 p = splat(7.0376836292e-2f);
+  p = p * f + splat(-1.1514610310e-1f);
+  p = p * f + splat(1.1676998740e-1f);
+  p = p * f + splat(-1.2420140846e-1f);
+  p = p * f + splat(1.4249322787e-1f);
+  p = p * f + splat(-1.6668057665e-1f);
+  p = p * f + splat(2.0000714765e-1f);
+  p = p * f + splat(-2.4999993993e-1f);
+  p = p * f + splat(3.3333331174e-1f);
+  p = p * f * z;
+
+  p = XYLO_ASSOC_BARRIER(e * splat(-2.12194440e-4f) + p);
+  p = p - z * splat(0.5f);
+  f4 result = XYLO_ASSOC_BARRIER(f + p);
+  result = e * splat(0.693359375f) + result;
+
+  result = select(is_special, f4(bits), result);
+  result = select(is_negative, splat(std::numeric_limits<float>::quiet_NaN()),
+                  result);
+  return select(is_zero, splat(-std::numeric_limits<float>::infinity()),
+                result);
+}
+XYLO_STRICT_FP_END
+
+// The tails go through zero padded scratch, as in kernels_avx2.cc.
+template <typename F>
+void unary(const float *in, float *out, std::size_t size, F &&f) {
+  std::size_t i = 0;
+  for (; i + width <= size; i += width)
+    store(out + i, f(load(in + i)));
+  if (i == size)
+    return;
+  float tail[width] = {};
+  std::memcpy(tail, in + i, (size - i) * sizeof(float));
+  store(tail, f(load(tail)));
+  std::memcpy(out + i, tail, (size - i) * sizeof(float));
+}
+
+template <typename F>
+void binary(const float *in1, const float *in2, float *out, std::size_t size,
+            F &&f) {
+  std::size_t i = 0;
+  for (; i + width <= size; i += width)
+    store(out + i, f(load(in1 + i), load(in2 + i)));
+  if (i == size)
+    return;
+  float tail1[width] = {};
+  float tail2[width] = {1, 1, 1, 1};
+  std::memcpy(tail1, in1 + i, (size - i) * sizeof(float));
+  std::memcpy(tail2, in2 + i, (size - i) * sizeof(float));
+  store(tail1, f(load(tail1), load(tail2)));
+  std::memcpy(out + i, tail1, (size - i) * sizeof(float));
+}
+
+void add(const float *in1, const float *in2, float *out, std::size_t size) {
+  binary(in1, in2, out, size, [](f4 a, f4 b) { return a + b; });
+}
+void add(const float *in, float scalar, float *out, std::size_t size) {
+  const f4 s = splat(scalar);
+  unary(in, out, size, [s](f4 a) { return a + s; });
+}
+void minus(const float *in1, const float *in2, float *out, std::size_t size) {
+  binary(in1, in2, out, size, [](f4 a, f4 b) { return a - b; });
+}
+void minus(const float *in, float scalar, float *out, std::size_t size) {
+  const f4 s = splat(scalar);
+  unary(in, out, size, [s](f4 a) { return a - s; });
+}
+void multiply(const float *in1, const float *in2, float *out,
+              std::size_t size) {
+  binary(in1, in2, out, size, [](f4 a, f4 b) { return a * b; });
+}
+void multiply(const float *in, float scalar, float *out, std::size_t size) {
+  const f4 s = splat(scalar);
+  unary(in, out, size, [s](f4 a) { return a * s; });
+}
+void divide(const float *in1, const float *in2, float *out, std::size_t size) {
+  binary(in1, in2, out, size, [](f4 a, f4 b) { return a / b; });
+}
+void divide(const float *in, float scalar, float *out, std::size_t size) {
+  const f4 s = splat(scalar);
+  unary(in, out, size, [s](f4 a) { return a / s; });
+}
+
+void abs(const float *in, float *out, std::size_t size) {
+  const i4 magnitude = splat(0x7fffffff);
+  unary(in, out, size, [magnitude](f4 a) { return f4(i4(a) & magnitude); });
+}
+// There's no portable vector square root; these loops are what the compilers
+// vectorize into one.
+void sqrt(const float *in, float *out, std::size_t size) {
+  for (std::size_t i = 0; i < size; ++i)
+    out[i] = ::sqrtf(in[i]);
+}
+void exp(const float *in, float *out, std::size_t size) {
+  unary(in, out, size, exp4);
+}
+void log(const float *in, float *out, std::size_t size) {
+  unary(in, out, size, log4);
+}
+
+float sum(const float *in, std::size_t size) {
+  f4 s0 = {}, s1 = {}, s2 = {}, s3 = {};
+  std::size_t i = 0;
+  for (; i + 4 * width <= size; i += 4 * width) {
+    s0 += load(in + i);
+    s1 += load(in + i + width);
+    s2 += load(in + i + 2 * width);
+    s3 += load(in + i + 3 * width);
+  }
+  for (; i + width <= size; i += width)
+    s0 += load(in + i);
+  float result = horizontal_sum((s0 + s1) + (s2 + s3));
+  for (; i < size; ++i)
+    result += in[i];
+  return result;
+}
+
+float dot(const float *in1, const float *in2, std::size_t size) {
+  f4 s0 = {}, s1 = {}, s2 = {}, s3 = {};
+  std::size_t i = 0;
+  for (; i + 4 * width <= size; i += 4 * width) {
+    s0 += load(in1 + i) * load(in2 + i);
+    s1 += load(in1 + i + width) * load(in2 + i + width);
+    s2 += load(in1 + i + 2 * width) * load(in2 + i + 2 * width);
+    s3 += load(in1 + i + 3 * width) * load(in2 + i + 3 * width);
+  }
+  for (; i + width <= size; i += width)
+    s0 += load(in1 + i) * load(in2 + i);
+  float result = horizontal_sum((s0 + s1) + (s2 + s3));
+  for (; i < size; ++i)
+    result += in1[i] * in2[i];
+  return result;
+}
+
+float variance(const float *in, std::size_t size) {
+  if (size == 0)
+    return 0.0f;
+  const float mean = sum(in, size) / size;
+  const f4 m = splat(mean);
+  f4 s0 = {}, s1 = {};
+  std::size_t i = 0;
+  for (; i + 2 * width <= size; i += 2 * width) {
+    const f4 d0 = load(in + i) - m;
+    const f4 d1 = load(in + i + width) - m;
+    s0 += d0 * d0;
+    s1 += d1 * d1;
+  }
+  for (; i + width <= size; i += width) {
+    const f4 d = load(in + i) - m;
+    s0 += d * d;
+  }
+  float result = horizontal_sum(s0 + s1);
+  for (; i < size; ++i) {
+    const float d = in[i] - mean;
+    result += d * d;
+  }
+  return result / size;
+}
+
+float max(const float *in, std::size_t size) {
+  std::size_t i = 0;
+  float result = in[0];
+  if (size >= width) {
+    f4 m = load(in);
+    for (i = width; i + width <= size; i += width)
+      m = max(m, load(in + i));
+    result = std::max(std::max(m[0], m[1]), std::max(m[2], m[3]));
+  }
+  for (; i < size; ++i)
+    result = std::max(result, in[i]);
+  return result;
+}
+
+std::size_t argmax(const float *in, std::size_t size) {
+  std::size_t i = 0;
+  std::size_t best = 0;
+  if (size >= width && size <= std::numeric_limits<std::int32_t>::max()) {
+    // As in kernels_avx2.cc.
+    f4 best_values = load(in);
+    i4 best_indices = {0, 1, 2, 3};
+    i4 indices = best_indices;
+    for (i = width; i + width <= size; i += width) {
+      indices += splat(std::int32_t(width));
+      const f4 values = load(in + i);
+      const i4 greater = values > best_values;
+      best_values = select(greater, values, best_values);
+      best_indices = (greater & indices) | (~greater & best_indices);
+    }
+    best = best_indices[0];
+    for (std::size_t l = 1; l < width; ++l) {
+      if (best_values[l] > in[best] ||
+          (best_values[l] == in[best] && std::size_t(best_indices[l]) < best))
+        best = best_indices[l];
+    }
+  } else {
+    i = 1;
+  }
+  for (; i < size; ++i) {
+    if (in[i] > in[best])
+      best = i;
+  }
+  return best;
+}
+
+// The byte kernels stay loops: without widening shuffles, which the vector
+// extensions lack, the compilers do as well with them.
+void widen_u8(const std::uint8_t *in, float scale, float *out,
+              std::size_t size) {
+  for (std::size_t i = 0; i < size; ++i)
+    out[i] = in[i] * scale;
+}
+
+std::int32_t dot_u8s8(const std::uint8_t *a, const std::int8_t *b,
+                      std::size_t size) {
+  std::int32_t result = 0;
+  for (std::size_t i = 0; i < size; ++i)
+    result += std::int32_t(a[i]) * b[i];
+  return result;
+}
+
+float dot_bf16(const float *a, const std::uint16_t *b, std::size_t size) {
+  f4 s = {};
+  std::size_t i = 0;
+  for (; i + width <= size; i += width) {
+    const i4 bits = {b[i], b[i + 1], b[i + 2], b[i + 3]};
+    s += load(a + i) * f4(bits << 16);
+  }
+  float result = horizontal_sum(s);
+  for (; i < size; ++i) {
+    const std::uint32_t bits = std::uint32_t(b[i]) << 16;
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    result += a[i] * f;
+  }
+  return result;
+}
+
+} // namespace
+
+const kernel_table &table() {
+  static constexpr kernel_table t{
+      .add = add,
+      .add_scalar = add,
+      .minus = minus,
+      .minus_scalar = minus,
+      .multiply = multiply,
+      .multiply_scalar = multiply,
+      .divide = divide,
+      .divide_scalar = divide,
+      .abs = abs,
+      .sqrt = sqrt,
+      .widen_u8 = widen_u8,
+      .exp = exp,
+      .log = log,
+      .sum = sum,
+      .dot = dot,
+      .variance = variance,
+      .max = max,
+      .argmax = argmax,
+      .dot_u8s8 = dot_u8s8,
+      .dot_bf16 = dot_bf16,
+  };
+  return t;
+}
+} // namespace xylo::kernels::simd128
@@ -0,0 +1,93 @@
+#ifndef XYLO_MINIBATCH_
+#define XYLO_MINIBATCH_
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <span>
+#include <vector>
+
+#include <xeno/exception.h>
+#include <xylo/tensor.h>
+
+// Epochs over a batch of rows in shuffled minibatches, for learners that make
+// several optimizer steps on the same experience. Each epoch draws a new
+// permutation of the rows and cuts it into minibatches; the rows of a
+// minibatch are visited in increasing order, so that a contiguous run can be
+// handed on as a view and anything else is packed with one pass over input.
+namespace xylo {
+
+class minibatch_schedule {
+public:
+  // A minibatch_size of 0, or one at least the number of rows, makes every
+  // epoch a single step over the whole batch, in order and without copying.
+  explicit minibatch_schedule(std::size_t epochs = 1,
+                              std::size_t minibatch_size = 0)
+      : epochs_(epochs), minibatch_size_(minibatch_size),
+        generator_(default_generator()()) {
+    if (epochs == 0)
+      throw xeno::error("a schedule needs at least one epoch.");
+  }
+
+  std::size_t epochs() const { return epochs_; }
+  std::size_t minibatch_size() const { return minibatch_size_; }
+
+  // Calls f(rows, batch) for every minibatch of every epoch. rows are indices
+  // into input, in increasing order, and batch holds those rows of input:
+  // either a view into it, or a copy in a buffer the schedule reuses, valid
+  // until f returns.
+  template <typename F> void run(matrix_view input, F &&f) {
+    const std::size_t n = input.num_rows();
+    const std::size_t width = input.num_cols();
+    if (n == 0)
+      return;
+    const std::size_t m =
+        minibatch_size_ == 0 ? n : std::min(minibatch_size_, n);
+
+    order_.resize(n);
+    std::iota(order_.begin(), order_.end(), 0);
+    for (std::size_t epoch = 0; epoch < epochs_; ++epoch) {
+      if (m < n)
+        std::shuffle(order_.begin(), order_.end(), generator_);
+      for (std::size_t begin = 0; begin < n; begin += m) {
+        const std::span<std::size_t> rows(order_.data() + begin,
+                                          std::min(m, n - begin));
+        std::sort(rows.begin(), rows.end());
+        f(std::span<const std::size_t>(rows), gather(input, rows, width));
+      }
+    }
+  }
+
+private:
+  matrix_view gather(matrix_view input, std::span<const std::size_t> rows,
+                     std::size_t width) {
+    const std::size_t size = rows.size();
+    if (rows.back() - rows.front() + 1 == size) {
+      return fold<2>(slice(flatten(input), rows.front() * width, size * width),
+                     {size, width});
+    }
+    if (!packed_ || packed_->size() < size * width) {
+      // Outlives whatever scope the caller has open.
+      heap_scope heap;
+      packed_ = std::make_unique<vector>(size * width);
+    }
+    float *dst = packed_->data();
+    for (std::size_t row : rows) {
+      std::memcpy(dst, input[row].data(), width * sizeof(float));
+      dst += width;
+    }
+    return fold<2>(slice(*packed_, 0, size * width), {size, width});
+  }
+
+  std::size_t epochs_;
+  std::size_t minibatch_size_;
+  std::mt19937 generator_;
+  std::vector<std::size_t> order_;
+  std::unique_ptr<vector> packed_;
+};
+
+} // namespace xylo
+
+#endif // XYLO_MINIBATCH_
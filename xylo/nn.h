@@ -1,10 +1,21 @@
 #ifndef XYLO_NN_
 #define XYLO_NN_
 
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
 #include <functional>
 
 #include <memory>
+#include <mutex>
+#include <type_traits>
+#include <xeno/exception.h>
 #include <xeno/string.h>
+#include <xeno/sys/thread.h>
+#include <xylo/expression.h>
+#include <xylo/profile.h>
 #include <xylo/tensor.h>
 
 namespace xylo {
@@ -19,21 +30,67 @@ void he_initialize(std::size_t fan_in, vector_view v) {
 
 class layer {
 public:
-  explicit layer(std::string_view name = "") : name_(name) {}
+  explicit layer(std::string_view name = "", std::size_t parameter_size = 0)
+      : name_(name), owned_parameters_(vector(parameter_size)),
+        parameters_(*owned_parameters_) {}
   virtual ~layer() = default;
   virtual matrix forward(matrix_view t) = 0;
-  virtual matrix backward(matrix_view input, matrix_view loss) = 0;
-  virtual vector gradient(matrix_view input, matrix_view backprop) = 0;
-  virtual vector_view parameters() const = 0;
+  // output is what forward(input) returned, for layers that can reuse it.
+  virtual matrix backward(matrix_view input, matrix_view output,
+                          matrix_view loss) = 0;
+  // Writes the gradient of the parameters into out, which is laid out like
+  // parameters().
+  virtual void gradient(matrix_view input, matrix_view backprop,
+                        vector_view out) {}
+
+  enum class pass { forward, backward, gradient };
+  // Floating point operations pass p takes on a batch, with input what
+  // forward() gets, for the profile. 0 if nobody counted.
+  virtual std::uint64_t flops(pass p, matrix_view input) const { return 0; }
+
+  vector_view parameters() const { return *parameters_; }
+
+  // Moves the parameters into storage, which from then on has to outlive the
+  // layer. A model does this to keep all its parameters in one buffer.
+  void bind_parameters(vector_view storage) {
+    if (storage.size() != parameters_->size())
+      throw xeno::error("different tensor shapes.");
+    storage = *parameters_;
+    parameters_.emplace(storage);
+    owned_parameters_.reset();
+  }
+
+  // Like bind_parameters(), but takes the parameters from storage instead of
+  // copying them there.
+  void borrow_parameters(vector_view storage) {
+    if (storage.size() != parameters_->size())
+      throw xeno::error("different tensor shapes.");
+    parameters_.emplace(storage);
+    owned_parameters_.reset();
+  }
 
-  std::string_view name() { return name_; }
+  std::string_view name() const { return name_; }
 
 protected:
   std::string name_;
+
+private:
+  // Layers start out with storage of their own, until they are bound.
+  std::optional<vector> owned_parameters_;
+  std::optional<vector_view> parameters_;
 };
 
 namespace {
 
+// A multiply and an add per weight for each of rows rows, and forward and the
+// gradient add the bias too.
+std::uint64_t affine_flops(layer::pass p, std::uint64_t rows,
+                           std::uint64_t input_size,
+                           std::uint64_t output_size) {
+  const std::uint64_t products = 2 * rows * input_size * output_size;
+  return p == layer::pass::backward ? products : products + rows * output_size;
+}
+
 // Potentially move this into tensor.h
 matrix pad(matrix_view m, std::size_t padded_size) {
   matrix result({m.num_rows(), padded_size});
@@ -61,50 +118,59 @@ class matmul_layer : public layer {
 public:
   matmul_layer(std::size_t input_size, std::size_t output_size,
                std::string_view name = "")
-      : layer(name), parameters_({(input_size + 1) * output_size}),
-        a_(fold<2>(slice(parameters_, 0, input_size * output_size),
-                   {output_size, input_size})),
-        b_(slice(parameters_, input_size * output_size, output_size)) {
-    normal_initialize(input_size, flatten(a_));
-    b_ = 0;
-  } // namespace xylo
+      : layer(name, (input_size + 1) * output_size), input_size_(input_size),
+        output_size_(output_size) {
+    normal_initialize(input_size, flatten(a()));
+    b() = 0;
+  }
 
   matrix forward(matrix_view input) override {
-    matrix result = ::matmul_transposed(input, a_);
-
-    for (std::size_t i = 0; i < input.num_rows(); ++i) {
-      result[i] += b_;
-    }
+    matrix result({input.num_rows(), output_size_});
+    matmul_transposed(input, a(), b(), false, result);
     return result;
   }
 
-  matrix backward(matrix_view input, matrix_view backprop) override {
-    return ::matmul(backprop, a_);
+  matrix backward(matrix_view input, matrix_view output,
+                  matrix_view backprop) override {
+    return ::matmul(backprop, a());
   }
 
-  vector gradient(matrix_view input, matrix_view backprop) override {
+  void gradient(matrix_view input, matrix_view backprop,
+                vector_view out) override {
     std::size_t input_size = input.num_cols();
     std::size_t output_size = backprop.num_cols();
 
-    vector result({input_size * output_size + output_size});
-    matrix_view d_a = fold<2>(slice(result, 0, input_size * output_size),
+    matrix_view d_a = fold<2>(slice(out, 0, input_size * output_size),
                               {output_size, input_size});
-    vector_view d_b = slice(result, input_size * output_size, output_size);
+    vector_view d_b = slice(out, input_size * output_size, output_size);
 
-    matmul(::transpose(backprop), input, d_a);
+    transposed_matmul(backprop, input, d_a);
     d_b = 0;
     for (std::size_t i = 0; i < backprop.num_rows(); ++i) {
       d_b += backprop[i];
     }
-    return result;
   }
 
-  vector_view parameters() const override { return parameters_; }
+  std::uint64_t flops(pass p, matrix_view input) const override {
+    return affine_flops(p, input.num_rows(), input_size_, output_size_);
+  }
+
+  // output_size x input_size, and one bias per output.
+  matrix_view weights() const { return a(); }
+  vector_view bias() const { return b(); }
 
 protected:
-  vector parameters_;
-  matrix_view a_;
-  vector_view b_;
+  // Views into parameters(), which may move when the layer is bound.
+  matrix_view a() const {
+    return fold<2>(slice(parameters(), 0, input_size_ * output_size_),
+                   {output_size_, input_size_});
+  }
+  vector_view b() const {
+    return slice(parameters(), input_size_ * output_size_, output_size_);
+  }
+
+  std::size_t input_size_;
+  std::size_t output_size_;
 };
 
 using full_layer = matmul_layer;
@@ -114,19 +180,15 @@ class convolution1d_1_layer : public layer {
 public:
   convolution1d_1_layer(std::size_t input_channels, std::size_t output_channels,
                         std::string_view name = "")
-      : layer(name),
-        parameters_({output_channels * input_channels + output_channels}),
-        a_(fold<2>(slice(parameters_, 0, output_channels * input_channels),
-                   {output_channels, input_channels})),
-        b_(slice(parameters_, output_channels * input_channels,
-                 output_channels)) {
-    he_initialize(input_channels, flatten(a_));
-    b_ = 0;
+      : layer(name, output_channels * input_channels + output_channels),
+        input_channels_(input_channels), output_channels_(output_channels) {
+    he_initialize(input_channels, flatten(a()));
+    b() = 0;
   }
 
   matrix forward(matrix_view input) override {
-    std::size_t input_channels = a_.num_cols();
-    std::size_t output_channels = a_.num_rows();
+    std::size_t input_channels = input_channels_;
+    std::size_t output_channels = output_channels_;
     std::size_t num_batches = input.num_rows();
     std::size_t num_points = input.num_cols() / input_channels;
 
@@ -138,32 +200,30 @@ public:
     // Point per row, instead of batch per row. Output channel per col.
     matrix_view reshaped_result =
         fold<2>(flatten(result), {num_batches * num_points, output_channels});
-    matmul_transposed(reshaped_input, a_, reshaped_result);
-
-    for (std::size_t i = 0; i < num_batches * num_points; ++i) {
-      reshaped_result[i] += b_;
-    }
+    matmul_transposed(reshaped_input, a(), b(), false, reshaped_result);
     return result;
   }
 
-  matrix backward(matrix_view input, matrix_view backprop) override {
+  matrix backward(matrix_view input, matrix_view output,
+                  matrix_view backprop) override {
     std::size_t num_batches = input.num_rows();
-    std::size_t output_channels = a_.num_rows();
+    std::size_t output_channels = output_channels_;
     std::size_t num_points = backprop.num_cols() / output_channels;
     matrix_view reshaped_backprop =
         fold<2>(flatten(backprop), {num_batches * num_points, output_channels});
 
-    std::size_t input_channels = a_.num_cols();
+    std::size_t input_channels = input_channels_;
     matrix result({num_batches, num_points * input_channels});
     matrix_view reshaped_result =
         fold<2>(flatten(result), {num_batches * num_points, input_channels});
-    matmul(reshaped_backprop, a_, reshaped_result);
+    matmul(reshaped_backprop, a(), reshaped_result);
     return result;
   }
-  vector gradient(matrix_view input, matrix_view backprop) override {
+  void gradient(matrix_view input, matrix_view backprop,
+                vector_view out) override {
     std::size_t num_batches = input.num_rows();
-    std::size_t input_channels = a_.num_cols();
-    std::size_t output_channels = a_.num_rows();
+    std::size_t input_channels = input_channels_;
+    std::size_t output_channels = output_channels_;
     std::size_t num_points = input.num_cols() / input_channels;
 
     matrix_view reshaped_input =
@@ -171,26 +231,41 @@ public:
     matrix_view reshaped_backprop =
         fold<2>(flatten(backprop), {num_batches * num_points, output_channels});
 
-    vector result({output_channels * input_channels + output_channels});
-    matrix_view d_a =
-        fold<2>(slice(result, 0, output_channels * input_channels),
-                {output_channels, input_channels});
+    matrix_view d_a = fold<2>(slice(out, 0, output_channels * input_channels),
+                              {output_channels, input_channels});
     vector_view d_b =
-        slice(result, output_channels * input_channels, output_channels);
-    matmul(::transpose(reshaped_backprop), reshaped_input, d_a);
+        slice(out, output_channels * input_channels, output_channels);
+    transposed_matmul(reshaped_backprop, reshaped_input, d_a);
     d_b = 0;
     for (std::size_t i = 0; i < reshaped_backprop.num_rows(); ++i) {
       d_b += reshaped_backprop[i];
     }
-    return result;
   }
 
-  vector_view parameters() const override { return parameters_; }
+  // One affine map per point.
+  std::uint64_t flops(pass p, matrix_view input) const override {
+    const std::size_t points =
+        input.num_rows() * input.num_cols() / input_channels_;
+    return affine_flops(p, points, input_channels_, output_channels_);
+  }
+
+  // output_channels x input_channels, and one bias per output channel.
+  matrix_view weights() const { return a(); }
+  vector_view bias() const { return b(); }
 
 private:
-  vector parameters_;
-  matrix_view a_;
-  vector_view b_;
+  // Views into parameters(), which may move when the layer is bound.
+  matrix_view a() const {
+    return fold<2>(slice(parameters(), 0, output_channels_ * input_channels_),
+                   {output_channels_, input_channels_});
+  }
+  vector_view b() const {
+    return slice(parameters(), output_channels_ * input_channels_,
+                 output_channels_);
+  }
+
+  std::size_t input_channels_;
+  std::size_t output_channels_;
 };
 #else
 class convolution1d_1_layer : public matmul_layer {
@@ -200,8 +275,8 @@ public:
       : matmul_layer(input_channels, output_channels, name) {}
 
   matrix forward(matrix_view input) override {
-    std::size_t input_channels = a_.num_cols();
-    std::size_t output_channels = a_.num_rows();
+    std::size_t input_channels = input_size_;
+    std::size_t output_channels = output_size_;
     std::size_t num_batches = input.num_rows();
     std::size_t num_points = input.num_cols() / input_channels;
 
@@ -214,10 +289,11 @@ public:
     return result;
   }
 
-  matrix backward(matrix_view input, matrix_view backprop) override {
+  matrix backward(matrix_view input, matrix_view output,
+                  matrix_view backprop) override {
     std::size_t num_batches = input.num_rows();
-    std::size_t input_channels = a_.num_cols();
-    std::size_t output_channels = a_.num_rows();
+    std::size_t input_channels = input_size_;
+    std::size_t output_channels = output_size_;
     std::size_t num_points = backprop.num_cols() / output_channels;
     matrix_view reshaped_backprop =
         fold<2>(flatten(backprop), {num_batches * num_points, output_channels});
@@ -225,14 +301,16 @@ public:
     matrix result({num_batches, num_points * input_channels});
 
     // Input isn't actually used.
-    flatten(result) = flatten(matmul_layer::backward(input, reshaped_backprop));
+    flatten(result) =
+        flatten(matmul_layer::backward(input, output, reshaped_backprop));
     return result;
   }
 
-  vector gradient(matrix_view input, matrix_view backprop) override {
+  void gradient(matrix_view input, matrix_view backprop,
+                vector_view out) override {
     std::size_t num_batches = input.num_rows();
-    std::size_t input_channels = a_.num_cols();
-    std::size_t output_channels = a_.num_rows();
+    std::size_t input_channels = input_size_;
+    std::size_t output_channels = output_size_;
     std::size_t num_points = input.num_cols() / input_channels;
 
     matrix_view reshaped_input =
@@ -240,14 +318,20 @@ public:
     matrix_view reshaped_backprop =
         fold<2>(flatten(backprop), {num_batches * num_points, output_channels});
 
-    return matmul_layer::gradient(reshaped_input, reshaped_backprop);
+    matmul_layer::gradient(reshaped_input, reshaped_backprop, out);
   }
-
-  vector_view parameters() const override { return matmul_layer::parameters(); }
 };
 #endif
 
-// 3x3 convolution layer.
+// Same-padded, stride 1 convolution over signal_row x signal_col images, one
+// image per row with the input channels innermost. Each output pixel is a row
+// of output_channels, in the same order.
+//
+// Nothing is kept between calls. The patches under a band of output rows are
+// gathered into a tile small enough to stay in cache, and multiplied with the
+// filters in one gemm; backward() multiplies the other way round and
+// scatter-adds the tile back into the images, and gradient() gathers the same
+// tiles again from the input.
 template <std::size_t signal_row, std::size_t signal_col>
 class convolution2d_layer : public matmul_layer {
 public:
@@ -258,94 +342,165 @@ public:
       // innermost.
       : matmul_layer(filter_size * filter_size * input_channels,
                      output_channels, name),
-        filter_size_(filter_size) {}
+        filter_size_(filter_size), input_channels_(input_channels) {
+    if (filter_size % 2 == 0)
+      throw xeno::error("convolution filters need a center.");
+  }
 
   matrix forward(matrix_view input) override {
-    stretched_out_.emplace(im2col(input));
-    matrix output = matmul_layer::forward(*stretched_out_);
-    return matrix(fold<2>(
-        flatten(output), {input.num_rows(), output.size() / input.num_rows()}));
+    check_input(input);
+    matrix result({input.num_rows(), pixels * output_size_});
+    for_each_tile(input.num_rows(), [&](std::size_t image, std::size_t row,
+                                        std::size_t rows, matrix_view tile) {
+      gather(input[image], row, tile);
+      matmul_transposed(tile, a(), b(), false,
+                        pixel_rows(result, image, row, rows));
+    });
+    return result;
+  }
+
+  matrix backward(matrix_view input, matrix_view output,
+                  matrix_view loss) override {
+    matrix result({loss.num_rows(), pixels * input_channels_});
+    flatten(result) = 0;
+    for_each_tile(loss.num_rows(), [&](std::size_t image, std::size_t row,
+                                       std::size_t rows, matrix_view tile) {
+      matmul(pixel_rows(loss, image, row, rows), a(), tile);
+      scatter_add(tile, row, result[image]);
+    });
+    return result;
   }
 
-  vector gradient(matrix_view input, matrix_view backprop) override {
-    matrix_view reshaped_backprop = matrix(
-        fold<2>(flatten(backprop),
-                {matrix_view(*stretched_out_).num_rows(),
-                 backprop.size() / matrix_view(*stretched_out_).num_rows()}));
-    return matmul_layer::gradient(*stretched_out_, reshaped_backprop);
+  void gradient(matrix_view input, matrix_view backprop,
+                vector_view out) override {
+    check_input(input);
+    const std::size_t patch = input_size_;
+    matrix_view d_a = fold<2>(slice(out, 0, patch * output_size_),
+                              {output_size_, patch});
+    vector_view d_b = slice(out, patch * output_size_, output_size_);
+    flatten(d_a) = 0;
+    d_b = 0;
+    matrix partial({output_size_, patch});
+    for_each_tile(input.num_rows(), [&](std::size_t image, std::size_t row,
+                                        std::size_t rows, matrix_view tile) {
+      matrix_view d_out = pixel_rows(backprop, image, row, rows);
+      gather(input[image], row, tile);
+      transposed_matmul(d_out, tile, partial);
+      flatten(d_a) += flatten(partial);
+      // A row per pixel is too many for vector arithmetic on each.
+      const float *g = d_out.data();
+      for (std::size_t p = 0; p < d_out.num_rows(); ++p) {
+        for (std::size_t o = 0; o < output_size_; ++o)
+          d_b.data()[o] += *g++;
+      }
+    });
   }
-  matrix backward(matrix_view input, matrix_view loss) override {
-    matrix stretched_out_flow = matmul_layer::backward(*stretched_out_, loss);
-    return col2im(stretched_out_flow);
+
+  // One patch per pixel, the gathering and scattering of which isn't counted.
+  std::uint64_t flops(pass p, matrix_view input) const override {
+    return affine_flops(p, input.num_rows() * pixels, input_size_,
+                        output_size_);
   }
-  vector_view parameters() const override { return matmul_layer::parameters(); }
 
 private:
-  matrix im2col(matrix_view images) {
-    std::size_t input_channels = images.num_cols() / signal_row / signal_col;
-    matrix result({images.num_rows() * signal_row * signal_col,
-                   filter_size_ * filter_size_ * input_channels});
-
-    const std::size_t radius = filter_size_ / 2;
-    std::size_t result_idx = 0;
-    for (vector_view image : images) {
-      tensor_view<3> image_matrix =
-          fold<3>(image, {signal_row, signal_col, input_channels});
-      for (std::size_t i = 0; i < signal_row; ++i) {
-        std::size_t row_start = i - radius;
-        for (std::size_t j = 0; j < signal_col; ++j) {
-          std::size_t col_start = j - radius;
-
-          vector_view result_row = result[result_idx++];
-          tensor_view<3> result_block =
-              fold<3>(result_row, {filter_size_, filter_size_, input_channels});
-          for (std::size_t i = 0; i < filter_size_; ++i) {
-            for (std::size_t j = 0; j < filter_size_; ++j) {
-              std::size_t x = row_start + i;
-              std::size_t y = col_start + j;
-              bool out_of_bound =
-                  x < 0 || y < 0 || x >= signal_row || y >= signal_col;
-              // Don't try to use a ternary. Types won't match.
-              if (out_of_bound) {
-                result_block[i][j] = 0;
-              } else {
-#if 0
-                lg() << "result block shape: "
-                     << xeno::string::streamable(result_block.shape());
-                lg() << "image matrix shape: "
-                     << xeno::string::streamable(image_matrix.shape());
-#endif
-                result_block[i][j] = image_matrix[x][y];
-              }
-            }
-          }
-        }
+  static constexpr std::size_t pixels = signal_row * signal_col;
+  // Floats in a tile of patches, which sits in L2 between the gather and the
+  // gemm.
+  static constexpr std::size_t tile_size = 16384;
+
+  void check_input(matrix_view input) const {
+    if (input.num_cols() != pixels * input_channels_)
+      throw xeno::error("wrong input shape for convolution.");
+  }
+
+  std::size_t tile_rows() const {
+    return std::clamp<std::size_t>(tile_size / (signal_col * input_size_), 1,
+                                   signal_row);
+  }
+
+  // Calls f(image, row, rows, tile) for bands of rows output rows starting at
+  // row, with tile a pixel x patch matrix to work in.
+  template <typename F> void for_each_tile(std::size_t num_images, F &&f) {
+    const std::size_t band = tile_rows();
+    matrix tile({band * signal_col, input_size_});
+    for (std::size_t image = 0; image < num_images; ++image) {
+      for (std::size_t row = 0; row < signal_row; row += band) {
+        const std::size_t rows = std::min(band, signal_row - row);
+        f(image, row, rows,
+          fold<2>(slice(flatten(tile), 0, rows * signal_col * input_size_),
+                  {rows * signal_col, input_size_}));
       }
     }
-    return result;
   }
 
-  matrix col2im(matrix_view blocks) {
-    std::size_t input_channels =
-        blocks.num_cols() / filter_size_ / filter_size_;
-    std::size_t num_images = blocks.num_rows() / signal_row / signal_col;
-    matrix result({num_images, signal_row * signal_col * input_channels});
+  // The pixels of rows image rows starting at row, one per row.
+  matrix_view pixel_rows(matrix_view images, std::size_t image,
+                         std::size_t row, std::size_t rows) const {
+    const std::size_t width = images.num_cols() / pixels;
+    return fold<2>(slice(images[image], row * signal_col * width,
+                         rows * signal_col * width),
+                   {rows * signal_col, width});
+  }
 
-    return result;
+  // Calls f(patch_offset, image_offset, length) for every run of the filter
+  // that falls inside the image, in floats, for the tile starting at row.
+  template <typename F>
+  void for_each_run(std::size_t row, std::size_t num_pixels, F &&f) const {
+    const std::ptrdiff_t radius = filter_size_ / 2;
+    const std::size_t channels = input_channels_;
+    for (std::size_t p = 0; p < num_pixels; ++p) {
+      const std::ptrdiff_t i = row + p / signal_col;
+      const std::ptrdiff_t j = p % signal_col;
+      // Columns of the filter that don't hang over the sides.
+      const std::ptrdiff_t first = std::max<std::ptrdiff_t>(0, radius - j);
+      const std::ptrdiff_t last = std::min<std::ptrdiff_t>(
+          filter_size_, signal_col + radius - j);
+      for (std::ptrdiff_t di = 0; di < std::ptrdiff_t(filter_size_); ++di) {
+        const std::ptrdiff_t x = i + di - radius;
+        if (x < 0 || x >= std::ptrdiff_t(signal_row))
+          continue;
+        const std::ptrdiff_t y = j + first - radius;
+        f(p * input_size_ + (di * filter_size_ + first) * channels,
+          (x * signal_col + y) * channels, (last - first) * channels);
+      }
+    }
+  }
+
+  // im2col for one tile: every row of tile gets the patch under its pixel,
+  // with zeros where the filter hangs over the edge.
+  void gather(vector_view image, std::size_t row, matrix_view tile) const {
+    flatten(tile) = 0;
+    const float *src = image.data();
+    float *dst = tile.data();
+    for_each_run(row, tile.num_rows(),
+                 [&](std::size_t to, std::size_t from, std::size_t length) {
+                   // Runs are only filter_size * channels long, too short
+                   // for memmove to pay off.
+                   for (std::size_t k = 0; k < length; ++k)
+                     dst[to + k] = src[from + k];
+                 });
+  }
+
+  // col2im for one tile: the inverse of gather, adding up where patches
+  // overlap.
+  void scatter_add(matrix_view tile, std::size_t row, vector_view image) const {
+    const float *src = tile.data();
+    float *dst = image.data();
+    for_each_run(row, tile.num_rows(),
+                 [&](std::size_t from, std::size_t to, std::size_t length) {
+                   for (std::size_t k = 0; k < length; ++k)
+                     dst[to + k] += src[from + k];
+                 });
   }
 
-  std::optional<matrix> stretched_out_;
   std::size_t filter_size_;
+  std::size_t input_channels_;
 };
 
 class activation_layer : public layer {
 public:
   explicit activation_layer(std::string_view name = "") : layer(name) {}
-  vector gradient(matrix_view input, matrix_view backprop) override {
-    return vector({0});
-  }
-  vector_view parameters() const override { return vector({0}); }
-}; // namespace xylo
+};
 
 class relu_activation : public activation_layer {
 public:
@@ -361,7 +516,8 @@ public:
     }
     return result;
   }
-  matrix backward(matrix_view input, matrix_view backprop) override {
+  matrix backward(matrix_view input, matrix_view output,
+                  matrix_view backprop) override {
     matrix result({backprop.num_rows(), backprop.num_cols()});
     vector_view input_flattened = flatten(input);
     vector_view backprop_flattened = flatten(backprop);
@@ -371,9 +527,14 @@ public:
       result_flattened[i] = input_flattened[i] > 0 ? backprop_flattened[i] : 0;
       num_dead += input_flattened[i] > 0 ? 0 : 1;
     }
-    // lg() << name_ << " dead fraction: " << num_dead / result.size();
+    XENO_LOG_EVERY_T(debug, 1)
+        << name_ << " dead fraction: " << num_dead / result.size();
     return result;
   }
+
+  std::uint64_t flops(pass p, matrix_view input) const override {
+    return p == pass::gradient ? 0 : input.num_rows() * input.num_cols();
+  }
 };
 
 class softmax_layer : public layer {
@@ -381,53 +542,41 @@ public:
   explicit softmax_layer(std::string_view name = "") : layer(name) {}
   matrix forward(matrix_view input) override {
     matrix result({input.num_rows(), input.num_cols()});
-    matrix exponentials({input.num_rows(), input.num_cols()});
-    exp(flatten(input), flatten(exponentials));
-
-    for (std::size_t i = 0; i < input.num_rows(); ++i) {
-      float sum = ::sum(exponentials[i]);
-      result[i] = exponentials[i] / sum;
-    }
+    softmax(input, result);
     return result;
   }
-  matrix backward(matrix_view input, matrix_view backprop) override {
-    std::size_t batch_size = input.num_rows();
-    std::size_t signal_length = input.num_cols();
-
-    matrix result({batch_size, signal_length});
-    matrix sigmas = forward(input);
-
-    for (std::size_t i = 0; i < batch_size; ++i) {
-      vector_view signal = sigmas[i];
-      vector_view grads = backprop[i];
-      matrix quadratic = ::matmul(fold<2>(signal, {signal_length, 1}),
-                                  fold<2>(signal, {1, signal_length}));
-
-      matrix linear{signal_length, signal_length};
-      for (std::size_t j = 0; j < signal_length; ++j) {
-        for (std::size_t k = 0; k < signal_length; ++k) {
-          linear[j][k] = (j == k) ? signal[j] : 0.0f;
-        }
-      }
-      matrix partial_diff = linear - quadratic;
-      result[i] = flatten(
-          ::matmul_transposed(partial_diff, grads.fold(1, signal_length)));
+  // With s the softmax and g the incoming gradient, the Jacobian-vector
+  // product diag(s) g - s s^T g is s * (g - <s, g>).
+  matrix backward(matrix_view input, matrix_view output,
+                  matrix_view backprop) override {
+    matrix result({backprop.num_rows(), backprop.num_cols()});
+    for (std::size_t i = 0; i < backprop.num_rows(); ++i) {
+      vector_view s = output[i];
+      vector_view g = backprop[i];
+      assign(result[i], (lazy(g) - ::dot(s, g)) * lazy(s));
     }
     return result;
   }
-  vector gradient(matrix_view input, matrix_view backprop) override {
-    return vector({0});
+
+  // Forward takes the max, the exponentials, their sum and the division;
+  // backward the dot product, a subtraction and a multiplication.
+  std::uint64_t flops(pass p, matrix_view input) const override {
+    return p == pass::gradient ? 0 : 4 * input.num_rows() * input.num_cols();
   }
-  vector_view parameters() const override { return vector({0}); }
 };
 
 class softmax_cross_entropy_layer : public softmax_layer {
 public:
   explicit softmax_cross_entropy_layer(std::string_view name = "")
       : softmax_layer(name) {}
-  matrix backward(matrix_view input, matrix_view backprop) override {
+  matrix backward(matrix_view input, matrix_view output,
+                  matrix_view backprop) override {
     return matrix(backprop);
   }
+
+  std::uint64_t flops(pass p, matrix_view input) const override {
+    return p == pass::forward ? softmax_layer::flops(p, input) : 0;
+  }
 };
 
 class matrix_var {
@@ -464,16 +613,35 @@ private:
   std::unique_ptr<vector> holder_;
 };
 
+// The model owns one contiguous buffer with the parameters of all its layers,
+// in order, and one laid out the same way for their gradient. Layers only hold
+// views into the former.
 class model {
 public:
   void add_layer(std::unique_ptr<layer> &&l) {
     layers_.emplace_back(std::move(l));
+    profile_names_.emplace_back(layers_.back()->name());
+    if (profile_names_.back().empty())
+      profile_names_.back() = "layer" + std::to_string(layers_.size() - 1);
+
+    // Binding copies out of the old buffer, so keep it until we're done.
+    auto parameters = std::make_unique<vector>(parameter_size());
+    std::size_t curr_offset = 0;
+    for (const auto &layer : layers_) {
+      const std::size_t layer_size = layer->parameters().size();
+      layer->bind_parameters(slice(*parameters, curr_offset, layer_size));
+      curr_offset += layer_size;
+    }
+    parameters_ = std::move(parameters);
+    borrowed_.reset();
+    gradient_ = std::make_unique<vector>(parameters_->size());
   }
 
   matrix eval(matrix_view batch) const {
     matrix_var input = matrix(batch);
     for (std::size_t i = 0; i < layers_.size(); ++i) {
-      input = layers_[i]->forward(input.value());
+      input = profiled(i, layer::pass::forward, input.value(),
+                       [&]() { return layers_[i]->forward(input.value()); });
     }
     return input.value();
   }
@@ -482,54 +650,104 @@ public:
     std::vector<matrix> input;
     input.emplace_back(batch);
     for (std::size_t i = 0; i < layers_.size(); ++i) {
-      input.emplace_back(layers_[i]->forward(input[i]));
+      input.emplace_back(profiled(i, layer::pass::forward, input[i], [&]() {
+        return layers_[i]->forward(input[i]);
+      }));
     }
     return input;
   }
 
   void set_parameters(vector_view parameters) {
-    std::size_t curr_offset = 0;
-    for (const auto &layer : layers_) {
-      std::size_t layer_size = layer->parameters().size();
-      layer->parameters() = slice(parameters, curr_offset, layer_size);
-      curr_offset += layer_size;
-    }
+    vector_view current = this->parameters();
+    current = parameters;
   }
 
-  vector parameters() {
-    vector result({parameter_size()});
+  // Makes storage the parameters of the model, as they are, without copying.
+  // It has to outlive the model, or its next add_layer(), which goes back to
+  // a buffer of the model's own.
+  void borrow_parameters(vector_view storage) {
+    if (storage.size() != parameters_->size())
+      throw xeno::error("different tensor shapes.");
     std::size_t curr_offset = 0;
     for (const auto &layer : layers_) {
       const std::size_t layer_size = layer->parameters().size();
-      slice(result, curr_offset, layer_size) = layer->parameters();
+      layer->borrow_parameters(slice(storage, curr_offset, layer_size));
       curr_offset += layer_size;
     }
-    return result;
+    borrowed_.emplace(storage);
+  }
+
+  // Writing through the view updates the layers in place.
+  vector_view parameters() const {
+    if (borrowed_)
+      return *borrowed_;
+    return *parameters_;
   }
 
-  vector gradient(const std::vector<matrix> &input,
-                  const matrix &target) const {
-    vector result(parameter_size());
-    matrix_var backprop = target;
-    std::size_t curr_offset = result.size();
+  // Called with the offset and size of a layer's part of the gradient once it
+  // is final, for every layer from the last to the first, so that it can be
+  // passed on while the backward pass goes on.
+  using layer_done_func = std::function<void(std::size_t, std::size_t)>;
+
+  // activations is what forward() returned, the output included. The view
+  // stays valid, and is overwritten by the next call.
+  vector_view gradient(const std::vector<matrix> &activations,
+                       matrix_view target, const layer_done_func &done = {}) {
+    gradient(activations, target, *gradient_, done);
+    return *gradient_;
+  }
+
+  // Into out, laid out like parameters(), instead of the model's own buffer.
+  // Safe to call from several threads at once, for different parts of one
+  // batch.
+  void gradient(const std::vector<matrix> &activations, matrix_view target,
+                vector_view out, const layer_done_func &done = {}) const {
+    if (out.size() != parameters().size())
+      throw xeno::error("different tensor shapes.");
+    matrix_var backprop = matrix(target);
+    std::size_t curr_offset = out.size();
 
     for (std::size_t i = layers_.size() - 1; i > 0; --i) {
       const auto &layer = layers_[i];
       const std::size_t layer_size = layer->parameters().size();
 
-      slice(result, curr_offset - layer_size, layer_size) =
-          layer->gradient(input[i], backprop.value());
-      backprop = layer->backward(input[i], backprop.value());
+      profiled(i, layer::pass::gradient, activations[i], [&]() {
+        layer->gradient(activations[i], backprop.value(),
+                        slice(out, curr_offset - layer_size, layer_size));
+      });
+      if (done)
+        done(curr_offset - layer_size, layer_size);
+      backprop = profiled(i, layer::pass::backward, activations[i], [&]() {
+        return layer->backward(activations[i], activations[i + 1],
+                               backprop.value());
+      });
       curr_offset -= layer_size;
     }
-    slice(result, 0, layers_[0]->parameters().size()) =
-        layers_[0]->gradient(input[0], backprop.value());
-    return result;
+    profiled(0, layer::pass::gradient, activations[0], [&]() {
+      layers_[0]->gradient(activations[0], backprop.value(),
+                           slice(out, 0, layers_[0]->parameters().size()));
+    });
+    if (done)
+      done(0, layers_[0]->parameters().size());
   }
 
   std::span<std::unique_ptr<layer>> layers() { return layers_; }
+  std::span<const std::unique_ptr<layer>> layers() const { return layers_; }
 
 private:
+  // Runs f, pass p of layer i on a batch with input input, and profiles it
+  // under the layer's name, or its index if it has none.
+  template <typename F>
+  std::invoke_result_t<F &> profiled(std::size_t i, layer::pass p,
+                                     matrix_view input, F &&f) const {
+    static constexpr std::string_view phases[] = {"forward", "backward",
+                                                  "gradient"};
+    profile_scope scope(profile_names_[i], phases[static_cast<int>(p)]);
+    if (scope)
+      scope.add_flops(layers_[i]->flops(p, input));
+    return f();
+  }
+
   std::size_t parameter_size() const {
     std::size_t size = 0;
     for (const auto &layer : layers_) {
@@ -539,6 +757,11 @@ private:
   }
 
   std::vector<std::unique_ptr<layer>> layers_;
+  std::vector<std::string> profile_names_;
+  std::unique_ptr<vector> parameters_ = std::make_unique<vector>(0);
+  // Where the parameters are instead, if borrowed.
+  std::optional<vector_view> borrowed_;
+  std::unique_ptr<vector> gradient_ = std::make_unique<vector>(0);
 };
 
 // output, external info per batch (e.g. label)
@@ -585,32 +808,336 @@ matrix softmax_cross_entropy_loss_grad(matrix_view truth, matrix_view output) {
   return output - truth;
 }
 
+// Mean cross entropy of softmax(logits) against labels, computed from the
+// logits as logsumexp(x) - x[label], so it stays finite where the softmax
+// underflows. grad gets softmax(logits) - one_hot(labels), the gradient of the
+// summed loss with respect to the logits, in the same pass.
+template <typename T>
+float softmax_cross_entropy(std::span<const T> labels, matrix_view logits,
+                            matrix_view grad) {
+  if (labels.size() != logits.num_rows() ||
+      grad.num_rows() != logits.num_rows() ||
+      grad.num_cols() != logits.num_cols())
+    throw xeno::error("different tensor shapes.");
+  float loss = 0;
+  for (std::size_t i = 0; i < labels.size(); ++i) {
+    vector_view x = logits[i];
+    vector_view g = grad[i];
+    const float m = ::max(x);
+    assign(g, exp(lazy(x) - m));
+    const float z = ::sum(g);
+    loss += ::logf(z) + m - x[labels[i]];
+    g *= 1 / z;
+    g[labels[i]] -= 1;
+  }
+  return loss / labels.size();
+}
+
 // class
 class optimizer {
 public:
   optimizer(model &m, float rate) : model_(m), rate_(rate) {}
   void set_rate(float rate) { rate_ = rate; }
 
-  void step(matrix_view input, const loss_grad_func &loss_grad) {
-    std::vector<matrix> inputs = model_.forward(input);
-
-    matrix output = inputs.back();
-    inputs.pop_back();
+  // Splits the batch of each step into up to max_shards shards of at least
+  // min_shard_rows rows, which go through the model at the same time on
+  // default_thread_pool(), each with a workspace of its own. Their gradients
+  // are then summed. 0 is a shard for every thread of the pool and the caller;
+  // 1, the default, keeps steps on the calling thread.
+  //
+  // The loss gradient still sees the whole output at once, but the layers
+  // have to treat the rows of a batch independently, as all of ours do.
+  void set_shards(std::size_t max_shards, std::size_t min_shard_rows = 16) {
+    max_shards_ = max_shards;
+    min_shard_rows_ = std::max<std::size_t>(min_shard_rows, 1);
+  }
 
-    matrix target = loss_grad(output);
+  // Called with the gradient of every step before the update, and may change
+  // it in place, e.g. to sum it over the processes of a distributed job.
+  //
+  // With a bucket_size, reduce is handed the gradient in buckets instead: runs
+  // of whole layers, from the last, of at least bucket_size floats but for the
+  // first layers, each as soon as the backward pass is done with it. It runs
+  // on a thread of the optimizer's own while the backward pass goes on, so it
+  // has to work element by element, as a sum does. Processes whose models are
+  // built alike get the same buckets in the same order.
+  void set_gradient_reduce(std::function<void(vector_view)> reduce,
+                           std::size_t bucket_size = 0) {
+    reducer_.reset();
+    reduce_ = std::move(reduce);
+    bucket_size_ = bucket_size;
+    if (reduce_ && bucket_size_ > 0)
+      reducer_ = std::make_unique<bucket_reducer>(reduce_);
+  }
 
-    vector gradient = model_.gradient(inputs, target);
-    vector parameters = next_parameters(model_.parameters(), gradient, rate_);
-    model_.set_parameters(parameters);
+  void step(matrix_view input, const loss_grad_func &loss_grad) {
+    profile_scope profile("optimizer", "step");
+    const std::size_t shards = num_shards(input.num_rows());
+    if (shards > 1) {
+      sharded_step(input, loss_grad, shards);
+      return;
+    }
+    // Activations, backprops and loss gradients all die with the step.
+    workspace_scope scope;
+    std::vector<matrix> activations = model_.forward(input);
+    matrix target = loss_grad(activations.back());
+
+    if (!reducer_) {
+      reduce_and_update(model_.gradient(activations, target));
+      return;
+    }
+    const std::size_t num_parameters = model_.parameters().size();
+    if (!gradient_ || gradient_->size() != num_parameters) {
+      heap_scope heap;
+      gradient_ = std::make_unique<vector>(num_parameters);
+    }
+    model_.gradient(activations, target, *gradient_,
+                    reduce_buckets(*gradient_));
+    reduce_and_update(*gradient_);
   }
 
 protected:
-  virtual vector next_parameters(const vector &parameters,
-                                 const vector &gradient, float rate) = 0;
+  // Updates parameters in place.
+  virtual void update(vector_view parameters, vector_view gradient,
+                      float rate) = 0;
 
 private:
+  // Runs reduce over the buckets it is handed, in order, on a thread of its
+  // own.
+  class bucket_reducer {
+  public:
+    explicit bucket_reducer(std::function<void(vector_view)> reduce)
+        : reduce_(std::move(reduce)), thread_("reduce") {
+      thread_.run([this]() { run(); });
+    }
+
+    ~bucket_reducer() {
+      {
+        std::lock_guard l(mutex_);
+        stop_ = true;
+      }
+      cv_.notify_all();
+      thread_.join();
+    }
+
+    bucket_reducer(const bucket_reducer &) = delete;
+    void operator=(const bucket_reducer &) = delete;
+
+    void submit(vector_view bucket) {
+      {
+        std::lock_guard l(mutex_);
+        buckets_.push_back(bucket);
+      }
+      cv_.notify_all();
+    }
+
+    // Blocks until every bucket handed in is reduced, and rethrows what
+    // reduce threw, if it did. The buckets after that one are skipped.
+    void wait() {
+      std::unique_lock l(mutex_);
+      cv_.wait(l, [this]() { return buckets_.empty() && !busy_; });
+      if (error_)
+        std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+
+  private:
+    void run() {
+      std::unique_lock l(mutex_);
+      for (;;) {
+        cv_.wait(l, [this]() { return stop_ || !buckets_.empty(); });
+        if (buckets_.empty())
+          return;
+        const vector_view bucket = buckets_.front();
+        buckets_.pop_front();
+        const bool skip = error_ != nullptr;
+        busy_ = true;
+        l.unlock();
+        std::exception_ptr error;
+        try {
+          if (!skip)
+            reduce_(bucket);
+        } catch (...) {
+          error = std::current_exception();
+        }
+        l.lock();
+        busy_ = false;
+        if (error)
+          error_ = error;
+        cv_.notify_all();
+      }
+    }
+
+    std::function<void(vector_view)> reduce_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<vector_view> buckets_;
+    bool busy_ = false;
+    bool stop_ = false;
+    std::exception_ptr error_;
+    xeno::sys::thread thread_;
+  };
+
+  // For model::gradient: hands gradient to reducer_ in buckets, as the layers
+  // are done with it.
+  model::layer_done_func reduce_buckets(vector_view gradient) {
+    return [this, gradient, end = gradient.size()](std::size_t offset,
+                                                   std::size_t) mutable {
+      if (offset < end && (end - offset >= bucket_size_ || offset == 0)) {
+        reducer_->submit(slice(gradient, offset, end - offset));
+        end = offset;
+      }
+    };
+  }
+
+  void reduce_and_update(vector_view gradient) {
+    if (reducer_) {
+      // Only what is left of the reduction once the backward pass is done.
+      profile_scope profile("optimizer", "reduce");
+      reducer_->wait();
+    } else if (reduce_) {
+      profile_scope profile("optimizer", "reduce");
+      reduce_(gradient);
+    }
+    profile_scope profile("optimizer", "update");
+    update(model_.parameters(), gradient, rate_);
+  }
+
+  struct shard {
+    // Holds the activations from the forward pass to the backward one, which
+    // may run on another thread.
+    workspace activations_workspace;
+    std::vector<matrix> activations;
+    std::unique_ptr<vector> gradient;
+  };
+
+  // Summed in blocks this long, so that the blocks of all shards stay in
+  // cache through the whole reduction.
+  static constexpr std::size_t reduce_block = 4096;
+
+  std::size_t num_shards(std::size_t rows) const {
+    if (max_shards_ == 1)
+      return 1;
+    const std::size_t threads =
+        max_shards_ != 0 ? max_shards_
+                         : xeno::sys::default_thread_pool().size() + 1;
+    return std::min(threads, rows / min_shard_rows_);
+  }
+
+  void sharded_step(matrix_view input, const loss_grad_func &loss_grad,
+                    std::size_t num_shards) {
+    const std::size_t rows = input.num_rows();
+    const std::size_t num_parameters = model_.parameters().size();
+    while (shards_.size() < num_shards)
+      shards_.emplace_back(std::make_unique<shard>());
+    for (std::size_t i = 0; i < num_shards; ++i) {
+      shard &s = *shards_[i];
+      s.activations.clear();
+      s.activations_workspace.clear();
+      if (!s.gradient || s.gradient->size() != num_parameters) {
+        heap_scope heap;
+        s.gradient = std::make_unique<vector>(num_parameters);
+      }
+    }
+    // Shard i has rows [first_row(i), first_row(i + 1)).
+    auto first_row = [&](std::size_t i) { return i * rows / num_shards; };
+    auto shard_rows = [&](matrix_view m, std::size_t i) {
+      const std::size_t width = m.num_cols();
+      const std::size_t begin = first_row(i), size = first_row(i + 1) - begin;
+      return fold<2>(slice(flatten(m), begin * width, size * width),
+                     {size, width});
+    };
+    xeno::sys::thread_pool &pool = xeno::sys::default_thread_pool();
+    // Every shard is already a thread's worth of work.
+    auto for_each_shard = [&](auto &&f) {
+      pool.parallel_for(0, num_shards, [&](std::size_t begin, std::size_t end) {
+        scoped_num_threads single(1);
+        for (std::size_t i = begin; i < end; ++i) {
+          shard &s = *shards_[i];
+          workspace_binding binding(s.activations_workspace);
+          f(i, s);
+        }
+      });
+    };
+
+    workspace_scope scope;
+    for_each_shard([&](std::size_t i, shard &s) {
+      s.activations = model_.forward(shard_rows(input, i));
+    });
+
+    const std::size_t output_cols =
+        matrix_view(shards_[0]->activations.back()).num_cols();
+    matrix output(std::array<std::size_t, 2>{rows, output_cols});
+    for (std::size_t i = 0; i < num_shards; ++i)
+      flatten(shard_rows(output, i)) = flatten(shards_[i]->activations.back());
+    const matrix target = loss_grad(output);
+
+    if (!reducer_) {
+      for_each_shard([&](std::size_t i, shard &s) {
+        model_.gradient(s.activations, shard_rows(target, i), *s.gradient);
+      });
+      sum_shards(num_shards, 0, num_parameters);
+      reduce_and_update(*shards_[0]->gradient);
+      return;
+    }
+
+    // A layer's part of the sum is final once every shard is done with it.
+    // The last one sums it into shard 0's gradient and hands it on. The
+    // layers still go in order: the shard that is last with a layer has to
+    // get through that before it can be done with the next.
+    std::mutex mutex;
+    std::vector<std::size_t> done(model_.layers().size());
+    const model::layer_done_func reduce = reduce_buckets(*shards_[0]->gradient);
+    for_each_shard([&](std::size_t i, shard &s) {
+      std::size_t layer = 0;
+      model_.gradient(s.activations, shard_rows(target, i), *s.gradient,
+                      [&](std::size_t offset, std::size_t size) {
+                        {
+                          std::lock_guard l(mutex);
+                          if (++done[layer++] < num_shards)
+                            return;
+                        }
+                        sum_shards(num_shards, offset, offset + size);
+                        std::lock_guard l(mutex);
+                        reduce(offset, size);
+                      });
+    });
+    reduce_and_update(*shards_[0]->gradient);
+  }
+
+  // Pairwise over [first, last), block by block: at each level shard i takes
+  // in shard i + stride, until shard 0 has the sum.
+  void sum_shards(std::size_t num_shards, std::size_t first,
+                  std::size_t last) {
+    profile_scope profile("optimizer", "sum_shards");
+    const std::size_t num_blocks = (last - first + reduce_block - 1) /
+                                   reduce_block;
+    xeno::sys::default_thread_pool().parallel_for(
+        0, num_blocks, [&](std::size_t begin, std::size_t end) {
+          for (std::size_t b = begin; b < end; ++b) {
+            const std::size_t offset = first + b * reduce_block;
+            const std::size_t size = std::min(reduce_block, last - offset);
+            for (std::size_t stride = 1; stride < num_shards; stride *= 2) {
+              for (std::size_t i = 0; i + stride < num_shards;
+                   i += 2 * stride) {
+                vector_view sum = slice(*shards_[i]->gradient, offset, size);
+                sum += slice(*shards_[i + stride]->gradient, offset, size);
+              }
+            }
+          }
+        });
+  }
+
   float rate_;
   model &model_;
+  std::size_t max_shards_ = 1;
+  std::size_t min_shard_rows_ = 16;
+  std::vector<std::unique_ptr<shard>> shards_;
+  std::function<void(vector_view)> reduce_;
+  // Set with reduce_ when it takes buckets.
+  std::size_t bucket_size_ = 0;
+  std::unique_ptr<bucket_reducer> reducer_;
+  // The gradient of a step that isn't sharded, when it goes in buckets.
+  std::unique_ptr<vector> gradient_;
 };
 
 class sgd_optimizer : public optimizer {
@@ -619,9 +1146,10 @@ public:
       : optimizer(m, rate), weight_decay_(weight_decay) {}
 
 protected:
-  vector next_parameters(const vector &parameters, const vector &gradient,
-                         float rate) override {
-    return parameters * (1 - weight_decay_) - gradient * rate;
+  void update(vector_view parameters, vector_view gradient,
+              float rate) override {
+    assign(parameters,
+           lazy(parameters) * (1 - weight_decay_) - lazy(gradient) * rate);
   }
 
   float weight_decay_;
@@ -633,9 +1161,10 @@ public:
       : optimizer(m, rate), velocity_{vector(0)} {}
 
 protected:
-  vector next_parameters(const vector &parameters, const vector &gradient,
-                         float rate) override {
+  void update(vector_view parameters, vector_view gradient,
+              float rate) override {
     if (velocity_->size() == 0) {
+      heap_scope heap;
       velocity_.emplace(parameters.size());
       *velocity_ = 0;
     }
@@ -646,7 +1175,7 @@ protected:
     velocity *= rho_;
     velocity += gradient;
 
-    return parameters - velocity * rate;
+    assign(parameters, lazy(parameters) - lazy(velocity) * rate);
   }
 
 private:
@@ -663,13 +1192,15 @@ public:
         second_moment_(vector({0})), beta1_(beta1), beta2_(beta2) {}
 
 protected:
-  vector next_parameters(const vector &parameters, const vector &gradient,
-                         float rate) override {
+  void update(vector_view parameters, vector_view gradient,
+              float rate) override {
     if (first_moment_->size() == 0) {
+      heap_scope heap;
       first_moment_.emplace(parameters.size());
       *first_moment_ = 0;
     }
     if (second_moment_->size() == 0) {
+      heap_scope heap;
       second_moment_.emplace(parameters.size());
       *second_moment_ = 0;
     }
@@ -677,16 +1208,21 @@ protected:
     vector_view first_moment(*first_moment_);
     vector_view second_moment(*second_moment_);
 
-    first_moment = first_moment * beta1_ + gradient * (1 - beta1_);
-    second_moment = second_moment * beta2_ + gradient * gradient * (1 - beta2_);
+    assign(first_moment,
+           lazy(first_moment) * beta1_ + lazy(gradient) * (1 - beta1_));
+    assign(second_moment, lazy(second_moment) * beta2_ +
+                              lazy(gradient) * lazy(gradient) * (1 - beta2_));
 
-    vector first_unbias = first_moment / (1 - powf(beta1_, t));
-    vector second_unbias = second_moment / (1 - powf(beta2_, t));
+    // Fold the bias corrections into the scalars, so the update is one pass.
+    const float first_unbias = rate / (1 - powf(beta1_, t));
+    const float second_unbias = 1 / (1 - powf(beta2_, t));
 
     t += 1;
 
-    vector delta = first_unbias * rate / (::sqrt(second_unbias) + 1e-7);
-    return parameters - first_unbias * rate / (::sqrt(second_unbias) + 1e-7);
+    assign(parameters,
+           lazy(parameters) - lazy(first_moment) * first_unbias /
+                                  (sqrt(lazy(second_moment) * second_unbias) +
+                                   1e-7f));
   }
 
 private:
@@ -1,5 +1,21 @@
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <unordered_map>
+
 #include "xylo/tensor.h"
+#include <xylo/accumulator.h>
+#include <xylo/inference.h>
+#include <xylo/minibatch.h>
+#include <xylo/quantize.h>
 #include <xylo/rl.h>
+#include <xylo/static_nn.h>
 
 namespace xylo {
 
@@ -58,7 +74,8 @@ inline matrix kl_regulated_loss(const std::vector<A> &actions,
   int i = 0;
   matrix action_matrix({actions.size(), A::cardinality()});
   for (vector_view v : matrix_view(action_matrix)) {
-    v = *(actions[i++].distrib);
+    const auto &distrib = *actions[i++].distrib;
+    std::copy(distrib.begin(), distrib.end(), v.begin());
   }
   matrix regulation =
       softmax_cross_entropy_loss_grad(action_matrix, orig_action_matrix);
@@ -96,8 +113,7 @@ public:
     // Takes stuff from the replay buffer, calculate advantages and take a step
     // toward a better action policy.
 
-    std::vector<td<A, S>> experience =
-        learner<A, S>::replay_buffer_.sample_td();
+    std::vector<td<A, S>> experience = this->sample();
 
     std::size_t total_num_transitions = num_transitions(experience);
     std::size_t state_length = S::length();
@@ -115,7 +131,11 @@ public:
       }
     }
 
-    vector advantages = get_advantages(experience);
+    vector advantages = [&]() {
+      profile_scope profile("learner", "advantage");
+      return get_advantages(experience);
+    }();
+    profile_scope profile("learner", "action");
     this->policy_optimizer_.step(state_matrix,
                                  [&](xylo::matrix_view v) -> matrix {
                                    return policy_loss(actions, advantages, v);
@@ -158,29 +178,48 @@ public:
 
   virtual void learn() override {
     // TODO: fill out this part.
-    std::vector<td<A, S>> experience =
-        learner<A, S>::replay_buffer_.sample_td();
+    std::vector<td<A, S>> experience = this->sample();
 
     std::size_t state_length = S::length();
     std::size_t total_num_transitions = num_transitions(experience);
 
-    // Adding a few end states.
-    matrix state_matrix(
-        {total_num_transitions + experience.size(), state_length});
+    // Adding a few end states. That is the layout an encoding replay buffer
+    // already keeps its rows in, so then there is nothing to convert.
+    std::optional<matrix_view> encoded =
+        learner<A, S>::replay_buffer_.encoded_states();
+    std::optional<matrix> converted;
+    if (!encoded) {
+      converted.emplace(std::array<std::size_t, 2>{
+          total_num_transitions + experience.size(), state_length});
+      encoded.emplace(*converted);
+    }
+    matrix_view state_matrix = *encoded;
     std::vector<A> actions;
+    actions.reserve(total_num_transitions + experience.size());
 
     std::size_t curr = 0;
     for (const auto &traj : experience) {
       for (const auto &transition : traj) {
-        transition.start_state->to_vector(state_matrix[curr++]);
+        if (converted)
+          transition.start_state->to_vector(state_matrix[curr]);
+        ++curr;
         actions.push_back(transition.action);
       }
       actions.push_back(actions.back());
-      traj.back().end_state.to_vector(state_matrix[curr++]);
+      if (converted)
+        traj.back().end_state.to_vector(state_matrix[curr]);
+      ++curr;
     }
 
-    update_value_model(experience, state_matrix);
-    vector advantage = calculate_advantage(experience, state_matrix);
+    {
+      profile_scope profile("learner", "value");
+      update_value_model(experience, state_matrix);
+    }
+    vector advantage = [&]() {
+      profile_scope profile("learner", "advantage");
+      return calculate_advantage(experience, state_matrix);
+    }();
+    profile_scope profile("learner", "action");
     optimize_action(state_matrix, actions, advantage);
   }
 
@@ -281,55 +320,102 @@ public:
   }
 
 protected:
+  // Runs f(states, actions, advantage) on every minibatch the schedule cuts
+  // out of the batch. Actions and advantages are gathered into buffers that
+  // are kept from step to step, unless the minibatch is the whole batch.
+  template <typename F>
+  void for_each_minibatch(minibatch_schedule &schedule,
+                          matrix_view state_matrix,
+                          const std::vector<A> &actions, vector_view advantage,
+                          F &&f) {
+    schedule.run(state_matrix, [&](std::span<const std::size_t> rows,
+                                   matrix_view states) {
+      if (rows.size() == actions.size()) {
+        f(states, actions, advantage);
+        return;
+      }
+      minibatch_actions_.clear();
+      if (!minibatch_advantage_ || minibatch_advantage_->size() < rows.size()) {
+        heap_scope heap;
+        minibatch_advantage_ = std::make_unique<vector>(actions.size());
+      }
+      vector_view gathered = slice(*minibatch_advantage_, 0, rows.size());
+      for (std::size_t i = 0; i < rows.size(); ++i) {
+        minibatch_actions_.push_back(actions[rows[i]]);
+        gathered[i] = advantage[rows[i]];
+      }
+      f(states, minibatch_actions_, gathered);
+    });
+  }
+
   model &value_model_;
   optimizer &value_optimizer_;
   float lambda_ = 0.95;
+
+private:
+  std::vector<A> minibatch_actions_;
+  std::unique_ptr<vector> minibatch_advantage_;
 };
 
 template <typename A, typename S>
 class ppo_learner : public actor_critic_learner<A, S> {
 public:
+  // Every step makes epochs passes over the experience, in minibatches of
+  // minibatch_size transitions, or the whole of it if that's 0.
   ppo_learner(replay_buffer<A, S> &rb, model &action_model,
               optimizer &action_optimizer, model &value_model,
-              optimizer &value_optimizer, float gamma = 0.99)
+              optimizer &value_optimizer, float gamma = 0.99,
+              std::size_t epochs = 4, std::size_t minibatch_size = 0)
       : actor_critic_learner<A, S>(rb, action_model, action_optimizer,
-                                   value_model, value_optimizer, gamma) {}
+                                   value_model, value_optimizer, gamma),
+        schedule_(epochs, minibatch_size) {}
   virtual void optimize_action(matrix_view state_matrix,
                                const std::vector<A> &actions,
                                vector_view advantage) {
-    constexpr std::size_t k = 4;
-    for (std::size_t i = 0; i < k; ++i) {
-      this->policy_optimizer_.step(
-          state_matrix, [&](xylo::matrix_view v) -> matrix {
-            return surrogate_loss(actions, advantage, v);
-          });
-    }
+    this->for_each_minibatch(
+        schedule_, state_matrix, actions, advantage,
+        [&](matrix_view states, const std::vector<A> &actions,
+            vector_view advantage) {
+          this->policy_optimizer_.step(
+              states, [&](xylo::matrix_view v) -> matrix {
+                return surrogate_loss(actions, advantage, v);
+              });
+        });
   }
+
+private:
+  minibatch_schedule schedule_;
 };
 
 template <typename A, typename S>
 class kl_ppo_learner : public actor_critic_learner<A, S> {
 public:
+  // See ppo_learner.
   kl_ppo_learner(replay_buffer<A, S> &rb, model &action_model,
                  optimizer &action_optimizer, model &value_model,
-                 optimizer &value_optimizer, float gamma = 0.99)
+                 optimizer &value_optimizer, float gamma = 0.99,
+                 std::size_t epochs = 4, std::size_t minibatch_size = 0)
       : actor_critic_learner<A, S>(rb, action_model, action_optimizer,
-                                   value_model, value_optimizer, gamma) {}
+                                   value_model, value_optimizer, gamma),
+        schedule_(epochs, minibatch_size) {}
   virtual void optimize_action(matrix_view state_matrix,
                                const std::vector<A> &actions,
                                vector_view advantage) {
-    constexpr std::size_t k = 4;
-    for (std::size_t i = 0; i < k; ++i) {
-      this->policy_optimizer_.step(
-          state_matrix, [&](xylo::matrix_view v) -> matrix {
-            matrix loss =
-                kl_regulated_loss(actions, advantage, d_targ_, beta_, v);
-            return loss;
-          });
-    }
+    this->for_each_minibatch(
+        schedule_, state_matrix, actions, advantage,
+        [&](matrix_view states, const std::vector<A> &actions,
+            vector_view advantage) {
+          this->policy_optimizer_.step(
+              states, [&](xylo::matrix_view v) -> matrix {
+                matrix loss =
+                    kl_regulated_loss(actions, advantage, d_targ_, beta_, v);
+                return loss;
+              });
+        });
   }
 
 private:
+  minibatch_schedule schedule_;
   float beta_ = 1;
   float d_targ_ = 1e-9;
 };
@@ -337,38 +423,273 @@ private:
 template <typename A, typename S>
 class policy_gradient_policy : public policy<A, S> {
 public:
-  policy_gradient_policy(model &m) : m_(m) {}
+  // The model's layers have to be in place by now; its weights may keep
+  // changing.
+  policy_gradient_policy(model &m) : compiled_(m) {}
 
 protected:
   A react(const S &state) const override {
-    vector state_vector = to_vector(state);
-    matrix action_vector =
-        m_.eval(fold<2>(state_vector, {1, state_vector.size()}));
+    auto context = contexts_.acquire(state.length());
+    state.to_vector(context->input()[0]);
     A action;
-    action.from_vector(flatten(action_vector));
+    action.from_vector(context->eval()[0]);
     return action;
   }
 
 private:
-  const model &m_;
+  compiled_model compiled_;
+  mutable inference_context_pool contexts_{compiled_};
 };
 
 template <typename A, typename S>
 class policy_gradient_deterministic_policy : public policy<A, S> {
 public:
-  policy_gradient_deterministic_policy(model &m) : m_(m) {}
+  policy_gradient_deterministic_policy(model &m) : compiled_(m) {}
+
+protected:
+  A react(const S &state) const override {
+    auto context = contexts_.acquire(state.length());
+    state.to_vector(context->input()[0]);
+    A action;
+    action.from_vector_deterministic(context->eval()[0]);
+    return action;
+  }
+
+private:
+  compiled_model compiled_;
+  mutable inference_context_pool contexts_{compiled_};
+};
+
+// Evaluates the first layer through a first_layer_accumulator, and the rest
+// compiled. Each thread that reacts keeps an accumulator state of its own, so
+// a thread that plays one game after the other only pays for what changed
+// from one state to the next. Like the quantized policy, it works on a copy of
+// the first layer: update() takes in the model's weights again, and mustn't
+// run while anyone reacts.
+template <typename A, typename S>
+class accumulator_policy : public policy<A, S> {
+public:
+  accumulator_policy(model &m, bool deterministic = false)
+      : accumulator_(m, S::length()), rest_(m, accumulator_.rest()),
+        deterministic_(deterministic) {}
+
+  void update() { accumulator_.update(); }
 
 protected:
   A react(const S &state) const override {
-    vector state_vector = to_vector(state);
-    matrix action_vector =
-        m_.eval(fold<2>(state_vector, {1, state_vector.size()}));
+    thread_state &local = local_state();
+    state.to_vector(*local.input);
+    accumulator_.advance(local.accumulated, *local.input,
+                         local.context.input()[0]);
     A action;
-    action.from_vector_deterministic(flatten(action_vector));
+    if (deterministic_) {
+      action.from_vector_deterministic(local.context.eval()[0]);
+    } else {
+      action.from_vector(local.context.eval()[0]);
+    }
     return action;
   }
 
 private:
-  const model &m_;
+  struct thread_state {
+    thread_state(const first_layer_accumulator &a, const compiled_model &rest)
+        : accumulated(a), context(rest, a.output_width()) {
+      heap_scope heap;
+      input = std::make_unique<vector>(a.input_width());
+    }
+
+    first_layer_accumulator::state accumulated;
+    inference_context context;
+    std::unique_ptr<vector> input;
+  };
+
+  thread_state &local_state() const {
+    std::lock_guard l(mutex_);
+    auto &local = states_[std::this_thread::get_id()];
+    if (!local)
+      local = std::make_unique<thread_state>(accumulator_, rest_);
+    return *local;
+  }
+
+  first_layer_accumulator accumulator_;
+  compiled_model rest_;
+  const bool deterministic_;
+
+  mutable std::mutex mutex_;
+  mutable std::unordered_map<std::thread::id, std::unique_ptr<thread_state>>
+      states_;
+};
+
+// policy_gradient_deterministic_policy on a quantized copy of the model, for
+// deployment. The copy is taken when the policy is made; update() takes the
+// model's weights again, and mustn't run while anyone reacts.
+template <typename A, typename S>
+class quantized_deterministic_policy : public policy<A, S> {
+public:
+  quantized_deterministic_policy(model &m,
+                                 weight_format format = weight_format::int8)
+      : quantized_(m, format) {}
+
+  void update() { quantized_.update(); }
+
+protected:
+  A react(const S &state) const override {
+    workspace_scope scope;
+    matrix input({1, state.length()});
+    state.to_vector(matrix_view(input)[0]);
+    A action;
+    action.from_vector_deterministic(matrix_view(quantized_.eval(input))[0]);
+    return action;
+  }
+
+private:
+  quantized_model quantized_;
+};
+
+// policy_gradient_deterministic_policy on a static_model copy of the model,
+// network, for when its shapes are known when compiling. The copy is taken
+// when the policy is made; update() takes the model's weights again, and
+// mustn't run while anyone reacts.
+template <typename A, typename S, typename network>
+class static_deterministic_policy : public policy<A, S> {
+public:
+  static_deterministic_policy(const model &m) : model_(m), network_(m) {}
+
+  void update() { network_.load(model_); }
+
+protected:
+  A react(const S &state) const override {
+    std::array<float, network::input_width> input;
+    state.to_vector(borrow_vector(input));
+    std::array<float, network::output_width> output = network_.eval(input);
+    A action;
+    action.from_vector_deterministic(borrow_vector(output));
+    return action;
+  }
+
+private:
+  const model &model_;
+  network network_;
+};
+
+// Coalesces react() calls from concurrent agents into one batched eval. A
+// caller adds its state to the open batch and waits; the call that fills the
+// batch, or the first to wait past the deadline, evaluates it for everybody.
+// There is no server thread, so a lone caller only ever waits for the
+// deadline. max_batch is best set to the number of threads that can be inside
+// react() at once, e.g. the pool's workers plus the thread waiting on them.
+template <typename A, typename S>
+class batched_policy : public policy<A, S> {
+public:
+  batched_policy(model &m, std::size_t max_batch,
+                 std::chrono::microseconds deadline,
+                 bool deterministic = false)
+      : compiled_(m), max_batch_(max_batch), deadline_(deadline),
+        deterministic_(deterministic) {
+    if (max_batch == 0)
+      throw xeno::error("batched policy needs room for a state.");
+  }
+
+protected:
+  A react(const S &state) const override {
+    std::unique_lock l(mutex_);
+    batch &b = open_batch(state.length());
+    const std::size_t row = b.size++;
+    state.to_vector(b.context.input(max_batch_)[row]);
+
+    if (b.size == max_batch_)
+      run(l, b);
+    const auto deadline = std::chrono::steady_clock::now() + deadline_;
+    while (!b.output && !b.error) {
+      // Someone else is already running it.
+      if (&b != open_) {
+        cv_.wait(l);
+      } else if (cv_.wait_until(l, deadline) == std::cv_status::timeout &&
+                 &b == open_) {
+        run(l, b);
+      }
+    }
+
+    A action;
+    const std::exception_ptr error = b.error;
+    if (!error) {
+      if (deterministic_) {
+        action.from_vector_deterministic((*b.output)[row]);
+      } else {
+        action.from_vector((*b.output)[row]);
+      }
+    }
+    // The last reader hands the batch back.
+    if (--b.unread == 0) {
+      b.size = 0;
+      b.output.reset();
+      b.error = nullptr;
+      free_.push_back(&b);
+    }
+    if (error)
+      std::rethrow_exception(error);
+    return action;
+  }
+
+private:
+  struct batch {
+    batch(const compiled_model &m, std::size_t input_width,
+          std::size_t max_batch)
+        : context(m, input_width, max_batch) {}
+
+    inference_context context;
+    std::size_t size = 0;
+    std::size_t unread = 0;
+    std::optional<matrix_view> output;
+    // Every caller in the batch rethrows what the eval threw.
+    std::exception_ptr error;
+  };
+
+  // Requires the lock.
+  batch &open_batch(std::size_t input_width) const {
+    if (!open_) {
+      if (free_.empty()) {
+        batches_.emplace_back(
+            std::make_unique<batch>(compiled_, input_width, max_batch_));
+        free_.push_back(batches_.back().get());
+      }
+      open_ = free_.back();
+      free_.pop_back();
+    }
+    if (open_->context.input_width() != input_width)
+      throw xeno::error("states of different lengths in one batch.");
+    return *open_;
+  }
+
+  // Closes b, so later callers start a new batch, and evaluates it without
+  // the lock.
+  void run(std::unique_lock<std::mutex> &l, batch &b) const {
+    open_ = nullptr;
+    b.unread = b.size;
+    l.unlock();
+    std::optional<matrix_view> output;
+    std::exception_ptr error;
+    try {
+      output.emplace(b.context.eval(b.size));
+    } catch (...) {
+      error = std::current_exception();
+    }
+    l.lock();
+    if (output)
+      b.output.emplace(*output);
+    b.error = error;
+    cv_.notify_all();
+  }
+
+  compiled_model compiled_;
+  const std::size_t max_batch_;
+  const std::chrono::microseconds deadline_;
+  const bool deterministic_;
+
+  mutable std::mutex mutex_;
+  mutable std::condition_variable cv_;
+  mutable std::vector<std::unique_ptr<batch>> batches_;
+  mutable std::vector<batch *> free_;
+  mutable batch *open_ = nullptr;
 };
 } // namespace xylo
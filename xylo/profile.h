@@ -0,0 +1,295 @@
+#ifndef XYLO_PROFILE_
+#define XYLO_PROFILE_
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <xeno/json.h>
+#include <xeno/logging.h>
+#include <xeno/sys/file_descriptor.h>
+#include <xeno/sys/thread.h>
+#include <xeno/time.h>
+#include <xylo/tensor.h>
+
+// Opt-in instrumentation of where training spends its time. While profiling
+// is on, every profile_scope records its wall time, the tensor bytes
+// allocated in it and the FLOPs it's credited with, under a name and a phase:
+// the model records the forward, backward and gradient pass of each layer by
+// the layer's name, and the optimizer and learners their own steps. Scopes
+// nest, and each counts everything inside it.
+//
+// Off, the default, a scope costs a relaxed load and a branch. On, each
+// thread adds up its records in a table of its own, so threads don't contend,
+// and collect_profile() sums the tables.
+namespace xylo {
+
+struct profile_stats {
+  static constexpr std::size_t num_buckets = 40;
+
+  std::uint64_t calls = 0;
+  std::uint64_t nanoseconds = 0;
+  std::uint64_t min_nanoseconds = std::numeric_limits<std::uint64_t>::max();
+  std::uint64_t max_nanoseconds = 0;
+  std::uint64_t flops = 0;
+  std::uint64_t bytes = 0;
+  // Calls by wall time: bucket i counts those under 2^i ns and, but for
+  // bucket 0, at least 2^(i - 1). The last one takes everything longer.
+  std::array<std::uint64_t, num_buckets> histogram{};
+
+  void add(std::uint64_t ns, std::uint64_t f, std::uint64_t b) {
+    ++calls;
+    nanoseconds += ns;
+    min_nanoseconds = std::min(min_nanoseconds, ns);
+    max_nanoseconds = std::max(max_nanoseconds, ns);
+    flops += f;
+    bytes += b;
+    ++histogram[std::min<std::size_t>(std::bit_width(ns), num_buckets - 1)];
+  }
+
+  void merge(const profile_stats &other) {
+    calls += other.calls;
+    nanoseconds += other.nanoseconds;
+    min_nanoseconds = std::min(min_nanoseconds, other.min_nanoseconds);
+    max_nanoseconds = std::max(max_nanoseconds, other.max_nanoseconds);
+    flops += other.flops;
+    bytes += other.bytes;
+    for (std::size_t i = 0; i < num_buckets; ++i)
+      histogram[i] += other.histogram[i];
+  }
+};
+
+// By name, then phase.
+using profile =
+    std::map<std::string, std::map<std::string, profile_stats, std::less<>>,
+             std::less<>>;
+
+// Behind the functions below.
+struct profile_registry {
+  struct table {
+    std::mutex mutex;
+    xylo::profile records;
+  };
+
+  static profile_registry &get() {
+    static profile_registry r;
+    return r;
+  }
+
+  // Outlives the thread, whose records stay in the profile.
+  table &local() {
+    thread_local std::shared_ptr<table> t = [this]() {
+      auto t = std::make_shared<table>();
+      std::lock_guard l(mutex);
+      tables.push_back(t);
+      return t;
+    }();
+    return *t;
+  }
+
+  std::atomic<bool> enabled = false;
+  std::mutex mutex;
+  std::vector<std::shared_ptr<table>> tables;
+};
+
+inline void set_profiling(bool on) {
+  profile_registry::get().enabled.store(on, std::memory_order_relaxed);
+}
+inline bool profiling() {
+  return profile_registry::get().enabled.load(std::memory_order_relaxed);
+}
+
+inline void record_profile(std::string_view name, std::string_view phase,
+                           std::uint64_t nanoseconds, std::uint64_t flops = 0,
+                           std::uint64_t bytes = 0) {
+  profile_registry::table &t = profile_registry::get().local();
+  std::lock_guard l(t.mutex);
+  auto by_name = t.records.find(name);
+  if (by_name == t.records.end())
+    by_name = t.records.emplace(name, profile::mapped_type()).first;
+  auto by_phase = by_name->second.find(phase);
+  if (by_phase == by_name->second.end())
+    by_phase = by_name->second.emplace(phase, profile_stats()).first;
+  by_phase->second.add(nanoseconds, flops, bytes);
+}
+
+// What every thread has recorded since the last reset.
+inline profile collect_profile() {
+  profile_registry &r = profile_registry::get();
+  std::lock_guard l(r.mutex);
+  profile result;
+  for (const auto &t : r.tables) {
+    std::lock_guard tl(t->mutex);
+    for (const auto &[name, phases] : t->records) {
+      for (const auto &[phase, stats] : phases)
+        result[name][phase].merge(stats);
+    }
+  }
+  return result;
+}
+
+inline void reset_profile() {
+  profile_registry &r = profile_registry::get();
+  std::lock_guard l(r.mutex);
+  for (const auto &t : r.tables) {
+    std::lock_guard tl(t->mutex);
+    t->records.clear();
+  }
+}
+
+// {name: {phase: {"calls", "total_ns", "mean_ns", "min_ns", "max_ns",
+// "flops", "gflops_per_s", "bytes", "histogram"}}}, the histogram as
+// [{"below_ns", "calls"}] for the buckets that have any.
+inline xeno::json::element profile_to_json(const profile &p) {
+  xeno::json::element result;
+  result.set_object({});
+  for (const auto &[name, phases] : p) {
+    for (const auto &[phase, stats] : phases) {
+      xeno::json::element &e = result[name][phase];
+      e["calls"] = std::int64_t(stats.calls);
+      e["total_ns"] = std::int64_t(stats.nanoseconds);
+      e["mean_ns"] =
+          float(stats.nanoseconds) / std::max<std::uint64_t>(stats.calls, 1);
+      e["min_ns"] = std::int64_t(stats.calls ? stats.min_nanoseconds : 0);
+      e["max_ns"] = std::int64_t(stats.max_nanoseconds);
+      e["flops"] = std::int64_t(stats.flops);
+      // FLOPs per ns are GFLOP/s.
+      e["gflops_per_s"] =
+          float(stats.flops) / std::max<std::uint64_t>(stats.nanoseconds, 1);
+      e["bytes"] = std::int64_t(stats.bytes);
+      std::vector<xeno::json::element> histogram;
+      for (std::size_t i = 0; i < stats.histogram.size(); ++i) {
+        if (stats.histogram[i] == 0)
+          continue;
+        xeno::json::element &bucket = histogram.emplace_back();
+        bucket["below_ns"] = std::int64_t(1) << i;
+        bucket["calls"] = std::int64_t(stats.histogram[i]);
+      }
+      e["histogram"].set_array(std::move(histogram));
+    }
+  }
+  return result;
+}
+
+// Writes the profile as JSON to a file next to p that is then renamed to p,
+// so that readers never see half of one.
+inline void write_profile(const std::filesystem::path &p,
+                          const profile &prof = collect_profile()) {
+  const std::string json = profile_to_json(prof).to_string();
+  std::filesystem::path temporary = p;
+  temporary += ".tmp";
+  {
+    xeno::sys::file f = xeno::sys::file::open_to_write(temporary);
+    auto bytes = std::as_bytes(std::span(json.data(), json.size()));
+    while (!bytes.empty())
+      bytes = bytes.subspan(f.write(bytes));
+  }
+  std::filesystem::rename(temporary, p);
+}
+
+// Records the time from construction to destruction, and the tensor bytes
+// the thread allocated in between, as a call of phase of name. Both have to
+// outlive the scope.
+class profile_scope {
+public:
+  profile_scope(std::string_view name, std::string_view phase,
+                std::uint64_t flops = 0)
+      : active_(profiling()) {
+    if (!active_)
+      return;
+    name_ = name;
+    phase_ = phase;
+    flops_ = flops;
+    bytes_ = allocated_bytes();
+    watch_.start();
+  }
+  ~profile_scope() {
+    if (active_) {
+      record_profile(name_, phase_, watch_.read().to_nanoseconds(), flops_,
+                     allocated_bytes() - bytes_);
+    }
+  }
+
+  profile_scope(const profile_scope &) = delete;
+  void operator=(const profile_scope &) = delete;
+
+  // Whether the scope records anything, for work that only feeds it.
+  explicit operator bool() const { return active_; }
+  void add_flops(std::uint64_t flops) { flops_ += flops; }
+
+private:
+  const bool active_;
+  std::string_view name_;
+  std::string_view phase_;
+  std::uint64_t flops_ = 0;
+  std::uint64_t bytes_ = 0;
+  xeno::time::stopwatch watch_{false};
+};
+
+// Turns profiling on, and writes the profile to path every interval from a
+// thread of its own, and once more on destruction, when profiling goes off
+// again. Each dump has everything since the writer was made.
+class profile_writer {
+public:
+  profile_writer(const std::filesystem::path &path,
+                 std::chrono::milliseconds interval = std::chrono::seconds(10))
+      : path_(path), interval_(interval), thread_("profile") {
+    reset_profile();
+    set_profiling(true);
+    thread_.run([this]() { run(); });
+  }
+
+  ~profile_writer() {
+    {
+      std::lock_guard l(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+    set_profiling(false);
+  }
+
+  profile_writer(const profile_writer &) = delete;
+  void operator=(const profile_writer &) = delete;
+
+private:
+  void run() {
+    std::unique_lock l(mutex_);
+    for (bool last = false; !last;) {
+      last = cv_.wait_for(l, interval_, [this]() { return stop_; });
+      l.unlock();
+      try {
+        write_profile(path_);
+      } catch (const std::exception &e) {
+        lg() << "writing profile: " << e.what();
+      }
+      l.lock();
+    }
+  }
+
+  const std::filesystem::path path_;
+  const std::chrono::milliseconds interval_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+
+  xeno::sys::thread thread_;
+};
+
+} // namespace xylo
+
+#endif // XYLO_PROFILE_
@@ -0,0 +1,239 @@
+#ifndef XYLO_QUANTIZE_
+#define XYLO_QUANTIZE_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <typeinfo>
+#include <vector>
+
+#include <xeno/exception.h>
+#include <xylo/kernels.h>
+#include <xylo/nn.h>
+#include <xylo/tensor.h>
+
+// Post-training quantization, for evaluating a trained model where it's
+// deployed. The weights of every matmul_layer and convolution1d_1_layer are
+// converted once, either to int8 with a scale per output channel, or to
+// bfloat16; biases stay in float. Recognized the same way as compiled_model
+// does; relu, softmax and other layers run in float as there.
+//
+// With int8 weights, each input row is quantized on the fly to 7 bits between
+// its own minimum and maximum, so that
+//
+//   sum_k w[o][k] x[k] ~= w_scale[o] * (x_scale * dot(q, w_q[o]) +
+//                                       x_min * sum_k w_q[o][k])
+//
+// with integer dot products. Those are kernels::dot_u8s8, one per output
+// channel, which runs on VNNI's vpdpbusd where the CPU has it and on
+// vpmaddubsw elsewhere on x86, picked at run time; kernels::vnni_active() says
+// which. Unlike compiled_model, the quantized model is a copy: call update() to
+// take in new weights.
+namespace xylo {
+
+enum class weight_format { int8, bf16 };
+
+// The upper half of f, rounded to nearest even.
+inline std::uint16_t to_bf16(float f) {
+  std::uint32_t bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  if (std::isnan(f))
+    return (bits >> 16) | 0x40;
+  bits += 0x7fff + ((bits >> 16) & 1);
+  return bits >> 16;
+}
+
+class quantized_model {
+public:
+  explicit quantized_model(const model &m,
+                           weight_format format = weight_format::int8)
+      : format_(format) {
+    auto layers = m.layers();
+    for (std::size_t i = 0; i < layers.size(); ++i) {
+      layer *l = layers[i].get();
+      stage s;
+      if (typeid(*l) == typeid(matmul_layer)) {
+        auto *affine = static_cast<matmul_layer *>(l);
+        s.kind = stage::op::affine;
+        s.weights.emplace(affine->weights());
+        s.bias.emplace(affine->bias());
+      } else if (typeid(*l) == typeid(convolution1d_1_layer)) {
+        auto *affine = static_cast<convolution1d_1_layer *>(l);
+        s.kind = stage::op::affine;
+        s.weights.emplace(affine->weights());
+        s.bias.emplace(affine->bias());
+      } else if (typeid(*l) == typeid(relu_activation)) {
+        s.kind = stage::op::relu;
+      } else if (typeid(*l) == typeid(softmax_layer) ||
+                 typeid(*l) == typeid(softmax_cross_entropy_layer)) {
+        s.kind = stage::op::softmax;
+      } else {
+        s.kind = stage::op::other;
+        s.layer = l;
+      }
+      if (s.kind == stage::op::affine && i + 1 < layers.size() &&
+          typeid(*layers[i + 1]) == typeid(relu_activation)) {
+        s.relu = true;
+        ++i;
+      }
+      stages_.emplace_back(std::move(s));
+    }
+    update();
+  }
+
+  weight_format format() const { return format_; }
+  std::size_t num_stages() const { return stages_.size(); }
+
+  // Converts the weights of the model again. Not while anyone evaluates.
+  void update() {
+    for (stage &s : stages_) {
+      if (s.kind != stage::op::affine)
+        continue;
+      const matrix_view w = *s.weights;
+      const std::size_t rows = w.num_rows(), cols = w.num_cols();
+      s.bias_values.assign(s.bias->begin(), s.bias->end());
+      if (format_ == weight_format::bf16) {
+        s.bf16.resize(rows * cols);
+        for (std::size_t i = 0; i < rows; ++i) {
+          for (std::size_t j = 0; j < cols; ++j)
+            s.bf16[i * cols + j] = to_bf16(w[i][j]);
+        }
+        continue;
+      }
+      s.int8.resize(rows * cols);
+      s.scales.resize(rows);
+      s.sums.resize(rows);
+      for (std::size_t i = 0; i < rows; ++i) {
+        float max = 0;
+        for (std::size_t j = 0; j < cols; ++j)
+          max = std::max(max, std::abs(float(w[i][j])));
+        const float scale = max > 0 ? max / 127 : 1;
+        std::int32_t sum = 0;
+        for (std::size_t j = 0; j < cols; ++j) {
+          const auto q = std::int8_t(std::lround(w[i][j] / scale));
+          s.int8[i * cols + j] = q;
+          sum += q;
+        }
+        s.scales[i] = scale;
+        s.sums[i] = sum;
+      }
+    }
+  }
+
+  // The converted weights, scales and biases, in bytes.
+  std::size_t weight_bytes() const {
+    std::size_t result = 0;
+    for (const stage &s : stages_) {
+      result += s.int8.size() * sizeof(std::int8_t) +
+                s.bf16.size() * sizeof(std::uint16_t) +
+                s.scales.size() * sizeof(float) +
+                s.sums.size() * sizeof(std::int32_t) +
+                s.bias_values.size() * sizeof(float);
+    }
+    return result;
+  }
+
+  matrix eval(matrix_view batch) const {
+    matrix_var input = matrix(batch);
+    std::vector<std::uint8_t> quantized;
+    for (const stage &s : stages_) {
+      matrix_view in = input.value();
+      switch (s.kind) {
+      case stage::op::affine: {
+        const std::size_t width = s.weights->num_cols();
+        if (in.num_cols() % width != 0)
+          throw xeno::error("wrong input shape for quantized layer.");
+        // A full layer has one row of input_size per sample, a 1x1
+        // convolution one row of input_channels per point.
+        const std::size_t rows = in.size() / width;
+        const std::size_t outputs = s.weights->num_rows();
+        matrix result({in.num_rows(), in.num_cols() / width * outputs});
+        const float *src = in.data();
+        float *dst = matrix_view(result).data();
+        for (std::size_t r = 0; r < rows; ++r) {
+          run_affine(s, src + r * width, dst + r * outputs, quantized);
+        }
+        input = std::move(result);
+        break;
+      }
+      case stage::op::relu: {
+        matrix result({in.num_rows(), in.num_cols()});
+        const float *src = in.data();
+        float *dst = matrix_view(result).data();
+        for (std::size_t i = 0; i < in.size(); ++i)
+          dst[i] = src[i] > 0 ? src[i] : 0;
+        input = std::move(result);
+        break;
+      }
+      case stage::op::softmax: {
+        matrix result({in.num_rows(), in.num_cols()});
+        softmax(in, result);
+        input = std::move(result);
+        break;
+      }
+      case stage::op::other:
+        input = s.layer->forward(in);
+        break;
+      }
+    }
+    return input.value();
+  }
+
+private:
+  struct stage {
+    enum class op { affine, relu, softmax, other };
+    op kind = op::other;
+    // Affine stages only. The views are where update() reads from.
+    std::optional<matrix_view> weights;
+    std::optional<vector_view> bias;
+    bool relu = false;
+    std::vector<float> bias_values;
+    // int8: row-major weights, and per output channel the scale and the sum
+    // of the quantized weights.
+    std::vector<std::int8_t> int8;
+    std::vector<float> scales;
+    std::vector<std::int32_t> sums;
+    // bf16: row-major weights.
+    std::vector<std::uint16_t> bf16;
+    // Other stages only.
+    xylo::layer *layer = nullptr;
+  };
+
+  // One row of width in to one row of outputs out.
+  void run_affine(const stage &s, const float *in, float *out,
+                  std::vector<std::uint8_t> &quantized) const {
+    const std::size_t width = s.weights->num_cols();
+    const std::size_t outputs = s.weights->num_rows();
+    if (format_ == weight_format::bf16) {
+      for (std::size_t o = 0; o < outputs; ++o) {
+        const float y = kernels::dot_bf16(in, &s.bf16[o * width], width) +
+                        s.bias_values[o];
+        out[o] = s.relu && y < 0 ? 0 : y;
+      }
+      return;
+    }
+
+    const auto [lo, hi] = std::minmax_element(in, in + width);
+    const float min = *lo;
+    const float scale = *hi > min ? (*hi - min) / 127 : 1;
+    quantized.resize(width);
+    for (std::size_t k = 0; k < width; ++k)
+      quantized[k] = std::uint8_t(std::lround((in[k] - min) / scale));
+    for (std::size_t o = 0; o < outputs; ++o) {
+      const std::int32_t dot =
+          kernels::dot_u8s8(quantized.data(), &s.int8[o * width], width);
+      const float y = s.scales[o] * (scale * dot + min * s.sums[o]) +
+                      s.bias_values[o];
+      out[o] = s.relu && y < 0 ? 0 : y;
+    }
+  }
+
+  weight_format format_;
+  std::vector<stage> stages_;
+};
+
+} // namespace xylo
+
+#endif // XYLO_QUANTIZE_
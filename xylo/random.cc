@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <xylo/kernel_table.h>
+#include <xylo/kernels.h>
+#include <xylo/random.h>
+
+namespace xylo {
+
+namespace {
+std::uint64_t initial_seed() {
+  if (const char *seed = std::getenv("XYLO_SEED"))
+    return std::strtoull(seed, nullptr, 0);
+  return std::chrono::system_clock::now().time_since_epoch().count();
+}
+
+// Function statics, so that generators made during static initialization
+// find them ready.
+std::atomic<std::uint64_t> &global_seed() {
+  static std::atomic<std::uint64_t> seed = initial_seed();
+  return seed;
+}
+std::atomic<std::uint64_t> &next_stream() {
+  static std::atomic<std::uint64_t> stream = 1;
+  return stream;
+}
+
+// 24 random bits as a float in [0, 1).
+inline float to_unit(std::uint32_t bits) { return (bits >> 8) * 0x1p-24f; }
+
+// Draws per chunk of the bulk fills, small enough for the stack.
+constexpr std::size_t chunk = 256;
+
+// Taylor series of sin(h) / h and cos(h) in h^2, highest power first.
+constexpr float sin_terms[] = {1 / 6227020800.0f, -1 / 39916800.0f,
+                               1 / 362880.0f,     -1 / 5040.0f,
+                               1 / 120.0f,        -1 / 6.0f,
+                               1};
+constexpr float cos_terms[] = {1 / 479001600.0f, -1 / 3628800.0f,
+                               1 / 40320.0f,     -1 / 720.0f,
+                               1 / 24.0f,        -1 / 2.0f,
+                               1};
+
+#if defined(__x86_64__)
+XYLO_TARGET_BEGIN("avx2")
+// The low and high halves of the 32x32->64 products of a's words with m.
+// _mm256_mul_epu32 only takes the even words, so the odd ones make a second
+// product, shifted down.
+inline void multiply_halves(__m256i a, __m256i m, __m256i &lo, __m256i &hi) {
+  const __m256i even = _mm256_mul_epu32(a, m);
+  const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+  lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xaa);
+  hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xaa);
+}
+
+// Blocks index, index + 1, ... in sixteens: two groups of eight, word j of a
+// group's blocks in c[j], so that one group's multiplies run while the
+// other's wait.
+void generate_avx2(std::uint64_t seed, std::uint64_t index,
+                   std::uint64_t stream, std::uint32_t *out,
+                   std::size_t blocks) {
+  constexpr int groups = 2;
+  const __m256i m0 = _mm256_set1_epi32(philox::multiplier0);
+  const __m256i m1 = _mm256_set1_epi32(philox::multiplier1);
+  for (std::size_t b = 0; b < blocks; b += 8 * groups) {
+    __m256i c[groups][4];
+    for (int g = 0; g < groups; ++g) {
+      std::uint32_t low[8], high[8];
+      for (int l = 0; l < 8; ++l) {
+        low[l] = index + b + 8 * g + l;
+        high[l] = (index + b + 8 * g + l) >> 32;
+      }
+      c[g][0] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(low));
+      c[g][1] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(high));
+      c[g][2] = _mm256_set1_epi32(std::uint32_t(stream));
+      c[g][3] = _mm256_set1_epi32(std::uint32_t(stream >> 32));
+    }
+    std::uint32_t k0 = seed, k1 = seed >> 32;
+    for (int round = 0; round < 10; ++round) {
+      const __m256i key0 = _mm256_set1_epi32(k0);
+      const __m256i key1 = _mm256_set1_epi32(k1);
+      for (int g = 0; g < groups; ++g) {
+        __m256i lo0, hi0, lo1, hi1;
+        multiply_halves(c[g][0], m0, lo0, hi0);
+        multiply_halves(c[g][2], m1, lo1, hi1);
+        c[g][0] = _mm256_xor_si256(_mm256_xor_si256(hi1, c[g][1]), key0);
+        c[g][1] = lo1;
+        c[g][2] = _mm256_xor_si256(_mm256_xor_si256(hi0, c[g][3]), key1);
+        c[g][3] = lo0;
+      }
+      k0 += philox::weyl0;
+      k1 += philox::weyl1;
+    }
+    // Back to a block after the other: 4x8 transposes.
+    for (int g = 0; g < groups; ++g) {
+      const __m256i t0 = _mm256_unpacklo_epi32(c[g][0], c[g][1]);
+      const __m256i t1 = _mm256_unpackhi_epi32(c[g][0], c[g][1]);
+      const __m256i t2 = _mm256_unpacklo_epi32(c[g][2], c[g][3]);
+      const __m256i t3 = _mm256_unpackhi_epi32(c[g][2], c[g][3]);
+      const __m256i b04 = _mm256_unpacklo_epi64(t0, t2);
+      const __m256i b15 = _mm256_unpackhi_epi64(t0, t2);
+      const __m256i b26 = _mm256_unpacklo_epi64(t1, t3);
+      const __m256i b37 = _mm256_unpackhi_epi64(t1, t3);
+      __m256i *o = reinterpret_cast<__m256i *>(out + 4 * (b + 8 * g));
+      _mm256_storeu_si256(o, _mm256_permute2x128_si256(b04, b15, 0x20));
+      _mm256_storeu_si256(o + 1, _mm256_permute2x128_si256(b26, b37, 0x20));
+      _mm256_storeu_si256(o + 2, _mm256_permute2x128_si256(b04, b15, 0x31));
+      _mm256_storeu_si256(o + 3, _mm256_permute2x128_si256(b26, b37, 0x31));
+    }
+  }
+}
+XYLO_TARGET_END
+#endif
+
+} // namespace
+
+void philox::fill(std::uint32_t *out, std::size_t n) {
+  std::size_t i = 0;
+  while (i < n && used_ < 4)
+    out[i++] = buffer_[used_++];
+
+#if defined(__x86_64__)
+  // Blocks are independent, so eight of them take the same vector ops.
+  if (kernels::active_isa() >= kernels::isa::avx2) {
+    const std::size_t blocks = (n - i) / 64 * 16;
+    generate_avx2(seed_, index_, stream_, out + i, blocks);
+    index_ += blocks;
+    i += 4 * blocks;
+  }
+#endif
+
+  while (i < n) {
+    buffer_ = generate(seed_, index_++, stream_);
+    used_ = 0;
+    while (i < n && used_ < 4)
+      out[i++] = buffer_[used_++];
+  }
+}
+
+philox &default_generator() {
+  thread_local philox generator(global_seed().load(),
+                                next_stream().fetch_add(1));
+  return generator;
+}
+
+void seed_generators(std::uint64_t seed) {
+  philox &mine = default_generator();
+  global_seed().store(seed);
+  next_stream().store(1);
+  mine = philox(seed, 0);
+}
+
+void uniform_fill(philox &generator, float lower, float upper, float *out,
+                  std::size_t n) {
+  const float range = upper - lower;
+  std::uint32_t bits[chunk];
+  for (std::size_t i = 0; i < n; i += chunk) {
+    const std::size_t m = std::min(chunk, n - i);
+    generator.fill(bits, m);
+    for (std::size_t j = 0; j < m; ++j)
+      out[i + j] = lower + range * to_unit(bits[j]);
+  }
+}
+
+// Box-Muller on pairs of uniforms u, v: sqrt(-2 ln u) times the cosine and
+// sine of an angle uniform over the circle. The angle is 2h, with h uniform
+// over [-pi/2, pi/2), where Taylor series to h^13 and h^12 are good to 6e-8;
+// the double angle formulas take it from there. logs go through the
+// dispatched kernel, and the rest are plain loops that vectorize.
+void normal_fill(philox &generator, float mean, float stddev, float *out,
+                 std::size_t n) {
+  constexpr std::size_t pairs = chunk / 2;
+  std::uint32_t bits[chunk];
+  float radius[pairs];
+  float z[chunk];
+  for (std::size_t i = 0; i < n; i += chunk) {
+    const std::size_t m = std::min(chunk, n - i);
+    const std::size_t p = (m + 1) / 2;
+    generator.fill(bits, 2 * p);
+    // (0, 1], so that the log is finite.
+    for (std::size_t j = 0; j < p; ++j)
+      radius[j] = ((bits[j] >> 8) + 1) * 0x1p-24f;
+    kernels::log(radius, radius, p);
+    for (std::size_t j = 0; j < p; ++j) {
+      const float r = stddev * std::sqrt(-2 * radius[j]);
+      const float h = float(M_PI) * (to_unit(bits[p + j]) - 0.5f);
+      const float h2 = h * h;
+      float sin_h = 0;
+      for (float t : sin_terms)
+        sin_h = sin_h * h2 + t;
+      sin_h *= h;
+      float cos_h = 0;
+      for (float t : cos_terms)
+        cos_h = cos_h * h2 + t;
+      z[j] = mean + r * (1 - 2 * sin_h * sin_h);
+      z[p + j] = mean + r * (2 * sin_h * cos_h);
+    }
+    std::memcpy(out + i, z, m * sizeof(float));
+  }
+}
+
+} // namespace xylo
@@ -0,0 +1,122 @@
+#ifndef XYLO_RANDOM_
+#define XYLO_RANDOM_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace xylo {
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+// 3"), a counter-based generator: block i of stream s is a pure function of
+// the key, i and s, four 32-bit words at a time. Streams are independent and
+// free to make, skipping ahead is O(1), and blocks can be computed side by
+// side, which is what fill() does. Meets UniformRandomBitGenerator, so the
+// std distributions take it too.
+class philox {
+public:
+  using result_type = std::uint32_t;
+  using block = std::array<std::uint32_t, 4>;
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return 0xffffffff; }
+
+  explicit philox(std::uint64_t seed = 0, std::uint64_t stream = 0)
+      : seed_(seed), stream_(stream) {}
+
+  std::uint64_t seed() const { return seed_; }
+  std::uint64_t stream() const { return stream_; }
+
+  // Ten rounds over the counter (index, stream) under seed.
+  static block generate(std::uint64_t seed, std::uint64_t index,
+                        std::uint64_t stream) {
+    std::uint32_t k0 = seed, k1 = seed >> 32;
+    std::uint32_t c0 = index, c1 = index >> 32, c2 = stream, c3 = stream >> 32;
+    for (int round = 0; round < 10; ++round) {
+      const std::uint64_t p0 = std::uint64_t(multiplier0) * c0;
+      const std::uint64_t p1 = std::uint64_t(multiplier1) * c2;
+      c0 = std::uint32_t(p1 >> 32) ^ c1 ^ k0;
+      c1 = std::uint32_t(p1);
+      c2 = std::uint32_t(p0 >> 32) ^ c3 ^ k1;
+      c3 = std::uint32_t(p0);
+      k0 += weyl0;
+      k1 += weyl1;
+    }
+    return {c0, c1, c2, c3};
+  }
+
+  result_type operator()() {
+    if (used_ == 4) {
+      buffer_ = generate(seed_, index_++, stream_);
+      used_ = 0;
+    }
+    return buffer_[used_++];
+  }
+
+  // The same words as n calls, many blocks at once.
+  void fill(std::uint32_t *out, std::size_t n);
+
+  void discard(unsigned long long n) {
+    const unsigned long long buffered = 4 - used_;
+    if (n <= buffered) {
+      used_ += n;
+      return;
+    }
+    n -= buffered;
+    index_ += n / 4;
+    used_ = 4;
+    if (n % 4 != 0) {
+      buffer_ = generate(seed_, index_++, stream_);
+      used_ = n % 4;
+    }
+  }
+
+  // A generator on a stream of its own, the i-th split of this one.
+  philox split(std::uint64_t i) const {
+    std::uint64_t z = stream_ * 0x9e3779b97f4a7c15ull + i + 1;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return philox(seed_, z ^ (z >> 31));
+  }
+
+  friend bool operator==(const philox &a, const philox &b) {
+    return a.seed_ == b.seed_ && a.stream_ == b.stream_ &&
+           a.index_ == b.index_ && a.used_ == b.used_;
+  }
+
+  // The round constants: multipliers, and the Weyl sequence of the key.
+  static constexpr std::uint32_t multiplier0 = 0xd2511f53;
+  static constexpr std::uint32_t multiplier1 = 0xcd9e8d57;
+  static constexpr std::uint32_t weyl0 = 0x9e3779b9;
+  static constexpr std::uint32_t weyl1 = 0xbb67ae85;
+
+private:
+  std::uint64_t seed_;
+  std::uint64_t stream_;
+  // The next block to generate; buffer_ holds the one before, of which used_
+  // words are gone.
+  std::uint64_t index_ = 0;
+  block buffer_{};
+  unsigned used_ = 4;
+};
+
+// The calling thread's generator. Threads take streams 1, 2, ... in the order
+// they first ask for one, under one seed: XYLO_SEED from the environment if
+// it's set, the clock otherwise. For streams that don't depend on thread
+// scheduling, give each agent a philox, or a split, of its own.
+philox &default_generator();
+
+// Seeds the generators threads make from now on, and gives the calling thread
+// stream 0 of the new seed. Threads that already have one keep it.
+void seed_generators(std::uint64_t seed);
+
+// Bulk draws, for initialization and sampling, n at a time: uniform over
+// [lower, upper), with 24 bits, or normal by Box-Muller.
+void uniform_fill(philox &generator, float lower, float upper, float *out,
+                  std::size_t n);
+void normal_fill(philox &generator, float mean, float stddev, float *out,
+                 std::size_t n);
+
+} // namespace xylo
+
+#endif // XYLO_RANDOM_
@@ -0,0 +1,544 @@
+#ifndef XYLO_REMOTE_
+#define XYLO_REMOTE_
+
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <xeno/endian.h>
+#include <xeno/exception.h>
+#include <xeno/logging.h>
+#include <xeno/string.h>
+#include <xeno/sys/file_descriptor.h>
+#include <xeno/sys/thread.h>
+#include <xylo/rl.h>
+#include <xylo/snapshot.h>
+#include <xylo/tensor.h>
+
+// Actors on other machines. They play into a replay_buffer of their own and
+// ship what it publishes to the learner through a remote_learner; the learner
+// takes them in with a trajectory_receiver, which feeds its replay_buffer and
+// broadcasts new parameters back.
+//
+// Everything goes in frames: a kind and the length of the rest, then the
+// body. Numbers are big endian, by xeno::to_wire, floats included. A batch of
+// trajectories is
+//
+//   u32 count, then per trajectory:
+//     u64 policy version, u8 frozen, u32 transitions, u32 state width,
+//     (transitions + 1) * width f32: the encoded opening and end states,
+//     per transition: the action, then f32 reward.
+//
+// A discrete_action is u32 choice, u8 whether it has a distribution, and the
+// distribution if so: the behaviour policy's probabilities, for importance
+// ratios. Parameters are u64 version, u64 count, count f32.
+//
+// States travel encoded, so S has to be able to decode what to_vector wrote,
+// with a static S::from_vector(vector_view).
+namespace xylo {
+
+namespace wire {
+
+enum class frame_kind : std::uint32_t { trajectories = 1, parameters = 2 };
+
+// Anything longer is a broken stream. That is 2^28 parameters at most.
+constexpr std::uint64_t max_frame_size = std::uint64_t(1) << 30;
+
+class writer {
+public:
+  template <typename T> void put(const T &v) {
+    const auto bytes = xeno::to_wire(v);
+    bytes_.insert(bytes_.end(), bytes.begin(), bytes.end());
+  }
+  void put(std::span<const float> v) {
+    for (float f : v)
+      put(f);
+  }
+
+  // Starts a frame. Its length is filled in by end_frame().
+  void begin_frame(frame_kind kind) {
+    put(static_cast<std::uint32_t>(kind));
+    length_at_ = bytes_.size();
+    put(std::uint64_t(0));
+  }
+  void end_frame() {
+    const auto length = xeno::to_wire<std::uint64_t>(
+        bytes_.size() - length_at_ - sizeof(std::uint64_t));
+    std::copy(length.begin(), length.end(), bytes_.begin() + length_at_);
+  }
+
+  std::span<const std::byte> bytes() const { return bytes_; }
+  void clear() { bytes_.clear(); }
+
+private:
+  std::vector<std::byte> bytes_;
+  std::size_t length_at_ = 0;
+};
+
+class reader {
+public:
+  explicit reader(std::span<const std::byte> bytes) : bytes_(bytes) {}
+
+  template <typename T> T get() {
+    if (bytes_.size() < sizeof(T))
+      throw xeno::error("truncated message.");
+    const T result = xeno::from_wire<T>(bytes_.first(sizeof(T)));
+    bytes_ = bytes_.subspan(sizeof(T));
+    return result;
+  }
+  void get(std::span<float> out) {
+    for (float &f : out)
+      f = get<float>();
+  }
+
+  bool empty() const { return bytes_.empty(); }
+  // Bytes left to read. Lengths from the wire are checked against it before
+  // anything is allocated for them.
+  std::size_t remaining() const { return bytes_.size(); }
+
+private:
+  std::span<const std::byte> bytes_;
+};
+
+template <std::size_t N>
+void put_action(writer &w, const discrete_action<N> &a) {
+  w.put(std::uint32_t(a.choice));
+  w.put(std::uint8_t(a.distrib.has_value()));
+  if (a.distrib)
+    w.put(std::span<const float>(*a.distrib));
+}
+template <std::size_t N> discrete_action<N> get_action(reader &r) {
+  discrete_action<N> a;
+  a.choice = r.get<std::uint32_t>();
+  if (a.choice >= N)
+    throw xeno::error("action out of range.");
+  if (r.get<std::uint8_t>()) {
+    a.distrib.emplace();
+    r.get(*a.distrib);
+  }
+  return a;
+}
+
+inline void put_action(writer &w, const continuous_action &a) {
+  w.put(a.action);
+  w.put(a.mean);
+  w.put(a.stddev);
+}
+
+template <typename A> struct action_reader;
+template <std::size_t N> struct action_reader<discrete_action<N>> {
+  static discrete_action<N> get(reader &r) { return get_action<N>(r); }
+};
+template <> struct action_reader<continuous_action> {
+  static continuous_action get(reader &r) {
+    continuous_action a;
+    a.action = r.get<float>();
+    a.mean = r.get<float>();
+    a.stddev = r.get<float>();
+    return a;
+  }
+};
+
+// Encodes the states of t that an encoding replay_buffer hasn't already.
+template <typename A, typename S>
+void put_trajectory(writer &w, const trajectory<A, S> &t) {
+  const std::size_t width = t.opening.length();
+  w.put(std::uint64_t(t.policy_version));
+  w.put(std::uint8_t(t.frozen));
+  w.put(std::uint32_t(t.size()));
+  w.put(std::uint32_t(width));
+  if (t.encoded.size() == (t.size() + 1) * width) {
+    w.put(std::span<const float>(t.encoded));
+  } else {
+    std::vector<float> row(width);
+    auto put_state = [&](const S &s) {
+      s.to_vector(borrow_vector(std::span(row)));
+      w.put(std::span<const float>(row));
+    };
+    put_state(t.opening);
+    for (const transition<A, S> &trans : t.transitions)
+      put_state(trans.end_state);
+  }
+  for (const transition<A, S> &trans : t.transitions) {
+    put_action(w, trans.action);
+    w.put(trans.reward);
+  }
+}
+
+template <typename A, typename S>
+std::unique_ptr<trajectory<A, S>> get_trajectory(reader &r) {
+  const std::uint64_t version = r.get<std::uint64_t>();
+  const bool frozen = r.get<std::uint8_t>();
+  const std::size_t size = r.get<std::uint32_t>();
+  const std::size_t width = r.get<std::uint32_t>();
+  if (size == 0)
+    throw xeno::error("empty trajectory.");
+  if (width == 0 || width != S::length())
+    throw xeno::error("states of the wrong width.");
+  // The states, and a reward per transition, at the least.
+  if ((size + 1) * width + size > r.remaining() / sizeof(float))
+    throw xeno::error("truncated message.");
+
+  std::vector<float> encoded((size + 1) * width);
+  r.get(encoded);
+  auto state = [&](std::size_t i) {
+    return S::from_vector(
+        borrow_vector(std::span(encoded).subspan(i * width, width)));
+  };
+  auto result = std::make_unique<trajectory<A, S>>(state(0));
+  for (std::size_t i = 0; i < size; ++i) {
+    A action = action_reader<A>::get(r);
+    const float reward = r.get<float>();
+    result->add_transition(std::move(action), reward, state(i + 1));
+  }
+  result->policy_version = version;
+  result->encoded = std::move(encoded);
+  if (frozen)
+    result->freeze();
+  return result;
+}
+
+// The whole of bytes, or throws. Nothing at all before the connection closes
+// is fine, if allowed, and returns false.
+inline bool read_exactly(xeno::sys::socket &s, std::span<std::byte> bytes,
+                         bool eof_ok = false) {
+  bool first = true;
+  while (!bytes.empty()) {
+    const std::size_t n = s.read(bytes);
+    if (n == 0 && first && eof_ok)
+      return false;
+    if (n == 0 || n > bytes.size())
+      throw xeno::error("connection lost in the middle of a message.");
+    bytes = bytes.subspan(n);
+    first = false;
+  }
+  return true;
+}
+
+// Without SIGPIPE if the other side has gone, which throws instead.
+inline void write_all(xeno::sys::socket &s, std::span<const std::byte> bytes) {
+  while (!bytes.empty()) {
+    const ssize_t n =
+        ::send(s.get_handle(), bytes.data(), bytes.size(), MSG_NOSIGNAL);
+    if (n <= 0)
+      throw xeno::error(xeno::string::strcat("send failed: ", strerror(errno)));
+    bytes = bytes.subspan(n);
+  }
+}
+
+// The next frame from s into body, or nullopt if s closed between frames.
+inline std::optional<frame_kind> read_frame(xeno::sys::socket &s,
+                                            std::vector<std::byte> &body) {
+  std::array<std::byte, 12> header;
+  if (!read_exactly(s, header, true))
+    return std::nullopt;
+  const auto kind = static_cast<frame_kind>(
+      xeno::from_wire<std::uint32_t>(std::span(header).first(4)));
+  const auto length =
+      xeno::from_wire<std::uint64_t>(std::span(header).subspan(4));
+  if (length > max_frame_size)
+    throw xeno::error("message too long.");
+  // Grown as the bytes come in, so that a length the sender doesn't follow
+  // up on costs no more than what was sent.
+  constexpr std::size_t chunk_size = 1 << 20;
+  body.clear();
+  while (body.size() < length) {
+    const std::size_t done = body.size();
+    body.resize(std::min<std::uint64_t>(length, done + chunk_size));
+    read_exactly(s, std::span(body).subspan(done));
+  }
+  return kind;
+}
+
+} // namespace wire
+
+// The actor's end of the connection to a trajectory_receiver. New parameters
+// from the learner go into a parameter_snapshot, for the actor's threads to
+// update their models from as usual.
+template <typename A, typename S> class remote_learner {
+public:
+  // Retries until the learner is listening, and throws after timeout.
+  remote_learner(std::string_view host, int port,
+                 parameter_snapshot &parameters,
+                 std::chrono::milliseconds timeout = std::chrono::seconds(60))
+      : parameters_(parameters), receiver_("remote_learner") {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    for (;;) {
+      try {
+        socket_ = xeno::sys::socket::open(host, port);
+        break;
+      } catch (const xeno::error &) {
+        if (std::chrono::steady_clock::now() > deadline)
+          throw;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+    }
+    receiver_.run([this]() { receive_loop(); });
+  }
+
+  ~remote_learner() {
+    ::shutdown(socket_.get_handle(), SHUT_RDWR);
+    receiver_.join();
+  }
+
+  remote_learner(const remote_learner &) = delete;
+  void operator=(const remote_learner &) = delete;
+
+  // The learner's version of the parameters last put into the snapshot, for
+  // agent::set_policy_version.
+  std::size_t version() const {
+    return version_.load(std::memory_order_acquire);
+  }
+  // Whether the learner is still there.
+  bool connected() const { return connected_.load(std::memory_order_acquire); }
+
+  // Sends everything rb has published, as one message, and returns the
+  // number of transitions. Empty trajectories, which the learner would
+  // refuse, are dropped.
+  std::size_t send(replay_buffer<A, S> &rb) {
+    auto published = rb.take_published();
+    std::erase_if(published, [](const auto &t) { return t->size() == 0; });
+    if (published.empty())
+      return 0;
+    std::size_t transitions = 0;
+    writer_.clear();
+    writer_.begin_frame(wire::frame_kind::trajectories);
+    writer_.put(std::uint32_t(published.size()));
+    for (const auto &t : published) {
+      wire::put_trajectory(writer_, *t);
+      transitions += t->size();
+    }
+    writer_.end_frame();
+    wire::write_all(socket_, writer_.bytes());
+    return transitions;
+  }
+
+private:
+  void receive_loop() {
+    std::vector<std::byte> body;
+    std::vector<float> values;
+    try {
+      while (auto kind = wire::read_frame(socket_, body)) {
+        if (*kind != wire::frame_kind::parameters)
+          throw xeno::error("unexpected message from the learner.");
+        wire::reader r(body);
+        const std::uint64_t version = r.get<std::uint64_t>();
+        const std::uint64_t count = r.get<std::uint64_t>();
+        if (count > r.remaining() / sizeof(float))
+          throw xeno::error("truncated message.");
+        values.resize(count);
+        r.get(values);
+        parameters_.publish(borrow_vector(std::span(values)));
+        version_.store(version, std::memory_order_release);
+      }
+    } catch (const std::exception &e) {
+      lg() << "learner connection: " << e.what();
+    }
+    connected_.store(false, std::memory_order_release);
+  }
+
+  parameter_snapshot &parameters_;
+  xeno::sys::socket socket_;
+  wire::writer writer_;
+  std::atomic<std::size_t> version_ = 0;
+  std::atomic<bool> connected_ = true;
+  xeno::sys::thread receiver_;
+};
+
+// The learner's end: accepts actors on port, and publishes what they send
+// into rb through a producer per actor, so the learner drains them like any
+// other. rb has to encode states, or be happy with trajectories that are.
+template <typename A, typename S> class trajectory_receiver {
+public:
+  trajectory_receiver(replay_buffer<A, S> &rb, int port)
+      : replay_buffer_(rb), listener_(xeno::sys::socket::create(port)),
+        acceptor_("receiver") {
+    acceptor_.run([this]() { accept_loop(); });
+  }
+
+  ~trajectory_receiver() {
+    stopping_.store(true, std::memory_order_release);
+    ::shutdown(listener_.get_handle(), SHUT_RDWR);
+    acceptor_.join();
+    std::lock_guard l(mutex_);
+    for (auto &c : connections_)
+      ::shutdown(c->socket.get_handle(), SHUT_RDWR);
+    for (auto &c : connections_)
+      c->thread.join();
+  }
+
+  trajectory_receiver(const trajectory_receiver &) = delete;
+  void operator=(const trajectory_receiver &) = delete;
+
+  // Actors connected right now.
+  std::size_t num_actors() {
+    std::lock_guard l(mutex_);
+    std::size_t result = 0;
+    for (auto &c : connections_)
+      result += c->open.load(std::memory_order_acquire);
+    return result;
+  }
+
+  // Sends parameters to every actor, as of version, and to those that connect
+  // later. Actors that have gone are skipped. The writes happen outside
+  // mutex_, so a slow actor holds up this call but not the actors connecting
+  // meanwhile.
+  void broadcast(vector_view parameters, std::size_t version) {
+    wire::writer w;
+    w.begin_frame(wire::frame_kind::parameters);
+    w.put(std::uint64_t(version));
+    w.put(std::uint64_t(parameters.size()));
+    w.put(std::span<const float>(parameters.data(), parameters.size()));
+    w.end_frame();
+    auto frame = std::make_shared<const std::vector<std::byte>>(
+        w.bytes().begin(), w.bytes().end());
+
+    std::vector<connection *> open;
+    {
+      std::lock_guard l(mutex_);
+      latest_ = std::move(frame);
+      for (auto &c : connections_) {
+        if (c->open.load(std::memory_order_acquire))
+          open.push_back(c.get());
+      }
+    }
+    for (connection *c : open)
+      send_latest(*c);
+  }
+
+private:
+  using frame = std::shared_ptr<const std::vector<std::byte>>;
+
+  struct connection {
+    explicit connection(xeno::sys::socket &&s)
+        : socket(std::move(s)), thread("actor") {}
+
+    xeno::sys::socket socket;
+    std::atomic<bool> open = true;
+    xeno::sys::thread thread;
+    // Guards writes to socket, and sent.
+    std::mutex write_mutex;
+    // The last frame written, so that parameters never go back to an older
+    // version when two broadcasts race.
+    frame sent;
+  };
+
+  // Writes whatever latest_ is by the time c is free to write to.
+  void send_latest(connection &c) {
+    std::lock_guard w(c.write_mutex);
+    frame latest;
+    {
+      std::lock_guard l(mutex_);
+      latest = latest_;
+    }
+    if (!latest || latest == c.sent)
+      return;
+    try {
+      wire::write_all(c.socket, *latest);
+      c.sent = std::move(latest);
+    } catch (const xeno::error &e) {
+      lg() << "actor connection: " << e.what();
+      c.open.store(false, std::memory_order_release);
+    }
+  }
+
+  // Whether accept() failing with err is worth another try. The first group
+  // is the connection at the head of the queue going away, or the network
+  // errors accept(2) says to treat like EAGAIN; the second, running out of
+  // descriptors or memory, which can come back after a while.
+  static bool transient(int err) {
+    switch (err) {
+    case EINTR:
+    case EAGAIN:
+    case ECONNABORTED:
+    case EPROTO:
+    case ENETDOWN:
+    case ENOPROTOOPT:
+    case EHOSTDOWN:
+    case ENONET:
+    case EHOSTUNREACH:
+    case EOPNOTSUPP:
+    case ENETUNREACH:
+    case EMFILE:
+    case ENFILE:
+    case ENOBUFS:
+    case ENOMEM:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  void accept_loop() {
+    for (;;) {
+      xeno::sys::socket s = listener_.accept();
+      if (s.get_handle() < 0) {
+        const int err = errno;
+        if (stopping_.load(std::memory_order_acquire))
+          return;
+        if (!transient(err)) {
+          lg(lg::error) << "no more actors, accept failed: " << strerror(err);
+          return;
+        }
+        if (err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM) {
+          lg() << "accept failed, retrying: " << strerror(err);
+          std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        continue;
+      }
+      connection *c;
+      {
+        std::lock_guard l(mutex_);
+        auto &added = connections_.emplace_back(
+            std::make_unique<connection>(std::move(s)));
+        c = added.get();
+      }
+      send_latest(*c);
+      c->thread.run([this, c]() { receive_loop(*c); });
+    }
+  }
+
+  void receive_loop(connection &c) {
+    auto &producer = replay_buffer_.add_producer();
+    std::vector<std::byte> body;
+    try {
+      while (auto kind = wire::read_frame(c.socket, body)) {
+        if (*kind != wire::frame_kind::trajectories)
+          throw xeno::error("unexpected message from an actor.");
+        wire::reader r(body);
+        for (std::uint32_t n = r.get<std::uint32_t>(); n > 0; --n)
+          producer.publish(wire::get_trajectory<A, S>(r));
+      }
+    } catch (const std::exception &e) {
+      lg() << "actor connection: " << e.what();
+    }
+    c.open.store(false, std::memory_order_release);
+    replay_buffer_.retire(producer);
+  }
+
+  replay_buffer<A, S> &replay_buffer_;
+  xeno::sys::socket listener_;
+  // Set before the listener is shut down, so that accept_loop() can tell
+  // that from accept() failing.
+  std::atomic<bool> stopping_ = false;
+  // Guards connections_ and latest_.
+  std::mutex mutex_;
+  std::list<std::unique_ptr<connection>> connections_;
+  frame latest_;
+  xeno::sys::thread acceptor_;
+};
+
+} // namespace xylo
+
+#endif // XYLO_REMOTE_
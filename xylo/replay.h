@@ -0,0 +1,211 @@
+#ifndef XYLO_REPLAY_
+#define XYLO_REPLAY_
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <span>
+#include <vector>
+
+#include <xeno/exception.h>
+#include <xylo/rl.h>
+#include <xylo/tensor.h>
+
+// Fixed-capacity experience replay for off-policy learners. replay_buffer keeps
+// whole trajectories, in pooled chunks, for the on-policy learners; here
+// transitions sit in one contiguous ring, the oldest overwritten once it is
+// full, so a uniform sample is a single random index.
+namespace xylo {
+
+// A complete binary tree over capacity leaves, where every node holds the sum
+// of its children. Setting a leaf and finding the leaf at a given prefix sum
+// are both O(log n). Sums are kept in double, so that millions of small
+// priorities still add up.
+class sum_tree {
+public:
+  explicit sum_tree(std::size_t capacity) : leaves_(1) {
+    while (leaves_ < capacity)
+      leaves_ *= 2;
+    nodes_.assign(2 * leaves_, 0);
+  }
+
+  std::size_t capacity() const { return leaves_; }
+  double total() const { return nodes_[1]; }
+  double get(std::size_t i) const { return nodes_[leaves_ + i]; }
+
+  void set(std::size_t i, double priority) {
+    std::size_t node = leaves_ + i;
+    const double delta = priority - nodes_[node];
+    for (; node != 0; node /= 2)
+      nodes_[node] += delta;
+  }
+
+  // The leaf i with sum(get(0..i)) <= prefix < sum(get(0..i+1)), for prefix in
+  // [0, total()).
+  std::size_t find(double prefix) const {
+    std::size_t node = 1;
+    while (node < leaves_) {
+      const std::size_t left = 2 * node;
+      if (prefix < nodes_[left] || nodes_[left + 1] == 0) {
+        node = left;
+      } else {
+        prefix -= nodes_[left];
+        node = left + 1;
+      }
+    }
+    return node - leaves_;
+  }
+
+private:
+  std::size_t leaves_;
+  std::vector<double> nodes_;
+};
+
+template <typename A, typename S> struct stored_transition {
+  S start_state;
+  A action;
+  float reward;
+  S end_state;
+  // The episode ended with this transition.
+  bool terminal;
+};
+
+// With prioritized set, sampling is proportional to priority^alpha as in
+// prioritized experience replay, and new transitions come in at the highest
+// priority seen so far, so that each gets replayed at least once or so.
+// Otherwise it is uniform. Adding and sampling are thread safe. sample() hands
+// out slots, which keep whatever is there until add() comes round again.
+template <typename A, typename S> class ring_replay {
+public:
+  explicit ring_replay(std::size_t capacity, bool prioritized = false,
+                       float alpha = 0.6)
+      : capacity_(capacity), alpha_(alpha), generator_(default_generator()()) {
+    if (capacity == 0)
+      throw xeno::error("replay needs a capacity.");
+    slots_.reserve(capacity);
+    if (prioritized)
+      priorities_.emplace(capacity);
+  }
+
+  static constexpr float min_priority = 1e-6f;
+
+  std::size_t capacity() const { return capacity_; }
+  std::size_t size() const {
+    std::lock_guard l(mutex_);
+    return slots_.size();
+  }
+  bool prioritized() const { return priorities_.has_value(); }
+
+  // Returns the slot it went into.
+  std::size_t add(stored_transition<A, S> &&t) {
+    std::lock_guard l(mutex_);
+    const std::size_t slot = next_;
+    if (slots_.size() < capacity_) {
+      slots_.emplace_back(std::move(t));
+    } else {
+      slots_[slot] = std::move(t);
+    }
+    next_ = (next_ + 1) % capacity_;
+    if (priorities_)
+      priorities_->set(slot, max_priority_);
+    return slot;
+  }
+
+  // Everything in experience, in order.
+  void add(const std::vector<td<A, S>> &experience) {
+    for (const auto &traj : experience) {
+      std::size_t i = 0;
+      for (const auto &t : traj) {
+        const bool terminal = traj.frozen() && ++i == traj.size();
+        add({*t.start_state, t.action, t.reward, t.end_state, terminal});
+      }
+    }
+  }
+
+  const stored_transition<A, S> &operator[](std::size_t slot) const {
+    return slots_[slot];
+  }
+
+  // Fills out with slots. If weights isn't empty, it gets the importance
+  // sampling weight of each, (N * P(i))^-beta scaled so the largest in the
+  // sample is 1; all 1 when uniform.
+  void sample(std::span<std::size_t> out, std::span<float> weights = {},
+              float beta = 0.4) {
+    std::lock_guard l(mutex_);
+    if (slots_.empty())
+      throw xeno::error("sampling an empty replay.");
+    if (!weights.empty() && weights.size() != out.size())
+      throw xeno::error("one weight per sample.");
+
+    // Uniform too if every priority is 0, which min_priority should prevent.
+    if (!priorities_ || !(priorities_->total() > 0)) {
+      std::uniform_int_distribution<std::size_t> dist(0, slots_.size() - 1);
+      for (std::size_t &slot : out)
+        slot = dist(generator_);
+      std::fill(weights.begin(), weights.end(), 1.0f);
+      return;
+    }
+
+    // Stratified: one draw in each of n equal slices of the total.
+    const double total = priorities_->total();
+    const double segment = total / out.size();
+    std::uniform_real_distribution<double> dist(0, segment);
+    for (std::size_t i = 0; i < out.size(); ++i) {
+      const double prefix = std::min(segment * i + dist(generator_), total);
+      out[i] = std::min(priorities_->find(prefix), slots_.size() - 1);
+    }
+    if (weights.empty())
+      return;
+
+    const double n = slots_.size();
+    double max_weight = 0;
+    for (std::size_t i = 0; i < out.size(); ++i) {
+      const double p = priorities_->get(out[i]) / total;
+      weights[i] = std::pow(n * p, -beta);
+      max_weight = std::max<double>(max_weight, weights[i]);
+    }
+    for (float &w : weights)
+      w /= max_weight;
+  }
+
+  // New priorities for sampled slots, typically |TD error|. Anything below
+  // min_priority, NaN included, counts as min_priority, so that nothing drops
+  // out entirely and the weights stay finite.
+  void update_priorities(std::span<const std::size_t> slots,
+                         std::span<const float> priorities) {
+    if (!priorities_)
+      throw xeno::error("replay isn't prioritized.");
+    if (slots.size() != priorities.size())
+      throw xeno::error("one priority per slot.");
+    std::lock_guard l(mutex_);
+    for (std::size_t slot : slots) {
+      if (slot >= slots_.size())
+        throw xeno::error("slot out of range.");
+    }
+    for (std::size_t i = 0; i < slots.size(); ++i) {
+      const double priority =
+          priorities[i] > min_priority ? priorities[i] : min_priority;
+      const double p = std::pow(priority, alpha_);
+      priorities_->set(slots[i], p);
+      max_priority_ = std::max(max_priority_, p);
+    }
+  }
+
+private:
+  const std::size_t capacity_;
+  const float alpha_;
+
+  mutable std::mutex mutex_;
+  std::vector<stored_transition<A, S>> slots_;
+  // Where the next add goes; the oldest slot once full.
+  std::size_t next_ = 0;
+  std::optional<sum_tree> priorities_;
+  double max_priority_ = 1;
+  std::mt19937 generator_;
+};
+
+} // namespace xylo
+
+#endif // XYLO_REPLAY_
@@ -1,14 +1,25 @@
 #ifndef XYLO_RL_
 #define XYLO_RL_
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <cstdint>
 #include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <random>
 #include <span>
+#include <utility>
 #include <vector>
 
+#include <xeno/exception.h>
+#include <xeno/sys/spsc_queue.h>
+#include <xylo/chunk_list.h>
 #include <xylo/nn.h>
+#include <xylo/profile.h>
 #include <xylo/tensor.h>
 
 namespace xylo {
@@ -22,11 +33,15 @@ template <typename T> vector to_vector(const T &t) {
 template <std::size_t range> struct discrete_action {
   static std::size_t cardinality() { return range; }
   std::size_t choice;
-  std::optional<vector> distrib;
+  // Inline, so that acting allocates nothing.
+  std::optional<std::array<float, range>> distrib;
 
   void from_vector(vector_view a) {
+    if (a.size() != range)
+      throw std::exception();
     choice = discrete_distribution(a);
-    distrib = a;
+    distrib.emplace();
+    std::copy(a.begin(), a.end(), distrib->begin());
   }
   void from_vector_deterministic(vector_view a) { choice = argmax(a); }
 
@@ -82,10 +97,8 @@ struct continuous_action {
   float stddev = 1;
 
   void from_vector(vector_view a) {
-    vector result({1});
     mean = a[0];
-    normal_distribution(mean, stddev, result);
-    action = result[0];
+    normal_fill(default_generator(), mean, stddev, &action, 1);
   }
   void gradient_log(vector_view input, vector_view output, float reward,
                     float o_value) const {
@@ -156,8 +169,15 @@ template <typename A, typename S> struct trajectory {
   }
 
   S opening;
-  std::list<transition<A, S>> transitions;
+  // Recording a step takes no allocation but the odd chunk, and forgetting
+  // gives the chunks back for the next trajectories.
+  chunk_list<transition<A, S>> transitions;
   bool frozen;
+  // Of the parameters that acted, for learners that run behind their actors.
+  std::size_t policy_version = 0;
+  // Filled in by an encoding replay_buffer: opening, then every end_state, one
+  // S::to_vector row after the other.
+  std::vector<float> encoded;
 };
 
 template <typename A, typename S> class environment {
@@ -169,10 +189,31 @@ public:
   virtual void reset(std::size_t id) = 0;
 };
 
+// size() instances stepped together. Rather than handing out an S per
+// instance, observe() writes every instance into its own row of a matrix, laid
+// out the way S::to_vector would. Instances that finish an episode in a step
+// are reset right away, so the next observe() shows them at the start of a new
+// one.
+template <typename A> class vector_environment {
+public:
+  virtual ~vector_environment() = default;
+
+  virtual std::size_t size() const = 0;
+  // The width of a row of observe().
+  virtual std::size_t observation_length() const = 0;
+
+  // Applies actions[i] to instance i, and sets rewards[i], and done[i] if the
+  // episode ended.
+  virtual void step(std::span<const A> actions, vector_view rewards,
+                    std::span<std::uint8_t> done) = 0;
+  virtual void observe(matrix_view out) const = 0;
+  virtual void reset(std::size_t id) = 0;
+};
+
 // Temporal differences
 template <typename A, typename S> class td {
 public:
-  using container = std::list<transition<A, S>>;
+  using container = chunk_list<transition<A, S>>;
   td(const trajectory<A, S> &traj)
       : frozen_(traj.frozen), size_(traj.transitions.size()),
         begin_(traj.transitions.begin()), end_(traj.transitions.end()),
@@ -210,69 +251,253 @@ float total_rewards(const std::vector<td<A, S>> &experience) {
 template <typename A, typename S>
 using transition_ref = std::reference_wrapper<transition<A, S>>;
 
+// Actors write through producers, one per actor thread, each with a queue of
+// its own, so acting never takes a lock. A producer builds its trajectory where
+// nobody else can see it, and publishes finished episodes, or whatever an open
+// one has so far, into its queue. The learner side (sample_td,
+// sample_transitions and forget) belongs to a single thread, which drains the
+// queues into trajectories only it touches; it may run while actors are still
+// acting.
 template <typename A, typename S> class replay_buffer {
 public:
+  class producer {
+  public:
+    explicit producer(bool encode) : encode_(encode) {}
+    producer(const producer &) = delete;
+    void operator=(const producer &) = delete;
+
+    // The trajectory being written, if any.
+    trajectory<A, S> *current() { return current_.get(); }
+    trajectory<A, S> &open(S &&s) {
+      current_ = std::make_unique<trajectory<A, S>>(std::move(s));
+      if (encode_) {
+        current_->encoded.reserve(encoded_reserve_);
+        encode(current_->opening);
+      }
+      return *current_;
+    }
+    void add_transition(A &&a, float r, S &&curr) {
+      current_->add_transition(std::move(a), r, std::move(curr));
+      if (encode_)
+        encode(current_->last_state());
+    }
+
+    // A frozen trajectory goes as a whole. An open one is split: what it has
+    // goes now, and current() carries on from its last state.
+    void publish() {
+      if (!current_ || (!current_->frozen && current_->size() == 0))
+        return;
+      std::unique_ptr<trajectory<A, S>> next;
+      if (!current_->frozen) {
+        next = std::make_unique<trajectory<A, S>>(S(current_->last_state()));
+        const auto &rows = current_->encoded;
+        const std::size_t width = rows.size() / (current_->size() + 1);
+        next->encoded.assign(rows.end() - width, rows.end());
+      }
+      encoded_reserve_ = std::max(encoded_reserve_, current_->encoded.size());
+      queue_.push(std::move(current_));
+      current_ = std::move(next);
+    }
+
+    // For trajectories built elsewhere, such as by a remote actor. An encoding
+    // buffer needs them encoded.
+    void publish(std::unique_ptr<trajectory<A, S>> t) {
+      queue_.push(std::move(t));
+    }
+
+  private:
+    void encode(const S &s) {
+      std::vector<float> &rows = current_->encoded;
+      const std::size_t width = s.length();
+      rows.resize(rows.size() + width);
+      s.to_vector(borrow_vector(std::span(rows).last(width)));
+    }
+
+    const bool encode_;
+    // The most rows a trajectory has needed, so that the next ones are
+    // encoded without growing.
+    std::size_t encoded_reserve_ = 0;
+    std::unique_ptr<trajectory<A, S>> current_;
+    xeno::sys::spsc_queue<std::unique_ptr<trajectory<A, S>>> queue_;
+    // Set by the actor once it's done; nothing is pushed after.
+    std::atomic<bool> retired_ = false;
+
+    friend class replay_buffer;
+  };
+
+  // With encode_states, producers also encode every state as it comes in, so
+  // that learners can have them as one matrix; see encoded_states().
+  explicit replay_buffer(bool encode_states = false)
+      : encode_states_(encode_states) {}
+
+  // Registration is the only lock actors take.
+  producer &add_producer() {
+    std::lock_guard l(mutex_);
+    return producers_.emplace_back(encode_states_);
+  }
+  // p goes away at the next drain, after what it published.
+  void retire(producer &p) {
+    p.publish();
+    p.retired_.store(true, std::memory_order_release);
+  }
+
+  // For writers that share the buffer's own trajectories instead. These have
+  // no protection against a concurrent learner.
   trajectory<A, S> &emplace_trajectory(S &&s) {
     std::lock_guard l(mutex_);
     trajectories_.emplace_back(std::move(s));
     return trajectories_.back();
   }
 
+  // Moves everything published so far over to the learner's side. The other
+  // learner calls do this first; it never waits for actors.
+  void drain() {
+    std::lock_guard l(mutex_);
+    for (auto pos = producers_.begin(); pos != producers_.end();) {
+      // Read the flag first: if it's set, the queue already holds everything.
+      const bool retired = pos->retired_.load(std::memory_order_acquire);
+      while (auto traj = pos->queue_.pop()) {
+        published_.emplace_back(std::move(*traj));
+      }
+      pos = retired ? producers_.erase(pos) : std::next(pos);
+    }
+  }
+
+  // Transitions on the learner's side, after a drain.
+  std::size_t size() {
+    drain();
+    std::size_t result = 0;
+    for (const auto &traj : published_) {
+      result += traj->size();
+    }
+    for (const trajectory<A, S> &traj : trajectories_) {
+      result += traj.size();
+    }
+    return result;
+  }
+
+  struct policy_lag {
+    float mean = 0;
+    std::size_t max = 0;
+    // Transitions thrown away.
+    std::size_t dropped = 0;
+  };
+
+  // Drops published trajectories that acted more than max_lag versions before
+  // version, and reports how far behind the rest are, per transition. Past a
+  // few versions the behaviour policy is so far from the current one that
+  // clipped importance ratios mostly just clip.
+  policy_lag drop_stale(std::size_t version, std::size_t max_lag) {
+    drain();
+    policy_lag result;
+    std::size_t kept = 0;
+    double total_lag = 0;
+    std::erase_if(published_, [&](const auto &traj) {
+      const std::size_t lag =
+          version > traj->policy_version ? version - traj->policy_version : 0;
+      if (lag > max_lag) {
+        result.dropped += traj->size();
+        return true;
+      }
+      kept += traj->size();
+      total_lag += double(lag) * traj->size();
+      result.max = std::max(result.max, lag);
+      return false;
+    });
+    result.mean = kept == 0 ? 0 : total_lag / kept;
+    return result;
+  }
+
+  // The states of what the last sample_td() returned, in the same order: for
+  // each trajectory, the start state of every transition and then its last
+  // state. The rows were encoded as the states came in, so this is one block
+  // copy per trajectory, into storage that is reused from call to call. Empty
+  // if the buffer doesn't encode, or holds trajectories that weren't encoded.
+  std::optional<matrix_view> encoded_states() {
+    if (!encode_states_ || published_.empty() || !trajectories_.empty())
+      return std::nullopt;
+
+    const auto &first = *published_.front();
+    const std::size_t width = first.encoded.size() / (first.size() + 1);
+    std::size_t total = 0;
+    for (const auto &traj : published_) {
+      if (traj->size() > 0)
+        total += traj->encoded.size();
+    }
+    if (!state_rows_ || state_rows_->size() < total) {
+      heap_scope heap;
+      state_rows_ = std::make_unique<vector>(
+          std::max(total, state_rows_ ? 2 * state_rows_->size() : 0));
+    }
+    float *dst = state_rows_->data();
+    for (const auto &traj : published_) {
+      if (traj->size() > 0)
+        dst = std::copy(traj->encoded.begin(), traj->encoded.end(), dst);
+    }
+    return fold<2>(slice(*state_rows_, 0, total), {total / width, width});
+  }
+
   // TODO: parameters are not implemented yet.
   std::vector<td<A, S>> sample_td(std::size_t n = -1,
                                   std::size_t max_length = -1) {
+    drain();
     std::vector<td<A, S>> result;
 
+    for (const auto &traj : published_) {
+      if (traj->size() == 0) {
+        continue;
+      }
+      traj->fill_reference();
+      result.emplace_back(*traj);
+    }
     for (trajectory<A, S> &traj : trajectories_) {
-      traj.fill_reference();
-      result.emplace_back(traj);
       if (traj.size() == 0) {
         continue;
       }
+      traj.fill_reference();
+      result.emplace_back(traj);
     }
     return result;
   }
 
+  // Uniform over all transitions, with replacement. For repeated sampling over
+  // a large history, ring_replay in replay.h is the better fit.
   std::vector<transition_ref<A, S>> sample_transitions(std::size_t n) {
-    std::vector<transition_ref<A, S>> result;
-    result.reserve(n);
-
-    // TODO: implement the sampling
-    std::size_t total = 0;
+    drain();
+    std::vector<transition<A, S> *> all;
+    for (const auto &traj : published_) {
+      for (transition<A, S> &trans : traj->transitions) {
+        all.push_back(&trans);
+      }
+    }
     for (trajectory<A, S> &traj : trajectories_) {
-      total += traj.size();
+      for (transition<A, S> &trans : traj.transitions) {
+        all.push_back(&trans);
+      }
     }
+    if (all.empty())
+      throw xeno::error("sampling an empty replay buffer.");
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> distrib(0, total - 1);
-
+    std::vector<transition_ref<A, S>> result;
+    result.reserve(n);
+    std::uniform_int_distribution<std::size_t> distrib(0, all.size() - 1);
     for (std::size_t i = 0; i < n; ++i) {
-      std::size_t index = distrib(gen);
-
-      std::size_t start = 0;
-      transition<A, S> *p_trans = nullptr;
-      for (trajectory<A, S> &traj : trajectories_) {
-        std::size_t end = start + traj.size();
-        if (index >= start && index < end) {
-          std::size_t curr = start;
-          for (transition<A, S> &trans : traj.transitions) {
-            if (curr++ == index) {
-              p_trans = &trans;
-              break;
-            }
-          }
-          break;
-        }
-        start = end;
-      }
-      result.emplace_back(*p_trans);
+      result.emplace_back(*all[distrib(generator_)]);
     }
     return result;
   }
 
+  // Moves everything published out of the buffer, e.g. to ship it to a
+  // learner elsewhere. Takes no other trajectories.
+  std::vector<std::unique_ptr<trajectory<A, S>>> take_published() {
+    drain();
+    return std::exchange(published_, {});
+  }
+
+  // Published trajectories go entirely; open ones carry on at their producer.
   void forget() {
-    std::vector<trajectory<A, S>> left;
+    drain();
+    published_.clear();
     for (auto pos = trajectories_.begin(); pos != trajectories_.end();) {
       auto &trajectory = *pos;
 
@@ -291,8 +516,16 @@ public:
   }
 
 private:
+  // Guards producers_ and trajectories_.
   std::mutex mutex_;
+  std::list<producer> producers_;
   std::list<trajectory<A, S>> trajectories_;
+  const bool encode_states_;
+  // Learner side only.
+  std::vector<std::unique_ptr<trajectory<A, S>>> published_;
+  std::unique_ptr<vector> state_rows_;
+  // Seeded once, not per call.
+  std::mt19937 generator_{default_generator()()};
 };
 
 template <typename A, typename S> class policy {
@@ -318,30 +551,44 @@ template <typename A, typename S> class agent {
 public:
   explicit agent(const policy<A, S> &p, environment<A, S> &env,
                  replay_buffer<A, S> &rb, std::size_t id = 0)
-      : policy_(p), env_(env), replay_buffer_(rb), id_(id) {}
-  virtual ~agent() = default;
+      : id_(id), policy_(p), env_(env), replay_buffer_(rb),
+        producer_(&rb.add_producer()) {}
+  agent(agent &&other)
+      : id_(other.id_), policy_(other.policy_), env_(other.env_),
+        replay_buffer_(other.replay_buffer_),
+        producer_(std::exchange(other.producer_, nullptr)),
+        policy_version_(other.policy_version_) {}
+  virtual ~agent() {
+    if (producer_)
+      replay_buffer_.retire(*producer_);
+  }
 
-  // Return whether an episode is open after the step.
+  // Return whether an episode is open after the step. Finished episodes are
+  // published right away.
   bool step() {
-    if (!curr_traj_) {
+    trajectory<A, S> *traj = producer_->current();
+    if (!traj) {
       // We don't have a history. This is the very first state.
-      curr_traj_ = &replay_buffer_.emplace_trajectory(env_.view(id_));
+      traj = &producer_->open(env_.view(id_));
     }
 
+    if (traj->size() == 0)
+      traj->policy_version = policy_version_;
+
     // There is a past state.
-    const S &previous_state = curr_traj_->last_state();
+    const S &previous_state = traj->last_state();
     A action = policy_.react(previous_state);
     env_.apply(action, id_);
 
     S curr_state = env_.view(id_);
-    curr_traj_->add_transition(std::move(action),
-                               get_reward(previous_state, curr_state),
-                               std::move(curr_state));
+    producer_->add_transition(std::move(action),
+                              get_reward(previous_state, curr_state),
+                              std::move(curr_state));
 
-    if (game_over(curr_traj_->last_state())) {
+    if (game_over(traj->last_state())) {
       env_.reset(id_);
-      curr_traj_->freeze();
-      curr_traj_ = nullptr;
+      traj->freeze();
+      producer_->publish();
       return false;
     }
 
@@ -353,14 +600,20 @@ public:
       ;
   }
 
+  // Publishes what the open episode has so far at the end.
   void play_steps(std::size_t n) {
     for (std::size_t i = 0; i < n; ++i) {
       step();
     }
+    producer_->publish();
   }
 
   std::size_t id() { return id_; }
 
+  // Stamped on what gets published from here on. Change it only between
+  // play_steps() calls, so that every published piece comes from one version.
+  void set_policy_version(std::size_t version) { policy_version_ = version; }
+
 protected:
   virtual bool game_over(const S &state) = 0;
   virtual float get_reward(const S &state1, const S &state2) = 0;
@@ -369,8 +622,8 @@ protected:
   const policy<A, S> &policy_;
   environment<A, S> &env_;
   replay_buffer<A, S> &replay_buffer_;
-
-  trajectory<A, S> *curr_traj_ = nullptr;
+  typename replay_buffer<A, S>::producer *producer_;
+  std::size_t policy_version_ = 0;
 };
 
 template <typename A, typename S> class learner {
@@ -380,11 +633,20 @@ public:
       : replay_buffer_(rb), policy_model_(policy_model),
         policy_optimizer_(policy_optimizer), gamma_(gamma) {}
 
-  void step() { learn(); }
+  void step() {
+    profile_scope profile("learner", "learn");
+    learn();
+  }
 
   virtual void learn() = 0;
 
 protected:
+  // All the replay buffer has, profiled as the learner's sample phase.
+  std::vector<td<A, S>> sample() {
+    profile_scope profile("learner", "sample");
+    return replay_buffer_.sample_td();
+  }
+
   replay_buffer<A, S> &replay_buffer_;
   model &policy_model_;
   optimizer &policy_optimizer_;
@@ -0,0 +1,95 @@
+#ifndef XYLO_SNAPSHOT_
+#define XYLO_SNAPSHOT_
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+
+#include <xeno/exception.h>
+#include <xylo/tensor.h>
+
+namespace xylo {
+
+// Hands a parameter vector from one learner thread to any number of actor
+// threads without either side waiting on the other.
+//
+// There are two buffers, and publish() writes into the one the previous
+// version didn't use, so readers of the latest version are only disturbed if
+// the learner publishes twice while they copy. Each buffer carries a sequence
+// number that is odd while it's being written; a reader that sees it change
+// across its copy throws the copy away and tries again. Versions start at 1, so
+// 0 means "nothing yet".
+class parameter_snapshot {
+public:
+  explicit parameter_snapshot(std::size_t size) : size_(size) {
+    // Plain heap storage, whatever scope the caller is in.
+    heap_scope heap;
+    for (auto &s : slots_)
+      s.data = std::make_unique<vector>(size);
+  }
+
+  std::size_t size() const { return size_; }
+  std::size_t version() const {
+    return version_.load(std::memory_order_acquire);
+  }
+
+  // Learner only. Returns the new version.
+  std::size_t publish(vector_view parameters) {
+    if (parameters.size() != size_)
+      throw xeno::error("different tensor shapes.");
+    const std::size_t v = version_.load(std::memory_order_relaxed) + 1;
+    slot &s = slots_[v % 2];
+    s.sequence.store(2 * v - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(s.data->data(), parameters.data(), size_ * sizeof(float));
+    s.sequence.store(2 * v, std::memory_order_release);
+    version_.store(v, std::memory_order_release);
+    version_.notify_all();
+    return v;
+  }
+
+  // Blocks until there is a version newer than have, and returns it.
+  std::size_t wait(std::size_t have) const {
+    std::size_t v = version();
+    while (v <= have) {
+      version_.wait(v, std::memory_order_acquire);
+      v = version();
+    }
+    return v;
+  }
+
+  // Copies the latest version into out if it's newer than have, and returns
+  // the version out ends up with.
+  std::size_t update(vector_view out, std::size_t have) const {
+    if (out.size() != size_)
+      throw xeno::error("different tensor shapes.");
+    for (;;) {
+      const std::size_t v = version();
+      if (v <= have)
+        return have;
+      const slot &s = slots_[v % 2];
+      const std::size_t before = s.sequence.load(std::memory_order_acquire);
+      // Already being overwritten by v + 2; v + 1 is in the other buffer.
+      if (before != 2 * v)
+        continue;
+      std::memcpy(out.data(), s.data->data(), size_ * sizeof(float));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (s.sequence.load(std::memory_order_relaxed) == before)
+        return v;
+    }
+  }
+
+private:
+  struct slot {
+    std::atomic<std::size_t> sequence = 0;
+    std::unique_ptr<vector> data;
+  };
+
+  const std::size_t size_;
+  slot slots_[2];
+  std::atomic<std::size_t> version_ = 0;
+};
+
+} // namespace xylo
+
+#endif // XYLO_SNAPSHOT_
@@ -0,0 +1,259 @@
+#ifndef XYLO_STATIC_NN_
+#define XYLO_STATIC_NN_
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <span>
+#include <tuple>
+#include <utility>
+
+#include <xeno/exception.h>
+#include <xylo/nn.h>
+#include <xylo/tensor.h>
+
+// Inference for networks whose shapes are known when compiling, such as the
+// bin packing policy. Layers are plain classes with their sizes as template
+// parameters, weights in std::array, and no virtual calls or allocations: a
+// static_model evaluates one sample with its activations on the stack, and
+// every loop has a fixed trip count for the compiler to unroll and vectorize.
+//
+// The weights come from, and go back to, a model of the matching dynamic
+// layers, in the layout of its parameters(). They are copies: load() again
+// after training.
+namespace xylo {
+
+// A matmul_layer of input_size to output_size, and a relu_activation after it
+// if relu. Internally the weights are kept transposed, so that the innermost
+// loop runs over the outputs.
+template <std::size_t input_size, std::size_t output_size, bool relu = false>
+class static_matmul_layer {
+public:
+  static constexpr std::size_t input_width = input_size;
+  static constexpr std::size_t output_width = output_size;
+  static constexpr std::size_t parameter_size = (input_size + 1) * output_size;
+  // How many layers of a model it stands for.
+  static constexpr std::size_t num_layers = relu ? 2 : 1;
+
+  // From parameters laid out like matmul_layer's.
+  void load(std::span<const float, parameter_size> parameters) {
+    for (std::size_t o = 0; o < output_size; ++o) {
+      for (std::size_t i = 0; i < input_size; ++i)
+        weights_[i][o] = parameters[o * input_size + i];
+      bias_[o] = parameters[input_size * output_size + o];
+    }
+  }
+  void store(std::span<float, parameter_size> parameters) const {
+    for (std::size_t o = 0; o < output_size; ++o) {
+      for (std::size_t i = 0; i < input_size; ++i)
+        parameters[o * input_size + i] = weights_[i][o];
+      parameters[input_size * output_size + o] = bias_[o];
+    }
+  }
+
+  void forward(std::span<const float, input_size> input,
+               std::span<float, output_size> output) const {
+    std::array<float, output_size> acc = bias_;
+    for (std::size_t i = 0; i < input_size; ++i) {
+      const float x = input[i];
+      for (std::size_t o = 0; o < output_size; ++o)
+        acc[o] += weights_[i][o] * x;
+    }
+    for (std::size_t o = 0; o < output_size; ++o)
+      output[o] = relu ? std::max(acc[o], 0.0f) : acc[o];
+  }
+
+private:
+  std::array<std::array<float, output_size>, input_size> weights_{};
+  std::array<float, output_size> bias_{};
+};
+
+template <std::size_t input_size, std::size_t output_size, bool relu = false>
+using static_full_layer = static_matmul_layer<input_size, output_size, relu>;
+
+// A convolution1d_1_layer over num_points points, with its parameters laid out
+// the same way, which is matmul_layer's.
+template <std::size_t num_points, std::size_t input_channels,
+          std::size_t output_channels, bool relu = false>
+class static_convolution1d_1_layer {
+public:
+  static constexpr std::size_t input_width = num_points * input_channels;
+  static constexpr std::size_t output_width = num_points * output_channels;
+  static constexpr std::size_t parameter_size =
+      (input_channels + 1) * output_channels;
+  static constexpr std::size_t num_layers = relu ? 2 : 1;
+
+  void load(std::span<const float, parameter_size> parameters) {
+    point_.load(parameters);
+  }
+  void store(std::span<float, parameter_size> parameters) const {
+    point_.store(parameters);
+  }
+
+  void forward(std::span<const float, input_width> input,
+               std::span<float, output_width> output) const {
+    for (std::size_t p = 0; p < num_points; ++p) {
+      point_.forward(input.subspan(p * input_channels)
+                         .template first<input_channels>(),
+                     output.subspan(p * output_channels)
+                         .template first<output_channels>());
+    }
+  }
+
+private:
+  static_matmul_layer<input_channels, output_channels, relu> point_;
+};
+
+// For relus that don't follow a product.
+template <std::size_t size> class static_relu_activation {
+public:
+  static constexpr std::size_t input_width = size;
+  static constexpr std::size_t output_width = size;
+  static constexpr std::size_t parameter_size = 0;
+  static constexpr std::size_t num_layers = 1;
+
+  void load(std::span<const float, 0>) {}
+  void store(std::span<float, 0>) const {}
+
+  void forward(std::span<const float, size> input,
+               std::span<float, size> output) const {
+    for (std::size_t i = 0; i < size; ++i)
+      output[i] = std::max(input[i], 0.0f);
+  }
+};
+
+template <std::size_t size> class static_softmax_layer {
+public:
+  static constexpr std::size_t input_width = size;
+  static constexpr std::size_t output_width = size;
+  static constexpr std::size_t parameter_size = 0;
+  static constexpr std::size_t num_layers = 1;
+
+  void load(std::span<const float, 0>) {}
+  void store(std::span<float, 0>) const {}
+
+  void forward(std::span<const float, size> input,
+               std::span<float, size> output) const {
+    float max = input[0];
+    for (std::size_t i = 1; i < size; ++i)
+      max = std::max(max, input[i]);
+    float sum = 0;
+    for (std::size_t i = 0; i < size; ++i) {
+      output[i] = std::exp(input[i] - max);
+      sum += output[i];
+    }
+    for (std::size_t i = 0; i < size; ++i)
+      output[i] /= sum;
+  }
+};
+
+// The layers, in order, each taking what the one before gives out.
+template <typename... layers> class static_model {
+public:
+  static_assert(sizeof...(layers) > 0);
+
+  static constexpr std::size_t num_layers = sizeof...(layers);
+  static constexpr std::size_t input_width =
+      std::tuple_element_t<0, std::tuple<layers...>>::input_width;
+  static constexpr std::size_t output_width =
+      std::tuple_element_t<num_layers - 1,
+                           std::tuple<layers...>>::output_width;
+  static constexpr std::size_t parameter_size =
+      (layers::parameter_size + ... + 0);
+
+  static_model() = default;
+  // m has to be made of the same layers, with fused relus as layers of their
+  // own.
+  explicit static_model(const model &m) { load(m); }
+
+  void load(const model &m) {
+    constexpr std::size_t num_model_layers = (layers::num_layers + ... + 0);
+    if (m.layers().size() != num_model_layers)
+      throw xeno::error("static model with a different number of layers.");
+    std::size_t l = 0;
+    for_each_layer([&]<typename L>(L &) {
+      for (std::size_t i = 0; i < L::num_layers; ++i, ++l) {
+        const layer &dynamic = *m.layers()[l];
+        const std::size_t expected = i == 0 ? L::parameter_size : 0;
+        if (dynamic.parameters().size() != expected)
+          throw xeno::error("static model with different layer shapes.");
+        if (i > 0 && !dynamic_cast<const relu_activation *>(&dynamic))
+          throw xeno::error("static model with a relu the model lacks.");
+      }
+    });
+    load(m.parameters());
+  }
+
+  // From parameters laid out like the model's.
+  void load(vector_view parameters) {
+    if (parameters.size() != parameter_size)
+      throw xeno::error("different tensor shapes.");
+    const float *p = parameters.data();
+    for_each_layer([&]<typename L>(L &layer) {
+      layer.load(
+          std::span<const float, L::parameter_size>(p, L::parameter_size));
+      p += L::parameter_size;
+    });
+  }
+
+  void store(vector_view parameters) const {
+    if (parameters.size() != parameter_size)
+      throw xeno::error("different tensor shapes.");
+    float *p = parameters.data();
+    for_each_layer([&]<typename L>(const L &layer) {
+      layer.store(std::span<float, L::parameter_size>(p, L::parameter_size));
+      p += L::parameter_size;
+    });
+  }
+
+  void eval(std::span<const float, input_width> input,
+            std::span<float, output_width> output) const {
+    eval_from<0>(input, output);
+  }
+  std::array<float, output_width>
+  eval(std::span<const float, input_width> input) const {
+    std::array<float, output_width> output;
+    eval(input, output);
+    return output;
+  }
+
+private:
+  template <std::size_t i>
+  using layer_type = std::tuple_element_t<i, std::tuple<layers...>>;
+
+  template <std::size_t i> static constexpr bool chained() {
+    if constexpr (i + 1 < num_layers)
+      return layer_type<i>::output_width == layer_type<i + 1>::input_width &&
+             chained<i + 1>();
+    return true;
+  }
+  static_assert(chained<0>(), "layers with mismatched widths.");
+
+  // Layer i on input, and the ones after it on its output, which lives on
+  // the stack until they're done.
+  template <std::size_t i>
+  void eval_from(std::span<const float, layer_type<i>::input_width> input,
+                 std::span<float, output_width> output) const {
+    if constexpr (i + 1 == num_layers) {
+      std::get<i>(layers_).forward(input, output);
+    } else {
+      std::array<float, layer_type<i>::output_width> intermediate;
+      std::get<i>(layers_).forward(input, intermediate);
+      eval_from<i + 1>(intermediate, output);
+    }
+  }
+
+  template <typename F> void for_each_layer(F &&f) {
+    std::apply([&](auto &...l) { (f(l), ...); }, layers_);
+  }
+  template <typename F> void for_each_layer(F &&f) const {
+    std::apply([&](const auto &...l) { (f(l), ...); }, layers_);
+  }
+
+  std::tuple<layers...> layers_;
+};
+
+} // namespace xylo
+
+#endif // XYLO_STATIC_NN_
@@ -1,16 +1,19 @@
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstring>
 #include <experimental/source_location>
 #include <functional>
-#include <immintrin.h>
+#include <new>
 #include <numeric>
 #include <random>
 #include <sstream>
 
 #include <xeno/exception.h>
 #include <xeno/string.h>
-#include <xeno/time.h>
+#include <xeno/sys/thread.h>
+#include <xylo/gemm.h>
+#include <xylo/kernels.h>
 #include <xylo/tensor.h>
 
 namespace xylo {
@@ -57,30 +60,280 @@ void check_transpose_shapes(const matrix_view m1, const matrix_view m2,
   }
 }
 void check_matmul_shapes(const matrix_view m1, const matrix_view m2,
+                         const matrix_view out,
                          std::experimental::source_location location =
                              std::experimental::source_location::current()) {
+  if (m1.num_cols() != m2.num_rows() || out.num_rows() != m1.num_rows() ||
+      out.num_cols() != m2.num_cols()) {
+    std::string message = xeno::string::strcat(
+        "wrong shapes for matmul: ", m1.num_rows(), 'x', m1.num_cols(), " * ",
+        m2.num_rows(), 'x', m2.num_cols(), " -> ", out.num_rows(), 'x',
+        out.num_cols());
+    throw xeno::error(message, location);
+  }
+}
+void check_matmul_transposed_shapes(
+    const matrix_view m1, const matrix_view m2, const matrix_view out,
+    std::experimental::source_location location =
+        std::experimental::source_location::current()) {
   // Transposed
-  if (m1.num_cols() != m2.num_cols()) {
+  if (m1.num_cols() != m2.num_cols() || out.num_rows() != m1.num_rows() ||
+      out.num_cols() != m2.num_rows()) {
     std::string message = xeno::string::strcat(
         "wrong shapes for matmul: ", m1.num_rows(), 'x', m1.num_cols(), " vs. ",
         m2.num_cols(), 'x', m2.num_rows());
     throw xeno::error(message, location);
   }
 }
+void check_transposed_matmul_shapes(
+    const matrix_view m1, const matrix_view m2, const matrix_view out,
+    std::experimental::source_location location =
+        std::experimental::source_location::current()) {
+  if (m1.num_rows() != m2.num_rows() || out.num_rows() != m1.num_cols() ||
+      out.num_cols() != m2.num_cols()) {
+    std::string message = xeno::string::strcat(
+        "wrong shapes for matmul: ", m1.num_cols(), 'x', m1.num_rows(), " vs. ",
+        m2.num_rows(), 'x', m2.num_cols());
+    throw xeno::error(message, location);
+  }
+}
+
+// 0 means the whole default pool.
+std::atomic<std::size_t> g_num_threads = 0;
+// 0 means defer to g_num_threads.
+thread_local std::size_t t_num_threads = 0;
+
+std::size_t kernel_threads() {
+  std::size_t n = t_num_threads != 0 ? t_num_threads : g_num_threads.load();
+  if (n == 1)
+    return 1;
+  std::size_t pool_size = xeno::sys::default_thread_pool().size() + 1;
+  return n == 0 ? pool_size : std::min(n, pool_size);
+}
+
+// Runs f(begin, end) over [0, size), split over the pool if there are at least
+// two chunks of min_chunk items to go around.
+template <typename F>
+void parallel_chunks(std::size_t size, std::size_t min_chunk, F &&f) {
+  std::size_t threads = size >= 2 * min_chunk ? kernel_threads() : 1;
+  if (threads <= 1) {
+    f(std::size_t(0), size);
+    return;
+  }
+  std::size_t grain = std::max(min_chunk, (size + threads - 1) / threads);
+  xeno::sys::default_thread_pool().parallel_for(0, size, f, grain);
+}
+
+// Element-wise kernels are memory bound; below this many floats per chunk the
+// hand-off costs more than it saves.
+constexpr std::size_t elementwise_chunk = 1 << 15;
+
+// A gemm is only split if every thread gets at least this many flops.
+constexpr std::size_t gemm_chunk_flops = 1 << 20;
+// Row blocks are multiples of the micro-kernel height, column blocks of its
+// width, so splitting doesn't add edge tiles.
+constexpr std::size_t gemm_row_block = 24;
+constexpr std::size_t gemm_col_block = 64;
+
+// Splits c = op(a) * op(b) into independent blocks of rows or columns of c,
+// whichever dimension is larger.
+void parallel_gemm(bool transpose_a, bool transpose_b, std::size_t m,
+                   std::size_t n, std::size_t k, const float *a,
+                   std::size_t lda, const float *b, std::size_t ldb, float *c,
+                   std::size_t ldc, const gemm_epilogue &epilogue = {}) {
+  const std::size_t flops = 2 * m * n * k;
+  const std::size_t threads =
+      std::min(kernel_threads(), std::max<std::size_t>(flops / gemm_chunk_flops, 1));
+  if (threads <= 1) {
+    gemm(transpose_a, transpose_b, m, n, k, a, lda, b, ldb, c, ldc, false,
+         epilogue);
+    return;
+  }
+
+  auto &pool = xeno::sys::default_thread_pool();
+  if (m >= n) {
+    const std::size_t num_blocks = (m + gemm_row_block - 1) / gemm_row_block;
+    pool.parallel_for(
+        0, num_blocks,
+        [&](std::size_t begin, std::size_t end) {
+          std::size_t i0 = begin * gemm_row_block;
+          std::size_t i1 = std::min(m, end * gemm_row_block);
+          const float *a_block = transpose_a ? a + i0 : a + i0 * lda;
+          gemm(transpose_a, transpose_b, i1 - i0, n, k, a_block, lda, b, ldb,
+               c + i0 * ldc, ldc, false, epilogue);
+        },
+        (num_blocks + threads - 1) / threads);
+  } else {
+    const std::size_t num_blocks = (n + gemm_col_block - 1) / gemm_col_block;
+    pool.parallel_for(
+        0, num_blocks,
+        [&](std::size_t begin, std::size_t end) {
+          std::size_t j0 = begin * gemm_col_block;
+          std::size_t j1 = std::min(n, end * gemm_col_block);
+          const float *b_block = transpose_b ? b + j0 * ldb : b + j0;
+          gemm_epilogue block_epilogue = epilogue;
+          if (block_epilogue.bias)
+            block_epilogue.bias += j0;
+          gemm(transpose_a, transpose_b, m, j1 - j0, k, a, lda, b_block, ldb,
+               c + j0, ldc, false, block_epilogue);
+        },
+        (num_blocks + threads - 1) / threads);
+  }
+}
 
-std::default_random_engine
-    g_generator((xeno::time::now() - xeno::time::epoch()).time_.tv_sec);
+// Runs an element-wise kernel over raw storage in chunks. Aliasing the output
+// with an input is fine.
+template <typename F>
+void map(const float *in, float *out, std::size_t size, F &&kernel) {
+  parallel_chunks(size, elementwise_chunk,
+                  [=](std::size_t begin, std::size_t end) {
+                    kernel(in + begin, out + begin, end - begin);
+                  });
+}
+template <typename F>
+void map(const float *in1, const float *in2, float *out, std::size_t size,
+         F &&kernel) {
+  parallel_chunks(size, elementwise_chunk,
+                  [=](std::size_t begin, std::size_t end) {
+                    kernel(in1 + begin, in2 + begin, out + begin, end - begin);
+                  });
+}
+template <typename F>
+void map(const float *in, float scalar, float *out, std::size_t size,
+         F &&kernel) {
+  parallel_chunks(size, elementwise_chunk,
+                  [=](std::size_t begin, std::size_t end) {
+                    kernel(in + begin, scalar, out + begin, end - begin);
+                  });
+}
+
+// The kernels are overloaded, so name the one we mean.
+using unary_kernel = void (*)(const float *, float *, std::size_t);
+using binary_kernel = void (*)(const float *, const float *, float *,
+                               std::size_t);
+using scalar_kernel = void (*)(const float *, float, float *, std::size_t);
 } // namespace
 
-std::default_random_engine &default_generator() { return g_generator; }
+void set_num_threads(std::size_t n) { g_num_threads = n; }
+std::size_t num_threads() { return kernel_threads(); }
+
+scoped_num_threads::scoped_num_threads(std::size_t n)
+    : previous_(t_num_threads) {
+  t_num_threads = n;
+}
+scoped_num_threads::~scoped_num_threads() { t_num_threads = previous_; }
+
+// ******** Workspace methods ********
+namespace {
+constexpr std::size_t workspace_alignment = 64;
+
+// The workspace tensors on this thread allocate from, if any.
+thread_local workspace *t_active_workspace = nullptr;
+thread_local std::size_t t_allocated_bytes = 0;
+} // namespace
+
+workspace::workspace(std::size_t initial_bytes) { add_chunk(initial_bytes); }
+
+workspace::~workspace() {
+  for (const chunk &c : chunks_) {
+    free(c.data);
+  }
+}
+
+float *workspace::allocate(std::size_t size) {
+  std::size_t bytes = size * sizeof(float);
+  bytes = (bytes + workspace_alignment - 1) / workspace_alignment *
+          workspace_alignment;
+
+  while (offset_ + bytes > chunks_[current_].size) {
+    // Whatever is left at the end of this chunk counts as used.
+    used_ += chunks_[current_].size - offset_;
+    offset_ = 0;
+    if (++current_ == chunks_.size())
+      add_chunk(bytes);
+  }
+
+  float *result = reinterpret_cast<float *>(chunks_[current_].data + offset_);
+  offset_ += bytes;
+  used_ += bytes;
+  peak_ = std::max(peak_, used_);
+  return result;
+}
+
+void workspace::release(const mark &m) {
+  current_ = m.chunk;
+  offset_ = m.offset;
+  used_ = m.used;
+
+  // Once empty, fold the chunks into one, so the next round fits without
+  // spilling.
+  if (used_ == 0 && chunks_.size() > 1) {
+    std::size_t total = 0;
+    for (const chunk &c : chunks_) {
+      total += c.size;
+      free(c.data);
+    }
+    chunks_.clear();
+    add_chunk(total);
+  }
+}
+
+void workspace::clear() { release({0, 0, 0}); }
+
+void workspace::add_chunk(std::size_t min_bytes) {
+  std::size_t size = std::max(
+      min_bytes, chunks_.empty() ? workspace_alignment : 2 * chunks_.back().size);
+  size = (size + workspace_alignment - 1) / workspace_alignment *
+         workspace_alignment;
+  void *data;
+  if (posix_memalign(&data, workspace_alignment, size) != 0)
+    throw std::bad_alloc();
+  chunks_.push_back({reinterpret_cast<std::byte *>(data), size});
+}
+
+workspace &local_workspace() {
+  thread_local workspace w;
+  return w;
+}
+
+std::size_t allocated_bytes() { return t_allocated_bytes; }
+
+workspace_scope::workspace_scope(workspace &w)
+    : workspace_(w), mark_(w.get_mark()), previous_(t_active_workspace) {
+  t_active_workspace = &w;
+}
+workspace_scope::~workspace_scope() {
+  workspace_.release(mark_);
+  t_active_workspace = previous_;
+}
+
+workspace_binding::workspace_binding(workspace &w)
+    : previous_(t_active_workspace) {
+  t_active_workspace = &w;
+}
+workspace_binding::~workspace_binding() { t_active_workspace = previous_; }
+
+heap_scope::heap_scope() : previous_(t_active_workspace) {
+  t_active_workspace = nullptr;
+}
+heap_scope::~heap_scope() { t_active_workspace = previous_; }
 
 // ******** Memory blob methods ********
-memory_blob::memory_blob(std::size_t size, bool on_device)
-    : u_{on_device ? gpu_alloc(size) : default_alloc(size)} {
+memory_blob::memory_blob(std::size_t size, bool on_device) {
   static_assert(sizeof(float *) == sizeof(uint64_t));
   if (on_device) {
+    u_.addr = gpu_alloc(size);
     set_on_device();
+    return;
+  }
+  t_allocated_bytes += size * sizeof(float);
+  if (t_active_workspace != nullptr && size != 0) {
+    // The workspace frees it, not us.
+    u_.addr = t_active_workspace->allocate(size);
+    set_borrowed();
+    return;
   }
+  u_.addr = default_alloc(size);
 }
 
 memory_blob::memory_blob(float *addr, bool on_device) : u_{addr} {
@@ -157,24 +410,13 @@ void vector_view::operator=(const vector_view &other) {
 
 float vector_view::dot(const vector_view other) const {
   check_shape_equal(*this, other);
-  return std::inner_product(begin(), end(), other.begin(), 0.0f);
+  return kernels::dot(data(), other.data(), size());
 }
 
-float vector_view::sum() const {
-  if (size() == 0)
-    return 0.0f;
-  return std::accumulate(begin(), end(), 0.0f);
-}
+float vector_view::sum() const { return kernels::sum(data(), size()); }
 float vector_view::mean() const { return sum() / size(); }
 float vector_view::variance() const {
-  if (size() == 0)
-    return 0.0f;
-  float m = mean();
-  auto variance_sum = [m](float sum, float elem) {
-    float diff = elem - m;
-    return sum + diff * diff;
-  };
-  return std::accumulate(begin(), end(), 0.0f, variance_sum) / size();
+  return kernels::variance(data(), size());
 }
 float vector_view::stddev() const { return ::sqrt(variance()); }
 float vector_view::coef_variance() const {
@@ -184,19 +426,16 @@ float vector_view::coef_variance() const {
     return 0.0f;
   return mean() / stddev();
 }
+float vector_view::max() const { return kernels::max(data(), size()); }
 std::size_t vector_view::argmax() const {
-  return std::ranges::distance(begin(), std::ranges::max_element(*this));
+  return kernels::argmax(data(), size());
 }
 
 void vector_view::normal_distribution(float mean, float stddev) {
-  std::normal_distribution<float> dist{mean, stddev};
-  auto &gen = default_generator();
-  std::ranges::for_each(*this, [&](float &val) { val = dist(gen); });
+  normal_fill(default_generator(), mean, stddev, data(), size());
 }
 void vector_view::uniform_distribution(float lower, float upper) {
-  std::uniform_real_distribution<float> dist{lower, upper};
-  auto &gen = default_generator();
-  std::ranges::for_each(*this, [&](float &val) { val = dist(gen); });
+  uniform_fill(default_generator(), lower, upper, data(), size());
 }
 
 vector_view vector_view::slice(std::size_t pos, std::size_t size) const {
@@ -208,25 +447,63 @@ vector_view vector_view::slice(std::size_t pos, std::size_t size) const {
 // ******** Global matrix functions ********
 void transpose(const matrix_view in, matrix_view out) {
   check_transpose_shapes(in, out);
-  for (std::size_t i = 0; i < in.num_rows(); ++i) {
-    for (std::size_t j = 0; j < out.num_rows(); ++j) {
-      out[j][i] = in[i][j];
-    }
-  }
-}
-
+  // Go tile by tile, so that both the reads and the writes stay within a
+  // handful of cache lines.
+  constexpr std::size_t tile = 32;
+  const std::size_t rows = in.num_rows();
+  const std::size_t cols = in.num_cols();
+  // Nothing to move, and no columns to size the chunks by.
+  if (rows == 0 || cols == 0)
+    return;
+  const float *src = in.data();
+  float *dst = out.data();
+  const std::size_t num_row_tiles = (rows + tile - 1) / tile;
+  parallel_chunks(
+      num_row_tiles, std::max<std::size_t>(elementwise_chunk / tile / cols, 1),
+      [=](std::size_t begin, std::size_t end) {
+        for (std::size_t i0 = begin * tile; i0 < std::min(rows, end * tile);
+             i0 += tile) {
+          const std::size_t i1 = std::min(rows, i0 + tile);
+          for (std::size_t j0 = 0; j0 < cols; j0 += tile) {
+            const std::size_t j1 = std::min(cols, j0 + tile);
+            for (std::size_t i = i0; i < i1; ++i) {
+              for (std::size_t j = j0; j < j1; ++j) {
+                dst[j * rows + i] = src[i * cols + j];
+              }
+            }
+          }
+        }
+      });
+}
+
+// All three products go through the same gemm, which reads the operands in
+// their stored order instead of materializing a transpose.
 void matmul_transposed(matrix_view in1, matrix_view in2, matrix_view out) {
-  check_matmul_shapes(in1, in2);
-  std::size_t m = in1.num_rows();
-  std::size_t n = in2.num_rows();
-  for (std::size_t i = 0; i < m; ++i) {
-    for (std::size_t j = 0; j < n; ++j) {
-      out[i][j] = dot(in1[i], in2[j]);
-    }
-  }
+  check_matmul_transposed_shapes(in1, in2, out);
+  parallel_gemm(false, true, in1.num_rows(), in2.num_rows(), in1.num_cols(),
+                in1.data(), in1.num_cols(), in2.data(), in2.num_cols(),
+                out.data(), out.num_cols());
+}
+void matmul_transposed(matrix_view in1, matrix_view in2, vector_view bias,
+                       bool relu, matrix_view out) {
+  check_matmul_transposed_shapes(in1, in2, out);
+  if (bias.size() != out.num_cols())
+    throw xeno::error("wrong bias size for matmul.");
+  parallel_gemm(false, true, in1.num_rows(), in2.num_rows(), in1.num_cols(),
+                in1.data(), in1.num_cols(), in2.data(), in2.num_cols(),
+                out.data(), out.num_cols(), {bias.data(), relu});
+}
+void transposed_matmul(matrix_view in1, matrix_view in2, matrix_view out) {
+  check_transposed_matmul_shapes(in1, in2, out);
+  parallel_gemm(true, false, in1.num_cols(), in2.num_cols(), in1.num_rows(),
+                in1.data(), in1.num_cols(), in2.data(), in2.num_cols(),
+                out.data(), out.num_cols());
 }
 void matmul(matrix_view in1, matrix_view in2, matrix_view out) {
-  matmul_transposed(in1, ::transpose(in2), out);
+  check_matmul_shapes(in1, in2, out);
+  parallel_gemm(false, false, in1.num_rows(), in2.num_cols(), in1.num_cols(),
+                in1.data(), in1.num_cols(), in2.data(), in2.num_cols(),
+                out.data(), out.num_cols());
 }
 
 void add(matrix_view in1, matrix_view in2, matrix_view out) {
@@ -250,70 +527,92 @@ void divide(matrix_view in1, matrix_view in2, matrix_view out) {
   divide(flatten(in1), flatten(in2), flatten(out));
 }
 
+void softmax(matrix_view in, matrix_view out) {
+  check_shape_equal(in, out);
+  const std::size_t cols = in.num_cols();
+  const float *src = in.data();
+  float *dst = out.data();
+  parallel_chunks(in.num_rows(),
+                  std::max<std::size_t>(elementwise_chunk / (cols + 1), 1),
+                  [=](std::size_t begin, std::size_t end) {
+                    for (std::size_t i = begin; i < end; ++i) {
+                      const float *row = src + i * cols;
+                      float *result = dst + i * cols;
+                      kernels::minus(row, kernels::max(row, cols), result,
+                                     cols);
+                      kernels::exp(result, result, cols);
+                      kernels::multiply(result, 1 / kernels::sum(result, cols),
+                                        result, cols);
+                    }
+                  });
+}
+
 // ******** Global vector functions ********
 // We don't merge back into the vector class, because these functios offer
 // us the possibilities of writing to the output directly, saving a copy.
 void add(vector_view in1, vector_view in2, vector_view out) {
   check_shape_equal(in1, in2);
   check_shape_equal(in1, out);
-  std::ranges::transform(in1, in2, out.begin(), std::plus{});
+  map(in1.data(), in2.data(), out.data(), out.size(),
+      binary_kernel(kernels::add));
 }
 void add(vector_view in, float scalar, vector_view out) {
   check_shape_equal(in, out);
-  std::ranges::transform(in, out.begin(),
-                         std::bind(std::plus{}, std::placeholders::_1, scalar));
+  map(in.data(), scalar, out.data(), out.size(),
+      scalar_kernel(kernels::add));
 }
 void minus(vector_view in1, vector_view in2, vector_view out) {
   check_shape_equal(in1, in2);
   check_shape_equal(in1, out);
-  std::ranges::transform(in1, in2, out.begin(), std::minus{});
+  map(in1.data(), in2.data(), out.data(), out.size(),
+      binary_kernel(kernels::minus));
 }
 void minus(vector_view in, float scalar, vector_view out) {
   check_shape_equal(in, out);
-  std::ranges::transform(
-      in, out.begin(), std::bind(std::minus{}, std::placeholders::_1, scalar));
+  map(in.data(), scalar, out.data(), out.size(),
+      scalar_kernel(kernels::minus));
 }
 void multiply(vector_view in1, vector_view in2, vector_view out) {
   check_shape_equal(in1, in2);
   check_shape_equal(in1, out);
-  std::ranges::transform(in1, in2, out.begin(), std::multiplies{});
+  map(in1.data(), in2.data(), out.data(), out.size(),
+      binary_kernel(kernels::multiply));
 }
 void multiply(vector_view in, float scalar, vector_view out) {
   check_shape_equal(in, out);
-  std::ranges::transform(
-      in, out.begin(),
-      std::bind(std::multiplies{}, std::placeholders::_1, scalar));
+  map(in.data(), scalar, out.data(), out.size(),
+      scalar_kernel(kernels::multiply));
 }
 void divide(vector_view in1, vector_view in2, vector_view out) {
   check_shape_equal(in1, in2);
   check_shape_equal(in1, out);
-  std::ranges::transform(in1, in2, out.begin(), std::divides{});
+  map(in1.data(), in2.data(), out.data(), out.size(),
+      binary_kernel(kernels::divide));
 }
 void divide(vector_view in, float scalar, vector_view out) {
   check_shape_equal(in, out);
-  std::ranges::transform(
-      in, out.begin(),
-      std::bind(std::divides{}, std::placeholders::_1, scalar));
+  map(in.data(), scalar, out.data(), out.size(),
+      scalar_kernel(kernels::divide));
 }
 void abs(vector_view in, vector_view out) {
   check_shape_equal(in, out);
-  std::ranges::transform(in, out.begin(), ::fabsf);
+  map(in.data(), out.data(), out.size(), unary_kernel(kernels::abs));
 }
 void sin(vector_view in, vector_view out) {
   check_shape_equal(in, out);
-  std::ranges::transform(in, out.begin(), ::sinf);
+  map(in.data(), out.data(), out.size(), unary_kernel(kernels::sin));
 }
 void exp(vector_view in, vector_view out) {
   check_shape_equal(in, out);
-  std::ranges::transform(in, out.begin(), ::expf);
+  map(in.data(), out.data(), out.size(), unary_kernel(kernels::exp));
 }
 void log(vector_view in, vector_view out) {
   check_shape_equal(in, out);
-  std::ranges::transform(in, out.begin(), ::logf);
+  map(in.data(), out.data(), out.size(), unary_kernel(kernels::log));
 }
 void sqrt(vector_view in, vector_view out) {
   check_shape_equal(in, out);
-  std::ranges::transform(in, out.begin(), ::sqrtf);
+  map(in.data(), out.data(), out.size(), unary_kernel(kernels::sqrt));
 }
 
 } // namespace xylo
@@ -329,6 +628,11 @@ xylo::matrix matmul_transposed(xylo::matrix_view in1, xylo::matrix_view in2) {
   xylo::matmul_transposed(in1, in2, out);
   return out;
 }
+xylo::matrix transposed_matmul(xylo::matrix_view in1, xylo::matrix_view in2) {
+  xylo::matrix out(std::array<std::size_t, 2>{in1.num_cols(), in2.num_cols()});
+  xylo::transposed_matmul(in1, in2, out);
+  return out;
+}
 xylo::matrix matmul(xylo::matrix_view in1, xylo::matrix_view in2) {
   xylo::matrix out(std::array<std::size_t, 2>{in1.num_rows(), in2.num_cols()});
   xylo::matmul(in1, in2, out);
@@ -368,86 +672,34 @@ xylo::matrix operator-(xylo::matrix_view in1, xylo::matrix_view in2) {
 }
 
 // ******** Out-of-namespace vector operators ********
-void operator+=(xylo::vector_view v, float val) {
-  std::ranges::transform(v, v.begin(), std::bind_front(std::plus{}, val));
-}
+void operator+=(xylo::vector_view v, float val) { xylo::add(v, val, v); }
 void operator+=(xylo::vector_view v1, xylo::vector_view v2) {
-  xylo::check_shape_equal(v1, v2);
-  std::ranges::transform(v1, v2, v1.begin(), std::plus{});
-}
-void operator-=(xylo::vector_view v, float val) {
-  std::ranges::transform(v, v.begin(), std::bind_front(std::minus{}, val));
+  xylo::add(v1, v2, v1);
 }
+void operator-=(xylo::vector_view v, float val) { xylo::minus(v, val, v); }
 void operator-=(xylo::vector_view v1, xylo::vector_view v2) {
-  xylo::check_shape_equal(v1, v2);
-  std::ranges::transform(v1, v2, v1.begin(), std::minus{});
-}
-void operator*=(xylo::vector_view v, float val) {
-  std::ranges::transform(v, v.begin(), std::bind_front(std::multiplies{}, val));
+  xylo::minus(v1, v2, v1);
 }
+void operator*=(xylo::vector_view v, float val) { xylo::multiply(v, val, v); }
 void operator*=(xylo::vector_view v1, xylo::vector_view v2) {
-  xylo::check_shape_equal(v1, v2);
-  std::ranges::transform(v1, v2, v1.begin(), std::multiplies{});
-}
-void operator/=(xylo::vector_view v, float val) {
-  std::ranges::transform(v, v.begin(), std::bind_front(std::divides{}, val));
+  xylo::multiply(v1, v2, v1);
 }
+void operator/=(xylo::vector_view v, float val) { xylo::divide(v, val, v); }
 void operator/=(xylo::vector_view v1, xylo::vector_view v2) {
-  xylo::check_shape_equal(v1, v2);
-  std::ranges::transform(v1, v2, v1.begin(), std::divides{});
-}
-
-float fastdot(xylo::vector_view v1, xylo::vector_view v2) {
-  float sum = 0;
-  std::size_t num_fast_words = v1.size() / 8;
-  for (std::size_t i = 0; i < num_fast_words; ++i) {
-    alignas(32) float f[8];
-    auto aw = _mm256_load_ps(v1.data() + i * 8);
-    auto bw = _mm256_load_ps(v2.data() + i * 8);
-    auto cw = _mm256_dp_ps(aw, bw, 0xf1);
-    _mm256_store_ps(f, cw);
-    sum += f[0] + f[4];
-  }
-
-  std::size_t residual_offset = num_fast_words * 8;
-  auto v1_residual = slice(v1, residual_offset, v1.size() - residual_offset);
-  auto v2_residual = slice(v2, residual_offset, v2.size() - residual_offset);
-  sum += std::inner_product(v1_residual.begin(), v1_residual.end(),
-                            v2_residual.begin(), 0.0f);
-  return sum;
-}
-
-bool use_fastdot(xylo::vector_view v1, xylo::vector_view v2) {
-  std::size_t size = v1.size();
-  // return (size >= 8) && (size % 8 == 0);
-  return reinterpret_cast<uint64_t>(v1.data()) % 32 == 0 &&
-         reinterpret_cast<uint64_t>(v2.data()) % 32 == 0;
+  xylo::divide(v1, v2, v1);
 }
 
 float dot(xylo::vector_view v1, xylo::vector_view v2) {
   xylo::check_shape_equal(v1, v2);
-  if (use_fastdot(v1, v2))
-    return fastdot(v1, v2);
-  return std::inner_product(v1.begin(), v1.end(), v2.begin(), 0.0f);
+  return xylo::kernels::dot(v1.data(), v2.data(), v1.size());
 }
 
-float sum(xylo::vector_view v) {
-  if (v.size() == 0)
-    return 0.0f;
-  return std::accumulate(v.begin(), v.end(), 0.0f);
-}
+float sum(xylo::vector_view v) { return xylo::kernels::sum(v.data(), v.size()); }
 
 float mean(xylo::vector_view v) { return sum(v) / v.size(); }
 
 float variance(xylo::vector_view v) {
-  if (v.size() == 0)
-    return 0.0f;
-  float m = mean(v);
-  auto variance_sum = [m](float sum, float elem) {
-    float diff = elem - m;
-    return sum + diff * diff;
-  };
-  return std::accumulate(v.begin(), v.end(), 0.0f, variance_sum) / v.size();
+  return xylo::kernels::variance(v.data(), v.size());
 }
 float stddev(xylo::vector_view v) { return sqrt(variance(v)); }
 
@@ -459,25 +711,39 @@ float coef_variance(xylo::vector_view v) {
   return m / sd;
 }
 
-float max(xylo::vector_view v) { return std::ranges::max(v); }
+float max(xylo::vector_view v) { return xylo::kernels::max(v.data(), v.size()); }
 
 std::size_t argmax(xylo::vector_view v) {
-  return std::ranges::distance(v.begin(), std::ranges::max_element(v));
+  return xylo::kernels::argmax(v.data(), v.size());
 }
+// Inverse of the cumulative weights, rather than std::discrete_distribution,
+// which allocates a table per call.
 std::size_t discrete_distribution(xylo::vector_view v) {
-  std::discrete_distribution<std::size_t> dist{v.begin(), v.end()};
-  return dist(xylo::default_generator());
+  float total = 0;
+  for (float w : v)
+    total += w;
+  std::uniform_real_distribution<float> dist{0, total};
+  float u = dist(xylo::default_generator());
+  std::size_t last = 0;
+  for (std::size_t i = 0; i < v.size(); ++i) {
+    if (v[i] <= 0)
+      continue;
+    if (u < v[i])
+      return i;
+    u -= v[i];
+    last = i;
+  }
+  // Rounding can leave a sliver past the end.
+  return last;
 }
 
 void normal_distribution(float mean, float stddev, xylo::vector_view v) {
-  std::normal_distribution<float> dist{mean, stddev};
-  auto &gen = xylo::default_generator();
-  std::ranges::for_each(v, [&](float &val) { val = dist(gen); });
+  xylo::normal_fill(xylo::default_generator(), mean, stddev, v.data(),
+                    v.size());
 }
 void uniform_distribution(float lower, float upper, xylo::vector_view v) {
-  std::uniform_real_distribution<float> dist{lower, upper};
-  auto &gen = xylo::default_generator();
-  std::ranges::for_each(v, [&](float &val) { val = dist(gen); });
+  xylo::uniform_fill(xylo::default_generator(), lower, upper, v.data(),
+                     v.size());
 }
 
 bool operator==(xylo::vector_view in1, xylo::vector_view in2) {
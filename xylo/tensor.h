@@ -8,13 +8,135 @@
 #include <numeric>
 #include <random>
 #include <span>
+#include <vector>
 
 #include <sstream>
 #include <xeno/exception.h>
+#include <xylo/random.h>
 
 namespace xylo {
 
-std::default_random_engine &default_generator();
+// Large tensor kernels (gemm, transpose and the element-wise maps) split their
+// work over xeno::sys::default_thread_pool(). This caps the number of threads a
+// single kernel may use, the calling thread included. 0, the default, means the
+// whole pool; 1 keeps every kernel on the calling thread.
+void set_num_threads(std::size_t n);
+std::size_t num_threads();
+
+// Overrides set_num_threads() for kernels called from the current thread while
+// in scope, e.g. to keep latency sensitive batch-1 inference single-threaded.
+class scoped_num_threads {
+public:
+  explicit scoped_num_threads(std::size_t n);
+  ~scoped_num_threads();
+
+  scoped_num_threads(const scoped_num_threads &) = delete;
+  void operator=(const scoped_num_threads &) = delete;
+
+private:
+  std::size_t previous_;
+};
+
+// Bump allocator for tensors that only live for one step. While a
+// workspace_scope is active on a thread, every tensor allocated on that thread
+// comes out of its workspace instead of the heap, and all of it is released at
+// once when the scope closes. Nothing allocated in a scope may outlive it; wrap
+// long-lived state in a heap_scope.
+class workspace {
+public:
+  explicit workspace(std::size_t initial_bytes = 1 << 20);
+  ~workspace();
+
+  workspace(const workspace &) = delete;
+  void operator=(const workspace &) = delete;
+
+  // 64 byte aligned.
+  float *allocate(std::size_t size);
+
+  // Frees everything at once. Nothing allocated in w may be in use, and no
+  // workspace_scope open on it.
+  void clear();
+
+  std::size_t used_bytes() const { return used_; }
+  // High-water mark since construction, to size initial_bytes.
+  std::size_t peak_bytes() const { return peak_; }
+
+private:
+  struct mark {
+    std::size_t chunk;
+    std::size_t offset;
+    std::size_t used;
+  };
+  mark get_mark() const { return {current_, offset_, used_}; }
+  void release(const mark &m);
+
+  struct chunk {
+    std::byte *data;
+    std::size_t size;
+  };
+  void add_chunk(std::size_t min_bytes);
+
+  std::vector<chunk> chunks_;
+  std::size_t current_ = 0;
+  std::size_t offset_ = 0;
+  std::size_t used_ = 0;
+  std::size_t peak_ = 0;
+
+  friend class workspace_scope;
+};
+
+// The calling thread's workspace.
+workspace &local_workspace();
+
+// Bytes of tensors the calling thread has allocated so far, from workspaces
+// and the heap alike. Only ever grows; the difference between two calls is
+// what was allocated in between.
+std::size_t allocated_bytes();
+
+// Makes w the allocator for tensors on this thread, and frees what it
+// allocated on exit. Scopes nest.
+class workspace_scope {
+public:
+  explicit workspace_scope(workspace &w = local_workspace());
+  ~workspace_scope();
+
+  workspace_scope(const workspace_scope &) = delete;
+  void operator=(const workspace_scope &) = delete;
+
+private:
+  workspace &workspace_;
+  workspace::mark mark_;
+  workspace *previous_;
+};
+
+// Makes w the allocator for tensors on this thread like workspace_scope, but
+// leaves what was allocated on exit. For work that keeps tensors in one
+// workspace across several tasks, maybe on different threads, and clear()s it
+// when done.
+class workspace_binding {
+public:
+  explicit workspace_binding(workspace &w);
+  ~workspace_binding();
+
+  workspace_binding(const workspace_binding &) = delete;
+  void operator=(const workspace_binding &) = delete;
+
+private:
+  workspace *previous_;
+};
+
+// Goes back to the heap inside a workspace_scope.
+class heap_scope {
+public:
+  heap_scope();
+  ~heap_scope();
+
+  heap_scope(const heap_scope &) = delete;
+  void operator=(const heap_scope &) = delete;
+
+private:
+  workspace *previous_;
+};
 
 template <std::size_t N> class array {
 public:
@@ -367,7 +489,16 @@ private:
 // Immitating at&t assemply.
 // Matrix
 void transpose(matrix_view in, matrix_view out);
+// out = in1 * transpose(in2)
 void matmul_transposed(matrix_view in1, const matrix_view in2, matrix_view out);
+// out = in1 * transpose(in2) + bias on every row, clamped at 0 if relu is set.
+// The bias and the clamp are applied by the gemm while each tile is still in
+// registers, so this is one pass over out instead of three.
+void matmul_transposed(matrix_view in1, matrix_view in2, vector_view bias,
+                       bool relu, matrix_view out);
+// out = transpose(in1) * in2
+void transposed_matmul(matrix_view in1, matrix_view in2, matrix_view out);
+// out = in1 * in2
 void matmul(matrix_view in1, matrix_view in2, matrix_view out);
 void add(xylo::matrix_view in1, xylo::matrix_view in2, xylo::matrix_view out);
 void minus(xylo::matrix_view in1, xylo::matrix_view in2, xylo::matrix_view out);
@@ -375,6 +506,9 @@ void multiply(xylo::matrix_view in1, xylo::matrix_view in2,
               xylo::matrix_view out);
 void divide(xylo::matrix_view in1, xylo::matrix_view in2,
             xylo::matrix_view out);
+// Softmax of every row. The row maximum is subtracted first, so large inputs
+// don't overflow.
+void softmax(matrix_view in, matrix_view out);
 
 // Vector
 void add(xylo::vector_view in1, xylo::vector_view in2, xylo::vector_view out);
@@ -432,6 +566,7 @@ tensor<N>::tensor(const tensor_view<N> &tv)
 
 xylo::matrix transpose(xylo::matrix_view m);
 xylo::matrix matmul_transposed(xylo::matrix_view in1, xylo::matrix_view in2);
+xylo::matrix transposed_matmul(xylo::matrix_view in1, xylo::matrix_view in2);
 xylo::matrix matmul(xylo::matrix_view in1, xylo::matrix_view in2);
 
 void operator+=(xylo::matrix_view v, float scalar);